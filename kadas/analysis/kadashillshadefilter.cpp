@@ -16,6 +16,8 @@
 
 #include "kadashillshadefilter.h"
 
+#include <kadas/analysis/kadasninecellkernels.h>
+
 KadasHillshadeFilter::KadasHillshadeFilter( const QString &inputFile, const QString &outputFile, const QString &outputFormat, double lightAzimuth,
     double lightAngle, const QgsRectangle &filterRegion, const QgsCoordinateReferenceSystem &filterRegionCrs )
   : KadasNineCellFilter( inputFile, outputFile, outputFormat, filterRegion, filterRegionCrs )
@@ -51,3 +53,11 @@ float KadasHillshadeFilter::processNineCellWindow( float *x11, float *x21, float
   }
   return qMax( 0.0, 255.0 * ( ( cos( zenith_rad ) * cos( slope_rad ) ) + ( sin( zenith_rad ) * sin( slope_rad ) * cos( azimuth_rad - aspect_rad ) ) ) );
 }
+
+void KadasHillshadeFilter::processRow( float *scanLine1, float *scanLine2, float *scanLine3, const unsigned char *noDataMask, float *resultLine, int width )
+{
+  float scaleX = 1. / ( 8 * mCellSizeX * mZFactor );
+  float scaleY = 1. / ( 8 * mCellSizeY * mZFactor );
+  KadasNineCellKernels::hornHillshadeRow( scanLine1, scanLine2, scanLine3, resultLine, width, scaleX, scaleY, mLightAngle * M_PI / 180.0, mLightAzimuth * M_PI / 180.0 );
+  processNoDataCells( scanLine1, scanLine2, scanLine3, noDataMask, resultLine, width );
+}
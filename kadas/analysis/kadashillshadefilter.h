@@ -33,6 +33,8 @@ class KADAS_ANALYSIS_EXPORT KadasHillshadeFilter: public KadasNineCellFilter
                                  float *x12, float *x22, float *x32,
                                  float *x13, float *x23, float *x33 ) override;
 
+    void processRow( float *scanLine1, float *scanLine2, float *scanLine3, const unsigned char *noDataMask, float *resultLine, int width ) override;
+
     float lightAzimuth() const { return mLightAzimuth; }
     void setLightAzimuth( float azimuth ) { mLightAzimuth = azimuth; }
     float lightAngle() const { return mLightAngle; }
@@ -16,7 +16,10 @@
 
 #include <QProgressDialog>
 
+#include <algorithm>
+#include <vector>
 #include <cpl_string.h>
+#include <omp.h>
 
 #include <qgis/qgscoordinatetransform.h>
 #include <qgis/qgslogger.h>
@@ -24,6 +27,8 @@
 
 #include <kadas/analysis/kadasninecellfilter.h>
 
+//maximum number of processed tiles held in memory per worker thread before they are written to the output
+static const int sTilesInFlightPerThread = 4;
 
 KadasNineCellFilter::KadasNineCellFilter( const QString &inputFile, const QString &outputFile, const QString &outputFormat, const QgsRectangle &region, const QgsCoordinateReferenceSystem &regionCrs )
   : mInputFile( inputFile )
@@ -77,7 +82,10 @@ int KadasNineCellFilter::processRaster( QProgressDialog *p )
   xSize = colEnd - colStart;
   ySize = rowEnd - rowStart;
 
-  GDALDatasetH outputDataset = openOutputFile( inputDataset, outputDriver, colStart, rowStart, xSize, ySize );
+  int tileSizeX, tileSizeY;
+  computeTileSize( GDALGetRasterBand( inputDataset, 1 ), tileSizeX, tileSizeY );
+
+  GDALDatasetH outputDataset = openOutputFile( inputDataset, outputDriver, colStart, rowStart, xSize, ySize, tileSizeX, tileSizeY );
   if ( outputDataset == NULL )
   {
     GDALClose( inputDataset );
@@ -149,24 +157,43 @@ int KadasNineCellFilter::processRaster( QProgressDialog *p )
     return 6;
   }
 
-  //keep only three scanlines in memory at a time
-  float *scanLine1 = ( float * ) CPLMalloc( sizeof( float ) * xSize );
-  float *scanLine2 = ( float * ) CPLMalloc( sizeof( float ) * xSize );
-  float *scanLine3 = ( float * ) CPLMalloc( sizeof( float ) * xSize );
+  //process the window in tiles aligned to the native blocks of the input, hence the first and last tiles of a row or column
+  //may be partial. Each worker thread reads its tiles (with a one pixel halo) through its own dataset handle, the results
+  //are written in tile order by this thread
+  int tileOffsetX = colStart % tileSizeX;
+  int tileOffsetY = rowStart % tileSizeY;
+  int nTilesX = ( tileOffsetX + xSize + tileSizeX - 1 ) / tileSizeX;
+  int nTilesY = ( tileOffsetY + ySize + tileSizeY - 1 ) / tileSizeY;
+  int nTiles = nTilesX * nTilesY;
+  auto tileExtent = [ = ]( int tile, int &tileCol, int &tileRow, int &tileWidth, int &tileHeight )
+  {
+    int tileX = ( tile % nTilesX ) * tileSizeX - tileOffsetX;
+    int tileY = ( tile / nTilesX ) * tileSizeY - tileOffsetY;
+    tileCol = qMax( 0, tileX );
+    tileRow = qMax( 0, tileY );
+    tileWidth = qMin( tileX + tileSizeX, xSize ) - tileCol;
+    tileHeight = qMin( tileY + tileSizeY, ySize ) - tileRow;
+  };
 
-  float *resultLine = ( float * ) CPLMalloc( sizeof( float ) * xSize );
+  int nThreads = omp_get_max_threads();
+  int batchSize = nThreads * sTilesInFlightPerThread;
+  std::vector<GDALDatasetH> threadDatasets( nThreads, nullptr );
+  std::vector<GDALRasterBandH> threadBands( nThreads, nullptr );
+  std::vector<std::vector<float>> threadInputs( nThreads );
+  std::vector<std::vector<float>> results( batchSize );
+  int readErrors = 0;
 
   if ( p )
   {
-    p->setMaximum( ySize );
+    p->setMaximum( nTiles );
   }
 
-  //values outside the layer extent (if the 3x3 window is on the border) are sent to the processing method as (input) nodata values
-  for ( int i = 0; i < ySize; ++i )
+  //values outside the window (if the 3x3 window is on the border) are sent to the processing method as (input) nodata values
+  for ( int batchStart = 0; batchStart < nTiles; batchStart += batchSize )
   {
     if ( p )
     {
-      p->setValue( i );
+      p->setValue( batchStart );
     }
 
     if ( p && p->wasCanceled() )
@@ -174,74 +201,66 @@ int KadasNineCellFilter::processRaster( QProgressDialog *p )
       break;
     }
 
-    if ( i == 0 )
+    int batchEnd = qMin( batchStart + batchSize, nTiles );
+
+    #pragma omp parallel for schedule(dynamic)
+    for ( int tile = batchStart; tile < batchEnd; ++tile )
     {
-      //fill scanline 1 with (input) nodata for the values above the first row and feed scanline2 with the first row
-      for ( int a = 0; a < xSize; ++a )
+      int thread = omp_get_thread_num();
+      if ( !threadDatasets[thread] )
       {
-        scanLine1[a] = mInputNodataValue;
+        threadDatasets[thread] = GDALOpen( mInputFile.toUtf8().constData(), GA_ReadOnly );
+        threadBands[thread] = threadDatasets[thread] ? GDALGetRasterBand( threadDatasets[thread], 1 ) : nullptr;
       }
-      CPLErr err = GDALRasterIO( rasterBand, GF_Read, colStart, rowStart, xSize, 1, scanLine2, xSize, 1, GDT_Float32, 0, 0 );
-      Q_UNUSED( err );
-    }
-    else
-    {
-      //normally fetch only scanLine3 and release scanline 1 if we move forward one row
-      CPLFree( scanLine1 );
-      scanLine1 = scanLine2;
-      scanLine2 = scanLine3;
-      scanLine3 = ( float * ) CPLMalloc( sizeof( float ) * xSize );
-    }
-
-    if ( i == ySize - 1 )   //fill the row below the bottom with nodata values
-    {
-      for ( int a = 0; a < xSize; ++a )
+      int tileCol, tileRow, tileWidth, tileHeight;
+      tileExtent( tile, tileCol, tileRow, tileWidth, tileHeight );
+
+      std::vector<float> &input = threadInputs[thread];
+      input.resize( ( tileSizeX + 2 ) * ( tileSizeY + 2 ) );
+      std::vector<float> &result = results[tile - batchStart];
+      result.resize( tileWidth * tileHeight );
+      if ( !threadBands[thread] || !readTile( threadBands[thread], colStart, rowStart, xSize, ySize, tileCol, tileRow, tileWidth, tileHeight, input.data() ) )
       {
-        scanLine3[a] = mInputNodataValue;
+        #pragma omp atomic
+        ++readErrors;
+        continue;
       }
+      processTile( input.data(), result.data(), tileWidth, tileHeight );
     }
-    else
+    if ( readErrors > 0 )
     {
-      CPLErr err = GDALRasterIO( rasterBand, GF_Read, colStart, rowStart + i + 1, xSize, 1, scanLine3, xSize, 1, GDT_Float32, 0, 0 );
-      Q_UNUSED( err );
+      break;
     }
 
-    #pragma omp parallel for schedule(static)
-    for ( int j = 0; j < xSize; ++j )
+    for ( int tile = batchStart; tile < batchEnd; ++tile )
     {
-      if ( j == 0 )
-      {
-        resultLine[j] = processNineCellWindow( &mInputNodataValue, &scanLine1[j], &scanLine1[j + 1], &mInputNodataValue, &scanLine2[j],
-                                               &scanLine2[j + 1], &mInputNodataValue, &scanLine3[j], &scanLine3[j + 1] );
-      }
-      else if ( j == xSize - 1 )
-      {
-        resultLine[j] = processNineCellWindow( &scanLine1[j - 1], &scanLine1[j], &mInputNodataValue, &scanLine2[j - 1], &scanLine2[j],
-                                               &mInputNodataValue, &scanLine3[j - 1], &scanLine3[j], &mInputNodataValue );
-      }
-      else
-      {
-        resultLine[j] = processNineCellWindow( &scanLine1[j - 1], &scanLine1[j], &scanLine1[j + 1], &scanLine2[j - 1], &scanLine2[j],
-                                               &scanLine2[j + 1], &scanLine3[j - 1], &scanLine3[j], &scanLine3[j + 1] );
-      }
+      int tileCol, tileRow, tileWidth, tileHeight;
+      tileExtent( tile, tileCol, tileRow, tileWidth, tileHeight );
+      CPLErr err = GDALRasterIO( outputRasterBand, GF_Write, tileCol, tileRow, tileWidth, tileHeight, results[tile - batchStart].data(), tileWidth, tileHeight, GDT_Float32, 0, 0 );
+      Q_UNUSED( err );
     }
-
-    CPLErr err = GDALRasterIO( outputRasterBand, GF_Write, 0, i, xSize, 1, resultLine, xSize, 1, GDT_Float32, 0, 0 );
-    Q_UNUSED( err );
   }
 
   if ( p )
   {
-    p->setValue( ySize );
+    p->setValue( nTiles );
   }
 
-  CPLFree( resultLine );
-  CPLFree( scanLine1 );
-  CPLFree( scanLine2 );
-  CPLFree( scanLine3 );
-
+  for ( GDALDatasetH dataset : threadDatasets )
+  {
+    if ( dataset )
+    {
+      GDALClose( dataset );
+    }
+  }
   GDALClose( inputDataset );
 
+  if ( readErrors > 0 )
+  {
+    QgsDebugMsg( QString( "Failed to read %1 input tiles" ).arg( readErrors ) );
+    GDALDeleteDataset( outputDriver, mOutputFile.toUtf8().constData() );
+    return 8;
+  }
   if ( p && p->wasCanceled() )
   {
     //delete the dataset without closing (because it is faster)
@@ -253,6 +272,78 @@ int KadasNineCellFilter::processRaster( QProgressDialog *p )
   return 0;
 }
 
+void KadasNineCellFilter::computeTileSize( GDALRasterBandH band, int &tileSizeX, int &tileSizeY ) const
+{
+  // Use the native block size if it is a reasonable tile size (GTiff output tiles need to be multiples of 16),
+  // otherwise (i.e. for scanline organized datasets) fall back to the default tile size
+  int blockSizeX = 0, blockSizeY = 0;
+  GDALGetBlockSize( band, &blockSizeX, &blockSizeY );
+  tileSizeX = blockSizeX >= 64 && blockSizeX <= 1024 && blockSizeX % 16 == 0 ? blockSizeX : 256;
+  tileSizeY = blockSizeY >= 64 && blockSizeY <= 1024 && blockSizeY % 16 == 0 ? blockSizeY : 256;
+}
+
+bool KadasNineCellFilter::readTile( GDALRasterBandH band, int colStart, int rowStart, int xSize, int ySize, int tileCol, int tileRow, int tileWidth, int tileHeight, float *buffer ) const
+{
+  int stride = tileWidth + 2;
+  std::fill( buffer, buffer + stride * ( tileHeight + 2 ), mInputNodataValue );
+
+  // Portion of the tile plus halo which lies inside the window
+  int readColStart = qMax( 0, tileCol - 1 );
+  int readColEnd = qMin( xSize, tileCol + tileWidth + 1 );
+  int readRowStart = qMax( 0, tileRow - 1 );
+  int readRowEnd = qMin( ySize, tileRow + tileHeight + 1 );
+  float *readBuffer = buffer + ( readRowStart - tileRow + 1 ) * stride + ( readColStart - tileCol + 1 );
+  int readWidth = readColEnd - readColStart;
+  int readHeight = readRowEnd - readRowStart;
+
+  CPLErr err = GDALRasterIO( band, GF_Read, colStart + readColStart, rowStart + readRowStart, readWidth, readHeight, readBuffer, readWidth, readHeight, GDT_Float32, 0, stride * sizeof( float ) );
+  return err == CE_None;
+}
+
+void KadasNineCellFilter::processTile( float *input, float *output, int tileWidth, int tileHeight )
+{
+  int stride = tileWidth + 2;
+  std::vector<unsigned char> columnNoData( stride );
+  std::vector<unsigned char> noDataMask( tileWidth );
+  for ( int i = 0; i < tileHeight; ++i )
+  {
+    float *scanLine1 = input + i * stride;
+    float *scanLine2 = scanLine1 + stride;
+    float *scanLine3 = scanLine2 + stride;
+    for ( int k = 0; k < stride; ++k )
+    {
+      columnNoData[k] = scanLine1[k] == mInputNodataValue || scanLine2[k] == mInputNodataValue || scanLine3[k] == mInputNodataValue;
+    }
+    for ( int j = 0; j < tileWidth; ++j )
+    {
+      noDataMask[j] = columnNoData[j] | columnNoData[j + 1] | columnNoData[j + 2];
+    }
+    processRow( scanLine1, scanLine2, scanLine3, noDataMask.data(), output + i * tileWidth, tileWidth );
+  }
+}
+
+void KadasNineCellFilter::processRow( float *scanLine1, float *scanLine2, float *scanLine3, const unsigned char *noDataMask, float *resultLine, int width )
+{
+  Q_UNUSED( noDataMask );
+  for ( int j = 0; j < width; ++j )
+  {
+    resultLine[j] = processNineCellWindow( &scanLine1[j], &scanLine1[j + 1], &scanLine1[j + 2], &scanLine2[j], &scanLine2[j + 1],
+                                           &scanLine2[j + 2], &scanLine3[j], &scanLine3[j + 1], &scanLine3[j + 2] );
+  }
+}
+
+void KadasNineCellFilter::processNoDataCells( float *scanLine1, float *scanLine2, float *scanLine3, const unsigned char *noDataMask, float *resultLine, int width )
+{
+  for ( int j = 0; j < width; ++j )
+  {
+    if ( noDataMask[j] )
+    {
+      resultLine[j] = processNineCellWindow( &scanLine1[j], &scanLine1[j + 1], &scanLine1[j + 2], &scanLine2[j], &scanLine2[j + 1],
+                                             &scanLine2[j + 2], &scanLine3[j], &scanLine3[j + 1], &scanLine3[j + 2] );
+    }
+  }
+}
+
 GDALDatasetH KadasNineCellFilter::openInputFile( int &nCellsX, int &nCellsY )
 {
   GDALDatasetH inputDataset = GDALOpen( mInputFile.toUtf8().constData(), GA_ReadOnly );
@@ -354,7 +445,7 @@ GDALDriverH KadasNineCellFilter::openOutputDriver()
   return outputDriver;
 }
 
-GDALDatasetH KadasNineCellFilter::openOutputFile( GDALDatasetH inputDataset, GDALDriverH outputDriver, int colStart, int rowStart, int xSize, int ySize )
+GDALDatasetH KadasNineCellFilter::openOutputFile( GDALDatasetH inputDataset, GDALDriverH outputDriver, int colStart, int rowStart, int xSize, int ySize, int tileSizeX, int tileSizeY )
 {
   if ( inputDataset == NULL )
   {
@@ -364,7 +455,15 @@ GDALDatasetH KadasNineCellFilter::openOutputFile( GDALDatasetH inputDataset, GDA
   //open output file
   char **papszOptions = NULL;
   papszOptions = CSLSetNameValue( papszOptions, "COMPRESS", "LZW" );
+  if ( mOutputFormat == "GTiff" )
+  {
+    //match the output blocks to the processing tiles, so that each tile write fills whole blocks
+    papszOptions = CSLSetNameValue( papszOptions, "TILED", "YES" );
+    papszOptions = CSLSetNameValue( papszOptions, "BLOCKXSIZE", QString::number( tileSizeX ).toLocal8Bit().data() );
+    papszOptions = CSLSetNameValue( papszOptions, "BLOCKYSIZE", QString::number( tileSizeY ).toLocal8Bit().data() );
+  }
   GDALDatasetH outputDataset = GDALCreate( outputDriver, mOutputFile.toUtf8().constData(), xSize, ySize, 1, GDT_Float32, papszOptions );
+  CSLDestroy( papszOptions );
   if ( outputDataset == NULL )
   {
     return outputDataset;
@@ -58,6 +58,12 @@ class KADAS_ANALYSIS_EXPORT KadasNineCellFilter
                                          float *x12, float *x22, float *x32,
                                          float *x13, float *x23, float *x33 ) = 0;
 
+    /**Calculates a row of output values. scanLine1, scanLine2 and scanLine3 hold the rows above, at and below the output row,
+      each padded with one cell on either side (i.e. width + 2 values). noDataMask is nonzero for the output cells whose 3x3 window
+      contains an input nodata value. The default implementation calls processNineCellWindow for each cell, subclasses can
+      override this to process the cells without nodata in a batch*/
+    virtual void processRow( float *scanLine1, float *scanLine2, float *scanLine3, const unsigned char *noDataMask, float *resultLine, int width );
+
   private:
 
     /**Opens the input file and returns the dataset handle and the number of pixels in x-/y- direction*/
@@ -67,9 +73,15 @@ class KADAS_ANALYSIS_EXPORT KadasNineCellFilter
     GDALDriverH openOutputDriver();
     /**Opens the output file and sets the same geotransform and CRS as the input data
       @return the output dataset or NULL in case of error*/
-    GDALDatasetH openOutputFile( GDALDatasetH inputDataset, GDALDriverH outputDriver, int colStart, int rowStart, int xSize, int ySize );
+    GDALDatasetH openOutputFile( GDALDatasetH inputDataset, GDALDriverH outputDriver, int colStart, int rowStart, int xSize, int ySize, int tileSizeX, int tileSizeY );
     /**Computes the window of the raster which contains the specified region of the raster*/
     bool computeWindow( GDALDatasetH dataset, const QgsRectangle &region, const QgsCoordinateReferenceSystem &regionCrs, int &rowStart, int &rowEnd, int &colStart, int &colEnd );
+    /**Computes the processing tile size, aligned to the native block size of the input band where sensible*/
+    void computeTileSize( GDALRasterBandH band, int &tileSizeX, int &tileSizeY ) const;
+    /**Reads the tile at (tileCol, tileRow) of the window, including a one pixel halo, into buffer. Pixels outside the window are set to the input nodata value*/
+    bool readTile( GDALRasterBandH band, int colStart, int rowStart, int xSize, int ySize, int tileCol, int tileRow, int tileWidth, int tileHeight, float *buffer ) const;
+    /**Processes a tile read by readTile and stores tileWidth x tileHeight values in output*/
+    void processTile( float *input, float *output, int tileWidth, int tileHeight );
 
   protected:
 
@@ -77,6 +89,8 @@ class KADAS_ANALYSIS_EXPORT KadasNineCellFilter
     float calcFirstDerX( float *x11, float *x21, float *x31, float *x12, float *x22, float *x32, float *x13, float *x23, float *x33 );
     /**Calculates the first order derivative in y-direction according to Horn (1981)*/
     float calcFirstDerY( float *x11, float *x21, float *x31, float *x12, float *x22, float *x32, float *x13, float *x23, float *x33 );
+    /**Calls processNineCellWindow for the cells of a row (see processRow) with a nonzero noDataMask entry*/
+    void processNoDataCells( float *scanLine1, float *scanLine2, float *scanLine3, const unsigned char *noDataMask, float *resultLine, int width );
 
     QString mInputFile;
     QString mOutputFile;
@@ -0,0 +1,362 @@
+/***************************************************************************
+    kadasninecellkernels.cpp
+    ------------------------
+    copyright            : (C) 2019 by Sandro Mani
+    email                : smani at sourcepole dot ch
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <cmath>
+
+#include <QtGlobal>
+
+#include <kadas/analysis/kadasninecellkernels.h>
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define KADAS_NINECELL_X86
+#include <immintrin.h>
+#define KADAS_TARGET_SSE2 __attribute__( ( target( "sse2" ) ) )
+#define KADAS_TARGET_AVX2 __attribute__( ( target( "avx2" ) ) )
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define KADAS_NINECELL_NEON
+#include <arm_neon.h>
+#endif
+
+
+// Coefficients of the single precision arctangent approximation (Cephes atanf)
+static const float ATAN_P0 = 8.05374449538e-2f;
+static const float ATAN_P1 = -1.38776856032e-1f;
+static const float ATAN_P2 = 1.99777106478e-1f;
+static const float ATAN_P3 = -3.33329491539e-1f;
+static const float TAN_3PI_8 = 2.414213562373095f;
+static const float TAN_PI_8 = 0.4142135623730950f;
+static const float RAD_TO_DEG = 180.f / M_PI;
+
+enum class KadasNineCellIsa { Scalar, SSE2, AVX2, NEON };
+
+static KadasNineCellIsa detectIsa()
+{
+#ifdef KADAS_NINECELL_X86
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports( "avx2" ) )
+  {
+    return KadasNineCellIsa::AVX2;
+  }
+  if ( __builtin_cpu_supports( "sse2" ) )
+  {
+    return KadasNineCellIsa::SSE2;
+  }
+#endif
+#ifdef KADAS_NINECELL_NEON
+  return KadasNineCellIsa::NEON;
+#endif
+  return KadasNineCellIsa::Scalar;
+}
+
+static const KadasNineCellIsa sIsa = detectIsa();
+
+///////////////////////////////////////////////////////////////////////////////
+// Scalar
+
+// The window of output cell j spans the indices [j, j + 2] of the padded scanlines
+static inline void hornDerivatives( const float *l1, const float *l2, const float *l3, int j, float scaleX, float scaleY, float &derX, float &derY )
+{
+  derX = ( ( l1[j + 2] - l1[j] ) + 2.f * ( l2[j + 2] - l2[j] ) + ( l3[j + 2] - l3[j] ) ) * scaleX;
+  derY = ( ( l1[j] - l3[j] ) + 2.f * ( l1[j + 1] - l3[j + 1] ) + ( l1[j + 2] - l3[j + 2] ) ) * scaleY;
+}
+
+static inline float slope( float derX, float derY )
+{
+  return std::atan( std::sqrt( derX * derX + derY * derY ) ) * RAD_TO_DEG;
+}
+
+// cos(slope) = 1 / sqrt(1 + g^2), sin(slope) * cos(azimuth - aspect) = -(cos(azimuth) * derY + sin(azimuth) * derX) / sqrt(1 + g^2)
+static inline float hillshade( float derX, float derY, float cosZenith, float sinZenith, float cosAzimuth, float sinAzimuth )
+{
+  float value = 255.f * ( cosZenith - sinZenith * ( cosAzimuth * derY + sinAzimuth * derX ) ) / std::sqrt( 1.f + derX * derX + derY * derY );
+  return qMax( 0.f, value );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AVX2 / SSE2
+
+#ifdef KADAS_NINECELL_X86
+
+KADAS_TARGET_AVX2 static inline void hornDerivatives256( const float *l1, const float *l2, const float *l3, int j, __m256 scaleX, __m256 scaleY, __m256 &derX, __m256 &derY )
+{
+  __m256 two = _mm256_set1_ps( 2.f );
+  __m256 a1 = _mm256_loadu_ps( l1 + j ), b1 = _mm256_loadu_ps( l1 + j + 1 ), c1 = _mm256_loadu_ps( l1 + j + 2 );
+  __m256 a2 = _mm256_loadu_ps( l2 + j ), c2 = _mm256_loadu_ps( l2 + j + 2 );
+  __m256 a3 = _mm256_loadu_ps( l3 + j ), b3 = _mm256_loadu_ps( l3 + j + 1 ), c3 = _mm256_loadu_ps( l3 + j + 2 );
+  __m256 dx = _mm256_add_ps( _mm256_add_ps( _mm256_sub_ps( c1, a1 ), _mm256_mul_ps( two, _mm256_sub_ps( c2, a2 ) ) ), _mm256_sub_ps( c3, a3 ) );
+  __m256 dy = _mm256_add_ps( _mm256_add_ps( _mm256_sub_ps( a1, a3 ), _mm256_mul_ps( two, _mm256_sub_ps( b1, b3 ) ) ), _mm256_sub_ps( c1, c3 ) );
+  derX = _mm256_mul_ps( dx, scaleX );
+  derY = _mm256_mul_ps( dy, scaleY );
+}
+
+// Arctangent of non-negative values
+KADAS_TARGET_AVX2 static inline __m256 atan256( __m256 x )
+{
+  __m256 one = _mm256_set1_ps( 1.f );
+  __m256 big = _mm256_cmp_ps( x, _mm256_set1_ps( TAN_3PI_8 ), _CMP_GT_OQ );
+  __m256 mid = _mm256_andnot_ps( big, _mm256_cmp_ps( x, _mm256_set1_ps( TAN_PI_8 ), _CMP_GT_OQ ) );
+  __m256 y0 = _mm256_or_ps( _mm256_and_ps( big, _mm256_set1_ps( M_PI_2 ) ), _mm256_and_ps( mid, _mm256_set1_ps( M_PI_4 ) ) );
+  x = _mm256_blendv_ps( x, _mm256_div_ps( _mm256_sub_ps( x, one ), _mm256_add_ps( x, one ) ), mid );
+  x = _mm256_blendv_ps( x, _mm256_div_ps( _mm256_set1_ps( -1.f ), x ), big );
+  __m256 z = _mm256_mul_ps( x, x );
+  __m256 p = _mm256_set1_ps( ATAN_P0 );
+  p = _mm256_add_ps( _mm256_mul_ps( p, z ), _mm256_set1_ps( ATAN_P1 ) );
+  p = _mm256_add_ps( _mm256_mul_ps( p, z ), _mm256_set1_ps( ATAN_P2 ) );
+  p = _mm256_add_ps( _mm256_mul_ps( p, z ), _mm256_set1_ps( ATAN_P3 ) );
+  p = _mm256_add_ps( _mm256_mul_ps( _mm256_mul_ps( p, z ), x ), x );
+  return _mm256_add_ps( y0, p );
+}
+
+KADAS_TARGET_AVX2 static int hornSlopeRowAvx2( const float *l1, const float *l2, const float *l3, float *out, int width, float scaleX, float scaleY )
+{
+  __m256 sx = _mm256_set1_ps( scaleX ), sy = _mm256_set1_ps( scaleY ), radToDeg = _mm256_set1_ps( RAD_TO_DEG );
+  int j = 0;
+  for ( ; j + 8 <= width; j += 8 )
+  {
+    __m256 derX, derY;
+    hornDerivatives256( l1, l2, l3, j, sx, sy, derX, derY );
+    __m256 g = _mm256_sqrt_ps( _mm256_add_ps( _mm256_mul_ps( derX, derX ), _mm256_mul_ps( derY, derY ) ) );
+    _mm256_storeu_ps( out + j, _mm256_mul_ps( atan256( g ), radToDeg ) );
+  }
+  return j;
+}
+
+KADAS_TARGET_AVX2 static int hornHillshadeRowAvx2( const float *l1, const float *l2, const float *l3, float *out, int width, float scaleX, float scaleY, float cosZenith, float sinZenith, float cosAzimuth, float sinAzimuth )
+{
+  __m256 sx = _mm256_set1_ps( scaleX ), sy = _mm256_set1_ps( scaleY );
+  __m256 cz = _mm256_set1_ps( 255.f * cosZenith ), sz = _mm256_set1_ps( 255.f * sinZenith );
+  __m256 ca = _mm256_set1_ps( cosAzimuth ), sa = _mm256_set1_ps( sinAzimuth );
+  __m256 one = _mm256_set1_ps( 1.f ), zero = _mm256_setzero_ps();
+  int j = 0;
+  for ( ; j + 8 <= width; j += 8 )
+  {
+    __m256 derX, derY;
+    hornDerivatives256( l1, l2, l3, j, sx, sy, derX, derY );
+    __m256 norm = _mm256_sqrt_ps( _mm256_add_ps( one, _mm256_add_ps( _mm256_mul_ps( derX, derX ), _mm256_mul_ps( derY, derY ) ) ) );
+    __m256 dir = _mm256_add_ps( _mm256_mul_ps( ca, derY ), _mm256_mul_ps( sa, derX ) );
+    __m256 value = _mm256_div_ps( _mm256_sub_ps( cz, _mm256_mul_ps( sz, dir ) ), norm );
+    _mm256_storeu_ps( out + j, _mm256_max_ps( value, zero ) );
+  }
+  return j;
+}
+
+KADAS_TARGET_SSE2 static inline void hornDerivatives128( const float *l1, const float *l2, const float *l3, int j, __m128 scaleX, __m128 scaleY, __m128 &derX, __m128 &derY )
+{
+  __m128 two = _mm_set1_ps( 2.f );
+  __m128 a1 = _mm_loadu_ps( l1 + j ), b1 = _mm_loadu_ps( l1 + j + 1 ), c1 = _mm_loadu_ps( l1 + j + 2 );
+  __m128 a2 = _mm_loadu_ps( l2 + j ), c2 = _mm_loadu_ps( l2 + j + 2 );
+  __m128 a3 = _mm_loadu_ps( l3 + j ), b3 = _mm_loadu_ps( l3 + j + 1 ), c3 = _mm_loadu_ps( l3 + j + 2 );
+  __m128 dx = _mm_add_ps( _mm_add_ps( _mm_sub_ps( c1, a1 ), _mm_mul_ps( two, _mm_sub_ps( c2, a2 ) ) ), _mm_sub_ps( c3, a3 ) );
+  __m128 dy = _mm_add_ps( _mm_add_ps( _mm_sub_ps( a1, a3 ), _mm_mul_ps( two, _mm_sub_ps( b1, b3 ) ) ), _mm_sub_ps( c1, c3 ) );
+  derX = _mm_mul_ps( dx, scaleX );
+  derY = _mm_mul_ps( dy, scaleY );
+}
+
+KADAS_TARGET_SSE2 static inline __m128 select128( __m128 mask, __m128 a, __m128 b )
+{
+  return _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) );
+}
+
+// Arctangent of non-negative values
+KADAS_TARGET_SSE2 static inline __m128 atan128( __m128 x )
+{
+  __m128 one = _mm_set1_ps( 1.f );
+  __m128 big = _mm_cmpgt_ps( x, _mm_set1_ps( TAN_3PI_8 ) );
+  __m128 mid = _mm_andnot_ps( big, _mm_cmpgt_ps( x, _mm_set1_ps( TAN_PI_8 ) ) );
+  __m128 y0 = _mm_or_ps( _mm_and_ps( big, _mm_set1_ps( M_PI_2 ) ), _mm_and_ps( mid, _mm_set1_ps( M_PI_4 ) ) );
+  x = select128( mid, _mm_div_ps( _mm_sub_ps( x, one ), _mm_add_ps( x, one ) ), x );
+  x = select128( big, _mm_div_ps( _mm_set1_ps( -1.f ), x ), x );
+  __m128 z = _mm_mul_ps( x, x );
+  __m128 p = _mm_set1_ps( ATAN_P0 );
+  p = _mm_add_ps( _mm_mul_ps( p, z ), _mm_set1_ps( ATAN_P1 ) );
+  p = _mm_add_ps( _mm_mul_ps( p, z ), _mm_set1_ps( ATAN_P2 ) );
+  p = _mm_add_ps( _mm_mul_ps( p, z ), _mm_set1_ps( ATAN_P3 ) );
+  p = _mm_add_ps( _mm_mul_ps( _mm_mul_ps( p, z ), x ), x );
+  return _mm_add_ps( y0, p );
+}
+
+KADAS_TARGET_SSE2 static int hornSlopeRowSse2( const float *l1, const float *l2, const float *l3, float *out, int width, float scaleX, float scaleY )
+{
+  __m128 sx = _mm_set1_ps( scaleX ), sy = _mm_set1_ps( scaleY ), radToDeg = _mm_set1_ps( RAD_TO_DEG );
+  int j = 0;
+  for ( ; j + 4 <= width; j += 4 )
+  {
+    __m128 derX, derY;
+    hornDerivatives128( l1, l2, l3, j, sx, sy, derX, derY );
+    __m128 g = _mm_sqrt_ps( _mm_add_ps( _mm_mul_ps( derX, derX ), _mm_mul_ps( derY, derY ) ) );
+    _mm_storeu_ps( out + j, _mm_mul_ps( atan128( g ), radToDeg ) );
+  }
+  return j;
+}
+
+KADAS_TARGET_SSE2 static int hornHillshadeRowSse2( const float *l1, const float *l2, const float *l3, float *out, int width, float scaleX, float scaleY, float cosZenith, float sinZenith, float cosAzimuth, float sinAzimuth )
+{
+  __m128 sx = _mm_set1_ps( scaleX ), sy = _mm_set1_ps( scaleY );
+  __m128 cz = _mm_set1_ps( 255.f * cosZenith ), sz = _mm_set1_ps( 255.f * sinZenith );
+  __m128 ca = _mm_set1_ps( cosAzimuth ), sa = _mm_set1_ps( sinAzimuth );
+  __m128 one = _mm_set1_ps( 1.f ), zero = _mm_setzero_ps();
+  int j = 0;
+  for ( ; j + 4 <= width; j += 4 )
+  {
+    __m128 derX, derY;
+    hornDerivatives128( l1, l2, l3, j, sx, sy, derX, derY );
+    __m128 norm = _mm_sqrt_ps( _mm_add_ps( one, _mm_add_ps( _mm_mul_ps( derX, derX ), _mm_mul_ps( derY, derY ) ) ) );
+    __m128 dir = _mm_add_ps( _mm_mul_ps( ca, derY ), _mm_mul_ps( sa, derX ) );
+    __m128 value = _mm_div_ps( _mm_sub_ps( cz, _mm_mul_ps( sz, dir ) ), norm );
+    _mm_storeu_ps( out + j, _mm_max_ps( value, zero ) );
+  }
+  return j;
+}
+
+#endif // KADAS_NINECELL_X86
+
+///////////////////////////////////////////////////////////////////////////////
+// NEON
+
+#ifdef KADAS_NINECELL_NEON
+
+static inline void hornDerivativesNeon( const float *l1, const float *l2, const float *l3, int j, float32x4_t scaleX, float32x4_t scaleY, float32x4_t &derX, float32x4_t &derY )
+{
+  float32x4_t a1 = vld1q_f32( l1 + j ), b1 = vld1q_f32( l1 + j + 1 ), c1 = vld1q_f32( l1 + j + 2 );
+  float32x4_t a2 = vld1q_f32( l2 + j ), c2 = vld1q_f32( l2 + j + 2 );
+  float32x4_t a3 = vld1q_f32( l3 + j ), b3 = vld1q_f32( l3 + j + 1 ), c3 = vld1q_f32( l3 + j + 2 );
+  float32x4_t dx = vaddq_f32( vmlaq_n_f32( vsubq_f32( c1, a1 ), vsubq_f32( c2, a2 ), 2.f ), vsubq_f32( c3, a3 ) );
+  float32x4_t dy = vaddq_f32( vmlaq_n_f32( vsubq_f32( a1, a3 ), vsubq_f32( b1, b3 ), 2.f ), vsubq_f32( c1, c3 ) );
+  derX = vmulq_f32( dx, scaleX );
+  derY = vmulq_f32( dy, scaleY );
+}
+
+// Arctangent of non-negative values
+static inline float32x4_t atanNeon( float32x4_t x )
+{
+  float32x4_t one = vdupq_n_f32( 1.f );
+  uint32x4_t big = vcgtq_f32( x, vdupq_n_f32( TAN_3PI_8 ) );
+  uint32x4_t mid = vbicq_u32( vcgtq_f32( x, vdupq_n_f32( TAN_PI_8 ) ), big );
+  float32x4_t y0 = vbslq_f32( big, vdupq_n_f32( M_PI_2 ), vbslq_f32( mid, vdupq_n_f32( M_PI_4 ), vdupq_n_f32( 0.f ) ) );
+  x = vbslq_f32( mid, vdivq_f32( vsubq_f32( x, one ), vaddq_f32( x, one ) ), x );
+  x = vbslq_f32( big, vdivq_f32( vdupq_n_f32( -1.f ), x ), x );
+  float32x4_t z = vmulq_f32( x, x );
+  float32x4_t p = vdupq_n_f32( ATAN_P0 );
+  p = vmlaq_f32( vdupq_n_f32( ATAN_P1 ), p, z );
+  p = vmlaq_f32( vdupq_n_f32( ATAN_P2 ), p, z );
+  p = vmlaq_f32( vdupq_n_f32( ATAN_P3 ), p, z );
+  p = vmlaq_f32( x, vmulq_f32( p, z ), x );
+  return vaddq_f32( y0, p );
+}
+
+static int hornSlopeRowNeon( const float *l1, const float *l2, const float *l3, float *out, int width, float scaleX, float scaleY )
+{
+  float32x4_t sx = vdupq_n_f32( scaleX ), sy = vdupq_n_f32( scaleY );
+  int j = 0;
+  for ( ; j + 4 <= width; j += 4 )
+  {
+    float32x4_t derX, derY;
+    hornDerivativesNeon( l1, l2, l3, j, sx, sy, derX, derY );
+    float32x4_t g = vsqrtq_f32( vmlaq_f32( vmulq_f32( derX, derX ), derY, derY ) );
+    vst1q_f32( out + j, vmulq_n_f32( atanNeon( g ), RAD_TO_DEG ) );
+  }
+  return j;
+}
+
+static int hornHillshadeRowNeon( const float *l1, const float *l2, const float *l3, float *out, int width, float scaleX, float scaleY, float cosZenith, float sinZenith, float cosAzimuth, float sinAzimuth )
+{
+  float32x4_t sx = vdupq_n_f32( scaleX ), sy = vdupq_n_f32( scaleY );
+  float32x4_t cz = vdupq_n_f32( 255.f * cosZenith );
+  float32x4_t one = vdupq_n_f32( 1.f ), zero = vdupq_n_f32( 0.f );
+  int j = 0;
+  for ( ; j + 4 <= width; j += 4 )
+  {
+    float32x4_t derX, derY;
+    hornDerivativesNeon( l1, l2, l3, j, sx, sy, derX, derY );
+    float32x4_t norm = vsqrtq_f32( vmlaq_f32( vmlaq_f32( one, derX, derX ), derY, derY ) );
+    float32x4_t dir = vmlaq_n_f32( vmulq_n_f32( derY, cosAzimuth ), derX, sinAzimuth );
+    float32x4_t value = vdivq_f32( vmlsq_n_f32( cz, dir, 255.f * sinZenith ), norm );
+    vst1q_f32( out + j, vmaxq_f32( value, zero ) );
+  }
+  return j;
+}
+
+#endif // KADAS_NINECELL_NEON
+
+///////////////////////////////////////////////////////////////////////////////
+
+void KadasNineCellKernels::hornSlopeRow( const float *scanLine1, const float *scanLine2, const float *scanLine3, float *resultLine, int width, float scaleX, float scaleY )
+{
+  int j = 0;
+#ifdef KADAS_NINECELL_X86
+  if ( sIsa == KadasNineCellIsa::AVX2 )
+  {
+    j = hornSlopeRowAvx2( scanLine1, scanLine2, scanLine3, resultLine, width, scaleX, scaleY );
+  }
+  else if ( sIsa == KadasNineCellIsa::SSE2 )
+  {
+    j = hornSlopeRowSse2( scanLine1, scanLine2, scanLine3, resultLine, width, scaleX, scaleY );
+  }
+#endif
+#ifdef KADAS_NINECELL_NEON
+  j = hornSlopeRowNeon( scanLine1, scanLine2, scanLine3, resultLine, width, scaleX, scaleY );
+#endif
+  for ( ; j < width; ++j )
+  {
+    float derX, derY;
+    hornDerivatives( scanLine1, scanLine2, scanLine3, j, scaleX, scaleY, derX, derY );
+    resultLine[j] = slope( derX, derY );
+  }
+}
+
+void KadasNineCellKernels::hornHillshadeRow( const float *scanLine1, const float *scanLine2, const float *scanLine3, float *resultLine, int width, float scaleX, float scaleY, float zenithRad, float azimuthRad )
+{
+  float cosZenith = std::cos( zenithRad );
+  float sinZenith = std::sin( zenithRad );
+  float cosAzimuth = std::cos( azimuthRad );
+  float sinAzimuth = std::sin( azimuthRad );
+  int j = 0;
+#ifdef KADAS_NINECELL_X86
+  if ( sIsa == KadasNineCellIsa::AVX2 )
+  {
+    j = hornHillshadeRowAvx2( scanLine1, scanLine2, scanLine3, resultLine, width, scaleX, scaleY, cosZenith, sinZenith, cosAzimuth, sinAzimuth );
+  }
+  else if ( sIsa == KadasNineCellIsa::SSE2 )
+  {
+    j = hornHillshadeRowSse2( scanLine1, scanLine2, scanLine3, resultLine, width, scaleX, scaleY, cosZenith, sinZenith, cosAzimuth, sinAzimuth );
+  }
+#endif
+#ifdef KADAS_NINECELL_NEON
+  j = hornHillshadeRowNeon( scanLine1, scanLine2, scanLine3, resultLine, width, scaleX, scaleY, cosZenith, sinZenith, cosAzimuth, sinAzimuth );
+#endif
+  for ( ; j < width; ++j )
+  {
+    float derX, derY;
+    hornDerivatives( scanLine1, scanLine2, scanLine3, j, scaleX, scaleY, derX, derY );
+    resultLine[j] = hillshade( derX, derY, cosZenith, sinZenith, cosAzimuth, sinAzimuth );
+  }
+}
+
+const char *KadasNineCellKernels::instructionSet()
+{
+  switch ( sIsa )
+  {
+    case KadasNineCellIsa::AVX2:
+      return "AVX2";
+    case KadasNineCellIsa::SSE2:
+      return "SSE2";
+    case KadasNineCellIsa::NEON:
+      return "NEON";
+    case KadasNineCellIsa::Scalar:
+      break;
+  }
+  return "Scalar";
+}
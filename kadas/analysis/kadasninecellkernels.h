@@ -0,0 +1,42 @@
+/***************************************************************************
+    kadasninecellkernels.h
+    ----------------------
+    copyright            : (C) 2019 by Sandro Mani
+    email                : smani at sourcepole dot ch
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef KADASNINECELLKERNELS_H
+#define KADASNINECELLKERNELS_H
+
+#include <kadas/analysis/kadas_analysis.h>
+
+/**Row kernels for nine cell filters, vectorized with AVX2, SSE2 or NEON depending on the CPU.
+  All kernels take the rows above, at and below the output row, each padded with one cell on either side
+  (i.e. width + 2 values), and assume that none of the input cells is nodata.*/
+class KADAS_ANALYSIS_EXPORT KadasNineCellKernels
+{
+  public:
+    /**Computes the slope in degrees from the Horn (1981) derivatives.
+      scaleX and scaleY are 1 / (8 * cellSize * zFactor) in x- and y-direction respectively*/
+    static void hornSlopeRow( const float *scanLine1, const float *scanLine2, const float *scanLine3, float *resultLine, int width,
+                              float scaleX, float scaleY );
+
+    /**Computes the hillshade (0-255) from the Horn (1981) derivatives for the specified light zenith and azimuth angles.
+      scaleX and scaleY are 1 / (8 * cellSize * zFactor) in x- and y-direction respectively*/
+    static void hornHillshadeRow( const float *scanLine1, const float *scanLine2, const float *scanLine3, float *resultLine, int width,
+                                  float scaleX, float scaleY, float zenithRad, float azimuthRad );
+
+    /**Name of the instruction set used by the kernels on this CPU*/
+    static const char *instructionSet();
+};
+
+#endif // KADASNINECELLKERNELS_H
@@ -14,6 +14,7 @@
  *                                                                         *
  ***************************************************************************/
 
+#include <kadas/analysis/kadasninecellkernels.h>
 #include <kadas/analysis/kadasslopefilter.h>
 
 
@@ -36,3 +37,10 @@ float KadasSlopeFilter::processNineCellWindow( float *x11, float *x21, float *x3
   return atan( sqrt( derX * derX + derY * derY ) ) * 180.0 / M_PI;
 }
 
+void KadasSlopeFilter::processRow( float *scanLine1, float *scanLine2, float *scanLine3, const unsigned char *noDataMask, float *resultLine, int width )
+{
+  float scaleX = 1. / ( 8 * mCellSizeX * mZFactor );
+  float scaleY = 1. / ( 8 * mCellSizeY * mZFactor );
+  KadasNineCellKernels::hornSlopeRow( scanLine1, scanLine2, scanLine3, resultLine, width, scaleX, scaleY );
+  processNoDataCells( scanLine1, scanLine2, scanLine3, noDataMask, resultLine, width );
+}
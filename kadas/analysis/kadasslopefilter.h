@@ -31,6 +31,8 @@ class KADAS_ANALYSIS_EXPORT KadasSlopeFilter: public KadasNineCellFilter
     float processNineCellWindow( float *x11, float *x21, float *x31,
                                  float *x12, float *x22, float *x32,
                                  float *x13, float *x23, float *x33 ) override;
+
+    void processRow( float *scanLine1, float *scanLine2, float *scanLine3, const unsigned char *noDataMask, float *resultLine, int width ) override;
 };
 
 #endif // KADASSLOPEFILTER_H
@@ -14,11 +14,20 @@
  *                                                                         *
  ***************************************************************************/
 
+#include <QAtomicInt>
+#include <QMutex>
 #include <QProgressDialog>
+#include <QTemporaryDir>
 
 #include <cstring>
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 #include <cpl_string.h>
 #include <gdal.h>
+#include <omp.h>
 
 #include <qgis/qgscoordinatetransform.h>
 #include <qgis/qgslogger.h>
@@ -26,29 +35,694 @@
 
 #include <kadas/analysis/kadasviewshedfilter.h>
 
+qint64 KadasViewshedFilter::sMemoryBudget = 1073741824;
 
-static inline double geoToPixelX( double gtrans[6], double x, double y )
+static inline double geoToPixelX( const double gtrans[6], double x, double y )
 {
   return ( -gtrans[0] * gtrans[5] + gtrans[2] * gtrans[3] - gtrans[2] * y + gtrans[5] * x ) / ( gtrans[1] * gtrans[5] - gtrans[2] * gtrans[4] );
 }
 
-static inline double geoToPixelY( double gtrans[6], double x, double y )
+static inline double geoToPixelY( const double gtrans[6], double x, double y )
 {
   return ( -gtrans[0] * gtrans[4] + gtrans[1] * gtrans[3] - gtrans[1] * y + gtrans[4] * x ) / ( gtrans[2] * gtrans[4] - gtrans[1] * gtrans[5] );
 }
 
-static inline double pixelToGeoX( double gtrans[6], double px, double py )
+static inline double pixelToGeoX( const double gtrans[6], double px, double py )
 {
   return gtrans[0] + px * gtrans[1] + py * gtrans[2];
 }
 
-static inline double pixelToGeoY( double gtrans[6], double px, double py )
+static inline double pixelToGeoY( const double gtrans[6], double px, double py )
 {
   return gtrans[3] + px * gtrans[4] + py * gtrans[5];
 }
 
-bool KadasViewshedFilter::computeViewshed( const QString &inputFile, const QString &outputFile, const QString &outputFormat, QgsPointXY observerPos, const QgsCoordinateReferenceSystem &observerPosCrs, double observerHeight, double targetHeight, bool heightRelToTerr, double radius, const QgsUnitTypes::DistanceUnit distanceElevUnit, const QVector<QgsPointXY> &filterRegion, bool displayVisible, int accuracyFactor, QProgressDialog *progress )
+struct KadasViewshedContext
 {
+  float noDataValue = 0;
+  // Origin and width of the heightmap and viewshed buffers
+  int hmapCol = 0;
+  int hmapRow = 0;
+  int hmapWidth = 0;
+  // Bounds of the region of the observer
+  int colStart = 0;
+  int colEnd = 0;
+  int rowStart = 0;
+  int rowEnd = 0;
+  int obs[2] = {0, 0};
+  int roi = 0;
+  double gtrans[6] = {};
+  QgsPointXY observerPos;
+  double earthRadius = 0;
+  double observerHeight = 0;
+  double targetHeight = 0;
+  bool heightRelToTerr = false;
+  QPolygon filterPoly;
+};
+
+// Heightmap and viewshed held in memory, covering the whole window
+class KadasViewshedMemoryRaster
+{
+  public:
+    class Accessor
+    {
+      public:
+        Accessor( const KadasViewshedContext &ctx, const float *heightmap, int heightmapSize, unsigned char *viewshed )
+          : mCtx( ctx ), mHeightmap( heightmap ), mHeightmapSize( heightmapSize ), mViewshed( viewshed ) {}
+        bool height( int px, int py, float &elev ) const
+        {
+          int idx = ( py - mCtx.hmapRow ) * mCtx.hmapWidth + ( px - mCtx.hmapCol );
+          if ( idx >= mHeightmapSize )
+          {
+            return false;
+          }
+          elev = mHeightmap[idx];
+          return true;
+        }
+        void setVisibility( int px, int py, unsigned char value )
+        {
+          mViewshed[( py - mCtx.hmapRow ) * mCtx.hmapWidth + ( px - mCtx.hmapCol )] = value;
+        }
+
+      private:
+        const KadasViewshedContext &mCtx;
+        const float *mHeightmap;
+        int mHeightmapSize;
+        unsigned char *mViewshed;
+    };
+
+    KadasViewshedMemoryRaster( const KadasViewshedContext &ctx, const float *heightmap, int heightmapSize, unsigned char *viewshed )
+      : mAccessor( ctx, heightmap, heightmapSize, viewshed ) {}
+    // The accessor is stateless and shared by all octants
+    Accessor &accessor( int /*octant*/ ) { return mAccessor; }
+    void ringsCompleted( int /*ring*/ ) {}
+
+  private:
+    Accessor mAccessor;
+};
+
+// Heightmap streamed in blocks through a LRU cache per octant, viewshed blocks are written to the output as soon as the sweep has passed them
+class KadasViewshedStreamingRaster
+{
+  public:
+    static const int BlockSize = 256;
+    typedef std::function<bool( int col, int row, int width, int height, const unsigned char *data, int stride )> BlockWriter;
+
+    class Accessor
+    {
+      public:
+        Accessor( KadasViewshedStreamingRaster *raster, GDALDatasetH dataset, int capacity )
+          : mRaster( raster ), mDataset( dataset ), mBand( dataset ? GDALGetRasterBand( dataset, 1 ) : nullptr ), mCapacity( qMax( 1, capacity ) ) {}
+        ~Accessor()
+        {
+          if ( mDataset )
+          {
+            GDALClose( mDataset );
+          }
+        }
+        bool height( int px, int py, float &elev )
+        {
+          int col = px - mRaster->mCtx.hmapCol;
+          int row = py - mRaster->mCtx.hmapRow;
+          if ( col < 0 || row < 0 || col >= mRaster->mWidth || row >= mRaster->mHeight )
+          {
+            return false;
+          }
+          int key = ( row / BlockSize ) * mRaster->mBlocksX + col / BlockSize;
+          if ( key != mLastHeightKey )
+          {
+            mLastHeightBlock = heightBlock( key );
+            mLastHeightKey = key;
+          }
+          elev = mLastHeightBlock[( row % BlockSize ) * BlockSize + col % BlockSize];
+          return true;
+        }
+        void setVisibility( int px, int py, unsigned char value )
+        {
+          int col = px - mRaster->mCtx.hmapCol;
+          int row = py - mRaster->mCtx.hmapRow;
+          int key = ( row / BlockSize ) * mRaster->mBlocksX + col / BlockSize;
+          if ( key != mLastOutputKey )
+          {
+            mLastOutputBlock = mRaster->outputBlock( key );
+            mLastOutputKey = key;
+          }
+          mLastOutputBlock[( row % BlockSize ) * BlockSize + col % BlockSize] = value;
+        }
+        void resetOutputBlock()
+        {
+          mLastOutputKey = -1;
+          mLastOutputBlock = nullptr;
+        }
+
+      private:
+        struct Block
+        {
+          int key;
+          std::vector<float> data;
+        };
+        KadasViewshedStreamingRaster *mRaster;
+        GDALDatasetH mDataset;
+        GDALRasterBandH mBand;
+        int mCapacity;
+        std::list<Block> mBlocks; // Most recently used first
+        std::unordered_map<int, std::list<Block>::iterator> mBlockIndex;
+        int mLastHeightKey = -1;
+        const float *mLastHeightBlock = nullptr;
+        int mLastOutputKey = -1;
+        unsigned char *mLastOutputBlock = nullptr;
+
+        const float *heightBlock( int key )
+        {
+          auto it = mBlockIndex.find( key );
+          if ( it != mBlockIndex.end() )
+          {
+            mBlocks.splice( mBlocks.begin(), mBlocks, it->second );
+            return mBlocks.front().data.data();
+          }
+          if ( int( mBlocks.size() ) >= mCapacity )
+          {
+            // Recycle the least recently used block
+            mBlockIndex.erase( mBlocks.back().key );
+            mBlocks.splice( mBlocks.begin(), mBlocks, std::prev( mBlocks.end() ) );
+          }
+          else
+          {
+            mBlocks.push_front( Block() );
+            mBlocks.front().data.resize( BlockSize * BlockSize );
+          }
+          Block &block = mBlocks.front();
+          block.key = key;
+          mBlockIndex[key] = mBlocks.begin();
+          mRaster->readBlock( mBand, key, block.data.data() );
+          return block.data.data();
+        }
+    };
+
+    KadasViewshedStreamingRaster( const KadasViewshedContext &ctx, const QString &inputFile, int srcColStart, int srcRowStart, int accuracyFactor, int width, int height, unsigned char defaultValue, const BlockWriter &writer )
+      : mCtx( ctx ), mSrcColStart( srcColStart ), mSrcRowStart( srcRowStart ), mAccuracyFactor( accuracyFactor ), mWidth( width ), mHeight( height )
+      , mBlocksX( ( width + BlockSize - 1 ) / BlockSize ), mBlocksY( ( height + BlockSize - 1 ) / BlockSize ), mDefaultValue( defaultValue ), mWriter( writer )
+      , mFlushed( mBlocksX * mBlocksY, false )
+    {
+      // The output blocks are released as the sweep advances
+      int capacity = heightCacheCapacity( ctx.roi );
+      for ( int octant = 0; octant < 8; ++octant )
+      {
+        GDALDatasetH dataset = GDALOpen( inputFile.toLocal8Bit().data(), GA_ReadOnly );
+        mAccessors.emplace_back( new Accessor( this, dataset, capacity ) );
+      }
+    }
+    Accessor &accessor( int octant ) { return *mAccessors[octant]; }
+
+    // Number of heightmap blocks cached per octant. A step of the sweep covers less than a block of rings, i.e. up to two block
+    // columns (or rows) along the whole length of the octant, which are visited once per ring. A LRU cache which cannot hold
+    // all of them misses on every block.
+    static int heightCacheCapacity( int roi ) { return 2 * ( roi / BlockSize + 2 ); }
+    // Size in bytes of the heightmap caches of all octants
+    static qint64 heightCacheSize( int roi ) { return qint64( 8 ) * heightCacheCapacity( roi ) * BlockSize * BlockSize * sizeof( float ); }
+
+    // Writes all output blocks which lie entirely within the specified ring around the observer
+    void ringsCompleted( int ring )
+    {
+      for ( const std::unique_ptr<Accessor> &accessor : mAccessors )
+      {
+        accessor->resetOutputBlock();
+      }
+      for ( auto it = mOutputBlocks.begin(); it != mOutputBlocks.end(); )
+      {
+        int key = it->first;
+        int bx = key % mBlocksX, by = key / mBlocksX;
+        int x0 = mCtx.hmapCol + bx * BlockSize, x1 = mCtx.hmapCol + qMin( ( bx + 1 ) * BlockSize, mWidth ) - 1;
+        int y0 = mCtx.hmapRow + by * BlockSize, y1 = mCtx.hmapRow + qMin( ( by + 1 ) * BlockSize, mHeight ) - 1;
+        int dist = qMax( qMax( qAbs( x0 - mCtx.obs[0] ), qAbs( x1 - mCtx.obs[0] ) ), qMax( qAbs( y0 - mCtx.obs[1] ), qAbs( y1 - mCtx.obs[1] ) ) );
+        if ( dist <= ring || ring >= mCtx.roi )
+        {
+          writeBlock( key, it->second.data() );
+          it = mOutputBlocks.erase( it );
+        }
+        else
+        {
+          ++it;
+        }
+      }
+    }
+
+    // Writes all remaining blocks, and if writeUntouched is set also those which were never touched by the sweep
+    bool finish( bool writeUntouched )
+    {
+      ringsCompleted( mCtx.roi );
+      std::vector<unsigned char> empty( BlockSize * BlockSize, mDefaultValue );
+      for ( int key = 0, n = mFlushed.size(); writeUntouched && key < n; ++key )
+      {
+        if ( !mFlushed[key] )
+        {
+          writeBlock( key, empty.data() );
+        }
+      }
+      return mOk;
+    }
+
+  private:
+    friend class Accessor;
+    const KadasViewshedContext &mCtx;
+    int mSrcColStart;
+    int mSrcRowStart;
+    int mAccuracyFactor;
+    int mWidth;
+    int mHeight;
+    int mBlocksX;
+    int mBlocksY;
+    unsigned char mDefaultValue;
+    BlockWriter mWriter;
+    std::vector<std::unique_ptr<Accessor>> mAccessors;
+    QMutex mOutputMutex;
+    std::unordered_map<int, std::vector<unsigned char>> mOutputBlocks;
+    std::vector<bool> mFlushed;
+    bool mOk = true;
+
+    void readBlock( GDALRasterBandH band, int key, float *data ) const
+    {
+      int bx = key % mBlocksX, by = key / mBlocksX;
+      int width = qMin( BlockSize, mWidth - bx * BlockSize );
+      int height = qMin( BlockSize, mHeight - by * BlockSize );
+      std::fill( data, data + BlockSize * BlockSize, mCtx.noDataValue );
+      GDALRasterIOExtraArg rioargs;
+      INIT_RASTERIO_EXTRA_ARG( rioargs );
+      rioargs.eResampleAlg = GRIORA_Average;
+      int srcCol = mSrcColStart + bx * BlockSize * mAccuracyFactor;
+      int srcRow = mSrcRowStart + by * BlockSize * mAccuracyFactor;
+      if ( !band || GDALRasterIOEx( band, GF_Read, srcCol, srcRow, width * mAccuracyFactor, height * mAccuracyFactor, data, width, height, GDT_Float32, 0, BlockSize * sizeof( float ), &rioargs ) != CE_None )
+      {
+        QgsDebugMsg( "Failed to fetch raster pixels" );
+        std::fill( data, data + BlockSize * BlockSize, mCtx.noDataValue );
+      }
+    }
+    unsigned char *outputBlock( int key )
+    {
+      QMutexLocker locker( &mOutputMutex );
+      auto it = mOutputBlocks.find( key );
+      if ( it == mOutputBlocks.end() )
+      {
+        it = mOutputBlocks.emplace( key, std::vector<unsigned char>( BlockSize * BlockSize, mDefaultValue ) ).first;
+      }
+      return it->second.data();
+    }
+    void writeBlock( int key, const unsigned char *data )
+    {
+      int bx = key % mBlocksX, by = key / mBlocksX;
+      int width = qMin( BlockSize, mWidth - bx * BlockSize );
+      int height = qMin( BlockSize, mHeight - by * BlockSize );
+      mOk &= mWriter( bx * BlockSize, by * BlockSize, width, height, data, BlockSize );
+      mFlushed[key] = true;
+    }
+};
+
+const int KadasViewshedStreamingRaster::BlockSize;
+
+// Returns the earth curvature corrected elevation of the specified pixel, or false if the pixel is not to be considered
+template<class Accessor>
+static inline bool sampleElevation( const KadasViewshedContext &ctx, Accessor &accessor, int px, int py, double &elev )
+{
+  if ( !ctx.filterPoly.isEmpty() && !ctx.filterPoly.containsPoint( QPoint( px, py ), Qt::OddEvenFill ) )
+  {
+    return false;
+  }
+
+  float pElev;
+  if ( !accessor.height( px, py, pElev ) || pElev == ctx.noDataValue )
+  {
+    return false;
+  }
+
+  // Earth curvature correction
+  double pGeoX = pixelToGeoX( ctx.gtrans, px, py );
+  double pGeoY = pixelToGeoY( ctx.gtrans, px, py );
+  double geoDistSqr = ( ctx.observerPos.x() - pGeoX ) * ( ctx.observerPos.x() - pGeoX ) + ( ctx.observerPos.y() - pGeoY ) * ( ctx.observerPos.y() - pGeoY );
+  // http://www.swisstopo.admin.ch/internet/swisstopo/de/home/topics/survey/faq/curvature.html
+  elev = pElev - 0.87 * geoDistSqr / ( 2 * ctx.earthRadius );
+  return true;
+}
+
+// Whether a target on top of the pixel with the specified elevation is visible, given the slope of the horizon at the pixel
+static inline bool isTargetVisible( const KadasViewshedContext &ctx, double elev, double horizonSlope, int dist )
+{
+  double horizon_alt = ctx.observerHeight + horizonSlope * dist;
+  double tHeight = ctx.targetHeight;
+  if ( ctx.heightRelToTerr )
+  {
+    tHeight += elev;
+  }
+  return tHeight >= horizon_alt;
+}
+
+// Cancellation is requested through the progress dialog, or through the canceled flag if the algorithm runs in a worker thread
+static bool rayCastViewshed( const KadasViewshedContext &ctx, KadasViewshedMemoryRaster &raster, QProgressDialog *progress, const QAtomicInt *canceled = nullptr )
+{
+  KadasViewshedMemoryRaster::Accessor &accessor = raster.accessor( 0 );
+  const int *obs = ctx.obs;
+  int roi = ctx.roi;
+  if ( progress )
+  {
+    progress->setRange( 0, 8 * roi );
+  }
+  for ( int radiusNumber = 0; radiusNumber < 8 * roi; ++radiusNumber )
+  {
+    if ( canceled && canceled->load() )
+    {
+      return false;
+    }
+    if ( progress )
+    {
+      if ( progress->wasCanceled() )
+      {
+        return false;
+      }
+      progress->setValue( radiusNumber );
+    }
+    int target[2];
+    if ( radiusNumber <= roi )
+    {
+      target[0] = obs[0] + roi;
+      target[1] = obs[1] + radiusNumber;
+    }
+    else if ( radiusNumber <= 3 * roi )
+    {
+      target[0] = obs[0] + 2 * roi - radiusNumber;
+      target[1] = obs[1] + roi;
+    }
+    else if ( radiusNumber <= 5 * roi )
+    {
+      target[0] = obs[0] - roi;
+      target[1] = obs[1] + 4 * roi - radiusNumber;
+    }
+    else if ( radiusNumber <= 7 * roi )
+    {
+      target[0] = obs[0] + radiusNumber - 6 * roi;
+      target[1] = obs[1] - roi;
+    }
+    else if ( radiusNumber < 8 * roi )
+    {
+      target[0] = obs[0] + roi;
+      target[1] = obs[1] + radiusNumber - 8 * roi;
+    }
+    else
+    {
+      break; // All terrain points processed.
+    }
+
+    // Line of sight from observer to target.
+    int delta[2] = {target[0] - obs[0], target[1] - obs[1]};
+    int inciny = qAbs( delta[0] ) < qAbs( delta[1] );
+
+    // Step along coord (X or Y) that varies most from observer to target.
+    // That coord is inciny. Slope is how fast the other coord varies.
+    double slope = ( double ) delta[1 - inciny] / ( double ) delta[inciny];
+    int step = delta[inciny] > 0 ? 1 : -1;
+    double horizon_slope = -99999; // Slope (in vertical plane) to horizon so far.
+
+    // i = 0 would be the observer, which is always visible.
+    for ( int i = step; true; i += step )
+    {
+      int p[2];
+      p[inciny] = obs[inciny] + i;
+
+      if ( i * slope > 0 )
+      {
+        p[1 - inciny] = obs[1 - inciny] + int ( qCeil( i * slope - 0.5 ) );
+      }
+      else
+      {
+        p[1 - inciny] = obs[1 - inciny] + int ( qFloor( i * slope + 0.5 ) );
+      }
+
+      if ( p[0] < ctx.colStart || p[0] > ctx.colEnd || p[1] < ctx.rowStart || p[1] > ctx.rowEnd )
+      {
+        break;
+      }
+
+      //Is the point in the outside of the viewshed area?
+      double dx = qAbs( p[0] - obs[0] ), dy = qAbs( p[1] - obs[1] );
+      if ( !( dx <= roi && dy <= roi && dx * dx + dy * dy <= double ( roi ) * double ( roi ) ) )
+      {
+        break;
+      }
+
+      double pElev;
+      if ( !sampleElevation( ctx, accessor, p[0], p[1], pElev ) )
+      {
+        continue;
+      }
+
+      // Update the slope if the current slope is greater than the old one
+      int dist = qAbs( p[inciny] - obs[inciny] );
+      double s = double ( pElev - ctx.observerHeight ) / double ( dist );
+      horizon_slope = qMax( horizon_slope, s );
+
+      accessor.setVisibility( p[0], p[1], isTargetVisible( ctx, pElev, horizon_slope, dist ) ? 255 : 0 );
+    }
+  }
+  return true;
+}
+
+// Octant transformations: pixel offset from observer = (a * u + b * v, c * u + d * v), with ring u and 0 <= v <= u
+static const int sOctants[8][4] =
+{
+  { 1, 0, 0, 1 }, { 0, 1, 1, 0 }, { 0, -1, 1, 0 }, { -1, 0, 0, 1 },
+  { -1, 0, 0, -1 }, { 0, -1, -1, 0 }, { 0, 1, -1, 0 }, { 1, 0, 0, -1 }
+};
+
+// XDraw: the horizon slope of each cell is interpolated from the two cells of the previous ring which enclose the line of sight.
+// The octants only depend on their own cells and are swept in parallel. Axis and diagonal cells are shared by two octants and
+// computed identically by both, they are written by the even and odd octant respectively.
+template<class Raster>
+static bool xdrawViewshed( const KadasViewshedContext &ctx, Raster &raster, QProgressDialog *progress, const QAtomicInt *canceled = nullptr )
+{
+  // Less than a block of the streaming raster, see KadasViewshedStreamingRaster::heightCacheCapacity
+  const int ringsPerStep = 32;
+  int roi = ctx.roi;
+  std::vector<std::vector<double>> prevRing( 8, std::vector<double>( roi + 2, -99999 ) );
+  std::vector<std::vector<double>> curRing( 8, std::vector<double>( roi + 2, -99999 ) );
+
+  if ( progress )
+  {
+    progress->setRange( 0, roi );
+  }
+  for ( int ringStart = 1; ringStart <= roi; ringStart += ringsPerStep )
+  {
+    if ( canceled && canceled->load() )
+    {
+      return false;
+    }
+    if ( progress )
+    {
+      if ( progress->wasCanceled() )
+      {
+        return false;
+      }
+      progress->setValue( ringStart - 1 );
+    }
+    int ringEnd = qMin( ringStart + ringsPerStep, roi + 1 );
+
+    #pragma omp parallel for schedule(static, 1)
+    for ( int octant = 0; octant < 8; ++octant )
+    {
+      const int *t = sOctants[octant];
+      typename Raster::Accessor &accessor = raster.accessor( octant );
+      std::vector<double> &prev = prevRing[octant];
+      std::vector<double> &cur = curRing[octant];
+      for ( int u = ringStart; u < ringEnd; ++u )
+      {
+        for ( int v = 0; v <= u; ++v )
+        {
+          double pos = double( v ) * ( u - 1 ) / u;
+          int i0 = int( pos );
+          int i1 = qMin( i0 + 1, u - 1 );
+          double horizonSlope = prev[i0] + ( pos - i0 ) * ( prev[i1] - prev[i0] );
+          cur[v] = horizonSlope;
+
+          int px = ctx.obs[0] + t[0] * u + t[1] * v;
+          int py = ctx.obs[1] + t[2] * u + t[3] * v;
+          if ( px < ctx.colStart || px > ctx.colEnd || py < ctx.rowStart || py > ctx.rowEnd || qint64( u ) * u + qint64( v ) * v > qint64( roi ) * roi )
+          {
+            continue;
+          }
+          double pElev;
+          if ( !sampleElevation( ctx, accessor, px, py, pElev ) )
+          {
+            continue;
+          }
+          horizonSlope = qMax( horizonSlope, ( pElev - ctx.observerHeight ) / u );
+          cur[v] = horizonSlope;
+
+          bool owned = octant % 2 == 0 ? v < u : v > 0;
+          if ( owned )
+          {
+            accessor.setVisibility( px, py, isTargetVisible( ctx, pElev, horizonSlope, u ) ? 255 : 0 );
+          }
+        }
+        std::swap( prev, cur );
+      }
+    }
+    raster.ringsCompleted( ringEnd - 1 );
+  }
+  return true;
+}
+
+static bool computeViewshedsOutOfCore( const QVector<KadasViewshedContext> &contexts, const QString &inputFile, GDALDatasetH outputDataset, int srcColStart, int srcRowStart, int accuracyFactor, int hmapWidth, int hmapHeight, qint64 memoryBudget, KadasViewshedFilter::OutputMode outputMode, bool displayVisible, QProgressDialog *progress )
+{
+  // Half of the budget is available for the heightmap caches
+  for ( const KadasViewshedContext &ctx : contexts )
+  {
+    if ( KadasViewshedStreamingRaster::heightCacheSize( ctx.roi ) > memoryBudget / 2 )
+    {
+      QgsDebugMsg( QString( "Memory budget too small for a viewshed radius of %1 cells" ).arg( ctx.roi ) );
+      return false;
+    }
+  }
+
+  // In cumulative mode, the counts are accumulated in an uncompressed temporary raster and written to the output once all observers
+  // are computed, rather than reading, recompressing and appending the output blocks once per observer. The counts take half the
+  // size of the heightmap, which exceeds the budget, hence they are not held in memory.
+  bool cumulative = outputMode == KadasViewshedFilter::OutputCumulative;
+  GDALDatasetH countsDataset = nullptr;
+  QTemporaryDir countsDir;
+  if ( cumulative )
+  {
+    if ( countsDir.isValid() )
+    {
+      char **papszOptions = CSLSetNameValue( 0, "TILED", "YES" );
+      papszOptions = CSLSetNameValue( papszOptions, "BLOCKXSIZE", QString::number( KadasViewshedStreamingRaster::BlockSize ).toLocal8Bit().data() );
+      papszOptions = CSLSetNameValue( papszOptions, "BLOCKYSIZE", QString::number( KadasViewshedStreamingRaster::BlockSize ).toLocal8Bit().data() );
+      papszOptions = CSLSetNameValue( papszOptions, "BIGTIFF", "IF_SAFER" );
+      countsDataset = GDALCreate( GDALGetDriverByName( "GTiff" ), countsDir.filePath( "counts.tif" ).toLocal8Bit().data(), hmapWidth, hmapHeight, 1, GDT_UInt16, papszOptions );
+      CSLDestroy( papszOptions );
+    }
+    if ( !countsDataset )
+    {
+      QgsDebugMsg( "Failed to create the cumulative counts raster" );
+      return false;
+    }
+  }
+
+  // Observers are processed one after another, each sweep is parallelized over the octants
+  bool success = true;
+  for ( int i = 0, n = contexts.size(); i < n && success; ++i )
+  {
+    const KadasViewshedContext &ctx = contexts[i];
+    KadasViewshedStreamingRaster::BlockWriter writer;
+    if ( outputMode == KadasViewshedFilter::OutputBands )
+    {
+      GDALRasterBandH band = GDALGetRasterBand( outputDataset, i + 1 );
+      writer = [band]( int col, int row, int width, int height, const unsigned char *data, int stride )
+      {
+        return GDALRasterIO( band, GF_Write, col, row, width, height, const_cast<unsigned char *>( data ), width, height, GDT_Byte, 0, stride ) == CE_None;
+      };
+    }
+    else
+    {
+      GDALRasterBandH band = GDALGetRasterBand( countsDataset, 1 );
+      writer = [band]( int col, int row, int width, int height, const unsigned char *data, int stride )
+      {
+        std::vector<quint16> counts( width * height );
+        if ( GDALRasterIO( band, GF_Read, col, row, width, height, counts.data(), width, height, GDT_UInt16, 0, 0 ) != CE_None )
+        {
+          return false;
+        }
+        for ( int y = 0; y < height; ++y )
+        {
+          for ( int x = 0; x < width; ++x )
+          {
+            counts[y * width + x] += data[y * stride + x] == 255;
+          }
+        }
+        return GDALRasterIO( band, GF_Write, col, row, width, height, counts.data(), width, height, GDT_UInt16, 0, 0 ) == CE_None;
+      };
+    }
+
+    // In cumulative mode, cells only count if the observer marked them visible, hence unvisited cells must not default to 255.
+    // Untouched blocks add nothing to the counts and are not written.
+    KadasViewshedStreamingRaster raster( ctx, inputFile, srcColStart, srcRowStart, accuracyFactor, hmapWidth, hmapHeight, cumulative ? 0 : 255 * !displayVisible, writer );
+    // The observer is always visible from itself
+    raster.accessor( 0 ).setVisibility( ctx.obs[0], ctx.obs[1], 255 );
+    if ( !xdrawViewshed( ctx, raster, progress ) )
+    {
+      QgsDebugMsg( "Canceled" );
+      success = false;
+    }
+    else if ( !raster.finish( !cumulative ) )
+    {
+      QgsDebugMsg( "Failed to write to output dataset" );
+      success = false;
+    }
+  }
+
+  if ( countsDataset )
+  {
+    // Copy the counts to the output in rows of blocks, so that each output block is compressed once
+    GDALRasterBandH countsBand = GDALGetRasterBand( countsDataset, 1 );
+    GDALRasterBandH outputBand = GDALGetRasterBand( outputDataset, 1 );
+    std::vector<quint16> counts;
+    for ( int row = 0; row < hmapHeight && success; row += KadasViewshedStreamingRaster::BlockSize )
+    {
+      int height = qMin( KadasViewshedStreamingRaster::BlockSize, hmapHeight - row );
+      counts.resize( size_t( hmapWidth ) * height );
+      if ( GDALRasterIO( countsBand, GF_Read, 0, row, hmapWidth, height, counts.data(), hmapWidth, height, GDT_UInt16, 0, 0 ) != CE_None ||
+           GDALRasterIO( outputBand, GF_Write, 0, row, hmapWidth, height, counts.data(), hmapWidth, height, GDT_UInt16, 0, 0 ) != CE_None )
+      {
+        QgsDebugMsg( "Failed to write to output dataset" );
+        success = false;
+      }
+    }
+    GDALClose( countsDataset );
+  }
+  return success;
+}
+
+// Computes the pixel window of the raster covering the square of the specified radius around pos
+static void computeWindow( const double gtrans[6], const QgsPointXY &pos, double radius, int terWidth, int terHeight, int &colStart, int &rowStart, int &colEnd, int &rowEnd )
+{
+  QList<QgsPointXY> cornerPoints = QList<QgsPointXY>()
+                                   << QgsPointXY( pos.x() - radius, pos.y() - radius )
+                                   << QgsPointXY( pos.x() + radius, pos.y() - radius )
+                                   << QgsPointXY( pos.x() + radius, pos.y() + radius )
+                                   << QgsPointXY( pos.x() - radius, pos.y() + radius );
+  colStart = std::numeric_limits<int>::max();
+  rowStart = std::numeric_limits<int>::max();
+  colEnd = -std::numeric_limits<int>::max();
+  rowEnd = -std::numeric_limits<int>::max();
+  for ( const QgsPointXY &p : cornerPoints )
+  {
+    double x = geoToPixelX( gtrans, p.x(), p.y() );
+    double y = geoToPixelY( gtrans, p.x(), p.y() );
+    colStart = qMin( colStart, qFloor( x ) );
+    colEnd = qMax( colEnd, qCeil( x ) );
+    rowStart = qMin( rowStart, qFloor( y ) );
+    rowEnd = qMax( rowEnd, qCeil( y ) );
+  }
+  colStart = qMax( 0, colStart );
+  colEnd = qMin( terWidth - 1, colEnd );
+  rowStart = qMax( 0, rowStart );
+  rowEnd = qMin( terHeight - 1, rowEnd );
+}
+
+bool KadasViewshedFilter::computeViewshed( const QString &inputFile, const QString &outputFile, const QString &outputFormat, QgsPointXY observerPos, const QgsCoordinateReferenceSystem &observerPosCrs, double observerHeight, double targetHeight, bool heightRelToTerr, double radius, const QgsUnitTypes::DistanceUnit distanceElevUnit, const QVector<QgsPointXY> &filterRegion, bool displayVisible, int accuracyFactor, QProgressDialog *progress, Algorithm algorithm )
+{
+  Observer observer;
+  observer.pos = observerPos;
+  observer.observerHeight = observerHeight;
+  observer.targetHeight = targetHeight;
+  observer.radius = radius;
+  return computeViewsheds( inputFile, outputFile, outputFormat, QVector<Observer>() << observer, observerPosCrs, heightRelToTerr, distanceElevUnit, OutputBands, filterRegion, displayVisible, accuracyFactor, progress, algorithm );
+}
+
+bool KadasViewshedFilter::computeViewsheds( const QString &inputFile, const QString &outputFile, const QString &outputFormat, QVector<Observer> observers, const QgsCoordinateReferenceSystem &observerPosCrs, bool heightRelToTerr, const QgsUnitTypes::DistanceUnit distanceElevUnit, OutputMode outputMode, const QVector<QgsPointXY> &filterRegion, bool displayVisible, int accuracyFactor, QProgressDialog *progress, Algorithm algorithm )
+{
+  if ( observers.isEmpty() )
+  {
+    QgsDebugMsg( "No observers specified" );
+    return false;
+  }
+
   // Open input file
   GDALDatasetH inputDataset = GDALOpen( inputFile.toLocal8Bit().data(), GA_ReadOnly );
   if ( inputDataset == 0 )
@@ -66,12 +740,15 @@ bool KadasViewshedFilter::computeViewshed( const QString &inputFile, const QStri
     return false;
   }
   QgsCoordinateTransform ct( observerPosCrs, datasetCrs, QgsProject::instance() );
-  observerPos = ct.transform( observerPos );
-  if ( datasetCrs.mapUnits() != distanceElevUnit )
+  for ( Observer &observer : observers )
   {
-    observerHeight *= QgsUnitTypes::fromUnitToUnitFactor( distanceElevUnit, datasetCrs.mapUnits() );
-    targetHeight *= QgsUnitTypes::fromUnitToUnitFactor( distanceElevUnit, datasetCrs.mapUnits() );
-    radius *= QgsUnitTypes::fromUnitToUnitFactor( distanceElevUnit, datasetCrs.mapUnits() );
+    observer.pos = ct.transform( observer.pos );
+    if ( datasetCrs.mapUnits() != distanceElevUnit )
+    {
+      observer.observerHeight *= QgsUnitTypes::fromUnitToUnitFactor( distanceElevUnit, datasetCrs.mapUnits() );
+      observer.targetHeight *= QgsUnitTypes::fromUnitToUnitFactor( distanceElevUnit, datasetCrs.mapUnits() );
+      observer.radius *= QgsUnitTypes::fromUnitToUnitFactor( distanceElevUnit, datasetCrs.mapUnits() );
+    }
   }
 
 
@@ -96,39 +773,36 @@ bool KadasViewshedFilter::computeViewshed( const QString &inputFile, const QStri
   int terWidth = GDALGetRasterXSize( inputDataset );
   int terHeight = GDALGetRasterYSize( inputDataset );
 
-  int obs[2] =
-  {
-    qRound( geoToPixelX( gtrans, observerPos.x(), observerPos.y() ) ),
-    qRound( geoToPixelY( gtrans, observerPos.x(), observerPos.y() ) )
-  };
   double earthRadius = 6370000;
   if ( datasetCrs.mapUnits() != QgsUnitTypes::DistanceMeters )
   {
     earthRadius *= QgsUnitTypes::fromUnitToUnitFactor( QgsUnitTypes::DistanceMeters, datasetCrs.mapUnits() );
   }
 
-  QList<QgsPointXY> cornerPoints = QList<QgsPointXY>()
-                                   << QgsPointXY( observerPos.x() - radius, observerPos.y() - radius )
-                                   << QgsPointXY( observerPos.x() + radius, observerPos.y() - radius )
-                                   << QgsPointXY( observerPos.x() + radius, observerPos.y() + radius )
-                                   << QgsPointXY( observerPos.x() - radius, observerPos.y() + radius );
+  // Window of each observer, and the union of all windows which is read from the input
+  int nObservers = observers.size();
+  QVector<KadasViewshedContext> contexts( nObservers );
   int colStart = std::numeric_limits<int>::max();
   int rowStart = std::numeric_limits<int>::max();
   int colEnd = -std::numeric_limits<int>::max();
   int rowEnd = -std::numeric_limits<int>::max();
-  for ( const QgsPointXY &p : cornerPoints )
+  for ( int i = 0; i < nObservers; ++i )
   {
-    double x = geoToPixelX( gtrans, p.x(), p.y() );
-    double y = geoToPixelY( gtrans, p.x(), p.y() );
-    colStart = qMin( colStart, qFloor( x ) );
-    colEnd = qMax( colEnd, qCeil( x ) );
-    rowStart = qMin( rowStart, qFloor( y ) );
-    rowEnd = qMax( rowEnd, qCeil( y ) );
+    KadasViewshedContext &ctx = contexts[i];
+    ctx.obs[0] = qRound( geoToPixelX( gtrans, observers[i].pos.x(), observers[i].pos.y() ) );
+    ctx.obs[1] = qRound( geoToPixelY( gtrans, observers[i].pos.x(), observers[i].pos.y() ) );
+    computeWindow( gtrans, observers[i].pos, observers[i].radius, terWidth, terHeight, ctx.colStart, ctx.rowStart, ctx.colEnd, ctx.rowEnd );
+    if ( ctx.obs[0] < ctx.colStart || ctx.obs[0] > ctx.colEnd || ctx.obs[1] < ctx.rowStart || ctx.obs[1] > ctx.rowEnd )
+    {
+      GDALClose( inputDataset );
+      QgsDebugMsg( "Observer pos is outside vieweshed area, reprojection distortion?" );
+      return false;
+    }
+    colStart = qMin( colStart, ctx.colStart );
+    rowStart = qMin( rowStart, ctx.rowStart );
+    colEnd = qMax( colEnd, ctx.colEnd );
+    rowEnd = qMax( rowEnd, ctx.rowEnd );
   }
-  colStart = qMax( 0, colStart );
-  colEnd = qMin( terWidth - 1, colEnd );
-  rowStart = qMax( 0, rowStart );
-  rowEnd = qMin( terHeight - 1, rowEnd );
   int hmapWidth = colEnd - colStart + 1;
   int hmapHeight = rowEnd - rowStart + 1;
   QPolygon filterPoly;
@@ -138,34 +812,38 @@ bool KadasViewshedFilter::computeViewshed( const QString &inputFile, const QStri
     filterPoly.append( QPoint( qRound( geoToPixelX( gtrans, p.x(), p.y() ) ), qRound( geoToPixelY( gtrans, p.x(), p.y() ) ) ) );
   }
 
-  if ( obs[0] < colStart || obs[0] > colEnd || obs[1] < rowStart || obs[1] > rowEnd )
-  {
-    GDALClose( inputDataset );
-    QgsDebugMsg( "Observer pos is outside vieweshed area, reprojection distortion?" );
-    return false;
-  }
-
   int scaledHmapHeight = hmapHeight / accuracyFactor;
   int scaledHmapWidth = hmapWidth / accuracyFactor;
 
-  // Read input heightmap
-  // Allow at most 1GB allocated
-  if ( scaledHmapWidth * scaledHmapHeight * sizeof( float ) > 1073741824 )
+  // Read input heightmap, unless it exceeds the memory budget, in which case it is streamed in blocks while sweeping.
+  // In memory, the observers are computed concurrently and each thread holds a viewshed of the heightmap size, hence
+  // the number of threads is limited to what fits into the budget next to the heightmap and the cumulative counts.
+  qint64 hmapCells = qint64( scaledHmapWidth ) * scaledHmapHeight;
+  qint64 sharedSize = hmapCells * ( sizeof( float ) + ( outputMode == OutputCumulative ? sizeof( quint16 ) : 0 ) );
+  qint64 threadSize = hmapCells * sizeof( unsigned char );
+  bool streaming = sharedSize + threadSize > sMemoryBudget;
+  int nThreads = streaming ? 1 : int( qBound<qint64>( 1, ( sMemoryBudget - sharedSize ) / threadSize, qMin( omp_get_max_threads(), nObservers ) ) );
+  int srcColStart = colStart;
+  int srcRowStart = rowStart;
+  QVector<float> heightmap;
+  if ( streaming )
   {
-    GDALClose( inputDataset );
-    QgsDebugMsg( "Too much memory required" );
-    return false;
+    QgsDebugMsg( "Heightmap exceeds memory budget, computing viewshed out-of-core" );
+    algorithm = SweepXDraw;
   }
-  QVector<float> heightmap( scaledHmapWidth * scaledHmapHeight, noDataValue );
-  GDALRasterIOExtraArg rioargs;
-  INIT_RASTERIO_EXTRA_ARG( rioargs );
-  rioargs.eResampleAlg = GRIORA_Average;
-  CPLErr err = GDALRasterIOEx( inputBand, GF_Read, colStart, rowStart, hmapWidth, hmapHeight, heightmap.data(), scaledHmapWidth, scaledHmapHeight, GDT_Float32, 0, 0, &rioargs );
-  if ( err != CE_None )
+  else
   {
-    GDALClose( inputDataset );
-    QgsDebugMsg( "Failed to fetch raster pixels" );
-    return false;
+    heightmap = QVector<float>( scaledHmapWidth * scaledHmapHeight, noDataValue );
+    GDALRasterIOExtraArg rioargs;
+    INIT_RASTERIO_EXTRA_ARG( rioargs );
+    rioargs.eResampleAlg = GRIORA_Average;
+    CPLErr err = GDALRasterIOEx( inputBand, GF_Read, colStart, rowStart, hmapWidth, hmapHeight, heightmap.data(), scaledHmapWidth, scaledHmapHeight, GDT_Float32, 0, 0, &rioargs );
+    if ( err != CE_None )
+    {
+      GDALClose( inputDataset );
+      QgsDebugMsg( "Failed to fetch raster pixels" );
+      return false;
+    }
   }
 
   // Adjust for reduced resolution
@@ -177,8 +855,6 @@ bool KadasViewshedFilter::computeViewshed( const QString &inputFile, const QStri
   colEnd /= accuracyFactor;
   rowStart /= accuracyFactor;
   rowEnd /= accuracyFactor;
-  obs[0] /= accuracyFactor;
-  obs[1] /= accuracyFactor;
   hmapWidth = scaledHmapWidth;
   hmapHeight = scaledHmapHeight;
   for ( int i = 0, n = filterPoly.size(); i < n; ++i )
@@ -200,8 +876,18 @@ bool KadasViewshedFilter::computeViewshed( const QString &inputFile, const QStri
     QgsDebugMsg( "Driver for output does not support creation" );
     return false;
   }
+  int nOutputBands = outputMode == OutputBands ? nObservers : 1;
+  GDALDataType outputType = outputMode == OutputBands ? GDT_Byte : GDT_UInt16;
   char **papszOptions = CSLSetNameValue( 0, "COMPRESS", "LZW" );
-  GDALDatasetH outputDataset = GDALCreate( outputDriver, outputFile.toLocal8Bit().data(), hmapWidth, hmapHeight, 1, GDT_Byte, papszOptions );
+  if ( streaming && outputFormat == "GTiff" )
+  {
+    // Output is written in blocks
+    papszOptions = CSLSetNameValue( papszOptions, "TILED", "YES" );
+    papszOptions = CSLSetNameValue( papszOptions, "BLOCKXSIZE", QString::number( KadasViewshedStreamingRaster::BlockSize ).toLocal8Bit().data() );
+    papszOptions = CSLSetNameValue( papszOptions, "BLOCKYSIZE", QString::number( KadasViewshedStreamingRaster::BlockSize ).toLocal8Bit().data() );
+  }
+  GDALDatasetH outputDataset = GDALCreate( outputDriver, outputFile.toLocal8Bit().data(), hmapWidth, hmapHeight, nOutputBands, outputType, papszOptions );
+  CSLDestroy( papszOptions );
   if ( outputDataset == NULL )
   {
     GDALClose( inputDataset );
@@ -219,159 +905,164 @@ bool KadasViewshedFilter::computeViewshed( const QString &inputFile, const QStri
   GDALSetGeoTransform( outputDataset, outgtrans );
   GDALSetProjection( outputDataset, GDALGetProjectionRef( inputDataset ) );
 
-  GDALRasterBandH outputBand = GDALGetRasterBand( outputDataset, 1 );
-  if ( outputBand == 0 )
+  for ( int band = 1; band <= nOutputBands; ++band )
   {
-    GDALClose( inputDataset );
-    GDALClose( outputDataset );
-    QgsDebugMsg( "Failed to get output dataset band 1" );
-    return false;
+    GDALRasterBandH outputBand = GDALGetRasterBand( outputDataset, band );
+    if ( outputBand == 0 )
+    {
+      GDALClose( inputDataset );
+      GDALClose( outputDataset );
+      QgsDebugMsg( QString( "Failed to get output dataset band %1" ).arg( band ) );
+      return false;
+    }
+    // Cells which no observer sees are nodata in the cumulative output
+    GDALSetRasterNoDataValue( outputBand, outputMode == OutputBands ? 255 * !displayVisible : 0 );
   }
-  GDALSetRasterNoDataValue( outputBand, 255 * !displayVisible );
 
-  // Offset observer elevation by position at point
-  if ( heightRelToTerr )
+  // Setup the observers in the resolution reduced heightmap
+  for ( int i = 0; i < nObservers; ++i )
   {
-    observerHeight += heightmap[( obs[1] - rowStart ) * hmapWidth + ( obs[0] - colStart )];
-  }
-
+    KadasViewshedContext &ctx = contexts[i];
+    int obsHmapWidth = ( ctx.colEnd - ctx.colStart + 1 ) / accuracyFactor;
+    int obsHmapHeight = ( ctx.rowEnd - ctx.rowStart + 1 ) / accuracyFactor;
+    ctx.noDataValue = noDataValue;
+    ctx.hmapCol = colStart;
+    ctx.hmapRow = rowStart;
+    ctx.hmapWidth = hmapWidth;
+    ctx.colStart /= accuracyFactor;
+    ctx.colEnd /= accuracyFactor;
+    ctx.rowStart /= accuracyFactor;
+    ctx.rowEnd /= accuracyFactor;
+    ctx.obs[0] /= accuracyFactor;
+    ctx.obs[1] /= accuracyFactor;
+    ctx.roi = .5 * qMin( obsHmapWidth, obsHmapHeight );
+    std::memcpy( ctx.gtrans, gtrans, sizeof( gtrans ) );
+    ctx.observerPos = observers[i].pos;
+    ctx.earthRadius = earthRadius;
+    ctx.observerHeight = observers[i].observerHeight;
+    ctx.targetHeight = observers[i].targetHeight;
+    ctx.heightRelToTerr = heightRelToTerr;
+    ctx.filterPoly = filterPoly;
 
-  // Compute viewshed
-  int roi = .5 * qMin( hmapWidth, hmapHeight );
-  if ( progress )
-  {
-    progress->setRange( 0, 8 * roi );
-  }
-  QVector<unsigned char> viewshed( hmapWidth * hmapHeight, 255 * !displayVisible );
-  for ( int radiusNumber = 0; radiusNumber < 8 * roi; ++radiusNumber )
-  {
-    if ( progress )
+    // Offset observer elevation by position at point
+    if ( heightRelToTerr && !streaming )
     {
-      if ( progress->wasCanceled() )
+      ctx.observerHeight += heightmap[( ctx.obs[1] - rowStart ) * hmapWidth + ( ctx.obs[0] - colStart )];
+    }
+    else if ( heightRelToTerr )
+    {
+      float obsElev = 0;
+      GDALRasterIOExtraArg rioargs;
+      INIT_RASTERIO_EXTRA_ARG( rioargs );
+      rioargs.eResampleAlg = GRIORA_Average;
+      int srcCol = srcColStart + ( ctx.obs[0] - colStart ) * accuracyFactor;
+      int srcRow = srcRowStart + ( ctx.obs[1] - rowStart ) * accuracyFactor;
+      if ( GDALRasterIOEx( inputBand, GF_Read, srcCol, srcRow, accuracyFactor, accuracyFactor, &obsElev, 1, 1, GDT_Float32, 0, 0, &rioargs ) != CE_None )
       {
-        QgsDebugMsg( "Canceled" );
         GDALClose( inputDataset );
         GDALClose( outputDataset );
+        QgsDebugMsg( "Failed to fetch raster pixels" );
         return false;
       }
-      progress->setValue( radiusNumber );
-    }
-    int target[2];
-    if ( radiusNumber <= roi )
-    {
-      target[0] = obs[0] + roi;
-      target[1] = obs[1] + radiusNumber;
+      ctx.observerHeight += obsElev;
     }
-    else if ( radiusNumber <= 3 * roi )
-    {
-      target[0] = obs[0] + 2 * roi - radiusNumber;
-      target[1] = obs[1] + roi;
-    }
-    else if ( radiusNumber <= 5 * roi )
-    {
-      target[0] = obs[0] - roi;
-      target[1] = obs[1] + 4 * roi - radiusNumber;
-    }
-    else if ( radiusNumber <= 7 * roi )
-    {
-      target[0] = obs[0] + radiusNumber - 6 * roi;
-      target[1] = obs[1] - roi;
-    }
-    else if ( radiusNumber < 8 * roi )
+  }
+
+  if ( streaming )
+  {
+    bool success = computeViewshedsOutOfCore( contexts, inputFile, outputDataset, srcColStart, srcRowStart, accuracyFactor, hmapWidth, hmapHeight, sMemoryBudget, outputMode, displayVisible, progress );
+    GDALClose( inputDataset );
+    GDALClose( outputDataset );
+    return success;
+  }
+
+
+  // Compute viewsheds. A single observer is computed with progress reporting from the algorithm, multiple observers are computed
+  // concurrently and report progress per completed observer. Only the calling thread (omp thread 0) accesses the progress dialog.
+  QVector<quint16> cumulative;
+  if ( outputMode == OutputCumulative )
+  {
+    cumulative.resize( hmapWidth * hmapHeight );
+    cumulative.fill( 0 );
+  }
+  if ( progress && nObservers > 1 )
+  {
+    progress->setRange( 0, nObservers );
+  }
+  // Set by the thread which notices the cancellation, and polled by all threads while computing their observers
+  QAtomicInt canceled( 0 );
+  int completed = 0;
+  CPLErr err = CE_None;
+
+  #pragma omp parallel for schedule(dynamic) num_threads( nThreads ) if( nObservers > 1 )
+  for ( int i = 0; i < nObservers; ++i )
+  {
+    if ( canceled.load() )
     {
-      target[0] = obs[0] + roi;
-      target[1] = obs[1] + radiusNumber - 8 * roi;
+      continue;
     }
-    else
+
+    const KadasViewshedContext &ctx = contexts[i];
+    // In cumulative mode, cells only count if an observer marked them visible, hence unvisited cells must not default to 255
+    QVector<unsigned char> viewshed( hmapWidth * hmapHeight, outputMode == OutputBands ? 255 * !displayVisible : 0 );
+    QProgressDialog *observerProgress = nObservers == 1 ? progress : nullptr;
+    KadasViewshedMemoryRaster raster( ctx, heightmap.constData(), heightmap.size(), viewshed.data() );
+    bool finished = algorithm == SweepXDraw ? xdrawViewshed( ctx, raster, observerProgress, &canceled ) : rayCastViewshed( ctx, raster, observerProgress, &canceled );
+    if ( !finished )
     {
-      break; // All terrain points processed.
+      canceled.store( 1 );
+      continue;
     }
+    // The observer is always visible from itself
+    viewshed[( ctx.obs[1] - rowStart ) * hmapWidth + ( ctx.obs[0] - colStart )] = 255;
 
-    // Line of sight from observer to target.
-    int delta[2] = {target[0] - obs[0], target[1] - obs[1]};
-    int inciny = qAbs( delta[0] ) < qAbs( delta[1] );
-
-    // Step along coord (X or Y) that varies most from observer to target.
-    // That coord is inciny. Slope is how fast the other coord varies.
-    double slope = ( double ) delta[1 - inciny] / ( double ) delta[inciny];
-    int step = delta[inciny] > 0 ? 1 : -1;
-    double horizon_slope = -99999; // Slope (in vertical plane) to horizon so far.
-
-    // i = 0 would be the observer, which is always visible.
-    for ( int i = step; true; i += step )
+    #pragma omp critical( viewshedOutput )
     {
-      int p[2];
-      p[inciny] = obs[inciny] + i;
-
-      if ( i * slope > 0 )
+      if ( outputMode == OutputBands )
       {
-        p[1 - inciny] = obs[1 - inciny] + int ( qCeil( i * slope - 0.5 ) );
+        CPLErr bandErr = GDALRasterIO( GDALGetRasterBand( outputDataset, i + 1 ), GF_Write, 0, 0, hmapWidth, hmapHeight, viewshed.data(), hmapWidth, hmapHeight, GDT_Byte, 0, 0 );
+        if ( bandErr != CE_None )
+        {
+          err = bandErr;
+        }
       }
       else
       {
-        p[1 - inciny] = obs[1 - inciny] + int ( qFloor( i * slope + 0.5 ) );
-      }
-
-      if ( p[0] < colStart || p[0] > colEnd || p[1] < rowStart || p[1] > rowEnd )
-      {
-        break;
+        for ( int j = 0, n = viewshed.size(); j < n; ++j )
+        {
+          cumulative[j] += viewshed[j] == 255;
+        }
       }
+      ++completed;
+    }
 
-      //Is the point in the outside of the viewshed area?
-      double dx = qAbs( p[0] - obs[0] ), dy = qAbs( p[1] - obs[1] );
-      if ( !( dx <= roi && dy <= roi && dx * dx + dy * dy <= double ( roi ) * double ( roi ) ) )
-      {
-        break;
-      }
-      if ( !filterPoly.isEmpty() && !filterPoly.containsPoint( QPoint( p[0], p[1] ), Qt::OddEvenFill ) )
-      {
-        continue;
-      }
-
-      int idx = ( p[1] - rowStart ) * hmapWidth + ( p[0] - colStart );
-      if ( idx >= heightmap.size() )
-      {
-        continue;
-      }
-      float pElev = heightmap[idx];
-      if ( pElev == noDataValue )
-      {
-        continue;
-      }
-
-      // Earth curvature correction
-      double pGeoX = pixelToGeoX( gtrans, p[0], p[1] );
-      double pGeoY = pixelToGeoY( gtrans, p[0], p[1] );
-      double geoDistSqr = ( observerPos.x() - pGeoX ) * ( observerPos.x() - pGeoX ) + ( observerPos.y() - pGeoY ) * ( observerPos.y() - pGeoY );
-      // http://www.swisstopo.admin.ch/internet/swisstopo/de/home/topics/survey/faq/curvature.html
-      pElev -= 0.87 * geoDistSqr / ( 2 * earthRadius );
-
-      // Update the slope if the current slope is greater than the old one
-      double s = double ( pElev - observerHeight ) / double ( qAbs( p[inciny] - obs[inciny] ) );
-      horizon_slope = qMax( horizon_slope, s );
-
-      double horizon_alt =  observerHeight + horizon_slope * qAbs( p[inciny] - obs[inciny] );
-      double tHeight = targetHeight;
-      if ( heightRelToTerr )
-      {
-        tHeight += pElev;
-      }
-      if ( tHeight >= horizon_alt )
-      {
-        viewshed[( p[1] - rowStart ) * hmapWidth + ( p[0] - colStart )] = 255;
-      }
-      else
+    if ( progress && nObservers > 1 && omp_get_thread_num() == 0 )
+    {
+      int value;
+      #pragma omp atomic read
+      value = completed;
+      progress->setValue( value );
+      if ( progress->wasCanceled() )
       {
-        viewshed[( p[1] - rowStart ) * hmapWidth + ( p[0] - colStart )] = 0;
+        canceled.store( 1 );
       }
     }
   }
-  // The observer is always visible from itself
-  viewshed[( obs[1] - rowStart ) * hmapWidth + ( obs[0] - colStart )] = 255;
+
+  if ( canceled.load() )
+  {
+    QgsDebugMsg( "Canceled" );
+    GDALClose( inputDataset );
+    GDALClose( outputDataset );
+    return false;
+  }
 
 
   // Write output
-  err = GDALRasterIO( outputBand, GF_Write, 0, 0, hmapWidth, hmapHeight, viewshed.data(), hmapWidth, hmapHeight, GDT_Byte, 0, 0 );
+  if ( outputMode == OutputCumulative )
+  {
+    err = GDALRasterIO( GDALGetRasterBand( outputDataset, 1 ), GF_Write, 0, 0, hmapWidth, hmapHeight, cumulative.data(), hmapWidth, hmapHeight, GDT_UInt16, 0, 0 );
+  }
   GDALClose( inputDataset );
   GDALClose( outputDataset );
   if ( err != CE_None )
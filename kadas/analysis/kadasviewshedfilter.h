@@ -30,13 +30,55 @@ class QProgressDialog;
 class KADAS_ANALYSIS_EXPORT KadasViewshedFilter
 {
   public:
+    enum Algorithm
+    {
+      RayCasting, //!< Cast rays from the observer to each cell of the border of the region
+      SweepXDraw  //!< Sweep the region ring by ring, interpolating the horizon from the previous ring (XDraw), processing the octants in parallel
+    };
+
+    enum OutputMode
+    {
+      OutputBands,     //!< One band per observer, with the visibility of each cell as 255 (visible) or 0 (invisible)
+      OutputCumulative //!< A single band counting the observers which see each cell
+    };
+
+    struct Observer
+    {
+      QgsPointXY pos;
+      double observerHeight = 0;
+      double targetHeight = 0;
+      double radius = 0;
+    };
+
     static bool computeViewshed( const QString &inputFile,
                                  const QString &outputFile, const QString &outputFormat,
                                  QgsPointXY observerPos, const QgsCoordinateReferenceSystem &observerPosCrs,
                                  double observerHeight, double targetHeight, bool heightRelToTerr, double radius,
                                  const QgsUnitTypes::DistanceUnit distanceElevUnit,
                                  const QVector<QgsPointXY> &filterRegion = QVector<QgsPointXY>(), bool displayVisible = true, int accuracyFactor = 1,
-                                 QProgressDialog *progress = 0 );
+                                 QProgressDialog *progress = 0, Algorithm algorithm = RayCasting );
+
+    /**
+     * Computes the viewsheds of multiple observers, which are processed concurrently on a shared window of the input raster.
+     * The observer positions are in observerPosCrs, heights and radii in distanceElevUnit.
+     */
+    static bool computeViewsheds( const QString &inputFile,
+                                  const QString &outputFile, const QString &outputFormat,
+                                  QVector<Observer> observers, const QgsCoordinateReferenceSystem &observerPosCrs,
+                                  bool heightRelToTerr, const QgsUnitTypes::DistanceUnit distanceElevUnit, OutputMode outputMode,
+                                  const QVector<QgsPointXY> &filterRegion = QVector<QgsPointXY>(), bool displayVisible = true, int accuracyFactor = 1,
+                                  QProgressDialog *progress = 0, Algorithm algorithm = SweepXDraw );
+
+    /**
+     * Returns the memory budget in bytes for the heightmap. If the heightmap of a viewshed computation exceeds the budget,
+     * the viewshed is computed out-of-core, streaming the heightmap in blocks through a cache bounded by the budget
+     * and writing the output in blocks.
+     */
+    static qint64 memoryBudget() { return sMemoryBudget; }
+    static void setMemoryBudget( qint64 bytes ) { sMemoryBudget = bytes; }
+
+  private:
+    static qint64 sMemoryBudget;
 
 };
 
@@ -137,6 +137,8 @@ KadasGlobeItemFeatureSource::KadasGlobeItemFeatureSource( const KadasGlobeFeatur
 
   connect( layer, &KadasItemLayer::itemAdded, this, &KadasGlobeItemFeatureSource::itemAdded );
   connect( layer, &KadasItemLayer::itemRemoved, this, &KadasGlobeItemFeatureSource::itemRemoved );
+  connect( layer, &KadasItemLayer::itemsAdded, this, &KadasGlobeItemFeatureSource::itemsAdded );
+  connect( layer, &KadasItemLayer::itemsRemoved, this, &KadasGlobeItemFeatureSource::itemsRemoved );
 
   // Populate initial cache with featureIds, features are build on-demand
   for ( auto it = layer->items().begin(), itEnd = layer->items().end(); it != itEnd; ++it )
@@ -172,6 +174,22 @@ void KadasGlobeItemFeatureSource::itemRemoved( KadasItemLayer::ItemId itemId )
   mFeatures.remove( itemId );
 }
 
+void KadasGlobeItemFeatureSource::itemsAdded( const QList<KadasItemLayer::ItemId> &itemIds )
+{
+  for ( KadasItemLayer::ItemId itemId : itemIds )
+  {
+    loadFeature( itemId );
+  }
+}
+
+void KadasGlobeItemFeatureSource::itemsRemoved( const QList<KadasItemLayer::ItemId> &itemIds )
+{
+  for ( KadasItemLayer::ItemId itemId : itemIds )
+  {
+    mFeatures.remove( itemId );
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 class KadasGlobeFeatureSourceFactory : public osgEarth::Features::FeatureSourceDriver
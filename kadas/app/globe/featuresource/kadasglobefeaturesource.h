@@ -140,6 +140,8 @@ class KadasGlobeItemFeatureSource : public KadasGlobeFeatureSource
   private slots:
     void itemAdded( KadasItemLayer::ItemId itemId );
     void itemRemoved( KadasItemLayer::ItemId itemId );
+    void itemsAdded( const QList<KadasItemLayer::ItemId> &itemIds );
+    void itemsRemoved( const QList<KadasItemLayer::ItemId> &itemIds );
 };
 
 #endif // KADASGLOBEFEATURESOURCE_H
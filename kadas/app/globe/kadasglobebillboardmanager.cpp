@@ -102,6 +102,20 @@ void KadasGlobeBillboardManager::updateLayers( const QStringList &layerIds )
     }
     connect( layer, &KadasItemLayer::itemAdded, mSignalScope, [layerId, this]( KadasItemLayer::ItemId id ) { addLayerBillboard( layerId, id ); } );
     connect( layer, &KadasItemLayer::itemRemoved, mSignalScope, [layerId, this]( KadasItemLayer::ItemId id ) { removeLayerBillboard( layerId, id ); } );
+    connect( layer, &KadasItemLayer::itemsAdded, mSignalScope, [layerId, this]( const QList<KadasItemLayer::ItemId> &ids )
+    {
+      for ( KadasItemLayer::ItemId id : ids )
+      {
+        addLayerBillboard( layerId, id );
+      }
+    } );
+    connect( layer, &KadasItemLayer::itemsRemoved, mSignalScope, [layerId, this]( const QList<KadasItemLayer::ItemId> &ids )
+    {
+      for ( KadasItemLayer::ItemId id : ids )
+      {
+        removeLayerBillboard( layerId, id );
+      }
+    } );
   }
 }
 
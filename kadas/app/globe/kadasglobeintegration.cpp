@@ -144,7 +144,7 @@ void KadasGlobeIntegration::run()
   connect( mDockWidget, &KadasGlobeWidget::layersChanged, mProjectLayerManager, [this] { mProjectLayerManager->updateLayers( mDockWidget->getSelectedLayerIds() ); } );
   connect( mDockWidget, &KadasGlobeWidget::layersChanged, mBillboardManager, [this] { mBillboardManager->updateLayers( mDockWidget->getSelectedLayerIds() ); } );
   connect( mDockWidget, &KadasGlobeWidget::showSettings, this, &KadasGlobeIntegration::showSettings );
-  connect( mDockWidget, &KadasGlobeWidget::refresh, mProjectLayerManager, [this] { mMapNode->getTerrainEngine()->dirtyTerrain(); } );
+  connect( mDockWidget, &KadasGlobeWidget::refresh, mProjectLayerManager, &KadasGlobeProjectLayerManager::refresh );
   connect( mDockWidget, &KadasGlobeWidget::syncExtent, this, &KadasGlobeIntegration::syncExtent );
 
   QString cacheDirectory = settings.value( "cache/directory" ).toString();
@@ -218,7 +218,7 @@ void KadasGlobeIntegration::run()
   setupControls();
   applySettings();
 
-  mProjectLayerManager->init( mMapNode, mDockWidget->getSelectedLayerIds() );
+  mProjectLayerManager->init( mMapNode, manip, mDockWidget->getSelectedLayerIds() );
   mBillboardManager->init( mMapNode, mDockWidget->getSelectedLayerIds() );
 }
 
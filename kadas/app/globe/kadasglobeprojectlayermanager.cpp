@@ -15,6 +15,7 @@
  ***************************************************************************/
 
 #include <osgEarth/ModelLayer>
+#include <osgEarth/TerrainEngineNode>
 #include <osgEarthDrivers/model_feature_geom/FeatureGeomModelOptions>
 
 #include <qgis/qgspallabeling.h>
@@ -27,9 +28,10 @@
 #include <kadas/app/globe/kadasglobevectorlayerproperties.h>
 #include <kadas/app/globe/featuresource/kadasglobefeatureoptions.h>
 
-void KadasGlobeProjectLayerManager::init( osg::ref_ptr<osgEarth::MapNode> mapNode, const QStringList &visibleLayerIds )
+void KadasGlobeProjectLayerManager::init( osg::ref_ptr<osgEarth::MapNode> mapNode, osgEarth::Util::EarthManipulator *manipulator, const QStringList &visibleLayerIds )
 {
   mMapNode = mapNode;
+  mManipulator = manipulator;
   mLayerSignalScope = new QObject( this );
 
   osgEarth::TileSourceOptions opts;
@@ -52,8 +54,10 @@ void KadasGlobeProjectLayerManager::reset()
   mLayerSignalScope = nullptr;
   mMapNode->getMap()->removeLayer( mDrapedLayer ); // abort any rendering
   mTileSource->waitForFinished();
+  mTileSource->releaseLayers();
   mDrapedLayer = nullptr;
   mTileSource = nullptr;
+  mManipulator = nullptr;
   mMapNode = nullptr;
 }
 
@@ -111,9 +115,20 @@ void KadasGlobeProjectLayerManager::updateLayers( const QStringList &visibleLaye
   }
 
   // Set new layers for draped layer
+  updateViewCenter();
   mTileSource->setLayers( newDrapedLayerIds );
 }
 
+void KadasGlobeProjectLayerManager::refresh()
+{
+  if ( !mMapNode )
+    return;
+
+  // Reloaded tiles must be rendered again, not taken from the cache
+  mTileSource->invalidateCache();
+  mMapNode->getTerrainEngine()->dirtyTerrain();
+}
+
 void KadasGlobeProjectLayerManager::updateLayer( const QString &layerId )
 {
   QgsMapLayer *mapLayer = QgsProject::instance()->mapLayer( layerId );
@@ -122,6 +137,7 @@ void KadasGlobeProjectLayerManager::updateLayer( const QString &layerId )
     return;
   }
   KadasGlobeVectorLayerConfig *layerConfig = KadasGlobeVectorLayerConfig::getConfig( mapLayer );
+  updateViewCenter();
 
   if ( layerConfig && layerConfig->renderingMode != KadasGlobeVectorLayerConfig::RenderingModeRasterized )
   {
@@ -158,11 +174,27 @@ void KadasGlobeProjectLayerManager::updateLayer( const QString &layerId )
     else
     {
       QgsRectangle extent = QgsCoordinateTransform( mapLayer->crs(), QgsCoordinateReferenceSystem( "EPSG:4326" ), QgsProject::instance()->transformContext() ).transform( mapLayer->extent() );
-      mTileSource->refresh( extent );
+      mTileSource->refresh( extent, QSet<QString>() << layerId );
     }
   }
 }
 
+void KadasGlobeProjectLayerManager::updateViewCenter()
+{
+  // Tiles close to the view center are updated first
+  osg::ref_ptr<osgEarth::Util::EarthManipulator> manipulator;
+  if ( !mManipulator.lock( manipulator ) )
+  {
+    return;
+  }
+  osgEarth::Viewpoint viewpoint = manipulator->getViewpoint();
+  if ( viewpoint.focalPoint().isSet() )
+  {
+    osgEarth::GeoPoint center = viewpoint.focalPoint()->transform( osgEarth::SpatialReference::get( "wgs84" ) );
+    mTileSource->setViewCenter( QgsPointXY( center.x(), center.y() ) );
+  }
+}
+
 
 void KadasGlobeProjectLayerManager::addModelLayer( const QString &layerId )
 {
@@ -19,9 +19,11 @@
 
 #include <QObject>
 
+#include <osg/observer_ptr>
 #include <osg/ref_ptr>
 #include <osgEarth/MapNode>
 #include <osgEarth/ImageLayer>
+#include <osgEarthUtil/EarthManipulator>
 
 #include <kadas/app/globe/kadasglobetilesource.h>
 
@@ -32,20 +34,23 @@ class KadasGlobeProjectLayerManager : public QObject
 
   public:
     KadasGlobeProjectLayerManager( QObject *parent ) : QObject( parent ) {}
-    void init( osg::ref_ptr<osgEarth::MapNode> mapNode, const QStringList &visibleLayerIds );
+    void init( osg::ref_ptr<osgEarth::MapNode> mapNode, osgEarth::Util::EarthManipulator *manipulator, const QStringList &visibleLayerIds );
     void reset();
     osg::ref_ptr<osgEarth::ImageLayer> drapedLayer() const { return mDrapedLayer; }
 
   public slots:
     void updateLayers( const QStringList &visibleLayerIds );
+    void refresh();
 
   private:
     osg::ref_ptr<osgEarth::MapNode> mMapNode;
     osg::ref_ptr<osgEarth::ImageLayer> mDrapedLayer;
     osg::ref_ptr<KadasGlobeTileSource> mTileSource;
+    osg::observer_ptr<osgEarth::Util::EarthManipulator> mManipulator;
     QObject *mLayerSignalScope = nullptr;
 
     void addModelLayer( const QString &layerId );
+    void updateViewCenter();
     void updateLayer( const QString &layerId );
 };
 
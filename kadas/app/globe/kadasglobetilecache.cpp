@@ -0,0 +1,240 @@
+/***************************************************************************
+    kadasglobetilecache.cpp
+    -----------------------
+    copyright            : (C) 2019 by Sandro Mani
+    email                : smani at sourcepole dot ch
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+
+#include <qgis/qgslogger.h>
+
+#include <kadas/app/globe/kadasglobetilecache.h>
+
+
+KadasGlobeTileCache::KadasGlobeTileCache( int maxMemoryTiles, const QString &diskCacheDir )
+  : mDiskCacheDir( diskCacheDir )
+{
+  mMemoryCache.setMaxCost( maxMemoryTiles );
+  if ( !mDiskCacheDir.isEmpty() )
+  {
+    // Stored tiles are only valid for the session, since the layers may have changed in between
+    QDir( mDiskCacheDir ).removeRecursively();
+    if ( !QDir().mkpath( mDiskCacheDir ) )
+    {
+      QgsDebugMsg( QString( "Failed to create globe tile cache directory %1" ).arg( mDiskCacheDir ) );
+      mDiskCacheDir.clear();
+    }
+  }
+}
+
+KadasGlobeTileCache::~KadasGlobeTileCache()
+{
+  if ( !mDiskCacheDir.isEmpty() )
+  {
+    QDir( mDiskCacheDir ).removeRecursively();
+  }
+}
+
+KadasGlobeTileCache::LayerSet KadasGlobeTileCache::layerSet( const QStringList &layerIds )
+{
+  QMutexLocker locker( &mMutex );
+  LayerSet layerSet;
+  layerSet.layerIds = layerIds;
+  layerSet.revisions.reserve( layerIds.size() );
+  for ( const QString &layerId : layerIds )
+  {
+    layerSet.revisions.append( mLayerRevisions.value( layerId, 0 ) );
+  }
+  return layerSet;
+}
+
+bool KadasGlobeTileCache::lookup( const LayerSet &layerSet, const QString &tileKey, QImage &image )
+{
+  QString key = cacheKey( layerSet, tileKey );
+  QMutexLocker locker( &mMutex );
+  const Tile *tile = mMemoryCache.object( key );
+  if ( tile )
+  {
+    image = tile->image;
+    return true;
+  }
+  auto it = mDiskTiles.find( key );
+  if ( it != mDiskTiles.end() && readDiskTile( key, image ) )
+  {
+    mMemoryCache.insert( key, new Tile{ it.value().layerSet, tileKey, it.value().extent, image } );
+    return true;
+  }
+  return false;
+}
+
+void KadasGlobeTileCache::insert( const LayerSet &layerSet, const QString &tileKey, const QgsRectangle &tileExtent, const QImage &image )
+{
+  QString key = cacheKey( layerSet, tileKey );
+  QMutexLocker locker( &mMutex );
+  if ( !isCurrent( layerSet ) )
+  {
+    // Tile was rendered before a layer was invalidated and may be stale
+    return;
+  }
+  mMemoryCache.insert( key, new Tile{ layerSet, tileKey, tileExtent, image } );
+  if ( !mDiskCacheDir.isEmpty() && writeDiskTile( key, image ) )
+  {
+    mDiskTiles.insert( key, Tile{ layerSet, tileKey, tileExtent, QImage() } );
+  }
+}
+
+void KadasGlobeTileCache::invalidate( const QSet<QString> &layerIds, const QgsRectangle &dirtyExtent )
+{
+  invalidateTiles( layerIds, &dirtyExtent );
+}
+
+void KadasGlobeTileCache::invalidate( const QSet<QString> &layerIds )
+{
+  invalidateTiles( layerIds, nullptr );
+}
+
+void KadasGlobeTileCache::invalidateTiles( const QSet<QString> &layerIds, const QgsRectangle *dirtyExtent )
+{
+  QMutexLocker locker( &mMutex );
+  for ( const QString &layerId : layerIds )
+  {
+    ++mLayerRevisions[layerId];
+  }
+  // Tiles outside the dirty extent are moved to the key of the new revision
+  for ( const QString &key : mMemoryCache.keys() )
+  {
+    if ( !containsAny( mMemoryCache.object( key )->layerSet, layerIds ) )
+    {
+      continue;
+    }
+    Tile *tile = mMemoryCache.take( key );
+    if ( dirtyExtent && !tile->extent.intersects( *dirtyExtent ) )
+    {
+      updateRevisions( tile->layerSet );
+      mMemoryCache.insert( cacheKey( tile->layerSet, tile->tileKey ), tile );
+    }
+    else
+    {
+      delete tile;
+    }
+  }
+  QHash<QString, Tile> diskTiles;
+  for ( auto it = mDiskTiles.begin(), itEnd = mDiskTiles.end(); it != itEnd; ++it )
+  {
+    Tile &tile = it.value();
+    if ( !containsAny( tile.layerSet, layerIds ) )
+    {
+      diskTiles.insert( it.key(), tile );
+    }
+    else if ( dirtyExtent && !tile.extent.intersects( *dirtyExtent ) )
+    {
+      updateRevisions( tile.layerSet );
+      QString key = cacheKey( tile.layerSet, tile.tileKey );
+      if ( QFile::rename( diskPath( it.key() ), diskPath( key ) ) )
+      {
+        diskTiles.insert( key, tile );
+      }
+    }
+    else
+    {
+      QFile::remove( diskPath( it.key() ) );
+    }
+  }
+  mDiskTiles = diskTiles;
+}
+
+QString KadasGlobeTileCache::cacheKey( const LayerSet &layerSet, const QString &tileKey )
+{
+  QStringList layers;
+  for ( int i = 0, n = layerSet.layerIds.size(); i < n; ++i )
+  {
+    layers.append( QString( "%1#%2" ).arg( layerSet.layerIds[i] ).arg( layerSet.revisions[i] ) );
+  }
+  return layers.join( "," ) + "@" + tileKey;
+}
+
+bool KadasGlobeTileCache::isCurrent( const LayerSet &layerSet ) const
+{
+  // Called with mMutex locked
+  for ( int i = 0, n = layerSet.layerIds.size(); i < n; ++i )
+  {
+    if ( mLayerRevisions.value( layerSet.layerIds[i], 0 ) != layerSet.revisions[i] )
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool KadasGlobeTileCache::containsAny( const LayerSet &layerSet, const QSet<QString> &layerIds )
+{
+  for ( const QString &layerId : layerSet.layerIds )
+  {
+    if ( layerIds.contains( layerId ) )
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void KadasGlobeTileCache::updateRevisions( LayerSet &layerSet ) const
+{
+  // Called with mMutex locked
+  for ( int i = 0, n = layerSet.layerIds.size(); i < n; ++i )
+  {
+    layerSet.revisions[i] = mLayerRevisions.value( layerSet.layerIds[i], 0 );
+  }
+}
+
+QString KadasGlobeTileCache::diskPath( const QString &key ) const
+{
+  QString hash = QString::fromLatin1( QCryptographicHash::hash( key.toUtf8(), QCryptographicHash::Md5 ).toHex() );
+  return QDir( mDiskCacheDir ).absoluteFilePath( hash + ".tile" );
+}
+
+bool KadasGlobeTileCache::readDiskTile( const QString &key, QImage &image ) const
+{
+  QFile file( diskPath( key ) );
+  if ( !file.open( QIODevice::ReadOnly ) )
+  {
+    return false;
+  }
+  QDataStream ds( &file );
+  qint32 width = 0, height = 0;
+  ds >> width >> height;
+  if ( width <= 0 || height <= 0 )
+  {
+    return false;
+  }
+  image = QImage( width, height, QImage::Format_ARGB32_Premultiplied );
+  int size = image.bytesPerLine() * image.height();
+  return ds.readRawData( reinterpret_cast<char *>( image.bits() ), size ) == size;
+}
+
+bool KadasGlobeTileCache::writeDiskTile( const QString &key, const QImage &image ) const
+{
+  QFile file( diskPath( key ) );
+  if ( !file.open( QIODevice::WriteOnly ) )
+  {
+    return false;
+  }
+  QDataStream ds( &file );
+  ds << qint32( image.width() ) << qint32( image.height() );
+  int size = image.bytesPerLine() * image.height();
+  return ds.writeRawData( reinterpret_cast<const char *>( image.constBits() ), size ) == size;
+}
@@ -0,0 +1,86 @@
+/***************************************************************************
+    kadasglobetilecache.h
+    ---------------------
+    copyright            : (C) 2019 by Sandro Mani
+    email                : smani at sourcepole dot ch
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef KADASGLOBETILECACHE_H
+#define KADASGLOBETILECACHE_H
+
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+#include <qgis/qgsrectangle.h>
+
+
+class KadasGlobeTileCache
+{
+  public:
+    /**Layer ids in rendering order, with the revision of each layer at the time the layer set was taken.
+      Tiles are cached under their layer set, so that a tile composited in another layer order or from an
+      outdated layer revision is not reused.*/
+    struct LayerSet
+    {
+      QStringList layerIds;
+      QVector<int> revisions;
+    };
+
+    /**Keeps up to maxMemoryTiles rendered tiles in memory. If diskCacheDir is not empty, tiles are additionally
+      stored there for the rest of the session, so that tiles evicted from memory need not be rendered again.*/
+    KadasGlobeTileCache( int maxMemoryTiles, const QString &diskCacheDir = QString() );
+    ~KadasGlobeTileCache();
+
+    /**Returns the layer set of the specified layers at their current revisions*/
+    LayerSet layerSet( const QStringList &layerIds );
+
+    bool lookup( const LayerSet &layerSet, const QString &tileKey, QImage &image );
+    /**Inserts the tile unless one of its layers was invalidated since the layer set was taken, i.e. while the tile was rendered*/
+    void insert( const LayerSet &layerSet, const QString &tileKey, const QgsRectangle &tileExtent, const QImage &image );
+    /**Increments the revision of the layers. Cached tiles containing any of the layers are dropped if they intersect
+      the dirty extent, the others remain valid for the new revision. Tiles of other layers are not affected.*/
+    void invalidate( const QSet<QString> &layerIds, const QgsRectangle &dirtyExtent );
+    /**Increments the revision of the layers and drops all cached tiles containing any of the layers*/
+    void invalidate( const QSet<QString> &layerIds );
+
+  private:
+    struct Tile
+    {
+      LayerSet layerSet;
+      QString tileKey;
+      QgsRectangle extent;
+      QImage image;
+    };
+
+    QMutex mMutex;
+    QHash<QString, int> mLayerRevisions;
+    QCache<QString, Tile> mMemoryCache;
+    QString mDiskCacheDir;
+    // Stored tiles, without image
+    QHash<QString, Tile> mDiskTiles;
+
+    static QString cacheKey( const LayerSet &layerSet, const QString &tileKey );
+    bool isCurrent( const LayerSet &layerSet ) const;
+    static bool containsAny( const LayerSet &layerSet, const QSet<QString> &layerIds );
+    void updateRevisions( LayerSet &layerSet ) const;
+    void invalidateTiles( const QSet<QString> &layerIds, const QgsRectangle *dirtyExtent );
+    QString diskPath( const QString &key ) const;
+    bool readDiskTile( const QString &key, QImage &image ) const;
+    bool writeDiskTile( const QString &key, const QImage &image ) const;
+};
+
+#endif // KADASGLOBETILECACHE_H
@@ -14,18 +14,83 @@
  *                                                                         *
  ***************************************************************************/
 
+#include <algorithm>
+
 #include <osgEarth/Registry>
 #include <osgEarth/ImageUtils>
 
+#include <QDir>
+#include <QMutexLocker>
+#include <QPainter>
+#include <QStandardPaths>
+#include <QThread>
+
 #include <qgis/qgscoordinatetransform.h>
+#include <qgis/qgslayertree.h>
 #include <qgis/qgslogger.h>
 #include <qgis/qgsmaprenderercustompainterjob.h>
 #include <qgis/qgsmaprendererparalleljob.h>
 #include <qgis/qgsproject.h>
+#include <qgis/qgssettings.h>
 
+#include <kadas/gui/kadasitemlayer.h>
 #include <kadas/app/globe/kadasglobetilesource.h>
 
 
+// Layers in rendering order, top layer first
+static QList<QgsMapLayer *> globeTileLayers( const QSet<QString> &layerIds )
+{
+  QList<QgsMapLayer *> layers;
+  for ( QgsMapLayer *layer : QgsProject::instance()->layerTreeRoot()->layerOrder() )
+  {
+    if ( layerIds.contains( layer->id() ) )
+    {
+      layers.append( layer );
+    }
+  }
+  return layers;
+}
+
+static QStringList globeTileLayerIds( const QList<QgsMapLayer *> &layers )
+{
+  QStringList layerIds;
+  for ( QgsMapLayer *layer : layers )
+  {
+    layerIds.append( layer->id() );
+  }
+  return layerIds;
+}
+
+// Item layers are rendered in the osgEarth pager threads from render copies, which need to be prepared in the main thread
+static void updateThreadedRendering( const QSet<QString> &layerIds, bool prepare )
+{
+  for ( const QString &layerId : layerIds )
+  {
+    KadasItemLayer *itemLayer = qobject_cast<KadasItemLayer *>( QgsProject::instance()->mapLayer( layerId ) );
+    if ( itemLayer && prepare )
+    {
+      itemLayer->prepareThreadedRendering();
+    }
+    else if ( itemLayer )
+    {
+      itemLayer->clearThreadedRendering();
+    }
+  }
+}
+
+static QImage compositeLayerImages( const QList<QgsMapLayer *> &layers, const QHash<QString, QImage> &layerImages, int tileSize )
+{
+  QImage image( tileSize, tileSize, QImage::Format_ARGB32_Premultiplied );
+  image.fill( 0 );
+  QPainter painter( &image );
+  for ( auto it = layers.rbegin(), itEnd = layers.rend(); it != itEnd; ++it )
+  {
+    painter.setCompositionMode( ( *it )->blendMode() );
+    painter.drawImage( 0, 0, layerImages.value( ( *it )->id() ) );
+  }
+  return image;
+}
+
 KadasGlobeTileStatistics *KadasGlobeTileStatistics::s_instance = 0;
 
 KadasGlobeTileStatistics::KadasGlobeTileStatistics() : mTileCount( 0 ), mQueueTileCount( 0 )
@@ -51,10 +116,11 @@ void KadasGlobeTileStatistics::updateQueueTileCount( int num )
 
 ///////////////////////////////////////////////////////////////////////////////
 
-KadasGlobeTileImage::KadasGlobeTileImage( KadasGlobeTileSource *tileSource, const QgsRectangle &tileExtent, int tileSize, int tileLod )
+KadasGlobeTileImage::KadasGlobeTileImage( KadasGlobeTileSource *tileSource, const QgsRectangle &tileExtent, const QString &tileKey, int tileSize, int tileLod )
   : osg::Image()
   , mTileSource( tileSource )
   , mTileExtent( tileExtent )
+  , mTileKey( tileKey )
   , mTileSize( tileSize )
   , mLod( tileLod )
 {
@@ -69,22 +135,34 @@ KadasGlobeTileImage::KadasGlobeTileImage( KadasGlobeTileSource *tileSource, cons
             GL_BGRA, GL_UNSIGNED_BYTE,
             mTileData, osg::Image::NO_DELETE );
 
-  mTileSource->mTileUpdateManager.addTile( const_cast<KadasGlobeTileImage *>( this ) );
+  mTileSource->mTileUpdateManager.addTile( const_cast<KadasGlobeTileImage *>( this ), mTileSource->layers() );
   mDpi = 72;
 #else
-  QList<QgsMapLayer *> layers;
-  for ( const QString &layerId : mTileSource->layers() )
+  mTileSource->mTileListLock.lock();
+  QSet<QString> layerIds = mTileSource->mLayerIds;
+  mTileSource->mTileListLock.unlock();
+
+  QImage qImage( mTileData, mTileSize, mTileSize, QImage::Format_ARGB32_Premultiplied );
+  QImage cachedImage;
+  // The layer set holds the layer revisions before rendering, a tile rendered from layers invalidated meanwhile is then not cached
+  QList<QgsMapLayer *> layers = globeTileLayers( layerIds );
+  KadasGlobeTileCache::LayerSet layerSet = mTileSource->mTileCache.layerSet( globeTileLayerIds( layers ) );
+  if ( mTileSource->mTileCache.lookup( layerSet, mTileKey, cachedImage ) && cachedImage.size() == qImage.size() )
   {
-    QgsMapLayer *layer = QgsProject::instance()->mapLayer( layerId );
-    if ( layer )
-    {
-      layers.append( layer );
-    }
+    std::memcpy( mTileData, cachedImage.constBits(), mTileSize * mTileSize * 4 );
+  }
+  else
+  {
+    // Render all layers in one job. The individual layer images for recompositing partial updates are rendered by the tile update manager.
+    QImage image( mTileSize, mTileSize, QImage::Format_ARGB32_Premultiplied );
+    image.fill( 0 );
+    QPainter painter( &image );
+    QgsMapRendererCustomPainterJob job( createSettings( qImage.logicalDpiX(), layers ), &painter );
+    job.renderSynchronously();
+    painter.end();
+    std::memcpy( mTileData, image.constBits(), mTileSize * mTileSize * 4 );
+    mTileSource->mTileCache.insert( layerSet, mTileKey, mTileExtent, image );
   }
-  QImage qImage( mTileData, mTileSize, mTileSize, QImage::Format_ARGB32_Premultiplied );
-  QPainter painter( &qImage );
-  QgsMapRendererCustomPainterJob job( createSettings( qImage.logicalDpiX(), layers ), &painter );
-  job.renderSynchronously();
 
   setImage( mTileSize, mTileSize, 1, 4, // width, height, depth, internal_format
             GL_BGRA, GL_UNSIGNED_BYTE,
@@ -137,9 +215,12 @@ void KadasGlobeTileImage::update( osg::NodeVisitor * )
 
 ///////////////////////////////////////////////////////////////////////////////
 
-KadasGlobeTileUpdateManager::KadasGlobeTileUpdateManager( QObject *parent )
+KadasGlobeTileUpdateManager::KadasGlobeTileUpdateManager( KadasGlobeTileCache *tileCache, QObject *parent )
   : QObject( parent )
+  , mTileCache( tileCache )
+  , mMaxTileUpdates( qMax( 1, QThread::idealThreadCount() ) )
 {
+  mLayerImages.setMaxCost( QgsSettings().value( "/Globe/layerImageCacheMB", 256 ).toInt() * 1024 );
   connect( this, &KadasGlobeTileUpdateManager::startRendering, this, &KadasGlobeTileUpdateManager::start );
   connect( this, &KadasGlobeTileUpdateManager::cancelRendering, this, &KadasGlobeTileUpdateManager::cancel );
 }
@@ -149,98 +230,242 @@ KadasGlobeTileUpdateManager::~KadasGlobeTileUpdateManager()
 #ifdef GLOBE_SHOW_TILE_STATS
   KadasGlobeTileStatistics::instance()->updateQueueTileCount( 0 );
 #endif
-  mTileQueue.clear();
-  mCurrentTile = nullptr;
-  if ( mRenderer )
+  mMutex.lock();
+  mTileHeap.clear();
+  mQueuedTiles.clear();
+  mLayerImages.clear();
+  QList<QgsMapRendererParallelJob *> jobs = mRenderJobs.keys();
+  mRenderJobs.clear();
+  mMutex.unlock();
+  // Cancel without holding the lock: cancel() emits finished synchronously
+  for ( QgsMapRendererParallelJob *job : jobs )
   {
-    mRenderer->cancel();
+    disconnect( job, nullptr, this, nullptr );
+    job->cancel();
+    delete job;
   }
 }
 
-void KadasGlobeTileUpdateManager::addTile( KadasGlobeTileImage *tile )
+void KadasGlobeTileUpdateManager::updateLayerSet( const QSet<QString> &layerIds )
+{
+  QMutexLocker locker( &mMutex );
+  mLayerIds = layerIds;
+}
+
+void KadasGlobeTileUpdateManager::setViewCenter( const QgsPointXY &center )
+{
+  QMutexLocker locker( &mMutex );
+  mViewCenter = center;
+}
+
+void KadasGlobeTileUpdateManager::addTile( KadasGlobeTileImage *tile, const QSet<QString> &dirtyLayers )
 {
-  if ( !mTileQueue.contains( tile ) )
+  mMutex.lock();
+  auto it = mQueuedTiles.find( tile );
+  if ( it != mQueuedTiles.end() )
+  {
+    it.value().unite( dirtyLayers );
+  }
+  else
   {
-    mTileQueue.append( tile );
+    mQueuedTiles.insert( tile, dirtyLayers );
+    QgsPointXY center = tile->extent().center();
+    double dx = qAbs( center.x() - mViewCenter.x() );
+    if ( dx > 180. )
+    {
+      dx = 360. - dx;
+    }
+    double dy = center.y() - mViewCenter.y();
+    mTileHeap.push_back( QueueEntry{ tile->lod(), dx * dx + dy * dy, ++mQueueSequence, tile } );
+    std::push_heap( mTileHeap.begin(), mTileHeap.end() );
 #ifdef GLOBE_SHOW_TILE_STATS
-    KadasGlobeTileStatistics::instance()->updateQueueTileCount( mTileQueue.size() );
+    KadasGlobeTileStatistics::instance()->updateQueueTileCount( mQueuedTiles.size() );
 #endif
-    std::sort( mTileQueue.begin(), mTileQueue.end(), KadasGlobeTileImage::lodSort );
   }
+  mMutex.unlock();
   emit startRendering();
 }
 
 void KadasGlobeTileUpdateManager::removeTile( KadasGlobeTileImage *tile )
 {
-  if ( mCurrentTile == tile )
+  bool cancelJobs = false;
+  mMutex.lock();
+  for ( auto it = mRenderJobs.begin(), itEnd = mRenderJobs.end(); it != itEnd; ++it )
   {
-    mCurrentTile = nullptr;
-    if ( mRenderer )
-      emit cancelRendering();
+    if ( it.value().first->tile == tile )
+    {
+      it.value().first->tile = nullptr;
+      cancelJobs = true;
+    }
   }
-  else if ( mTileQueue.contains( tile ) )
+  mLayerImages.remove( tile );
+  if ( mQueuedTiles.remove( tile ) > 0 )
   {
-    mTileQueue.removeAll( tile );
 #ifdef GLOBE_SHOW_TILE_STATS
-    KadasGlobeTileStatistics::instance()->updateQueueTileCount( mTileQueue.size() );
+    KadasGlobeTileStatistics::instance()->updateQueueTileCount( mQueuedTiles.size() );
 #endif
   }
+  mMutex.unlock();
+  if ( cancelJobs )
+  {
+    emit cancelRendering();
+  }
+}
+
+void KadasGlobeTileUpdateManager::keepLayerImages( KadasGlobeTileImage *tile, const QHash<QString, QImage> &layerImages )
+{
+  // Called with mMutex locked
+  qint64 size = 0;
+  for ( const QImage &image : layerImages )
+  {
+    size += image.bytesPerLine() * image.height();
+  }
+  mLayerImages.insert( tile, new QHash<QString, QImage>( layerImages ), qMax( qint64( 1 ), size / 1024 ) );
 }
 
 void KadasGlobeTileUpdateManager::waitForFinished() const
 {
-  if ( mRenderer )
+  mMutex.lock();
+  QList<QgsMapRendererParallelJob *> jobs = mRenderJobs.keys();
+  mMutex.unlock();
+  for ( QgsMapRendererParallelJob *job : jobs )
   {
-    mRenderer->waitForFinished();
+    job->waitForFinished();
   }
 }
 
 void KadasGlobeTileUpdateManager::start()
 {
-  if ( mRenderer == nullptr && !mTileQueue.isEmpty() )
+  // Update up to mMaxTileUpdates tiles concurrently
+  QList<QgsMapRendererParallelJob *> newJobs;
+  mMutex.lock();
+  while ( mActiveTileUpdates < mMaxTileUpdates && !mTileHeap.empty() )
   {
-    mCurrentTile = mTileQueue.takeFirst();
+    std::pop_heap( mTileHeap.begin(), mTileHeap.end() );
+    KadasGlobeTileImage *tile = mTileHeap.back().tile;
+    mTileHeap.pop_back();
+    auto queuedIt = mQueuedTiles.find( tile );
+    if ( queuedIt == mQueuedTiles.end() )
+    {
+      // Tile was removed
+      continue;
+    }
+    QSet<QString> dirtyLayers = queuedIt.value();
+    mQueuedTiles.erase( queuedIt );
 #ifdef GLOBE_SHOW_TILE_STATS
-    KadasGlobeTileStatistics::instance()->updateQueueTileCount( mTileQueue.size() );
+    KadasGlobeTileStatistics::instance()->updateQueueTileCount( mQueuedTiles.size() );
 #endif
-    QList<QgsMapLayer *> layers;
-    for ( const QString &layerId : mLayerIds )
+
+    QSharedPointer<TileUpdate> update( new TileUpdate );
+    update->tile = tile;
+    update->layers = globeTileLayers( mLayerIds );
+    update->layerSet = mTileCache->layerSet( globeTileLayerIds( update->layers ) );
+    ++mActiveTileUpdates;
+
+    // Drop images of removed layers, render dirty layers and layers without image. The update works on its own
+    // copy of the images, since the kept images may be evicted meanwhile.
+    const QHash<QString, QImage> *keptImages = mLayerImages.object( tile );
+    if ( keptImages )
+    {
+      update->layerImages = *keptImages;
+    }
+    QHash<QString, QImage> &layerImages = update->layerImages;
+    for ( auto it = layerImages.begin(); it != layerImages.end(); )
+    {
+      if ( mLayerIds.contains( it.key() ) )
+        ++it;
+      else
+        it = layerImages.erase( it );
+    }
+    for ( QgsMapLayer *layer : update->layers )
     {
-      QgsMapLayer *layer = QgsProject::instance()->mapLayer( layerId );
-      if ( layer )
+      if ( !dirtyLayers.contains( layer->id() ) && layerImages.contains( layer->id() ) )
       {
-        layers.append( layer );
+        continue;
       }
+      QgsMapRendererParallelJob *job = new QgsMapRendererParallelJob( tile->createSettings( tile->dpi(), QList<QgsMapLayer *>() << layer ) );
+      connect( job, &QgsMapRendererParallelJob::finished, this, &KadasGlobeTileUpdateManager::renderingFinished );
+      mRenderJobs.insert( job, LayerJob( update, layer->id() ) );
+      newJobs.append( job );
+      ++update->pendingJobs;
+    }
+    if ( update->pendingJobs == 0 )
+    {
+      // Only recomposite
+      finishTileUpdate( update.data() );
     }
-    mRenderer = new QgsMapRendererParallelJob( mCurrentTile->createSettings( mCurrentTile->dpi(), layers ) );
-    connect( mRenderer, &QgsMapRendererParallelJob::finished, this, &KadasGlobeTileUpdateManager::renderingFinished );
-    mRenderer->start();
+  }
+  mMutex.unlock();
+  for ( QgsMapRendererParallelJob *job : newJobs )
+  {
+    job->start();
   }
 }
 
 void KadasGlobeTileUpdateManager::cancel()
 {
-  if ( mRenderer )
-    mRenderer->cancel();
+  // Cancel the jobs whose tiles were removed
+  QMutexLocker locker( &mMutex );
+  for ( auto it = mRenderJobs.begin(), itEnd = mRenderJobs.end(); it != itEnd; ++it )
+  {
+    if ( !it.value().first->tile )
+    {
+      it.key()->cancelWithoutBlocking();
+    }
+  }
 }
 
 void KadasGlobeTileUpdateManager::renderingFinished()
 {
-  if ( mCurrentTile )
+  QgsMapRendererParallelJob *job = qobject_cast<QgsMapRendererParallelJob *>( sender() );
+  mMutex.lock();
+  LayerJob layerJob = mRenderJobs.take( job );
+  TileUpdate *update = layerJob.first.data();
+  if ( update && update->tile )
+  {
+    update->layerImages[layerJob.second] = job->renderedImage();
+  }
+  // Keep the lock while finishing the update, the tile cannot be destroyed meanwhile
+  if ( update && --update->pendingJobs == 0 )
   {
-    QImage image = mRenderer->renderedImage();
-    mCurrentTile->setUpdatedImage( image );
-    mCurrentTile = nullptr;
+    finishTileUpdate( update );
   }
-  mRenderer->deleteLater();
-  mRenderer = nullptr;
+  mMutex.unlock();
+  job->deleteLater();
   start();
 }
 
+void KadasGlobeTileUpdateManager::finishTileUpdate( TileUpdate *update )
+{
+  // Called with mMutex locked
+  --mActiveTileUpdates;
+  if ( !update->tile )
+  {
+    return;
+  }
+  QImage image = compositeLayerImages( update->layers, update->layerImages, update->tile->tileSize() );
+  keepLayerImages( update->tile, update->layerImages );
+  update->tile->setUpdatedImage( image );
+  mTileCache->insert( update->layerSet, update->tile->tileKey(), update->tile->extent(), image );
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
+const int KadasGlobeTileSource::sMaxMemoryTiles = 1024;
+
+static QString globeTileDiskCacheDir()
+{
+  if ( !QgsSettings().value( "/Globe/tileDiskCache", false ).toBool() )
+  {
+    return QString();
+  }
+  return QDir( QStandardPaths::writableLocation( QStandardPaths::CacheLocation ) ).absoluteFilePath( "globetiles" );
+}
+
 KadasGlobeTileSource::KadasGlobeTileSource( const osgEarth::TileSourceOptions &options )
   : TileSource( options )
+  , mTileCache( sMaxMemoryTiles, globeTileDiskCacheDir() )
+  , mTileUpdateManager( &mTileCache )
 {
   osgEarth::GeoExtent geoextent( osgEarth::SpatialReference::get( "wgs84" ), -180., -90., 180., 90. );
   osgEarth::DataExtentList extents;
@@ -269,17 +494,24 @@ osg::Image *KadasGlobeTileSource::createImage( const osgEarth::TileKey &key, osg
   QgsRectangle tileExtent( xmin, ymin, xmax, ymax );
 
   QgsDebugMsg( QString( "Create earth tile image: %1" ).arg( tileExtent.toString( 5 ) ) );
-  return new KadasGlobeTileImage( this, tileExtent, getPixelsPerTile(), key.getLOD() );
+  return new KadasGlobeTileImage( this, tileExtent, QString::fromStdString( key.str() ), getPixelsPerTile(), key.getLOD() );
 }
 
 void KadasGlobeTileSource::refresh( const QgsRectangle &dirtyExtent )
 {
+  refresh( dirtyExtent, mLayerIds );
+}
+
+void KadasGlobeTileSource::refresh( const QgsRectangle &dirtyExtent, const QSet<QString> &dirtyLayers )
+{
+  updateThreadedRendering( dirtyLayers, true );
+  mTileCache.invalidate( dirtyLayers, dirtyExtent );
   mTileListLock.lock();
   for ( KadasGlobeTileImage *tile : mTiles )
   {
     if ( tile->extent().intersects( dirtyExtent ) )
     {
-      mTileUpdateManager.addTile( tile );
+      mTileUpdateManager.addTile( tile, dirtyLayers );
     }
   }
   mTileListLock.unlock();
@@ -290,8 +522,10 @@ void KadasGlobeTileSource::setLayers( const QSet<QString> &layerIds )
   // Compute damaged extent
   QgsRectangle dirtyRect;
   QgsCoordinateReferenceSystem crs84( "EPSG:4326" );
-  // Damage extent of draped layer: removed and added layers
-  QSet<QString> changedLayers = QSet<QString>( mLayerIds ).subtract( layerIds ).unite( QSet<QString>( layerIds ).subtract( mLayerIds ) );
+  // Damage extent of draped layer: removed and added layers. Only added layers need to be rendered, tiles
+  // of removed layers are just recomposited.
+  QSet<QString> addedLayers = QSet<QString>( layerIds ).subtract( mLayerIds );
+  QSet<QString> changedLayers = QSet<QString>( mLayerIds ).subtract( layerIds ).unite( addedLayers );
   for ( const QString &layerId : changedLayers )
   {
     QgsMapLayer *layer = QgsProject::instance()->mapLayer( layerId );
@@ -305,10 +539,21 @@ void KadasGlobeTileSource::setLayers( const QSet<QString> &layerIds )
     }
   }
 
-  // Update layers and refresh
+  // Update layers and refresh. Cached tiles containing the added or removed layers are dropped, since changes to
+  // layers outside the layer set are not tracked. Tiles of the unchanged layers remain valid.
+  updateThreadedRendering( QSet<QString>( mLayerIds ).subtract( layerIds ), false );
+  updateThreadedRendering( addedLayers, true );
+  mTileListLock.lock();
   mLayerIds = layerIds;
+  mTileListLock.unlock();
+  mTileCache.invalidate( changedLayers );
   mTileUpdateManager.updateLayerSet( layerIds );
-  refresh( dirtyRect );
+  refresh( dirtyRect, addedLayers );
+}
+
+void KadasGlobeTileSource::releaseLayers()
+{
+  updateThreadedRendering( mLayerIds, false );
 }
 
 void KadasGlobeTileSource::addTile( KadasGlobeTileImage *tile )
@@ -17,17 +17,25 @@
 #ifndef KADASGLOBETILESOURCE_H
 #define KADASGLOBETILESOURCE_H
 
+#include <vector>
+
 #include <osg/ImageStream>
 #include <osgEarth/TileSource>
 #include <osgEarth/Version>
 
+#include <QCache>
+#include <QHash>
 #include <QImage>
 #include <QSet>
 #include <QLabel>
 #include <QMutex>
+#include <QSharedPointer>
 
+#include <qgis/qgspointxy.h>
 #include <qgis/qgsrectangle.h>
 
+#include <kadas/app/globe/kadasglobetilecache.h>
+
 //#define GLOBE_SHOW_TILE_STATS
 
 class QgsCoordinateTransform;
@@ -60,21 +68,24 @@ class KadasGlobeTileStatistics : public QObject
 class KadasGlobeTileImage : public osg::Image
 {
   public:
-    KadasGlobeTileImage( KadasGlobeTileSource *tileSource, const QgsRectangle &tileExtent, int tileSize, int tileLod );
+    KadasGlobeTileImage( KadasGlobeTileSource *tileSource, const QgsRectangle &tileExtent, const QString &tileKey, int tileSize, int tileLod );
     ~KadasGlobeTileImage();
     bool requiresUpdateCall() const { return !mUpdatedImage.isNull(); }
     QgsMapSettings createSettings( int dpi, const QList<QgsMapLayer *> &layers ) const;
     void setUpdatedImage( const QImage &image ) { mUpdatedImage = image; }
     int dpi() const { return mDpi; }
     const QgsRectangle &extent() { return mTileExtent; }
+    const QString &tileKey() const { return mTileKey; }
 
     void update( osg::NodeVisitor * );
 
-    static bool lodSort( const KadasGlobeTileImage *lhs, const KadasGlobeTileImage *rhs ) { return lhs->mLod > rhs->mLod; }
+    int lod() const { return mLod; }
+    int tileSize() const { return mTileSize; }
 
   private:
     osg::ref_ptr<KadasGlobeTileSource> mTileSource;
     QgsRectangle mTileExtent;
+    QString mTileKey;
     int mTileSize;
     unsigned char *mTileData;
     int mLod;
@@ -87,10 +98,12 @@ class KadasGlobeTileUpdateManager : public QObject
 {
     Q_OBJECT
   public:
-    KadasGlobeTileUpdateManager( QObject *parent = nullptr );
+    KadasGlobeTileUpdateManager( KadasGlobeTileCache *tileCache, QObject *parent = nullptr );
     ~KadasGlobeTileUpdateManager();
-    void updateLayerSet( const QSet<QString> &layerIds ) { mLayerIds = layerIds; }
-    void addTile( KadasGlobeTileImage *tile );
+    void updateLayerSet( const QSet<QString> &layerIds );
+    void setViewCenter( const QgsPointXY &center );
+    /**Queues the tile for an update. Only the specified layers are rendered again, the others are recomposited from the kept layer images.*/
+    void addTile( KadasGlobeTileImage *tile, const QSet<QString> &dirtyLayers );
     void removeTile( KadasGlobeTileImage *tile );
     void waitForFinished() const;
 
@@ -99,10 +112,49 @@ class KadasGlobeTileUpdateManager : public QObject
     void cancelRendering();
 
   private:
+    // Tiles are updated by descending LOD, then by ascending distance to the view center
+    struct QueueEntry
+    {
+      int lod;
+      double distance;
+      quint64 sequence;
+      KadasGlobeTileImage *tile;
+      bool operator<( const QueueEntry &other ) const
+      {
+        if ( lod != other.lod )
+          return lod < other.lod;
+        if ( distance != other.distance )
+          return distance > other.distance;
+        return sequence > other.sequence;
+      }
+    };
+    struct TileUpdate
+    {
+      KadasGlobeTileImage *tile = nullptr;
+      KadasGlobeTileCache::LayerSet layerSet;
+      QList<QgsMapLayer *> layers;
+      QHash<QString, QImage> layerImages;
+      int pendingJobs = 0;
+    };
+    typedef QPair<QSharedPointer<TileUpdate>, QString> LayerJob;
+
+    KadasGlobeTileCache *mTileCache;
+    int mMaxTileUpdates;
     QSet<QString> mLayerIds;
-    QList<KadasGlobeTileImage *> mTileQueue;
-    KadasGlobeTileImage *mCurrentTile = nullptr;
-    QgsMapRendererParallelJob *mRenderer = nullptr;
+    QgsPointXY mViewCenter;
+    // Queue and jobs are accessed from the osgEarth pager threads when tiles are destroyed
+    mutable QMutex mMutex;
+    // Heap of queued tiles, entries of tiles which were removed from mQueuedTiles are skipped
+    std::vector<QueueEntry> mTileHeap;
+    QHash<KadasGlobeTileImage *, QSet<QString>> mQueuedTiles;
+    quint64 mQueueSequence = 0;
+    // Kept layer images of the tiles, limited to a total size in KiB. Evicted tiles are fully rendered on their next update.
+    QCache<KadasGlobeTileImage *, QHash<QString, QImage>> mLayerImages;
+    QHash<QgsMapRendererParallelJob *, LayerJob> mRenderJobs;
+    int mActiveTileUpdates = 0;
+
+    void finishTileUpdate( TileUpdate *update );
+    void keepLayerImages( KadasGlobeTileImage *tile, const QHash<QString, QImage> &layerImages );
 
   private slots:
     void start();
@@ -121,21 +173,31 @@ class KadasGlobeTileSource : public osgEarth::TileSource
     bool isDynamic() const override { return true; }
     osgEarth::CachePolicy getCachePolicyHint( const osgEarth::Profile * /*profile*/ ) const override { return osgEarth::CachePolicy::NO_CACHE; }
 
+    /**Updates the tiles intersecting the dirty extent. If dirtyLayers is specified, only those layers are rendered again.*/
     void refresh( const QgsRectangle &dirtyExtent );
+    void refresh( const QgsRectangle &dirtyExtent, const QSet<QString> &dirtyLayers );
+    void setViewCenter( const QgsPointXY &center ) { mTileUpdateManager.setViewCenter( center ); }
     void setLayers( const QSet<QString> &layerIds );
     const QSet<QString> &layers() const { return mLayerIds; }
+    /**Releases the resources which the layers hold for the tile rendering, i.e. when the globe is closed*/
+    void releaseLayers();
+    /**Drops the cached tiles of the current layers, i.e. when the layers are reloaded*/
+    void invalidateCache() { mTileCache.invalidate( mLayerIds ); }
 
     void waitForFinished() const
     {
       mTileUpdateManager.waitForFinished();
     }
 
+    static const int sMaxMemoryTiles;
+
   private:
     friend class KadasGlobeTileImage;
 
     QSet<QString> mLayerIds;
     QMutex mTileListLock;
     QList<KadasGlobeTileImage *> mTiles;
+    KadasGlobeTileCache mTileCache;
     KadasGlobeTileUpdateManager mTileUpdateManager;
 
     void addTile( KadasGlobeTileImage *tile );
@@ -143,6 +143,7 @@ bool KadasGpxIntegration::importGpx( const QString &filename, QString &errorMsg
     errorMsg = tr( "Failed to read input file." );
     return false;
   }
+  QList<KadasMapItem *> items;
   QDomNodeList wpts = doc.elementsByTagName( "wpt" );
   for ( int i = 0, n = wpts.size(); i < n; ++i )
   {
@@ -154,7 +155,7 @@ bool KadasGpxIntegration::importGpx( const QString &filename, QString &errorMsg
     KadasGpxWaypointItem *waypoint = new KadasGpxWaypointItem();
     waypoint->setName( name );
     waypoint->addPartFromGeometry( QgsPoint( lon, lat ) );
-    layer->addItem( waypoint );
+    items.append( waypoint );
   }
   QDomNodeList rtes = doc.elementsByTagName( "rte" );
   for ( int i = 0, n = rtes.size(); i < n; ++i )
@@ -175,7 +176,7 @@ bool KadasGpxIntegration::importGpx( const QString &filename, QString &errorMsg
     route->setName( name );
     route->setNumber( number );
     route->addPartFromGeometry( line );
-    layer->addItem( route );
+    items.append( route );
   }
   QDomNodeList trks = doc.elementsByTagName( "trk" );
   for ( int i = 0, n = trks.size(); i < n; ++i )
@@ -196,8 +197,10 @@ bool KadasGpxIntegration::importGpx( const QString &filename, QString &errorMsg
     route->setName( name );
     route->setNumber( number );
     route->addPartFromGeometry( line );
-    layer->addItem( route );
+    items.append( route );
   }
+  layer->addItems( items );
+  layer->triggerRepaint();
   return true;
 }
 
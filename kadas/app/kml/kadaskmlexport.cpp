@@ -15,9 +15,13 @@
  ***************************************************************************/
 
 #include <QApplication>
+#include <QBuffer>
+#include <QEventLoop>
 #include <QProgressDialog>
 #include <QIODevice>
+#include <QRunnable>
 #include <QTextStream>
+#include <QThreadPool>
 #include <QUuid>
 #include <quazip5/quazipfile.h>
 
@@ -32,6 +36,113 @@
 #include <kadas/app/kml/kadaskmlexport.h>
 #include <kadas/app/kml/kadaskmllabeling.h>
 
+// Renders a tile and encodes it as PNG. The layer renderer is prepared in the main thread, rendering happens in a pool thread.
+class KadasKMLTileJob : public QRunnable
+{
+  public:
+    KadasKMLTileJob( int tileIndex, const QgsRectangle &extent, const QSize &tileSize, QgsMapLayer *mapLayer, KadasKMLTileWriter *writer )
+      : mTileIndex( tileIndex )
+      , mImage( tileSize, QImage::Format_ARGB32 )
+      , mWriter( writer )
+    {
+      QgsCoordinateTransform crst = QgsCoordinateTransform( mapLayer->crs(), QgsCoordinateReferenceSystem( "EPSG:4326" ), QgsProject::instance() );
+      mImage.fill( 0 );
+      mPainter.begin( &mImage );
+      mContext.setPainter( &mPainter );
+      mContext.setCoordinateTransform( crst );
+      QgsPointXY centerPoint = extent.center();
+      QgsMapToPixel mtp( extent.width() / mImage.width(), centerPoint.x(), centerPoint.y(), mImage.width(), mImage.height(), 0.0 );
+      mContext.setMapToPixel( mtp );
+      mContext.setExtent( crst.transformBoundingBox( extent, QgsCoordinateTransform::ReverseTransform ) );
+      mContext.setCustomRenderFlags( QStringList() << "kml" );
+      mRenderer = mapLayer->createMapRenderer( mContext );
+    }
+    ~KadasKMLTileJob()
+    {
+      delete mRenderer;
+    }
+    void run() override
+    {
+      bool rendered = mRenderer && mRenderer->render();
+      mPainter.end();
+      QByteArray data;
+      if ( rendered )
+      {
+        QBuffer buffer( &data );
+        buffer.open( QIODevice::WriteOnly );
+        mImage.save( &buffer, "PNG" );
+      }
+      mWriter->addTile( mTileIndex, data );
+    }
+
+  private:
+    int mTileIndex;
+    QImage mImage;
+    QPainter mPainter;
+    QgsRenderContext mContext;
+    QgsMapLayerRenderer *mRenderer = nullptr;
+    KadasKMLTileWriter *mWriter;
+};
+
+
+KadasKMLTileWriter::KadasKMLTileWriter( QuaZip *quaZip, const QString &tilePrefix, int nTiles, const std::function<void()> &tileWritten )
+  : mQuaZip( quaZip )
+  , mTilePrefix( tilePrefix )
+  , mNTiles( nTiles )
+  , mTileWritten( tileWritten )
+{
+}
+
+void KadasKMLTileWriter::addTile( int tileIndex, const QByteArray &data )
+{
+  QMutexLocker locker( &mMutex );
+  mTiles.insert( tileIndex, data );
+  mCondition.wakeOne();
+}
+
+void KadasKMLTileWriter::abort()
+{
+  QMutexLocker locker( &mMutex );
+  mAborted = true;
+  mCondition.wakeOne();
+}
+
+void KadasKMLTileWriter::run()
+{
+  int tileCounter = 0;
+  for ( int tileIndex = 0; tileIndex < mNTiles; ++tileIndex )
+  {
+    QByteArray data;
+    {
+      QMutexLocker locker( &mMutex );
+      while ( !mAborted && !mTiles.contains( tileIndex ) )
+      {
+        mCondition.wait( &mMutex );
+      }
+      if ( mAborted )
+      {
+        return;
+      }
+      data = mTiles.take( tileIndex );
+    }
+    // Tiles which did not render are skipped
+    if ( !data.isEmpty() )
+    {
+      QString filename = QString( "%1_%2.png" ).arg( mTilePrefix ).arg( tileCounter++ );
+      QuaZipFile outputFile( mQuaZip );
+      QuaZipNewInfo info( filename );
+      info.setPermissions( QFile::ReadOwner | QFile::ReadUser | QFile::ReadGroup | QFile::ReadOther );
+      if ( outputFile.open( QIODevice::WriteOnly, info ) && outputFile.write( data ) == data.size() )
+      {
+        mWrittenTiles.insert( tileIndex, filename );
+      }
+    }
+    mTileWritten();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
 bool KadasKMLExport::exportToFile( const QString &filename, const QList<QgsMapLayer *> &layers, double exportScale, const QgsCoordinateReferenceSystem &mapCrs, const QgsRectangle &exportMapRect )
 {
   // Prepare outputs
@@ -329,46 +440,85 @@ void KadasKMLExport::writeTiles( QgsMapLayer *mapLayer, const QgsRectangle &laye
 
   // Compute pixels to match extent at scale
   // px / dpi * 0.0254 * scale = meters
-  QImage image( tileSize, tileSize, QImage::Format_ARGB32 );
   double meters = QgsScaleCalculator().calculateGeographicDistance( renderExtent );
-  int dpi = image.logicalDpiX();
-  int totPixels = meters / ( exportScale * 0.0254 ) * dpi;
+  int dpi = QImage( tileSize, tileSize, QImage::Format_ARGB32 ).logicalDpiX();
+  int totPixels = qMax( 1, int( meters / ( exportScale * 0.0254 ) * dpi ) );
   double resolution = renderExtent.width() / totPixels;
 
-  // Round up to next <tileSize> multiple
-  totPixels = qCeil( ( totPixels ) / double( tileSize ) ) * tileSize;
-  extension = totPixels * resolution * 0.5;
-  renderExtent = QgsRectangle( center.x() - extension, center.y() - extension, center.x() + extension, center.y() + extension );
-
-  progress->setRange( 0, ( totPixels / tileSize ) * ( totPixels / tileSize ) );
-  QApplication::processEvents();
-
-  // Render in <tileSize> blocks
-  int tileCounter = 0;
-  for ( int iy = 0; iy < totPixels; iy += tileSize )
+  // Cover the extent with <tileSize> blocks, the last column and row are clipped to the extent
+  int nTilesX = ( totPixels + tileSize - 1 ) / tileSize;
+  int nTiles = nTilesX * nTilesX;
+  auto tilePixelSize = [&]( int tileIndex )
+  {
+    int ix = ( tileIndex % nTilesX ) * tileSize;
+    int iy = ( tileIndex / nTilesX ) * tileSize;
+    return QSize( qMin( tileSize, totPixels - ix ), qMin( tileSize, totPixels - iy ) );
+  };
+  auto tileExtent = [&]( int tileIndex )
   {
-    for ( int ix = 0; ix < totPixels; ix += tileSize )
+    int ix = ( tileIndex % nTilesX ) * tileSize;
+    int iy = ( tileIndex / nTilesX ) * tileSize;
+    QSize size = tilePixelSize( tileIndex );
+    return QgsRectangle( renderExtent.xMinimum() + ix * resolution, renderExtent.yMinimum() + iy * resolution,
+                         renderExtent.xMinimum() + ( ix + size.width() ) * resolution, renderExtent.yMinimum() + ( iy + size.height() ) * resolution );
+  };
+
+  progress->setRange( 0, nTiles );
+  progress->setValue( 0 );
+
+  // Render and encode the <tileSize> blocks in a thread pool, the writer thread adds them to the zip in order.
+  // The number of tiles in flight is bounded, so that memory use does not depend on the exported extent.
+  QEventLoop loop;
+  QThreadPool pool;
+  const int maxTilesInFlight = 2 * pool.maxThreadCount();
+  int nextTile = 0;
+  int writtenTiles = 0;
+  std::function<void()> submitTiles;
+  KadasKMLTileWriter writer( quaZip, mapLayer->id(), nTiles, [&]
+  {
+    QMetaObject::invokeMethod( &loop, [&]
     {
-
-      progress->setValue( tileCounter );
-      QApplication::processEvents();
-      if ( progress->wasCanceled() )
-      {
-        return;
-      }
-
-      QgsRectangle tileExtent( renderExtent.xMinimum() + ix * resolution, renderExtent.yMinimum() + iy * resolution,
-                               renderExtent.xMinimum() + ( ix + tileSize ) * resolution, renderExtent.yMinimum() + ( iy + tileSize ) * resolution );
-      if ( renderTile( image, tileExtent, mapLayer ) )
-      {
-        QString filename = QString( "%1_%2.png" ).arg( mapLayer->id() ).arg( tileCounter++ );
-        QuaZipFile outputFile( quaZip );
-        QuaZipNewInfo info( filename );
-        info.setPermissions( QFile::ReadOwner | QFile::ReadUser | QFile::ReadGroup | QFile::ReadOther );
-        if ( outputFile.open( QIODevice::WriteOnly, info ) && image.save( &outputFile, "PNG" ) )
-          writeGroundOverlay( outStream, QString( "Tile %1" ).arg( tileExtent.toString( 3 ) ), filename, tileExtent, drawingOrder );
-      }
+      progress->setValue( ++writtenTiles );
+      submitTiles();
+    }, Qt::QueuedConnection );
+  } );
+  submitTiles = [&]
+  {
+    if ( progress->wasCanceled() )
+    {
+      loop.quit();
+      return;
+    }
+    while ( nextTile < nTiles && nextTile - writtenTiles < maxTilesInFlight )
+    {
+      pool.start( new KadasKMLTileJob( nextTile, tileExtent( nextTile ), tilePixelSize( nextTile ), mapLayer, &writer ) );
+      ++nextTile;
+    }
+    if ( writtenTiles == nTiles )
+    {
+      loop.quit();
     }
+  };
+  connect( progress, &QProgressDialog::canceled, &loop, &QEventLoop::quit );
+  writer.start();
+  submitTiles();
+  if ( writtenTiles < nTiles )
+  {
+    loop.exec();
+  }
+  pool.waitForDone();
+  writer.abort();
+  writer.wait();
+
+  if ( progress->wasCanceled() )
+  {
+    return;
+  }
+  const QMap<int, QString> &tileFiles = writer.writtenTiles();
+  for ( auto it = tileFiles.begin(), itEnd = tileFiles.end(); it != itEnd; ++it )
+  {
+    QgsRectangle extent = tileExtent( it.key() );
+    writeGroundOverlay( outStream, QString( "Tile %1" ).arg( extent.toString( 3 ) ), it.value(), extent, drawingOrder );
   }
 }
 
@@ -388,29 +538,6 @@ void KadasKMLExport::writeGroundOverlay( QTextStream &outStream, const QString &
 }
 
 
-bool KadasKMLExport::renderTile( QImage &img, const QgsRectangle &extent, QgsMapLayer *mapLayer )
-{
-  QgsCoordinateTransform crst = QgsCoordinateTransform( mapLayer->crs(), QgsCoordinateReferenceSystem( "EPSG:4326" ), QgsProject::instance() );
-  QgsRenderContext context;
-  img.fill( 0 );
-  QPainter p( &img );
-  context.setPainter( &p );
-  context.setCoordinateTransform( crst );
-  QgsPointXY centerPoint = extent.center();
-  QgsMapToPixel mtp( extent.width() / img.width(), centerPoint.x(), centerPoint.y(), img.width(), img.height(), 0.0 );
-  context.setMapToPixel( mtp );
-  context.setExtent( crst.transformBoundingBox( extent, QgsCoordinateTransform::ReverseTransform ) );
-  context.setCustomRenderFlags( QStringList() << "kml" );
-  QgsMapLayerRenderer *layerRenderer = mapLayer->createMapRenderer( context );
-  bool rendered = false;
-  if ( layerRenderer )
-  {
-    rendered = layerRenderer->render();
-  }
-  delete layerRenderer;
-  return rendered;
-}
-
 void KadasKMLExport::addStyle( QTextStream &outStream, QgsFeature &f, QgsFeatureRenderer &r, QgsRenderContext &rc )
 {
   // Take first symbollayer
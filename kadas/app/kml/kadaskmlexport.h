@@ -17,8 +17,14 @@
 #ifndef KADASKMLEXPORT_H
 #define KADASKMLEXPORT_H
 
+#include <functional>
+
 #include <QList>
+#include <QMap>
+#include <QMutex>
 #include <QObject>
+#include <QThread>
+#include <QWaitCondition>
 
 class QProgressDialog;
 class QTextStream;
@@ -46,9 +52,35 @@ class KadasKMLExport : public QObject
     void writeTiles( QgsMapLayer *mapLayer, const QgsRectangle &layerExtent, double exportScale, QTextStream &outStream, int drawingOrder, QuaZip *quaZip, QProgressDialog *progress );
     void writeGroundOverlay( QTextStream &outStream, const QString &name, const QString &href, const QgsRectangle &latLongBox, int drawingOrder );
     void writeMapItems( const QString &layerId, QTextStream &outStream, QuaZip *quaZip );
-    bool renderTile( QImage &img, const QgsRectangle &extent, QgsMapLayer *mapLayer );
     void addStyle( QTextStream &outStream, QgsFeature &f, QgsFeatureRenderer &r, QgsRenderContext &rc );
 
 };
 
+
+/**Writes the rendered tiles of a layer to the KMZ in tile order, as they become available*/
+class KadasKMLTileWriter : public QThread
+{
+  public:
+    KadasKMLTileWriter( QuaZip *quaZip, const QString &tilePrefix, int nTiles, const std::function<void()> &tileWritten );
+    /**Thread-safe, an empty data array denotes a tile which did not render*/
+    void addTile( int tileIndex, const QByteArray &data );
+    void abort();
+    /**Filenames of the written tiles by tile index*/
+    const QMap<int, QString> &writtenTiles() const { return mWrittenTiles; }
+
+  protected:
+    void run() override;
+
+  private:
+    QuaZip *mQuaZip;
+    QString mTilePrefix;
+    int mNTiles;
+    std::function<void()> mTileWritten;
+    QMutex mMutex;
+    QWaitCondition mCondition;
+    QMap<int, QByteArray> mTiles;
+    bool mAborted = false;
+    QMap<int, QString> mWrittenTiles;
+};
+
 #endif // KADASKMLEXPORT_H
@@ -15,18 +15,26 @@
  ***************************************************************************/
 
 
-#include <QDomDocument>
+#include <QBuffer>
+#include <QEventLoop>
 #include <QFileInfo>
 #include <QImageReader>
+#include <QProgressDialog>
 #include <QUuid>
+#include <QXmlStreamReader>
 
 #include <quazip5/quazipfile.h>
 
+#include <gdal.h>
+#include <cpl_vsi.h>
+
+#include <qgis/qgscoordinatetransform.h>
 #include <qgis/qgslinestring.h>
 #include <qgis/qgslogger.h>
 #include <qgis/qgspolygon.h>
 #include <qgis/qgsproject.h>
 #include <qgis/qgsrasterlayer.h>
+#include <qgis/qgssettings.h>
 #include <qgis/qgssymbollayerutils.h>
 
 #include <kadas/core/kadasalgorithms.h>
@@ -42,251 +50,91 @@
 #include <kadas/app/kml/kadaskmlimport.h>
 
 
-bool KadasKMLImport::importFile( const QString &filename, QString &errMsg )
+// Whether GDAL reads the encoded tile as a PNG with four 8 bit bands in RGBA order, as referenced by the VRT
+static bool isRgbaPngTile( const QByteArray &data )
 {
-  if ( filename.endsWith( ".kmz", Qt::CaseInsensitive ) )
+  QByteArray vsiName = QString( "/vsimem/kmltile_%1" ).arg( QUuid::createUuid().toString() ).toLocal8Bit();
+  VSILFILE *file = VSIFileFromMemBuffer( vsiName.constData(), reinterpret_cast<GByte *>( const_cast<char *>( data.constData() ) ), data.size(), FALSE );
+  if ( !file )
   {
-    QuaZip quaZip( filename );
-    if ( !quaZip.open( QuaZip::mdUnzip ) )
-    {
-      errMsg = tr( "Unable to open %1." ).arg( QFileInfo( filename ).fileName() );
-      return false;
-    }
-    // Search for kml file to open
-    QStringList kmzFileList = quaZip.getFileNameList();
-    int mainKmlIndex = kmzFileList.indexOf( QRegExp( "[^/]+.kml", Qt::CaseInsensitive ) );
-    if ( mainKmlIndex == -1 || !quaZip.setCurrentFile( kmzFileList[mainKmlIndex] ) )
-    {
-      errMsg = tr( "Corrupt KMZ file." );
-      return false;
-    }
-    QDomDocument doc;
-    QuaZipFile file( &quaZip );
-    if ( !file.open( QIODevice::ReadOnly ) || !doc.setContent( &file ) )
-    {
-      errMsg = tr( "Corrupt KMZ file." );
-      return false;
-    }
-    file.close();
-    return importDocument( QFileInfo( filename ).fileName(), doc, errMsg, &quaZip );
+    return false;
   }
-  else if ( filename.endsWith( ".kml", Qt::CaseInsensitive ) )
+  VSIFCloseL( file );
+  bool rgba = false;
+  GDALDatasetH dataset = GDALOpen( vsiName.constData(), GA_ReadOnly );
+  if ( dataset )
   {
-    QFile file( filename );
-    QDomDocument doc;
-    if ( !file.open( QIODevice::ReadOnly ) || !doc.setContent( &file ) )
+    static const GDALColorInterp sBandInterps[] = { GCI_RedBand, GCI_GreenBand, GCI_BlueBand, GCI_AlphaBand };
+    rgba = QString( GDALGetDriverShortName( GDALGetDatasetDriver( dataset ) ) ) == "PNG" && GDALGetRasterCount( dataset ) == 4;
+    for ( int iBand = 0; rgba && iBand < 4; ++iBand )
     {
-      errMsg = tr( "Unable to open %1." ).arg( QFileInfo( filename ).fileName() );
-      return false;
+      GDALRasterBandH band = GDALGetRasterBand( dataset, iBand + 1 );
+      rgba = GDALGetRasterDataType( band ) == GDT_Byte && GDALGetRasterColorInterpretation( band ) == sBandInterps[iBand];
     }
-    return importDocument( QFileInfo( filename ).fileName(), doc, errMsg );
+    GDALClose( dataset );
   }
-  return false;
+  VSIUnlink( vsiName.constData() );
+  return rgba;
 }
 
-bool KadasKMLImport::importDocument( const QString &filename, const QDomDocument &doc, QString &errMsg, QuaZip *zip )
+bool KadasKMLImport::importFile( const QString &filename, QString &errMsg )
 {
-  QDomElement documentEl = doc.firstChildElement( "kml" ).firstChildElement( "Document" );
-  if ( documentEl.isNull() )
+  bool isKmz = filename.endsWith( ".kmz", Qt::CaseInsensitive );
+  if ( !isKmz && !filename.endsWith( ".kml", Qt::CaseInsensitive ) )
   {
-    errMsg = tr( "Corrupt KMZ file." );
     return false;
   }
 
-  QgsCoordinateReferenceSystem crsWgs84( "EPSG:4326" );
-  QDomNodeList placemarkEls = documentEl.elementsByTagName( "Placemark" );
-  if ( !placemarkEls.isEmpty() )
-  {
+  // The document is parsed in a worker thread, which hands the items over in batches
+  QProgressDialog progress( tr( "Importing %1..." ).arg( QFileInfo( filename ).fileName() ), tr( "Cancel" ), 0, 1000 );
+  progress.setWindowModality( Qt::ApplicationModal );
+  KadasKMLImportWorker worker( this, filename );
+  QEventLoop loop;
+  connect( &worker, &KadasKMLImportWorker::progressChanged, &progress, &QProgressDialog::setValue );
+  connect( &progress, &QProgressDialog::canceled, &worker, [&worker] { worker.abort(); } );
+  connect( &worker, &QThread::finished, &loop, &QEventLoop::quit );
+  worker.start();
+  loop.exec();
+  // finished is emitted from the worker thread before it has terminated
+  worker.wait();
+  // Process the batches which are still queued, they are discarded if the import was canceled
+  QCoreApplication::sendPostedEvents( this, QEvent::MetaCall );
 
-    // Styles / StyleMaps with id
-    QMap<QString, StyleData> styleMap;
-    QDomNodeList styleEls = documentEl.elementsByTagName( "Style" );
-    for ( int iStyle = 0, nStyles = styleEls.size(); iStyle < nStyles; ++iStyle )
-    {
-      QDomElement styleEl = styleEls.at( iStyle ).toElement();
-      if ( !styleEl.attribute( "id" ).isEmpty() )
-      {
-        styleMap.insert( QString( "#%1" ).arg( styleEl.attribute( "id" ) ), parseStyle( styleEl, zip ) );
-      }
-    }
-    QDomNodeList styleMapEls = documentEl.elementsByTagName( "StyleMap" );
-    for ( int iStyleMap = 0, nStyleMaps = styleMapEls.size(); iStyleMap < nStyleMaps; ++iStyleMap )
-    {
-      QDomElement styleMapEl = styleMapEls.at( iStyleMap ).toElement();
-      if ( !styleMapEl.attribute( "id" ).isEmpty() )
-      {
-        QString id = QString( "#%1" ).arg( styleMapEl.attribute( "id" ) );
-        // Just pick the first item of the StyleMap
-        QDomElement pairEl = styleMapEl.firstChildElement( "Pair" );
-        QDomElement styleEl = pairEl.firstChildElement( "Style" );
-        QDomElement styleUrlEl = pairEl.firstChildElement( "styleUrl" );
-        if ( !styleEl.isNull() )
-        {
-          styleMap.insert( id, parseStyle( styleEl, zip ) );
-        }
-        else if ( !styleUrlEl.isNull() )
-        {
-          styleMap.insert( id, styleMap.value( styleUrlEl.text() ) );
-        }
-      }
-    }
-
-
-    // Placemarks
-    for ( int iPlacemark = 0, nPlacemarks = placemarkEls.size(); iPlacemark < nPlacemarks; ++iPlacemark )
-    {
-      QDomElement placemarkEl = placemarkEls.at( iPlacemark ).toElement();
-      QString name = placemarkEl.firstChildElement( "name" ).text();
-
-      QString layerName = filename;
-      // If tile contained in folder, group by folder
-      if ( placemarkEl.parentNode().nodeName() == "Folder" )
-      {
-        layerName = placemarkEl.parentNode().firstChildElement( "name" ).text();
-      }
-
-      KadasItemLayer *itemLayer = KadasItemLayerRegistry::getOrCreateItemLayer( layerName );
-      QgsCoordinateTransform itemCrst( crsWgs84, itemLayer->crs(), QgsProject::instance()->transformContext() );
-
-      // Geometry
-      QList<QgsAbstractGeometry *> geoms = parseGeometries( placemarkEl );
-
-      if ( geoms.isEmpty() )
-      {
-        // Placemark without geometry
-        QgsDebugMsg( "Could not parse placemark geometry" );
-        continue;
-      }
-
-      // Style
-      QDomElement styleEl = placemarkEl.firstChildElement( "Style" );
-      QDomElement styleUrlEl = placemarkEl.firstChildElement( "styleUrl" );
-      StyleData style;
-      if ( !styleEl.isNull() )
-      {
-        style = parseStyle( styleEl, zip );
-      }
-      else if ( !styleUrlEl.isNull() )
-      {
-        style = styleMap.value( styleUrlEl.text() );
-      }
-
-      QMap<QString, QString> attributes = parseExtendedData( placemarkEl );
-
-      // If there is an icon and the geometry is a point, add as symbol item, otherwise as redlining symbol
-      if ( geoms.size() == 1 && !style.icon.isEmpty() && dynamic_cast<QgsPoint *>( geoms.front() ) )
-      {
-        QgsPointXY pos = itemCrst.transform( *static_cast<QgsPoint *>( geoms.front() ) );
-        KadasSymbolItem *item = new KadasSymbolItem( itemLayer->crs() );
-        item->setFilePath( style.icon );
-        item->setAnchorX( style.hotSpot.x() / item->constState()->size.width() );
-        item->setAnchorY( style.hotSpot.y() / item->constState()->size.height() );
-        item->setPosition( KadasItemPos::fromPoint( pos ) );
-        itemLayer->addItem( item );
-        delete geoms.front();
-      }
-      else
-      {
-        // TODO?
-        QStringList attributesList;
-        for ( auto it = attributes.begin(), itEnd = attributes.end(); it != itEnd; ++it )
-        {
-          attributesList.append( it.key().toHtmlEscaped() + "=" + it.value().replace( QRegularExpression( "^\\s*(.*[^\\s])\\s*$", QRegularExpression::MultilineOption ), "\\1" ).toHtmlEscaped() );
-        }
-        QString attributesStr = attributesList.join( "&" );
-
-        for ( QgsAbstractGeometry *geom : geoms )
-        {
-          geom->transform( itemCrst );
-
-          if ( dynamic_cast<QgsPoint *>( geom ) && style.isLabel )
-          {
-            QgsPointXY pos = *static_cast<QgsPoint *>( geom );
-            KadasTextItem *item = new KadasTextItem( itemLayer->crs() );
-            item->setEditor( "KadasRedliningTextEditor" );
-            item->setText( name );
-            item->setFillColor( style.labelColor );
-            QFont font = item->font();
-            font.setPointSizeF( font.pointSizeF() * style.labelScale );
-            item->setFont( font );
-            item->setPosition( KadasItemPos::fromPoint( pos ) );
-            itemLayer->addItem( item );
-          }
-          else if ( dynamic_cast<QgsPoint *>( geom ) )
-          {
-            KadasPointItem *item = new KadasPointItem( itemLayer->crs() );
-            item->setEditor( "KadasRedliningItemEditor" );
-            item->addPartFromGeometry( *geom );
-            item->setIconSize( 10 + 2 * style.outlineSize );
-            item->setIconOutline( QPen( style.outlineColor, style.outlineSize ) );
-            item->setIconFill( QBrush( style.fillColor ) );
-            KadasItemLayerRegistry::getOrCreateItemLayer( filename )->addItem( item );
-          }
-          else if ( dynamic_cast<QgsLineString *>( geom ) )
-          {
-            KadasLineItem *item = new KadasLineItem( itemLayer->crs() );
-            item->setEditor( "KadasRedliningItemEditor" );
-            item->addPartFromGeometry( *geom );
-            item->setOutline( QPen( style.outlineColor, style.outlineSize ) );
-            itemLayer->addItem( item );
-          }
-          else if ( dynamic_cast<QgsPolygon *>( geom ) )
-          {
-            KadasPolygonItem *item = new KadasPolygonItem( itemLayer->crs() );
-            item->setEditor( "KadasRedliningItemEditor" );
-            item->addPartFromGeometry( *geom );
-            item->setOutline( QPen( style.outlineColor, style.outlineSize ) );
-            item->setFill( QBrush( style.fillColor ) );
-            KadasItemLayerRegistry::getOrCreateItemLayer( filename )->addItem( item );
-          }
-        }
-        qDeleteAll( geoms );
-      }
-    }
+  if ( progress.wasCanceled() )
+  {
+    errMsg = tr( "The import was canceled." );
+    return false;
+  }
+  if ( !worker.errorMessage().isEmpty() )
+  {
+    errMsg = worker.errorMessage();
+    return false;
   }
 
-  // Ground overlays: group by name of parent folder, if possible
-  if ( zip )
+  // Ground overlays: build VRTs for each overlay group
+  QMap<QString, OverlayData> &overlays = worker.overlays();
+  if ( isKmz && !overlays.isEmpty() )
   {
-    QMap<QString, OverlayData> overlays;
-    QDomNodeList groundOverlayEls = documentEl.elementsByTagName( "GroundOverlay" );
-    for ( int iOverlay = 0, nOverlays = groundOverlayEls.size(); iOverlay < nOverlays; ++iOverlay )
+    QuaZip quaZip( filename );
+    if ( quaZip.open( QuaZip::mdUnzip ) )
     {
-      QDomElement groundOverlayEl = groundOverlayEls.at( iOverlay ).toElement();
-      QDomElement bboxEl = groundOverlayEl.firstChildElement( "LatLonBox" ).toElement();
-      QString name = groundOverlayEl.firstChildElement( "name" ).text();
-      // If tile contained in folder, group by folder
-      if ( groundOverlayEl.parentNode().nodeName() == "Folder" )
-      {
-        name = groundOverlayEl.parentNode().firstChildElement( "name" ).text();
-      }
-      TileData tile;
-      tile.iconHref = groundOverlayEl.firstChildElement( "Icon" ).firstChildElement( "href" ).text();
-      tile.bbox.setXMinimum( bboxEl.firstChildElement( "west" ).text().toDouble() );
-      tile.bbox.setXMaximum( bboxEl.firstChildElement( "east" ).text().toDouble() );
-      tile.bbox.setYMinimum( bboxEl.firstChildElement( "south" ).text().toDouble() );
-      tile.bbox.setYMaximum( bboxEl.firstChildElement( "north" ).text().toDouble() );
-      overlays[name].tiles.append( tile );
-      if ( overlays[name].bbox.isEmpty() )
-      {
-        overlays[name].bbox = tile.bbox;
-      }
-      else
+      for ( auto it = overlays.begin(), itEnd = overlays.end(); it != itEnd; ++it )
       {
-        overlays[name].bbox.combineExtentWith( tile.bbox );
+        buildVSIVRT( it.key(), it.value(), &quaZip );
       }
     }
-
-    // Build VRTs for each overlay group
-    for ( auto it = overlays.begin(), itEnd = overlays.end(); it != itEnd; ++it )
-    {
-      buildVSIVRT( it.key(), it.value(), zip );
-    }
   }
 
   return true;
 }
 
+void KadasKMLImport::commitItems( const QString &layerName, const QList<KadasMapItem *> &items )
+{
+  KadasItemLayer *itemLayer = KadasItemLayerRegistry::getOrCreateItemLayer( layerName );
+  itemLayer->addItems( items );
+  itemLayer->triggerRepaint();
+}
+
 void KadasKMLImport::buildVSIVRT( const QString &name, OverlayData &overlayData, QuaZip *kmzZip ) const
 {
   if ( overlayData.tiles.empty() )
@@ -303,7 +151,7 @@ void KadasKMLImport::buildVSIVRT( const QString &name, OverlayData &overlayData,
   {
     return;
   }
-  // Copy tile images to vsi, determine tile sizes
+  // Determine tile sizes
   for ( TileData &tile : overlayData.tiles )
   {
     if ( !kmzZip->setCurrentFile( tile.iconHref ) )
@@ -338,60 +186,111 @@ void KadasKMLImport::buildVSIVRT( const QString &name, OverlayData &overlayData,
 
   const QList<KadasAlgorithms::Cluster> clusters = KadasAlgorithms::overlappingRects( rects );
 
-  QList<TileData> mergedTiles;
-  for ( const KadasAlgorithms::Cluster &cluster : clusters )
+  // Tiles which do not overlap others can be copied as-is, provided GDAL reads them as the RGBA bands referenced by the VRT.
+  // Paletted, grayscale, 16 bit and RGB-only PNGs are re-encoded.
+  bool passthrough = QgsSettings().value( "/kadas/kml_import_passthrough_tiles", true ).toBool();
+
+  // Clusters are processed in chunks: the tile data is read serially from the zip, decoded, composited
+  // and encoded in parallel, and then written to the vsi zip in order. Only a chunk is held in memory.
+  struct ClusterJob
   {
-    QImage outputImage;
+    const KadasAlgorithms::Cluster *cluster = nullptr;
+    QList<QByteArray> tileData;
     TileData outputTile;
-    outputTile.iconHref = QFileInfo( reinterpret_cast<const TileData *>( cluster.rects.first().data )->iconHref ).completeBaseName() + ".png";
-    outputTile.bbox = reinterpret_cast<const TileData *>( cluster.rects.first().data )->bbox;
-    if ( cluster.rects.size() == 1 )
+    QByteArray outputData;
+  };
+  const int chunkSize = 4 * qMax( 1, QThread::idealThreadCount() );
+
+  QList<TileData> mergedTiles;
+  for ( int chunkStart = 0, nClusters = clusters.size(); chunkStart < nClusters; chunkStart += chunkSize )
+  {
+    QVector<ClusterJob> jobs;
+    for ( int iCluster = chunkStart, chunkEnd = qMin( nClusters, chunkStart + chunkSize ); iCluster < chunkEnd; ++iCluster )
     {
-      const TileData &tile = *reinterpret_cast<const TileData *>( cluster.rects.first().data );
-      if ( !kmzZip->setCurrentFile( tile.iconHref ) )
-      {
-        continue;
-      }
-      QuaZipFile kmzTileFile( kmzZip );
-      if ( !kmzTileFile.open( QIODevice::ReadOnly ) )
+      ClusterJob job;
+      job.cluster = &clusters[iCluster];
+      for ( const KadasAlgorithms::Rect &rect : job.cluster->rects )
       {
-        continue;
+        QByteArray data;
+        const TileData &tile = *reinterpret_cast<const TileData *>( rect.data );
+        if ( kmzZip->setCurrentFile( tile.iconHref ) )
+        {
+          QuaZipFile kmzTileFile( kmzZip );
+          if ( kmzTileFile.open( QIODevice::ReadOnly ) )
+          {
+            data = kmzTileFile.readAll();
+          }
+        }
+        job.tileData.append( data );
       }
-      outputImage = QImage::fromData( kmzTileFile.readAll() );
+      jobs.append( job );
     }
-    else
+
+    #pragma omp parallel for schedule(dynamic)
+    for ( int iJob = 0; iJob < jobs.size(); ++iJob )
     {
-      outputImage = QImage( cluster.x2 - cluster.x1, cluster.y2 - cluster.y1, QImage::Format_ARGB32 );
-      outputImage.fill( Qt::transparent );
-      QPainter painter( &outputImage );
-      for ( const KadasAlgorithms::Rect &rect : cluster.rects )
+      ClusterJob &job = jobs[iJob];
+      const KadasAlgorithms::Cluster &cluster = *job.cluster;
+      const TileData &firstClusterTile = *reinterpret_cast<const TileData *>( cluster.rects.first().data );
+      job.outputTile.iconHref = QFileInfo( firstClusterTile.iconHref ).completeBaseName() + ".png";
+      job.outputTile.bbox = firstClusterTile.bbox;
+      QImage outputImage;
+      if ( cluster.rects.size() == 1 )
       {
-        const TileData &tile = *reinterpret_cast<const TileData *>( rect.data );
-        outputTile.bbox.combineExtentWith( tile.bbox );
-        if ( !kmzZip->setCurrentFile( tile.iconHref ) )
+        if ( job.tileData.first().isEmpty() )
         {
           continue;
         }
-        QuaZipFile kmzTileFile( kmzZip );
-        if ( !kmzTileFile.open( QIODevice::ReadOnly ) )
+        if ( passthrough && isRgbaPngTile( job.tileData.first() ) )
         {
+          job.outputTile.iconHref = QFileInfo( firstClusterTile.iconHref ).fileName();
+          job.outputTile.size = firstClusterTile.size;
+          job.outputData = job.tileData.first();
           continue;
         }
-        painter.drawImage( rect.x1 - cluster.x1, rect.y1 - cluster.y1, QImage::fromData( kmzTileFile.readAll() ) );
+        // The VRT references four RGBA bands, which Qt writes for ARGB32 images (but not i.e. for indexed images)
+        outputImage = QImage::fromData( job.tileData.first() ).convertToFormat( QImage::Format_ARGB32 );
       }
+      else
+      {
+        outputImage = QImage( cluster.x2 - cluster.x1, cluster.y2 - cluster.y1, QImage::Format_ARGB32 );
+        outputImage.fill( Qt::transparent );
+        QPainter painter( &outputImage );
+        for ( int iRect = 0, nRects = cluster.rects.size(); iRect < nRects; ++iRect )
+        {
+          const KadasAlgorithms::Rect &rect = cluster.rects[iRect];
+          const TileData &tile = *reinterpret_cast<const TileData *>( rect.data );
+          job.outputTile.bbox.combineExtentWith( tile.bbox );
+          if ( !job.tileData[iRect].isEmpty() )
+          {
+            painter.drawImage( rect.x1 - cluster.x1, rect.y1 - cluster.y1, QImage::fromData( job.tileData[iRect] ) );
+          }
+        }
+      }
+      job.tileData.clear();
+      job.outputTile.size = outputImage.size();
+      QBuffer buffer( &job.outputData );
+      buffer.open( QIODevice::WriteOnly );
+      outputImage.save( &buffer, "PNG" );
     }
-    outputTile.size = outputImage.size();
 
-    QuaZipFile vsiTileFile( &vsiZip );
-    QuaZipNewInfo vsiTileInfo( outputTile.iconHref );
-    vsiTileInfo.setPermissions( QFile::ReadOwner | QFile::ReadUser | QFile::ReadGroup | QFile::ReadOther );
-    if ( !vsiTileFile.open( QIODevice::WriteOnly, vsiTileInfo ) )
+    for ( const ClusterJob &job : jobs )
     {
-      continue;
+      if ( job.outputData.isEmpty() )
+      {
+        continue;
+      }
+      QuaZipFile vsiTileFile( &vsiZip );
+      QuaZipNewInfo vsiTileInfo( job.outputTile.iconHref );
+      vsiTileInfo.setPermissions( QFile::ReadOwner | QFile::ReadUser | QFile::ReadGroup | QFile::ReadOther );
+      if ( !vsiTileFile.open( QIODevice::WriteOnly, vsiTileInfo ) )
+      {
+        continue;
+      }
+      vsiTileFile.write( job.outputData );
+      vsiTileFile.close();
+      mergedTiles.append( job.outputTile );
     }
-    outputImage.save( &vsiTileFile, "PNG" );
-    vsiTileFile.close();
-    mergedTiles.append( outputTile );
   }
 
   // Write vrt
@@ -440,169 +339,766 @@ void KadasKMLImport::buildVSIVRT( const QString &name, OverlayData &overlayData,
   QgsProject::instance()->addMapLayer( rasterLayer );
 }
 
-QVector<QgsPoint> KadasKMLImport::parseCoordinates( const QDomElement &geomEl ) const
+
+///////////////////////////////////////////////////////////////////////////////
+
+const int KadasKMLImportWorker::sBatchSize = 1000;
+const int KadasKMLImportWorker::sMaxPendingBatches = 4;
+
+KadasKMLImportWorker::KadasKMLImportWorker( KadasKMLImport *importer, const QString &filename, QObject *parent )
+  : QThread( parent )
+  , mImporter( importer )
+  , mFilename( filename )
+  , mDefaultLayerName( QFileInfo( filename ).fileName() )
+  , mPendingBatches( sMaxPendingBatches )
 {
-  QStringList coordinates = geomEl.firstChildElement( "coordinates" ).text().split( QRegExp( "\\s+" ), QString::SkipEmptyParts );
-  QVector<QgsPoint> points;
-  for ( int i = 0, n = coordinates.size(); i < n; ++i )
+}
+
+void KadasKMLImportWorker::run()
+{
+  if ( mFilename.endsWith( ".kmz", Qt::CaseInsensitive ) )
+  {
+    QuaZip quaZip( mFilename );
+    if ( !quaZip.open( QuaZip::mdUnzip ) )
+    {
+      mErrorMsg = tr( "Unable to open %1." ).arg( mDefaultLayerName );
+      return;
+    }
+    // Search for kml file to open
+    QStringList kmzFileList = quaZip.getFileNameList();
+    int mainKmlIndex = kmzFileList.indexOf( QRegExp( "[^/]+.kml", Qt::CaseInsensitive ) );
+    if ( mainKmlIndex == -1 || !quaZip.setCurrentFile( kmzFileList[mainKmlIndex] ) )
+    {
+      mErrorMsg = tr( "Corrupt KMZ file." );
+      return;
+    }
+    QuaZipFile file( &quaZip );
+    if ( !file.open( QIODevice::ReadOnly ) )
+    {
+      mErrorMsg = tr( "Corrupt KMZ file." );
+      return;
+    }
+    // Icons are read through a second handle, since the document is being streamed from the first one
+    QuaZip resourceZip( mFilename );
+    if ( resourceZip.open( QuaZip::mdUnzip ) )
+    {
+      mResourceZip = &resourceZip;
+    }
+    readDocument( &file );
+    mResourceZip = nullptr;
+  }
+  else
   {
-    QStringList coordinate = coordinates[i].split( "," );
-    if ( coordinate.size() >= 3 )
+    QFile file( mFilename );
+    if ( !file.open( QIODevice::ReadOnly ) )
     {
-      QgsPoint p( QgsWkbTypes::PointZ );
-      p.setX( coordinate[0].toDouble() );
-      p.setY( coordinate[1].toDouble() );
-      p.setZ( coordinate[2].toDouble() );
-      points.append( p );
+      mErrorMsg = tr( "Unable to open %1." ).arg( mDefaultLayerName );
+      return;
     }
-    else if ( coordinate.size() == 2 )
+    readDocument( &file );
+  }
+}
+
+bool KadasKMLImportWorker::readDocument( QIODevice *device )
+{
+  mDevice = device;
+  QXmlStreamReader reader( device );
+  if ( !reader.readNextStartElement() || reader.name() != "kml" )
+  {
+    mErrorMsg = tr( "Invalid KML document." );
+    mDevice = nullptr;
+    return false;
+  }
+  readContainer( reader, false );
+  // Placemarks which refer to styles defined further down in the document
+  for ( QPair<QString, PlacemarkData> &deferred : mDeferredPlacemarks )
+  {
+    if ( isInterruptionRequested() )
     {
-      QgsPoint p( QgsWkbTypes::Point );
-      p.setX( coordinate[0].toDouble() );
-      p.setY( coordinate[1].toDouble() );
-      points.append( p );
+      qDeleteAll( deferred.second.geoms );
+    }
+    else
+    {
+      addPlacemark( deferred.second, deferred.first );
     }
   }
-  return points;
+  mDeferredPlacemarks.clear();
+  flushBatches();
+  mDevice = nullptr;
+  if ( reader.hasError() )
+  {
+    mErrorMsg = tr( "KML parse error at line %1: %2" ).arg( reader.lineNumber() ).arg( reader.errorString() );
+    return false;
+  }
+  return true;
 }
 
-KadasKMLImport::StyleData KadasKMLImport::parseStyle( const QDomElement &styleEl, QuaZip *zip ) const
+void KadasKMLImportWorker::readContainer( QXmlStreamReader &reader, bool isFolder )
 {
-  StyleData style;
+  QString folderName;
+  while ( !isInterruptionRequested() && reader.readNextStartElement() )
+  {
+    if ( reader.name() == "Document" )
+    {
+      readContainer( reader, false );
+    }
+    else if ( reader.name() == "Folder" )
+    {
+      readContainer( reader, true );
+    }
+    else if ( reader.name() == "name" && isFolder )
+    {
+      folderName = reader.readElementText();
+    }
+    else if ( reader.name() == "Placemark" )
+    {
+      // If placemark contained in folder, group by folder
+      readPlacemark( reader, folderName.isEmpty() ? mDefaultLayerName : folderName );
+    }
+    else if ( reader.name() == "GroundOverlay" )
+    {
+      readGroundOverlay( reader, folderName );
+    }
+    else if ( reader.name() == "Style" )
+    {
+      QString id = reader.attributes().value( "id" ).toString();
+      KadasKMLImport::StyleData style = readStyle( reader );
+      if ( !id.isEmpty() )
+      {
+        mStyles.insert( QString( "#%1" ).arg( id ), style );
+      }
+    }
+    else if ( reader.name() == "StyleMap" )
+    {
+      QString id = reader.attributes().value( "id" ).toString();
+      StyleMapData styleMap = readStyleMap( reader );
+      if ( !id.isEmpty() )
+      {
+        mStyleMaps.insert( QString( "#%1" ).arg( id ), styleMap );
+      }
+    }
+    else
+    {
+      reader.skipCurrentElement();
+    }
+    reportProgress();
+  }
+}
 
-  QDomElement lineStyleEl = styleEl.firstChildElement( "LineStyle" );
-  QDomElement lineWidthEl = lineStyleEl.firstChildElement( "width" );
-  style.outlineSize = lineWidthEl.isNull() ? 1 : lineWidthEl.text().toDouble();
+void KadasKMLImportWorker::readPlacemark( QXmlStreamReader &reader, const QString &layerName )
+{
+  PlacemarkData placemark;
+  while ( reader.readNextStartElement() )
+  {
+    if ( reader.name() == "name" )
+    {
+      placemark.name = reader.readElementText();
+    }
+    else if ( reader.name() == "styleUrl" )
+    {
+      placemark.styleUrl = reader.readElementText().trimmed();
+    }
+    else if ( reader.name() == "Style" )
+    {
+      placemark.style = readStyle( reader );
+      placemark.hasStyle = true;
+    }
+    else if ( reader.name() == "Point" || reader.name() == "LineString" || reader.name() == "Polygon" || reader.name() == "MultiGeometry" )
+    {
+      readGeometry( reader, placemark.geoms );
+    }
+    else
+    {
+      reader.skipCurrentElement();
+    }
+  }
 
-  QDomElement lineColorEl = lineStyleEl.firstChildElement( "color" );
-  style.outlineColor = lineColorEl.isNull() ? QColor( Qt::black ) : parseColor( lineColorEl.text() );
+  if ( placemark.geoms.isEmpty() )
+  {
+    // Placemark without geometry
+    QgsDebugMsg( "Could not parse placemark geometry" );
+    return;
+  }
+  if ( !placemark.hasStyle && !placemark.styleUrl.isEmpty() && !isStyleDefined( placemark.styleUrl ) )
+  {
+    mDeferredPlacemarks.append( qMakePair( layerName, placemark ) );
+    return;
+  }
+  addPlacemark( placemark, layerName );
+}
 
-  QDomElement polyStyleEl = styleEl.firstChildElement( "PolyStyle" );
-  QDomElement fillColorEl = polyStyleEl.firstChildElement( "color" );
-  style.fillColor = fillColorEl.isNull() ? QColor( Qt::white ) : parseColor( fillColorEl.text() );
+void KadasKMLImportWorker::addPlacemark( PlacemarkData &placemark, const QString &layerName )
+{
+  KadasKMLImport::StyleData style;
+  if ( placemark.hasStyle )
+  {
+    style = placemark.style;
+    resolveIcon( style );
+  }
+  else if ( !placemark.styleUrl.isEmpty() )
+  {
+    style = resolveStyle( placemark.styleUrl );
+  }
 
-  QDomElement labelStyleEl = styleEl.firstChildElement( "LabelStyle" );
-  QDomElement labelColorEl = labelStyleEl.firstChildElement( "color" );
-  QDomElement labelScaleEl = labelStyleEl.firstChildElement( "scale" );
-  style.isLabel = !labelScaleEl.isNull();
-  style.labelColor = labelColorEl.isNull() ? QColor( Qt::black ) : parseColor( labelColorEl.text() );
-  style.labelScale = labelScaleEl.isNull() ? 1. : labelScaleEl.text().toDouble();
+  QgsCoordinateTransform itemCrst = layerTransform( layerName );
+  QgsCoordinateReferenceSystem itemCrs = itemCrst.destinationCrs();
 
-  if ( polyStyleEl.firstChildElement( "fill" ).text() == "0" )
+  // If there is an icon and the geometry is a point, add as symbol item, otherwise as redlining symbol
+  if ( placemark.geoms.size() == 1 && !style.icon.isEmpty() && dynamic_cast<QgsPoint *>( placemark.geoms.front() ) )
   {
-    style.fillColor = QColor( Qt::transparent );
+    QgsPointXY pos = itemCrst.transform( *static_cast<QgsPoint *>( placemark.geoms.front() ) );
+    KadasSymbolItem *item = new KadasSymbolItem( itemCrs );
+    item->setFilePath( style.icon );
+    item->setAnchorX( style.hotSpot.x() / item->constState()->size.width() );
+    item->setAnchorY( style.hotSpot.y() / item->constState()->size.height() );
+    item->setPosition( KadasItemPos::fromPoint( pos ) );
+    addItem( layerName, item );
   }
-  if ( polyStyleEl.firstChildElement( "outline" ).text() == "0" )
+  else
   {
-    style.outlineColor = QColor( Qt::transparent );
+    for ( QgsAbstractGeometry *geom : placemark.geoms )
+    {
+      geom->transform( itemCrst );
+
+      if ( dynamic_cast<QgsPoint *>( geom ) && style.isLabel )
+      {
+        QgsPointXY pos = *static_cast<QgsPoint *>( geom );
+        KadasTextItem *item = new KadasTextItem( itemCrs );
+        item->setEditor( "KadasRedliningTextEditor" );
+        item->setText( placemark.name );
+        item->setFillColor( style.labelColor );
+        QFont font = item->font();
+        font.setPointSizeF( font.pointSizeF() * style.labelScale );
+        item->setFont( font );
+        item->setPosition( KadasItemPos::fromPoint( pos ) );
+        addItem( layerName, item );
+      }
+      else if ( dynamic_cast<QgsPoint *>( geom ) )
+      {
+        KadasPointItem *item = new KadasPointItem( itemCrs );
+        item->setEditor( "KadasRedliningItemEditor" );
+        item->addPartFromGeometry( *geom );
+        item->setIconSize( 10 + 2 * style.outlineSize );
+        item->setIconOutline( QPen( style.outlineColor, style.outlineSize ) );
+        item->setIconFill( QBrush( style.fillColor ) );
+        addItem( layerName, item );
+      }
+      else if ( dynamic_cast<QgsLineString *>( geom ) )
+      {
+        KadasLineItem *item = new KadasLineItem( itemCrs );
+        item->setEditor( "KadasRedliningItemEditor" );
+        item->addPartFromGeometry( *geom );
+        item->setOutline( QPen( style.outlineColor, style.outlineSize ) );
+        addItem( layerName, item );
+      }
+      else if ( dynamic_cast<QgsPolygon *>( geom ) )
+      {
+        KadasPolygonItem *item = new KadasPolygonItem( itemCrs );
+        item->setEditor( "KadasRedliningItemEditor" );
+        item->addPartFromGeometry( *geom );
+        item->setOutline( QPen( style.outlineColor, style.outlineSize ) );
+        item->setFill( QBrush( style.fillColor ) );
+        addItem( layerName, item );
+      }
+    }
   }
+  qDeleteAll( placemark.geoms );
+}
 
-  QDomElement iconHRefEl = styleEl.firstChildElement( "IconStyle" ).firstChildElement( "Icon" ).firstChildElement( "href" );
-  if ( !iconHRefEl.isNull() )
+void KadasKMLImportWorker::readGroundOverlay( QXmlStreamReader &reader, const QString &folderName )
+{
+  // Ground overlays are only supported for KMZ files
+  if ( !mResourceZip )
   {
-    QString filename = iconHRefEl.text();
-    // Only local files in KMZ are supported (also for security reasons)
-    if ( zip && zip->setCurrentFile( filename ) )
+    reader.skipCurrentElement();
+    return;
+  }
+  QString name;
+  KadasKMLImport::TileData tile;
+  while ( reader.readNextStartElement() )
+  {
+    if ( reader.name() == "name" )
+    {
+      name = reader.readElementText();
+    }
+    else if ( reader.name() == "Icon" )
+    {
+      while ( reader.readNextStartElement() )
+      {
+        if ( reader.name() == "href" )
+        {
+          tile.iconHref = reader.readElementText().trimmed();
+        }
+        else
+        {
+          reader.skipCurrentElement();
+        }
+      }
+    }
+    else if ( reader.name() == "LatLonBox" )
     {
-      QuaZipFile file( zip );
-      if ( file.open( QIODevice::ReadOnly ) )
+      while ( reader.readNextStartElement() )
       {
-        QImage icon = QImage::fromData( file.readAll() );
-        style.icon = QgsProject::instance()->createAttachedFile( "kml_import.png" );
-        icon.save( style.icon );
+        if ( reader.name() == "west" )
+        {
+          tile.bbox.setXMinimum( reader.readElementText().toDouble() );
+        }
+        else if ( reader.name() == "east" )
+        {
+          tile.bbox.setXMaximum( reader.readElementText().toDouble() );
+        }
+        else if ( reader.name() == "south" )
+        {
+          tile.bbox.setYMinimum( reader.readElementText().toDouble() );
+        }
+        else if ( reader.name() == "north" )
+        {
+          tile.bbox.setYMaximum( reader.readElementText().toDouble() );
+        }
+        else
+        {
+          reader.skipCurrentElement();
+        }
+      }
+    }
+    else
+    {
+      reader.skipCurrentElement();
+    }
+  }
 
-        QDomElement hotSpotEl = styleEl.firstChildElement( "IconStyle" ).firstChildElement( "hotSpot" );
-        if ( !hotSpotEl.isNull() )
+  // If tile contained in folder, group by folder
+  if ( !folderName.isEmpty() )
+  {
+    name = folderName;
+  }
+  KadasKMLImport::OverlayData &overlay = mOverlays[name];
+  overlay.tiles.append( tile );
+  if ( overlay.bbox.isEmpty() )
+  {
+    overlay.bbox = tile.bbox;
+  }
+  else
+  {
+    overlay.bbox.combineExtentWith( tile.bbox );
+  }
+}
+
+KadasKMLImport::StyleData KadasKMLImportWorker::readStyle( QXmlStreamReader &reader ) const
+{
+  KadasKMLImport::StyleData style;
+  bool noFill = false;
+  bool noOutline = false;
+  while ( reader.readNextStartElement() )
+  {
+    if ( reader.name() == "LineStyle" )
+    {
+      while ( reader.readNextStartElement() )
+      {
+        if ( reader.name() == "width" )
         {
-          double x = hotSpotEl.attribute( "x" ).toDouble();
-          double y = hotSpotEl.attribute( "y" ).toDouble();
-          if ( hotSpotEl.attribute( "xunits" ) == "fraction" )
-          {
-            x *= icon.width();
-          }
-          if ( hotSpotEl.attribute( "yunits" ) == "fraction" )
+          style.outlineSize = reader.readElementText().toDouble();
+        }
+        else if ( reader.name() == "color" )
+        {
+          style.outlineColor = parseColor( reader.readElementText() );
+        }
+        else
+        {
+          reader.skipCurrentElement();
+        }
+      }
+    }
+    else if ( reader.name() == "PolyStyle" )
+    {
+      while ( reader.readNextStartElement() )
+      {
+        if ( reader.name() == "color" )
+        {
+          style.fillColor = parseColor( reader.readElementText() );
+        }
+        else if ( reader.name() == "fill" )
+        {
+          noFill = reader.readElementText() == "0";
+        }
+        else if ( reader.name() == "outline" )
+        {
+          noOutline = reader.readElementText() == "0";
+        }
+        else
+        {
+          reader.skipCurrentElement();
+        }
+      }
+    }
+    else if ( reader.name() == "LabelStyle" )
+    {
+      while ( reader.readNextStartElement() )
+      {
+        if ( reader.name() == "color" )
+        {
+          style.labelColor = parseColor( reader.readElementText() );
+        }
+        else if ( reader.name() == "scale" )
+        {
+          style.isLabel = true;
+          style.labelScale = reader.readElementText().toDouble();
+        }
+        else
+        {
+          reader.skipCurrentElement();
+        }
+      }
+    }
+    else if ( reader.name() == "IconStyle" )
+    {
+      while ( reader.readNextStartElement() )
+      {
+        if ( reader.name() == "Icon" )
+        {
+          while ( reader.readNextStartElement() )
           {
-            y *= icon.height();
+            if ( reader.name() == "href" )
+            {
+              style.iconHref = reader.readElementText().trimmed();
+            }
+            else
+            {
+              reader.skipCurrentElement();
+            }
           }
-          style.hotSpot = QPointF( x, y );
+        }
+        else if ( reader.name() == "hotSpot" )
+        {
+          QXmlStreamAttributes attrs = reader.attributes();
+          style.hotSpot = QPointF( attrs.value( "x" ).toDouble(), attrs.value( "y" ).toDouble() );
+          style.hotSpotXFraction = attrs.value( "xunits" ) == "fraction";
+          style.hotSpotYFraction = attrs.value( "yunits" ) == "fraction";
+          reader.skipCurrentElement();
+        }
+        else
+        {
+          reader.skipCurrentElement();
         }
       }
     }
+    else
+    {
+      reader.skipCurrentElement();
+    }
+  }
+  if ( noFill )
+  {
+    style.fillColor = QColor( Qt::transparent );
+  }
+  if ( noOutline )
+  {
+    style.outlineColor = QColor( Qt::transparent );
   }
   return style;
 }
 
-QList<QgsAbstractGeometry *> KadasKMLImport::parseGeometries( const QDomElement &containerEl )
+KadasKMLImportWorker::StyleMapData KadasKMLImportWorker::readStyleMap( QXmlStreamReader &reader ) const
 {
-  QList<QgsAbstractGeometry *> geoms;
+  StyleMapData styleMap;
+  bool havePair = false;
+  while ( reader.readNextStartElement() )
+  {
+    // Just pick the first item of the StyleMap
+    if ( reader.name() == "Pair" && !havePair )
+    {
+      havePair = true;
+      while ( reader.readNextStartElement() )
+      {
+        if ( reader.name() == "Style" )
+        {
+          styleMap.style = readStyle( reader );
+          styleMap.hasStyle = true;
+        }
+        else if ( reader.name() == "styleUrl" )
+        {
+          styleMap.styleUrl = reader.readElementText().trimmed();
+        }
+        else
+        {
+          reader.skipCurrentElement();
+        }
+      }
+    }
+    else
+    {
+      reader.skipCurrentElement();
+    }
+  }
+  return styleMap;
+}
 
-  QDomElement pointEl = containerEl.firstChildElement( "Point" );
-  if ( !pointEl.isNull() )
+void KadasKMLImportWorker::readGeometry( QXmlStreamReader &reader, QList<QgsAbstractGeometry *> &geoms ) const
+{
+  if ( reader.name() == "Point" )
   {
-    QVector<QgsPoint> points = parseCoordinates( pointEl );
+    QVector<QgsPoint> points = readCoordinates( reader );
     if ( !points.isEmpty() )
     {
       geoms.append( points[0].clone() );
     }
   }
-
-  QDomElement lineStringEl = containerEl.firstChildElement( "LineString" );
-  if ( !lineStringEl.isNull() )
+  else if ( reader.name() == "LineString" )
   {
     QgsLineString *line = new QgsLineString();
-    line->setPoints( parseCoordinates( lineStringEl ) );
+    line->setPoints( readCoordinates( reader ) );
     geoms.append( line );
   }
-
-  QDomElement polygonEl = containerEl.firstChildElement( "Polygon" );
-  if ( !polygonEl.isNull() )
+  else if ( reader.name() == "Polygon" )
   {
-    QDomElement outerRingEl = polygonEl.firstChildElement( "outerBoundaryIs" ).firstChildElement( "LinearRing" );
-    QgsLineString *exterior = new QgsLineString();
-    exterior->setPoints( parseCoordinates( outerRingEl ) );
+    QgsLineString *exterior = nullptr;
+    QList<QgsLineString *> interiors;
+    while ( reader.readNextStartElement() )
+    {
+      if ( reader.name() == "outerBoundaryIs" )
+      {
+        delete exterior;
+        exterior = readRing( reader );
+      }
+      else if ( reader.name() == "innerBoundaryIs" )
+      {
+        interiors.append( readRing( reader ) );
+      }
+      else
+      {
+        reader.skipCurrentElement();
+      }
+    }
     QgsPolygon *poly = new QgsPolygon();
-    poly->setExteriorRing( exterior );
-
-    QDomNodeList innerBoundaryEls = polygonEl.elementsByTagName( "innerBoundaryIs" );
-    for ( int iRing = 0, nRings = innerBoundaryEls.size(); iRing < nRings; ++iRing )
+    poly->setExteriorRing( exterior ? exterior : new QgsLineString() );
+    for ( QgsLineString *interior : interiors )
     {
-      QDomElement innerRingEl = innerBoundaryEls.at( iRing ).toElement().firstChildElement( "LinearRing" );
-      QgsLineString *interior = new QgsLineString();
-      interior->setPoints( parseCoordinates( innerRingEl ) );
       poly->addInteriorRing( interior );
     }
     geoms.append( poly );
   }
+  else if ( reader.name() == "MultiGeometry" )
+  {
+    while ( reader.readNextStartElement() )
+    {
+      readGeometry( reader, geoms );
+    }
+  }
+  else
+  {
+    reader.skipCurrentElement();
+  }
+}
+
+QgsLineString *KadasKMLImportWorker::readRing( QXmlStreamReader &reader ) const
+{
+  QgsLineString *ring = new QgsLineString();
+  while ( reader.readNextStartElement() )
+  {
+    if ( reader.name() == "LinearRing" )
+    {
+      ring->setPoints( readCoordinates( reader ) );
+    }
+    else
+    {
+      reader.skipCurrentElement();
+    }
+  }
+  return ring;
+}
 
-  QDomElement multiGeometryEl = containerEl.firstChildElement( "MultiGeometry" );
-  if ( !multiGeometryEl.isNull() )
+QVector<QgsPoint> KadasKMLImportWorker::readCoordinates( QXmlStreamReader &reader ) const
+{
+  QVector<QgsPoint> points;
+  while ( reader.readNextStartElement() )
   {
-    geoms.append( parseGeometries( multiGeometryEl ) );
+    if ( reader.name() != "coordinates" )
+    {
+      reader.skipCurrentElement();
+      continue;
+    }
+    QStringList coordinates = reader.readElementText().split( QRegExp( "\\s+" ), QString::SkipEmptyParts );
+    points.reserve( coordinates.size() );
+    for ( int i = 0, n = coordinates.size(); i < n; ++i )
+    {
+      QStringList coordinate = coordinates[i].split( "," );
+      if ( coordinate.size() >= 3 )
+      {
+        QgsPoint p( QgsWkbTypes::PointZ );
+        p.setX( coordinate[0].toDouble() );
+        p.setY( coordinate[1].toDouble() );
+        p.setZ( coordinate[2].toDouble() );
+        points.append( p );
+      }
+      else if ( coordinate.size() == 2 )
+      {
+        QgsPoint p( QgsWkbTypes::Point );
+        p.setX( coordinate[0].toDouble() );
+        p.setY( coordinate[1].toDouble() );
+        points.append( p );
+      }
+    }
   }
-  return geoms;
+  return points;
 }
 
-QColor KadasKMLImport::parseColor( const QString &abgr ) const
+QColor KadasKMLImportWorker::parseColor( const QString &abgr ) const
 {
-  if ( abgr.length() < 8 )
+  QString color = abgr.trimmed();
+  if ( color.length() < 8 )
   {
     return Qt::black;
   }
-  int a = abgr.mid( 0, 2 ).toInt( nullptr, 16 );
-  int b = abgr.mid( 2, 2 ).toInt( nullptr, 16 );
-  int g = abgr.mid( 4, 2 ).toInt( nullptr, 16 );
-  int r = abgr.mid( 6, 2 ).toInt( nullptr, 16 );
+  int a = color.mid( 0, 2 ).toInt( nullptr, 16 );
+  int b = color.mid( 2, 2 ).toInt( nullptr, 16 );
+  int g = color.mid( 4, 2 ).toInt( nullptr, 16 );
+  int r = color.mid( 6, 2 ).toInt( nullptr, 16 );
   return QColor( r, g, b, a );
 }
 
-QMap<QString, QString> KadasKMLImport::parseExtendedData( const QDomElement &placemarkEl )
+bool KadasKMLImportWorker::isStyleDefined( const QString &styleUrl ) const
+{
+  auto mapIt = mStyleMaps.find( styleUrl );
+  if ( mapIt != mStyleMaps.end() )
+  {
+    return mapIt->hasStyle || mStyles.contains( mapIt->styleUrl );
+  }
+  return mStyles.contains( styleUrl );
+}
+
+KadasKMLImport::StyleData KadasKMLImportWorker::resolveStyle( const QString &styleUrl )
+{
+  QString url = styleUrl;
+  auto mapIt = mStyleMaps.find( url );
+  if ( mapIt != mStyleMaps.end() )
+  {
+    if ( mapIt->hasStyle )
+    {
+      resolveIcon( mapIt->style );
+      return mapIt->style;
+    }
+    url = mapIt->styleUrl;
+  }
+  auto it = mStyles.find( url );
+  if ( it == mStyles.end() )
+  {
+    // Undefined style, or a style of an external document
+    return KadasKMLImport::StyleData();
+  }
+  resolveIcon( it.value() );
+  return it.value();
+}
+
+void KadasKMLImportWorker::resolveIcon( KadasKMLImport::StyleData &style )
+{
+  if ( style.iconHref.isEmpty() )
+  {
+    return;
+  }
+  QString href = style.iconHref;
+  style.iconHref.clear();
+
+  // Only local files in KMZ are supported (also for security reasons)
+  if ( !mResourceZip || !mResourceZip->setCurrentFile( href ) )
+  {
+    return;
+  }
+  QuaZipFile file( mResourceZip );
+  if ( !file.open( QIODevice::ReadOnly ) )
+  {
+    return;
+  }
+  QImage icon = QImage::fromData( file.readAll() );
+  QMetaObject::invokeMethod( mImporter, [&style]
+  {
+    style.icon = QgsProject::instance()->createAttachedFile( "kml_import.png" );
+  }, Qt::BlockingQueuedConnection );
+  icon.save( style.icon );
+
+  if ( style.hotSpotXFraction )
+  {
+    style.hotSpot.rx() *= icon.width();
+  }
+  if ( style.hotSpotYFraction )
+  {
+    style.hotSpot.ry() *= icon.height();
+  }
+}
+
+QgsCoordinateTransform KadasKMLImportWorker::layerTransform( const QString &layerName )
+{
+  auto it = mLayerTransforms.find( layerName );
+  if ( it == mLayerTransforms.end() )
+  {
+    // The layer is looked up (or created) in the main thread
+    QgsCoordinateTransform transform;
+    QMetaObject::invokeMethod( mImporter, [&transform, &layerName]
+    {
+      KadasItemLayer *itemLayer = KadasItemLayerRegistry::getOrCreateItemLayer( layerName );
+      transform = QgsCoordinateTransform( QgsCoordinateReferenceSystem( "EPSG:4326" ), itemLayer->crs(), QgsProject::instance()->transformContext() );
+    }, Qt::BlockingQueuedConnection );
+    it = mLayerTransforms.insert( layerName, transform );
+  }
+  return it.value();
+}
+
+void KadasKMLImportWorker::addItem( const QString &layerName, KadasMapItem *item )
+{
+  mBatches[layerName].append( item );
+  if ( ++mBatchCount >= sBatchSize )
+  {
+    flushBatches();
+  }
+}
+
+void KadasKMLImportWorker::flushBatches()
 {
-  QMap<QString, QString> attributes;
-  QDomNodeList simpleDataEls = placemarkEl.elementsByTagName( "SimpleData" );
-  for ( int iSimpleData = 0, nSimpleData = simpleDataEls.size(); iSimpleData < nSimpleData; ++iSimpleData )
+  for ( auto it = mBatches.begin(), itEnd = mBatches.end(); it != itEnd; ++it )
+  {
+    if ( isInterruptionRequested() )
+    {
+      qDeleteAll( it.value() );
+      continue;
+    }
+    // Limit the number of batches waiting to be committed, so that memory stays bounded if the main thread lags behind
+    mPendingBatches.acquire();
+    QList<KadasMapItem *> items = it.value();
+    for ( KadasMapItem *item : items )
+    {
+      item->moveToThread( mImporter->thread() );
+    }
+    KadasKMLImport *importer = mImporter;
+    const KadasKMLImportWorker *worker = this;
+    QSemaphore *pendingBatches = &mPendingBatches;
+    QString layerName = it.key();
+    // The importer processes all queued batches before the worker is destroyed
+    QMetaObject::invokeMethod( mImporter, [importer, worker, pendingBatches, layerName, items]
+    {
+      if ( worker->isInterruptionRequested() )
+      {
+        qDeleteAll( items );
+      }
+      else
+      {
+        importer->commitItems( layerName, items );
+      }
+      pendingBatches->release();
+    }, Qt::QueuedConnection );
+  }
+  mBatches.clear();
+  mBatchCount = 0;
+}
+
+void KadasKMLImportWorker::reportProgress()
+{
+  if ( !mDevice || mDevice->size() <= 0 )
+  {
+    return;
+  }
+  int progress = qMin<qint64>( 1000, mDevice->pos() * 1000 / mDevice->size() );
+  if ( progress != mLastProgress )
   {
-    QDomElement simpleDataEl = simpleDataEls.at( iSimpleData ).toElement();
-    attributes.insert( simpleDataEl.attribute( "name" ), simpleDataEl.text() );
+    mLastProgress = progress;
+    emit progressChanged( progress );
   }
-  return attributes;
 }
@@ -18,15 +18,20 @@
 #define KADASKMLIMPORT_H
 
 #include <QImage>
+#include <QMap>
 #include <QObject>
+#include <QSemaphore>
+#include <QThread>
 
+#include <qgis/qgscoordinatetransform.h>
 #include <qgis/qgspoint.h>
 
-class QDomDocument;
-class QDomElement;
+class QIODevice;
+class QXmlStreamReader;
 class QuaZip;
+class QgsLineString;
 class QgsMapCanvas;
-class QgsRedliningLayer;
+class KadasMapItem;
 
 class KadasKMLImport : public QObject
 {
@@ -35,6 +40,8 @@ class KadasKMLImport : public QObject
     bool importFile( const QString &filename, QString &errMsg );
 
   private:
+    friend class KadasKMLImportWorker;
+
     struct StyleData
     {
       int outlineSize = 1;
@@ -47,6 +54,10 @@ class KadasKMLImport : public QObject
       double labelScale = 1.;
       QString icon;
       QPointF hotSpot;
+      // Unresolved icon reference, the icon is only extracted once the style is used by a placemark
+      QString iconHref;
+      bool hotSpotXFraction = false;
+      bool hotSpotYFraction = false;
     };
     struct TileData
     {
@@ -60,13 +71,80 @@ class KadasKMLImport : public QObject
       QList<TileData> tiles;
     };
 
-    bool importDocument( const QString &filename, const QDomDocument &doc, QString &errMsg, QuaZip *zip = nullptr );
     void buildVSIVRT( const QString &name, OverlayData &overlayData, QuaZip *kmzZip ) const;
-    QVector<QgsPoint> parseCoordinates( const QDomElement &geomEl ) const;
-    StyleData parseStyle( const QDomElement &styleEl, QuaZip *zip ) const;
-    QList<QgsAbstractGeometry *> parseGeometries( const QDomElement &containerEl );
-    QMap<QString, QString> parseExtendedData( const QDomElement &placemarkEl );
+    void commitItems( const QString &layerName, const QList<KadasMapItem *> &items );
+};
+
+
+/**Streams a KML document and builds the map items in batches, which are committed to the layers by the importer in the main thread*/
+class KadasKMLImportWorker : public QThread
+{
+    Q_OBJECT
+  public:
+    KadasKMLImportWorker( KadasKMLImport *importer, const QString &filename, QObject *parent = nullptr );
+    void abort() { requestInterruption(); }
+    const QString &errorMessage() const { return mErrorMsg; }
+    QMap<QString, KadasKMLImport::OverlayData> &overlays() { return mOverlays; }
+
+  signals:
+    void progressChanged( int permille );
+
+  private:
+    struct PlacemarkData
+    {
+      QString name;
+      QString styleUrl;
+      bool hasStyle = false;
+      KadasKMLImport::StyleData style;
+      QList<QgsAbstractGeometry *> geoms;
+    };
+    struct StyleMapData
+    {
+      bool hasStyle = false;
+      KadasKMLImport::StyleData style;
+      QString styleUrl;
+    };
+
+    static const int sBatchSize;
+    static const int sMaxPendingBatches;
+
+    KadasKMLImport *mImporter;
+    QString mFilename;
+    QString mDefaultLayerName;
+    QString mErrorMsg;
+    QuaZip *mResourceZip = nullptr;
+    QIODevice *mDevice = nullptr;
+    int mLastProgress = -1;
+    // Styles by "#id", icons of shared styles are resolved on first use
+    QMap<QString, KadasKMLImport::StyleData> mStyles;
+    QMap<QString, StyleMapData> mStyleMaps;
+    // Placemarks by layer name which refer to a style that is not defined yet, they are added at the end of the document
+    QList<QPair<QString, PlacemarkData>> mDeferredPlacemarks;
+    QMap<QString, QgsCoordinateTransform> mLayerTransforms;
+    QMap<QString, QList<KadasMapItem *>> mBatches;
+    int mBatchCount = 0;
+    QSemaphore mPendingBatches;
+    QMap<QString, KadasKMLImport::OverlayData> mOverlays;
+
+    void run() override;
+    bool readDocument( QIODevice *device );
+    void readContainer( QXmlStreamReader &reader, bool isFolder );
+    void readPlacemark( QXmlStreamReader &reader, const QString &layerName );
+    void addPlacemark( PlacemarkData &placemark, const QString &layerName );
+    void readGroundOverlay( QXmlStreamReader &reader, const QString &layerName );
+    KadasKMLImport::StyleData readStyle( QXmlStreamReader &reader ) const;
+    StyleMapData readStyleMap( QXmlStreamReader &reader ) const;
+    void readGeometry( QXmlStreamReader &reader, QList<QgsAbstractGeometry *> &geoms ) const;
+    QgsLineString *readRing( QXmlStreamReader &reader ) const;
+    QVector<QgsPoint> readCoordinates( QXmlStreamReader &reader ) const;
     QColor parseColor( const QString &abgr ) const;
+    bool isStyleDefined( const QString &styleUrl ) const;
+    KadasKMLImport::StyleData resolveStyle( const QString &styleUrl );
+    void resolveIcon( KadasKMLImport::StyleData &style );
+    QgsCoordinateTransform layerTransform( const QString &layerName );
+    void addItem( const QString &layerName, KadasMapItem *item );
+    void flushBatches();
+    void reportProgress();
 };
 
 
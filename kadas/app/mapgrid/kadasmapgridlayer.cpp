@@ -14,12 +14,17 @@
  *                                                                         *
  ***************************************************************************/
 
+#include <algorithm>
+#include <cmath>
+
 #include <QMenu>
+#include <QMutexLocker>
+#include <QSet>
 #include <QVector2D>
 
 #include <qgis/qgsapplication.h>
 #include <qgis/qgscoordinateformatter.h>
-#include <qgis/qgsgeometryutils.h>
+#include <qgis/qgscsexception.h>
 #include <qgis/qgslinestring.h>
 #include <qgis/qgsmaplayerrenderer.h>
 #include <qgis/qgsmapsettings.h>
@@ -30,6 +35,142 @@
 #include <kadas/app/mapgrid/kadasmapgridlayer.h>
 
 
+// Transforms the points in one batch, falling back to transforming them one by one on failure. Points which cannot be transformed are set to NaN.
+static void transformGridPoints( const QgsCoordinateTransform &crst, QVector<double> &x, QVector<double> &y )
+{
+  int n = x.size();
+  QVector<double> srcX = x;
+  QVector<double> srcY = y;
+  QVector<double> z( n, 0. );
+  try
+  {
+    crst.transformCoords( n, x.data(), y.data(), z.data() );
+  }
+  catch ( const QgsCsException & )
+  {
+    for ( int i = 0; i < n; ++i )
+    {
+      try
+      {
+        QgsPointXY p = crst.transform( srcX[i], srcY[i] );
+        x[i] = p.x();
+        y[i] = p.y();
+      }
+      catch ( const QgsCsException & )
+      {
+        x[i] = std::numeric_limits<double>::quiet_NaN();
+        y[i] = std::numeric_limits<double>::quiet_NaN();
+      }
+    }
+  }
+}
+
+// Transforms the lines to map coordinates. Segments are bisected until the transformed midpoint deviates less than tolerance (in map units)
+// from the chord, the midpoints of all lines are transformed in one batch per bisection level.
+static void densifyGridLines( const QgsCoordinateTransform &crst, QList<QPolygonF> &lines, double tolerance )
+{
+  const int maxDepth = 8;
+  QVector<double> x;
+  QVector<double> y;
+  for ( const QPolygonF &line : lines )
+  {
+    for ( const QPointF &p : line )
+    {
+      x.append( p.x() );
+      y.append( p.y() );
+    }
+  }
+  transformGridPoints( crst, x, y );
+
+  QList<QPolygonF> mapLines;
+  QList<QVector<bool>> refine;
+  int idx = 0;
+  for ( const QPolygonF &line : lines )
+  {
+    QPolygonF mapLine;
+    mapLine.reserve( line.size() );
+    for ( int i = 0, n = line.size(); i < n; ++i, ++idx )
+    {
+      mapLine.append( QPointF( x[idx], y[idx] ) );
+    }
+    mapLines.append( mapLine );
+    refine.append( QVector<bool>( qMax( 0, line.size() - 1 ), true ) );
+  }
+
+  for ( int depth = 0; depth < maxDepth; ++depth )
+  {
+    x.clear();
+    y.clear();
+    for ( int l = 0, nLines = lines.size(); l < nLines; ++l )
+    {
+      const QPolygonF &line = lines[l];
+      for ( int i = 0, n = refine[l].size(); i < n; ++i )
+      {
+        if ( refine[l][i] )
+        {
+          x.append( 0.5 * ( line[i].x() + line[i + 1].x() ) );
+          y.append( 0.5 * ( line[i].y() + line[i + 1].y() ) );
+        }
+      }
+    }
+    if ( x.isEmpty() )
+    {
+      break;
+    }
+    transformGridPoints( crst, x, y );
+
+    idx = 0;
+    for ( int l = 0, nLines = lines.size(); l < nLines; ++l )
+    {
+      const QPolygonF &line = lines[l];
+      const QPolygonF &mapLine = mapLines[l];
+      const QVector<bool> &lineRefine = refine[l];
+      QPolygonF newLine;
+      QPolygonF newMapLine;
+      QVector<bool> newRefine;
+      for ( int i = 0, n = lineRefine.size(); i < n; ++i )
+      {
+        newLine.append( line[i] );
+        newMapLine.append( mapLine[i] );
+        if ( !lineRefine[i] )
+        {
+          newRefine.append( false );
+          continue;
+        }
+        QPointF mid( x[idx], y[idx] );
+        ++idx;
+        QPointF d = mid - 0.5 * ( mapLine[i] + mapLine[i + 1] );
+        if ( d.x() * d.x() + d.y() * d.y() > tolerance * tolerance )
+        {
+          newLine.append( 0.5 * ( line[i] + line[i + 1] ) );
+          newMapLine.append( mid );
+          newRefine.append( true );
+          newRefine.append( true );
+        }
+        else
+        {
+          newRefine.append( false );
+        }
+      }
+      if ( !line.isEmpty() )
+      {
+        newLine.append( line.last() );
+        newMapLine.append( mapLine.last() );
+      }
+      lines[l] = newLine;
+      mapLines[l] = newMapLine;
+      refine[l] = newRefine;
+    }
+  }
+
+  // Drop vertices which could not be transformed
+  for ( QPolygonF &mapLine : mapLines )
+  {
+    mapLine.erase( std::remove_if( mapLine.begin(), mapLine.end(), []( const QPointF & p ) { return !std::isfinite( p.x() ) || !std::isfinite( p.y() ); } ), mapLine.end() );
+  }
+  lines = mapLines;
+}
+
 class KadasMapGridLayer::Renderer : public QgsMapLayerRenderer
 {
   public:
@@ -49,19 +190,19 @@ class KadasMapGridLayer::Renderer : public QgsMapLayerRenderer
       switch ( mLayer->mGridType )
       {
         case GridLV03:
-          drawCrsGrid( "EPSG:21781", 100000, QgsCoordinateFormatter::FormatPair, 0, 0 );
+          drawCrsGrid( "EPSG:21781", QgsCoordinateFormatter::FormatPair, 0, 0 );
           break;
         case GridLV95:
-          drawCrsGrid( "EPSG:2056", 100000, QgsCoordinateFormatter::FormatPair, 0, 0 );
+          drawCrsGrid( "EPSG:2056", QgsCoordinateFormatter::FormatPair, 0, 0 );
           break;
         case GridDD:
-          drawCrsGrid( "EPSG:4326", 1, QgsCoordinateFormatter::FormatDecimalDegrees, 3, 0 );
+          drawCrsGrid( "EPSG:4326", QgsCoordinateFormatter::FormatDecimalDegrees, 3, 0 );
           break;
         case GridDM:
-          drawCrsGrid( "EPSG:4326", 1, QgsCoordinateFormatter::FormatDegreesMinutes, 1, QgsCoordinateFormatter::FlagDegreesUseStringSuffix | QgsCoordinateFormatter::FlagDegreesPadMinutesSeconds );
+          drawCrsGrid( "EPSG:4326", QgsCoordinateFormatter::FormatDegreesMinutes, 1, QgsCoordinateFormatter::FlagDegreesUseStringSuffix | QgsCoordinateFormatter::FlagDegreesPadMinutesSeconds );
           break;
         case GridDMS:
-          drawCrsGrid( "EPSG:4326", 1, QgsCoordinateFormatter::FormatDegreesMinutesSeconds, 0, QgsCoordinateFormatter::FlagDegreesUseStringSuffix | QgsCoordinateFormatter::FlagDegreesPadMinutesSeconds );
+          drawCrsGrid( "EPSG:4326", QgsCoordinateFormatter::FormatDegreesMinutesSeconds, 0, QgsCoordinateFormatter::FlagDegreesUseStringSuffix | QgsCoordinateFormatter::FlagDegreesPadMinutesSeconds );
           break;
         case GridUTM:
         case GridMGRS:
@@ -83,11 +224,25 @@ class KadasMapGridLayer::Renderer : public QgsMapLayerRenderer
       QPointF screenPos;
     };
 
-    void drawCrsGrid( const QString &crs, double segmentLength, QgsCoordinateFormatter::Format format, int precision, QgsCoordinateFormatter::FormatFlags flags )
+    void drawCrsGrid( const QString &crs, QgsCoordinateFormatter::Format format, int precision, QgsCoordinateFormatter::FormatFlags flags )
     {
-      QgsCoordinateTransform crst( QgsCoordinateReferenceSystem( crs ), mRendererContext.coordinateTransform().destinationCrs(), mRendererContext.transformContext() );
+      const QgsMapToPixel &mapToPixel = mRendererContext.mapToPixel();
+      QgsCoordinateReferenceSystem destCrs = mRendererContext.coordinateTransform().destinationCrs();
+      CrsGrid grid;
+      {
+        QMutexLocker locker( &mLayer->mCrsGridMutex );
+        grid = mLayer->mCrsGrid;
+      }
+      if ( grid.crs != crs || grid.destCrs != destCrs )
+      {
+        grid = CrsGrid();
+        grid.crs = crs;
+        grid.destCrs = destCrs;
+        grid.transform = QgsCoordinateTransform( QgsCoordinateReferenceSystem( crs ), destCrs, mRendererContext.transformContext() );
+      }
+      const QgsCoordinateTransform &crst = grid.transform;
       QgsRectangle area = crst.transformBoundingBox( mRendererContext.mapExtent(), QgsCoordinateTransform::ReverseTransform );
-      QRectF screenRect = computeScreenExtent( mRendererContext.mapExtent(), mRendererContext.mapToPixel() );
+      QRectF screenRect = computeScreenExtent( mRendererContext.mapExtent(), mapToPixel );
 
       QList<GridLabel> leftLabels;
       QList<GridLabel> rightLabels;
@@ -117,97 +272,63 @@ class KadasMapGridLayer::Renderer : public QgsMapLayerRenderer
         intervalY *= 2;
         numY = qRound( ( yEnd - yStart ) / intervalY ) + 1;
       }
+      xStart = qFloor( xStart / intervalX ) * intervalX;
+      xEnd = qCeil( xEnd / intervalX ) * intervalX;
+      yStart = qFloor( yStart / intervalY ) * intervalY;
+      yEnd = qCeil( yEnd / intervalY ) * intervalY;
+
+      // Reuse the lines of the previous render if they cover the area at the same resolution
+      double mapUnitsPerPixel = mapToPixel.mapUnitsPerPixel();
+      if ( grid.mapUnitsPerPixel != mapUnitsPerPixel || grid.intervalX != intervalX || grid.intervalY != intervalY ||
+           !grid.area.contains( QgsRectangle( xStart, yStart, xEnd, yEnd ) ) )
+      {
+        computeCrsGridLines( grid, mapUnitsPerPixel, intervalX, intervalY, xStart, xEnd, yStart, yEnd );
+        QMutexLocker locker( &mLayer->mCrsGridMutex );
+        mLayer->mCrsGrid = grid;
+      }
 
       // Vertical lines
-      double ySegmentLength = intervalY / qCeil( intervalY / segmentLength );
-      for ( int ix = 0; ix <= numX; ++ix )
+      for ( int i = 0, n = grid.xLines.size(); i < n; ++i )
       {
-        QPolygonF poly;
-        double x = xStart + ix * intervalX;
-        double y = yStart;
-        while ( y - ySegmentLength <= area.yMaximum() )
-        {
-          QgsPointXY p = crst.transform( x, y );
-          poly.append( mRendererContext.mapToPixel().transform( p ).toQPointF() );
-          y += ySegmentLength;
-        }
+        QPolygonF poly = toScreen( grid.xLines[i] );
         mRendererContext.painter()->drawPolyline( poly );
 
         if ( drawLabels && mLayer->mLabelingMode == LabelingEnabled )
         {
-          int iSegment = 0, nSegments = poly.size() - 1;
+          QString text = QgsCoordinateFormatter::formatX( grid.xValues[i], format, precision, flags );
+          QPointF inter;
           // Bottom edge label pos
-          for ( ; iSegment < nSegments && poly[1 + iSegment].y() >= screenRect.bottom(); ++iSegment );
-          if ( iSegment < nSegments )
+          if ( screenEdgeIntersection( poly, Qt::Horizontal, screenRect.bottom(), screenRect.left(), screenRect.right(), false, inter ) )
           {
-            QgsPoint inter;
-            bool isInter = false;
-            QgsGeometryUtils::segmentIntersection( QgsPoint( poly[iSegment] ), QgsPoint( poly[iSegment + 1] ), QgsPoint( screenRect.bottomLeft() ), QgsPoint( screenRect.bottomRight() ), inter, isInter );
-            if ( isInter )
-            {
-              bottomLabels.append( {QgsCoordinateFormatter::formatX( x, format, precision, flags ), inter.toQPointF()} );
-            }
+            bottomLabels.append( {text, inter} );
           }
-
           // Top edge label pos
-          iSegment = nSegments - 2;
-          for ( ; iSegment >= 0 && poly[1 + iSegment].y() <= screenRect.top(); --iSegment );
-          if ( iSegment >= 0 )
+          if ( screenEdgeIntersection( poly, Qt::Horizontal, screenRect.top(), screenRect.left(), screenRect.right(), true, inter ) )
           {
-            QgsPoint inter;
-            bool isInter = false;
-            QgsGeometryUtils::segmentIntersection( QgsPoint( poly[iSegment] ), QgsPoint( poly[iSegment + 1] ), QgsPoint( screenRect.topLeft() ), QgsPoint( screenRect.topRight() ), inter, isInter );
-            if ( isInter )
-            {
-              topLabels.append( {QgsCoordinateFormatter::formatX( x, format, precision, flags ), inter.toQPointF()} );
-            }
+            topLabels.append( {text, inter} );
           }
         }
       }
 
       // Horizontal lines
-      double xSegmentLength = intervalX / qCeil( intervalX / segmentLength );
-      for ( int iy = numY; iy >= 0; --iy )
+      for ( int i = 0, n = grid.yLines.size(); i < n; ++i )
       {
-        QPolygonF poly;
-        double x = xStart;
-        double y = yStart + iy * intervalY;
-        while ( x - xSegmentLength <= area.xMaximum() )
-        {
-          QgsPointXY p = crst.transform( x, y );
-          poly.append( mRendererContext.mapToPixel().transform( p ).toQPointF() );
-          x += xSegmentLength;
-        }
+        QPolygonF poly = toScreen( grid.yLines[i] );
         mRendererContext.painter()->drawPolyline( poly );
 
         if ( drawLabels && mLayer->mLabelingMode == LabelingEnabled )
         {
-          int iSegment = 0, nSegments = poly.size() - 1;
+          QString text = QgsCoordinateFormatter::formatY( grid.yValues[i], format, precision, flags );
+          QPointF inter;
           // Left edge label pos
-          for ( ; iSegment < nSegments && poly[1 + iSegment].y() <= screenRect.left(); ++iSegment );
-          if ( iSegment < nSegments )
+          if ( screenEdgeIntersection( poly, Qt::Vertical, screenRect.left(), screenRect.top(), screenRect.bottom(), false, inter ) )
           {
-            QgsPoint inter;
-            bool isInter = false;
-            QgsGeometryUtils::segmentIntersection( QgsPoint( poly[iSegment] ), QgsPoint( poly[iSegment + 1] ), QgsPoint( screenRect.bottomLeft() ), QgsPoint( screenRect.topLeft() ), inter, isInter );
-            if ( isInter )
-            {
-              leftLabels.append( {QgsCoordinateFormatter::formatY( y, format, precision, flags ), inter.toQPointF()} );
-            }
+            leftLabels.append( {text, inter} );
           }
-
           // Right edge label pos
-          iSegment = nSegments - 2;
-          for ( ; iSegment >= 0 && poly[1 + iSegment].y() >= screenRect.right(); --iSegment );
-          if ( iSegment >= 0 )
+          if ( screenEdgeIntersection( poly, Qt::Vertical, screenRect.right(), screenRect.top(), screenRect.bottom(), true, inter ) )
           {
-            QgsPoint inter;
-            bool isInter = false;
-            QgsGeometryUtils::segmentIntersection( QgsPoint( poly[iSegment] ), QgsPoint( poly[iSegment + 1] ), QgsPoint( screenRect.bottomRight() ), QgsPoint( screenRect.topRight() ), inter, isInter );
-            if ( isInter )
-            {
-              rightLabels.append( {QgsCoordinateFormatter::formatY( y, format, precision, flags ), inter.toQPointF()} );
-            }
+            rightLabels.append( {text, inter} );
           }
         }
       }
@@ -275,6 +396,101 @@ class KadasMapGridLayer::Renderer : public QgsMapLayerRenderer
 
     }
 
+    void computeCrsGridLines( CrsGrid &grid, double mapUnitsPerPixel, double intervalX, double intervalY, double xStart, double xEnd, double yStart, double yEnd )
+    {
+      // Compute the lines for a larger area, so that they can be reused while panning
+      double padX = qCeil( 0.5 * ( xEnd - xStart ) / intervalX ) * intervalX;
+      double padY = qCeil( 0.5 * ( yEnd - yStart ) / intervalY ) * intervalY;
+      xStart -= padX;
+      xEnd += padX;
+      yStart -= padY;
+      yEnd += padY;
+      if ( grid.transform.sourceCrs().isGeographic() )
+      {
+        xStart = qMax( xStart, qFloor( -180. / intervalX ) * intervalX );
+        xEnd = qMin( xEnd, qCeil( 180. / intervalX ) * intervalX );
+        yStart = qMax( yStart, qFloor( -90. / intervalY ) * intervalY );
+        yEnd = qMin( yEnd, qCeil( 90. / intervalY ) * intervalY );
+      }
+      int numX = qRound( ( xEnd - xStart ) / intervalX );
+      int numY = qRound( ( yEnd - yStart ) / intervalY );
+
+      grid.mapUnitsPerPixel = mapUnitsPerPixel;
+      grid.intervalX = intervalX;
+      grid.intervalY = intervalY;
+      grid.area = QgsRectangle( xStart, yStart, xEnd, yEnd );
+      grid.xValues.clear();
+      grid.xLines.clear();
+      grid.yValues.clear();
+      grid.yLines.clear();
+
+      // Vertical lines, from west to east
+      for ( int ix = 0; ix <= numX; ++ix )
+      {
+        double x = xStart + ix * intervalX;
+        QPolygonF poly;
+        for ( int iy = 0; iy <= numY; ++iy )
+        {
+          poly.append( QPointF( x, yStart + iy * intervalY ) );
+        }
+        grid.xValues.append( x );
+        grid.xLines.append( poly );
+      }
+      // Horizontal lines, from north to south
+      for ( int iy = numY; iy >= 0; --iy )
+      {
+        double y = yStart + iy * intervalY;
+        QPolygonF poly;
+        for ( int ix = 0; ix <= numX; ++ix )
+        {
+          poly.append( QPointF( xStart + ix * intervalX, y ) );
+        }
+        grid.yValues.append( y );
+        grid.yLines.append( poly );
+      }
+
+      // Half a pixel error bound
+      densifyGridLines( grid.transform, grid.xLines, 0.5 * mapUnitsPerPixel );
+      densifyGridLines( grid.transform, grid.yLines, 0.5 * mapUnitsPerPixel );
+    }
+
+    QPolygonF toScreen( const QPolygonF &mapLine ) const
+    {
+      const QgsMapToPixel &mapToPixel = mRendererContext.mapToPixel();
+      QPolygonF poly;
+      poly.reserve( mapLine.size() );
+      for ( const QPointF &p : mapLine )
+      {
+        poly.append( mapToPixel.transform( p.x(), p.y() ).toQPointF() );
+      }
+      return poly;
+    }
+
+    /**Finds the first (or last) intersection of poly with the screen edge at pos, which extends from edgeMin to edgeMax.
+      A horizontal edge is at y = pos, a vertical edge at x = pos.*/
+    static bool screenEdgeIntersection( const QPolygonF &poly, Qt::Orientation edge, double pos, double edgeMin, double edgeMax, bool last, QPointF &inter )
+    {
+      for ( int k = 0, n = poly.size() - 1; k < n; ++k )
+      {
+        int i = last ? n - 1 - k : k;
+        double a = edge == Qt::Horizontal ? poly[i].y() : poly[i].x();
+        double b = edge == Qt::Horizontal ? poly[i + 1].y() : poly[i + 1].x();
+        if ( a == b || ( a - pos ) * ( b - pos ) > 0 )
+        {
+          continue;
+        }
+        double lambda = ( pos - a ) / ( b - a );
+        QPointF p = poly[i] + lambda * ( poly[i + 1] - poly[i] );
+        double t = edge == Qt::Horizontal ? p.x() : p.y();
+        if ( t >= edgeMin && t <= edgeMax )
+        {
+          inter = p;
+          return true;
+        }
+      }
+      return false;
+    }
+
     void adjustZoneLabelPos( QPointF &labelPos, const QPointF &maxLabelPos, const QRectF &visibleExtent )
     {
       if ( !visibleExtent.contains( labelPos ) )
@@ -337,7 +553,49 @@ class KadasMapGridLayer::Renderer : public QgsMapLayerRenderer
       QList<KadasLatLonToUTM::ZoneLabel> zoneLabels;
       QList<KadasLatLonToUTM::ZoneLabel> zoneSubLabels;
       QList<KadasLatLonToUTM::GridLabel> gridLabels;
-      KadasLatLonToUTM::computeGrid( area, mapScale, zoneLines, subZoneLines, gridLines, zoneLabels, zoneSubLabels, gridLabels, mLayer->mGridType == GridMGRS ? KadasLatLonToUTM::GridMGRS : KadasLatLonToUTM::GridUTM );
+      // Grid lines which start at a tile border inside a zone
+      QSet<int> tileBorderLines;
+      KadasLatLonToUTM::GridMode gridMode = mLayer->mGridType == GridMGRS ? KadasLatLonToUTM::GridMGRS : KadasLatLonToUTM::GridUTM;
+      int cellSize = KadasLatLonToUTM::gridCellSize( mapScale );
+      const QList<QgsRectangle> zones = KadasLatLonToUTM::gridZones();
+      for ( int iZone = 0, nZones = zones.size(); iZone < nZones; ++iZone )
+      {
+        const QgsRectangle &zone = zones[iZone];
+        if ( !KadasLatLonToUTM::computeZone( zone, area, zoneLines, zoneLabels ) || cellSize == 0 )
+        {
+          continue;
+        }
+        if ( gridMode == KadasLatLonToUTM::GridMGRS )
+        {
+          appendGridTile( gridTile( {gridMode, 100000, iZone, 0, 0}, zone ), zone, subZoneLines, zoneSubLabels, gridLabels, tileBorderLines );
+          if ( cellSize == 100000 )
+          {
+            continue;
+          }
+        }
+        double tileSize = gridTileSize( cellSize );
+        if ( tileSize == 0 )
+        {
+          appendGridTile( gridTile( {gridMode, cellSize, iZone, 0, 0}, zone ), zone, gridLines, zoneSubLabels, gridLabels, tileBorderLines );
+          continue;
+        }
+        int tileX1 = qFloor( qMax( zone.xMinimum(), area.xMinimum() ) / tileSize );
+        int tileX2 = qFloor( qMin( zone.xMaximum(), area.xMaximum() ) / tileSize );
+        int tileY1 = qFloor( qMax( zone.yMinimum(), area.yMinimum() ) / tileSize );
+        int tileY2 = qFloor( qMin( zone.yMaximum(), area.yMaximum() ) / tileSize );
+        for ( int tileY = tileY1; tileY <= tileY2; ++tileY )
+        {
+          for ( int tileX = tileX1; tileX <= tileX2; ++tileX )
+          {
+            QgsRectangle rect( qMax( zone.xMinimum(), tileX * tileSize ), qMax( zone.yMinimum(), tileY * tileSize ),
+                               qMin( zone.xMaximum(), ( tileX + 1 ) * tileSize ), qMin( zone.yMaximum(), ( tileY + 1 ) * tileSize ), false );
+            if ( rect.width() > 0 && rect.height() > 0 )
+            {
+              appendGridTile( gridTile( {gridMode, cellSize, iZone, tileX, tileY}, rect ), zone, gridLines, zoneSubLabels, gridLabels, tileBorderLines );
+            }
+          }
+        }
+      }
 
       // Draw grid lines
       mRendererContext.painter()->setPen( QPen( mLayer->mColor, 3 ) );
@@ -391,11 +649,11 @@ class KadasMapGridLayer::Renderer : public QgsMapLayerRenderer
       {
         zoneFontSize = mLayer->mFontSize;
       }
-      else if ( mapScale > 5000000 )   // Zones only, see KadasLatLonToUTM::computeGrid
+      else if ( mapScale > 5000000 )   // Zones only, see KadasLatLonToUTM::gridCellSize
       {
         zoneFontSize = 1.33 * mLayer->mFontSize;
       }
-      else if ( mapScale > 500000 )   // Zones and subzones only, see KadasLatLonToUTM::computeGrid
+      else if ( mapScale > 500000 )   // Zones and subzones only, see KadasLatLonToUTM::gridCellSize
       {
         zoneFontSize = 1.8 * mLayer->mFontSize;
         subZoneFontSize = mLayer->mFontSize;
@@ -487,6 +745,11 @@ class KadasMapGridLayer::Renderer : public QgsMapLayerRenderer
               pp = pn;
             }
           }
+          else if ( tileBorderLines.contains( gridLabel.lineIdx ) )
+          {
+            // The line continues in the neighbouring tile, where it is labeled
+            continue;
+          }
           if ( i < n )
           {
             drawGridLabel( labelPos, gridLabel.label, font, bufferColor );
@@ -494,6 +757,57 @@ class KadasMapGridLayer::Renderer : public QgsMapLayerRenderer
         }
       }
     }
+    static double gridTileSize( int cellSize )
+    {
+      // Tile size in degrees, such that a tile spans in the order of 100 cells. Zero means that whole zones are computed.
+      return cellSize >= 100000 ? 0. : cellSize * 0.0002;
+    }
+
+    GridTile gridTile( const GridTileKey &key, const QgsRectangle &rect )
+    {
+      {
+        QMutexLocker locker( &mLayer->mGridCacheMutex );
+        if ( GridTile *tile = mLayer->mGridCache.object( key ) )
+        {
+          return *tile;
+        }
+      }
+      GridTile *tile = new GridTile;
+      tile->rect = rect;
+      KadasLatLonToUTM::computeZoneGrid( rect, key.cellSize, static_cast<KadasLatLonToUTM::GridMode>( key.gridMode ), tile->lines, tile->zoneLabels, tile->gridLabels );
+      GridTile result = *tile;
+      int cost = 1;
+      for ( const QPolygonF &line : tile->lines )
+      {
+        cost += line.size();
+      }
+      QMutexLocker locker( &mLayer->mGridCacheMutex );
+      mLayer->mGridCache.insert( key, tile, cost );
+      return result;
+    }
+
+    void appendGridTile( const GridTile &tile, const QgsRectangle &zone, QList<QPolygonF> &lines, QList<KadasLatLonToUTM::ZoneLabel> &zoneLabels, QList<KadasLatLonToUTM::GridLabel> &gridLabels, QSet<int> &tileBorderLines )
+    {
+      int offset = lines.size();
+      lines.append( tile.lines );
+      zoneLabels.append( tile.zoneLabels );
+      // Horizontal lines start at the west border, vertical lines at the border closer to the equator
+      bool horizTileBorder = tile.rect.xMinimum() > zone.xMinimum();
+      bool vertTileBorder = zone.yMinimum() >= 0 ? tile.rect.yMinimum() > zone.yMinimum() : tile.rect.yMaximum() < zone.yMaximum();
+      double vertStartY = zone.yMinimum() >= 0 ? tile.rect.yMinimum() : tile.rect.yMaximum();
+      for ( KadasLatLonToUTM::GridLabel label : tile.gridLabels )
+      {
+        // Vertical lines may also enter the tile through its east or west border, continuing a line of the neighbouring tile
+        bool vertSideBorder = !label.horiz && qAbs( tile.lines[label.lineIdx].first().y() - vertStartY ) > 1E-9;
+        label.lineIdx += offset;
+        if ( label.horiz ? horizTileBorder : ( vertTileBorder || vertSideBorder ) )
+        {
+          tileBorderLines.insert( label.lineIdx );
+        }
+        gridLabels.append( label );
+      }
+    }
+
     void drawGridLabel( const QPointF &pos, const QString &text, const QFont &font, const QColor &bufferColor )
     {
       QPainterPath path;
@@ -505,10 +819,13 @@ class KadasMapGridLayer::Renderer : public QgsMapLayerRenderer
     }
 };
 
+const int KadasMapGridLayer::sGridCacheSize = 500000;
+
 KadasMapGridLayer::KadasMapGridLayer( const QString &name )
   : KadasPluginLayer( layerTypeKey(), name )
 {
   mValid = true;
+  mGridCache.setMaxCost( sGridCacheSize );
 }
 
 void KadasMapGridLayer::setup( GridType type, double intervalX, double intervalY )
@@ -17,6 +17,12 @@
 #ifndef KADASMAPGRIDLAYER_H
 #define KADASMAPGRIDLAYER_H
 
+#include <QCache>
+#include <QMutex>
+
+#include <qgis/qgscoordinatetransform.h>
+
+#include <kadas/core/kadaslatlontoutm.h>
 #include <kadas/core/kadaspluginlayer.h>
 
 class KadasMapGridLayer : public KadasPluginLayer
@@ -57,12 +63,59 @@ class KadasMapGridLayer : public KadasPluginLayer
   private:
     class Renderer;
 
+    // A piece of a UTM/MGRS grid, i.e. a UTM zone or the part of a UTM zone within a tile of the lon/lat tiling for the cell size
+    struct GridTileKey
+    {
+      int gridMode;
+      int cellSize;
+      int zone;
+      int tileX;
+      int tileY;
+      bool operator==( const GridTileKey &other ) const
+      {
+        return gridMode == other.gridMode && cellSize == other.cellSize && zone == other.zone && tileX == other.tileX && tileY == other.tileY;
+      }
+      friend uint qHash( const GridTileKey &key, uint seed = 0 )
+      {
+        return qHash( qMakePair( qMakePair( key.gridMode, key.cellSize ), qMakePair( key.zone, qMakePair( key.tileX, key.tileY ) ) ), seed );
+      }
+    };
+    struct GridTile
+    {
+      QgsRectangle rect;
+      QList<QPolygonF> lines;
+      QList<KadasLatLonToUTM::ZoneLabel> zoneLabels;
+      QList<KadasLatLonToUTM::GridLabel> gridLabels;
+    };
     GridType mGridType = GridLV95;
     double mIntervalX = 10000;
     double mIntervalY = 10000;
     int mFontSize = 15;
     QColor mColor = Qt::black;
     LabelingMode mLabelingMode = LabelingEnabled;
+
+    // Grid lines of a CRS grid in map coordinates, computed for an area around the last rendered extent
+    struct CrsGrid
+    {
+      QString crs;
+      QgsCoordinateReferenceSystem destCrs;
+      QgsCoordinateTransform transform;
+      double mapUnitsPerPixel = 0;
+      double intervalX = 0;
+      double intervalY = 0;
+      QgsRectangle area;
+      QList<double> xValues;
+      QList<QPolygonF> xLines;
+      QList<double> yValues;
+      QList<QPolygonF> yLines;
+    };
+    QMutex mCrsGridMutex;
+    CrsGrid mCrsGrid;
+
+    // Computed UTM/MGRS grid tiles, cost in number of vertices
+    QMutex mGridCacheMutex;
+    QCache<GridTileKey, GridTile> mGridCache;
+    static const int sGridCacheSize;
 };
 
 
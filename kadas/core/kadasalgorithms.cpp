@@ -15,114 +15,84 @@
  ***************************************************************************/
 
 #include <algorithm>
-#include <list>
 #include <vector>
 
 #include <kadas/core/kadasalgorithms.h>
 
 
-struct Cluster1D
-{
-  int min, max;
-  std::vector<const KadasAlgorithms::Rect *> rects;
-};
-
-struct Cluster2D
-{
-  int x1, y1, x2, y2;
-  std::vector<const KadasAlgorithms::Rect *> rects;
-};
+typedef std::vector<int>::iterator IndexIt;
 
-static int linescan( const std::vector<const KadasAlgorithms::Rect *> &rects, int axis, std::list<Cluster1D> &clusters )
+// Returns the end of the slab starting at begin, i.e. of the run of rects whose [min, max) ranges overlap in a chain.
+// The range must be sorted by min. Also returns the max of the slab.
+template<class MinOf, class MaxOf>
+static IndexIt slabEnd( IndexIt begin, IndexIt end, MinOf minOf, MaxOf maxOf, int &slabMax )
 {
-  if ( axis == 0 )
-  {
-    for ( const KadasAlgorithms::Rect *rect : rects )
-    {
-      clusters.push_back( {rect->x1, rect->x2, {rect}} );
-    }
-  }
-  else
+  slabMax = maxOf( *begin );
+  IndexIt it = begin + 1;
+  for ( ; it != end && minOf( *it ) < slabMax; ++it )
   {
-    for ( const KadasAlgorithms::Rect *rect : rects )
-    {
-      clusters.push_back( {rect->y1, rect->y2, {rect}} );
-    }
+    slabMax = std::max( slabMax, maxOf( *it ) );
   }
-
-  clusters.sort( []( const Cluster1D & c1, const Cluster1D & c2 ) { return c1.min < c2.min; } );
-
-  // Merge neighboring clusters
-  auto it = clusters.begin();
-  int count = it != clusters.end() ? 1 : 0;
-  ++it;
-  while ( it != clusters.end() )
-  {
-    auto prev = it; --prev;
-    Cluster1D &c1 = *prev;
-    Cluster1D &c2 = *it;
-    if ( c2.min < c1.max )
-    {
-      c1.max = std::max( c1.max, c2.max );
-      c1.rects.insert( c1.rects.end(), c2.rects.begin(), c2.rects.end() );
-      it = clusters.erase( it );
-    }
-    else
-    {
-      ++it;
-      ++count;
-    }
-  }
-  return count;
+  return it;
 }
 
-static void clusters( const std::vector<const KadasAlgorithms::Rect *> &rects, std::vector<Cluster2D> &output )
+// Splits the index range at the gaps between the x ranges of the rects, and each x slab at the gaps between the y ranges.
+// An x slab which does not split along y is a cluster, otherwise each of its y slabs is split recursively.
+// The index ranges are sorted in place, hence no rect lists are copied.
+static void xyCut( const std::vector<KadasAlgorithms::Rect> &rects, IndexIt begin, IndexIt end, QList<KadasAlgorithms::Cluster> &output )
 {
-  // Abort condition: y linescan returns a single cluster
-  std::list<Cluster1D> clustersX;
-  linescan( rects, 0, clustersX );
-  for ( const Cluster1D &cx : clustersX )
+  auto x1 = [&rects]( int i ) { return rects[i].x1; };
+  auto x2 = [&rects]( int i ) { return rects[i].x2; };
+  auto y1 = [&rects]( int i ) { return rects[i].y1; };
+  auto y2 = [&rects]( int i ) { return rects[i].y2; };
+
+  std::stable_sort( begin, end, [&rects]( int a, int b ) { return rects[a].x1 < rects[b].x1; } );
+  for ( IndexIt xBegin = begin; xBegin != end; )
   {
-    std::list<Cluster1D> clustersY;
-    int count = linescan( cx.rects, 1, clustersY );
-    if ( count == 1 )
+    int xMin = rects[*xBegin].x1;
+    int xMax = 0;
+    IndexIt xEnd = slabEnd( xBegin, end, x1, x2, xMax );
+
+    std::stable_sort( xBegin, xEnd, [&rects]( int a, int b ) { return rects[a].y1 < rects[b].y1; } );
+    int yMax = 0;
+    IndexIt yEnd = slabEnd( xBegin, xEnd, y1, y2, yMax );
+    if ( yEnd == xEnd )
     {
-      const Cluster1D &cy = clustersY.front();
-      output.push_back( {cx.min, cy.min, cx.max, cy.max, cy.rects} );
+      KadasAlgorithms::Cluster cluster;
+      cluster.x1 = xMin;
+      cluster.y1 = rects[*xBegin].y1;
+      cluster.x2 = xMax;
+      cluster.y2 = yMax;
+      cluster.rects.reserve( xEnd - xBegin );
+      for ( IndexIt it = xBegin; it != xEnd; ++it )
+      {
+        cluster.rects.append( rects[*it] );
+      }
+      output.append( cluster );
     }
     else
     {
-      for ( const Cluster1D &cy : clustersY )
+      for ( IndexIt yBegin = xBegin; yBegin != xEnd; yBegin = yEnd )
       {
-        clusters( cy.rects, output );
+        yEnd = slabEnd( yBegin, xEnd, y1, y2, yMax );
+        xyCut( rects, yBegin, yEnd, output );
       }
     }
+    xBegin = xEnd;
   }
 }
 
 
 QList<KadasAlgorithms::Cluster> KadasAlgorithms::overlappingRects( const QList<Rect> &rects )
 {
-  std::vector<const Rect *> rectp;
-  for ( const Rect &rect : rects )
+  // Copy the rects to contiguous storage and operate on an index array
+  std::vector<Rect> rectv( rects.begin(), rects.end() );
+  std::vector<int> indices( rectv.size() );
+  for ( int i = 0, n = indices.size(); i < n; ++i )
   {
-    rectp.push_back( &rect );
+    indices[i] = i;
   }
-  std::vector<Cluster2D> output;
-  clusters( rectp, output );
-
   QList<Cluster> result;
-  for ( const Cluster2D &c : output )
-  {
-    result.append( Cluster() );
-    result.back().x1 = c.x1;
-    result.back().y1 = c.y1;
-    result.back().x2 = c.x2;
-    result.back().y2 = c.y2;
-    for ( const Rect *rect : c.rects )
-    {
-      result.back().rects.append( *rect );
-    }
-  }
+  xyCut( rectv, indices.begin(), indices.end(), result );
   return result;
 }
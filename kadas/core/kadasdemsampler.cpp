@@ -0,0 +1,494 @@
+/***************************************************************************
+    kadasdemsampler.cpp
+    -------------------
+    copyright            : (C) 2019 by Sandro Mani
+    email                : smani at sourcepole dot ch
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <qmath.h>
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QThread>
+
+#include <qgis/qgscoordinatereferencesystem.h>
+#include <qgis/qgsexception.h>
+#include <qgis/qgslogger.h>
+#include <qgis/qgsmaplayer.h>
+#include <qgis/qgsproject.h>
+#include <qgis/qgsvector.h>
+
+#include <kadas/core/kadas.h>
+#include <kadas/core/kadasdemsampler.h>
+
+const int KadasDemSampler::sMaxCachedTiles = 64;
+const int KadasDemSampler::sMinWindowSamples = 16;
+const int KadasDemSampler::sMaxWindowPixels = 4 * 1024 * 1024;
+
+KadasDemSampler::KadasDemSampler()
+  : mMutex( QMutex::Recursive )
+{
+  // The project is only accessed from the main thread, also if the instance is first requested from a worker thread
+  if ( QCoreApplication::instance() )
+  {
+    moveToThread( QCoreApplication::instance()->thread() );
+  }
+  mTileCache.setMaxCost( sMaxCachedTiles );
+  connect( QgsProject::instance(), &QgsProject::cleared, this, &KadasDemSampler::invalidate );
+  connect( QgsProject::instance(), &QgsProject::readProject, this, &KadasDemSampler::invalidate );
+  connect( QgsProject::instance(), &QgsProject::layersWillBeRemoved, this, [this]( const QStringList & layerIds )
+  {
+    if ( layerIds.contains( mLayerId ) )
+    {
+      invalidate();
+    }
+  } );
+  connect( QgsProject::instance(), &QgsProject::transformContextChanged, this, [this]
+  {
+    QMutexLocker locker( &mMutex );
+    mTransformContext = QgsProject::instance()->transformContext();
+    mTransform = QgsCoordinateTransform();
+  } );
+}
+
+KadasDemSampler::~KadasDemSampler()
+{
+  closeDataset();
+}
+
+KadasDemSampler *KadasDemSampler::instance()
+{
+  static KadasDemSampler instance;
+  return &instance;
+}
+
+void KadasDemSampler::invalidate()
+{
+  QMutexLocker locker( &mMutex );
+  bool wasOpen = mDataset != nullptr;
+  closeDataset();
+  mLayerId.clear();
+  mSource.clear();
+  if ( wasOpen )
+  {
+    emit heightmapChanged();
+  }
+}
+
+bool KadasDemSampler::isValid( QString *errMsg )
+{
+  QMutexLocker locker( &mMutex );
+  return checkHeightmap( errMsg );
+}
+
+double KadasDemSampler::sampleHeight( const QgsPointXY &p, const QgsCoordinateReferenceSystem &crs, QgsUnitTypes::DistanceUnit unit, bool *ok, QString *errMsg )
+{
+  QVector<bool> valid;
+  QVector<double> heights = sampleHeights( QVector<QgsPointXY>() << p, crs, unit, &valid, errMsg );
+  if ( ok )
+  {
+    *ok = valid[0];
+  }
+  return heights[0];
+}
+
+QVector<double> KadasDemSampler::sampleHeights( const QVector<QgsPointXY> &points, const QgsCoordinateReferenceSystem &crs, QgsUnitTypes::DistanceUnit unit, QVector<bool> *valid, QString *errMsg )
+{
+  QVector<double> heights( points.size(), 0. );
+  if ( valid )
+  {
+    valid->fill( false, points.size() );
+  }
+
+  QMutexLocker locker( &mMutex );
+  if ( !checkHeightmap( errMsg ) || !prepareTransform( crs, errMsg ) )
+  {
+    return heights;
+  }
+
+  // Transform all points in one batch, falling back to transforming them one by one on failure
+  int n = points.size();
+  QVector<double> x( n ), y( n ), z( n, 0. );
+  for ( int i = 0; i < n; ++i )
+  {
+    x[i] = points[i].x();
+    y[i] = points[i].y();
+  }
+  QVector<bool> transformed( n, true );
+  try
+  {
+    mTransform.transformCoords( n, x.data(), y.data(), z.data() );
+  }
+  catch ( const QgsCsException & )
+  {
+    for ( int i = 0; i < n; ++i )
+    {
+      try
+      {
+        QgsPointXY pRaster = mTransform.transform( points[i] );
+        x[i] = pRaster.x();
+        y[i] = pRaster.y();
+      }
+      catch ( const QgsCsException & )
+      {
+        transformed[i] = false;
+      }
+    }
+  }
+
+  // Transform raster geo positions to pixel coordinates
+  int rowMin = mHeight;
+  int rowMax = -1;
+  double det = mGtrans[1] * mGtrans[5] - mGtrans[2] * mGtrans[4];
+  for ( int i = 0; i < n; ++i )
+  {
+    double col = ( -mGtrans[0] * mGtrans[5] + mGtrans[2] * mGtrans[3] - mGtrans[2] * y[i] + mGtrans[5] * x[i] ) / det;
+    double row = ( mGtrans[0] * mGtrans[4] - mGtrans[1] * mGtrans[3] + mGtrans[1] * y[i] - mGtrans[4] * x[i] ) / det;
+    x[i] = col;
+    y[i] = row;
+    if ( transformed[i] && col >= 0 && row >= 0 && col < mWidth && row < mHeight )
+    {
+      rowMin = qMin( rowMin, qFloor( row ) );
+      rowMax = qMax( rowMax, qMin( qFloor( row ) + 1, mHeight - 1 ) );
+    }
+  }
+
+  // Read the pixels needed by the interpolation row by row, each row only spanning the columns of the samples on it (i.e.
+  // a narrow band along the segments of a profile). Few samples or too many pixels go through the tile cache instead.
+  if ( n >= sMinWindowSamples && rowMax >= rowMin )
+  {
+    mWindowRowStart = rowMin;
+    mWindowRows = QVector<WindowRow>( rowMax - rowMin + 1 );
+    for ( int i = 0; i < n; ++i )
+    {
+      if ( !transformed[i] || x[i] < 0 || y[i] < 0 || x[i] >= mWidth || y[i] >= mHeight )
+      {
+        continue;
+      }
+      int col0 = qFloor( x[i] );
+      int col1 = qMin( col0 + 1, mWidth - 1 );
+      int row0 = qFloor( y[i] );
+      int row1 = qMin( row0 + 1, mHeight - 1 );
+      for ( int row = row0; row <= row1; ++row )
+      {
+        WindowRow &windowRow = mWindowRows[row - rowMin];
+        bool empty = windowRow.colEnd < windowRow.colStart;
+        windowRow.colStart = empty ? col0 : qMin( windowRow.colStart, col0 );
+        windowRow.colEnd = empty ? col1 : qMax( windowRow.colEnd, col1 );
+      }
+    }
+    qint64 nPixels = 0;
+    for ( WindowRow &windowRow : mWindowRows )
+    {
+      windowRow.offset = nPixels;
+      nPixels += windowRow.colEnd - windowRow.colStart + 1;
+    }
+    if ( nPixels <= sMaxWindowPixels )
+    {
+      mWindowData.resize( nPixels );
+      for ( int i = 0, nRows = mWindowRows.size(); i < nRows; ++i )
+      {
+        WindowRow &windowRow = mWindowRows[i];
+        int width = windowRow.colEnd - windowRow.colStart + 1;
+        if ( width > 0 && CE_None != GDALRasterIO( mBand, GF_Read, windowRow.colStart, rowMin + i, width, 1,
+             mWindowData.data() + windowRow.offset, width, 1, GDT_Float32, 0, 0 ) )
+        {
+          // Fall back to the tile cache for this row
+          windowRow.colEnd = windowRow.colStart - 1;
+        }
+      }
+    }
+    else
+    {
+      mWindowRows.clear();
+    }
+  }
+
+  double heightConversion = QgsUnitTypes::fromUnitToUnitFactor( mVertUnit, unit );
+  bool allValid = true;
+  for ( int i = 0; i < n; ++i )
+  {
+    double value = 0;
+    if ( transformed[i] && samplePixelPos( x[i], y[i], value ) )
+    {
+      heights[i] = value * heightConversion;
+      if ( valid )
+      {
+        ( *valid )[i] = true;
+      }
+    }
+    else
+    {
+      allValid = false;
+    }
+  }
+  mWindowRows.clear();
+  mWindowData.clear();
+  if ( !allValid && errMsg )
+  {
+    *errMsg = tr( "Failed to read pixel values" );
+  }
+  return heights;
+}
+
+QVector<double> KadasDemSampler::samplePolyline( const QList<QgsPointXY> &points, const QgsCoordinateReferenceSystem &crs, int nSamples, QgsUnitTypes::DistanceUnit unit, QVector<QgsPointXY> *samplePoints, QVector<bool> *valid, QString *errMsg )
+{
+  QVector<QgsPointXY> positions = polylineSamplePoints( points, nSamples );
+  if ( samplePoints )
+  {
+    *samplePoints = positions;
+  }
+  return sampleHeights( positions, crs, unit, valid, errMsg );
+}
+
+QVector<QgsPointXY> KadasDemSampler::polylineSamplePoints( const QList<QgsPointXY> &points, int nSamples )
+{
+  QVector<QgsPointXY> positions;
+  QVector<double> segmentLengths;
+  double totLength = 0;
+  for ( int i = 0, n = points.size() - 1; i < n; ++i )
+  {
+    segmentLengths.append( qSqrt( points[i + 1].sqrDist( points[i] ) ) );
+    totLength += segmentLengths.back();
+  }
+  if ( nSamples <= 0 || totLength <= 0 )
+  {
+    return positions;
+  }
+  positions.reserve( nSamples + 1 );
+
+  double x = 0;
+  for ( int i = 0, n = points.size() - 1; i < n; ++i )
+  {
+    if ( x >= segmentLengths[i] )
+    {
+      x -= segmentLengths[i];
+      continue;
+    }
+    QgsVector dir = QgsVector( points[i + 1] - points[i] ).normalized();
+    while ( x < segmentLengths[i] )
+    {
+      positions.append( points[i] + dir * x );
+      x += totLength / nSamples;
+    }
+    x -= segmentLengths[i];
+  }
+  return positions;
+}
+
+bool KadasDemSampler::checkHeightmap( QString *errMsg )
+{
+  // The project may only be queried from the main thread, worker threads use the current dataset
+  if ( QThread::currentThread() != thread() )
+  {
+    if ( !mDataset && errMsg )
+    {
+      *errMsg = tr( "No heightmap is defined in the project." );
+    }
+    return mDataset != nullptr;
+  }
+
+  mTransformContext = QgsProject::instance()->transformContext();
+  QString layerid = QgsProject::instance()->readEntry( "Heightmap", "layer" );
+  QgsMapLayer *layer = QgsProject::instance()->mapLayer( layerid );
+  if ( !layer || layer->type() != QgsMapLayerType::RasterLayer )
+  {
+    if ( mDataset )
+    {
+      closeDataset();
+      emit heightmapChanged();
+    }
+    mLayerId.clear();
+    mSource.clear();
+    if ( errMsg )
+    {
+      *errMsg = tr( "No heightmap is defined in the project." );
+    }
+    return false;
+  }
+  QString rasterFile = Kadas::gdalSource( layer );
+  if ( layerid == mLayerId && rasterFile == mSource )
+  {
+    if ( !mDataset && errMsg )
+    {
+      *errMsg = tr( "Failed to open raster file: %1" ).arg( rasterFile );
+    }
+    return mDataset != nullptr;
+  }
+
+  bool wasOpen = mDataset != nullptr;
+  closeDataset();
+  mLayerId = layerid;
+  mSource = rasterFile;
+  bool success = !rasterFile.isNull() && openDataset( rasterFile, errMsg );
+  if ( wasOpen || success )
+  {
+    emit heightmapChanged();
+  }
+  return success;
+}
+
+bool KadasDemSampler::openDataset( const QString &source, QString *errMsg )
+{
+  mDataset = GDALOpen( source.toLocal8Bit().data(), GA_ReadOnly );
+  if ( !mDataset )
+  {
+    if ( errMsg )
+    {
+      *errMsg = tr( "Failed to open raster file: %1" ).arg( source );
+    }
+    return false;
+  }
+
+  if ( GDALGetGeoTransform( mDataset, &mGtrans[0] ) != CE_None )
+  {
+    if ( errMsg )
+    {
+      *errMsg = tr( "Failed to get raster geotransform" );
+    }
+    closeDataset();
+    return false;
+  }
+
+  QString proj( GDALGetProjectionRef( mDataset ) );
+  mRasterCrs = QgsCoordinateReferenceSystem::fromWkt( proj );
+  if ( !mRasterCrs.isValid() )
+  {
+    if ( errMsg )
+    {
+      *errMsg = tr( "Failed to get raster CRS" );
+    }
+    closeDataset();
+    return false;
+  }
+
+  mBand = GDALGetRasterBand( mDataset, 1 );
+  if ( !mBand )
+  {
+    if ( errMsg )
+    {
+      *errMsg = tr( "Failed to open raster band 0" );
+    }
+    closeDataset();
+    return false;
+  }
+
+  mWidth = GDALGetRasterXSize( mDataset );
+  mHeight = GDALGetRasterYSize( mDataset );
+  int hasNoData = 0;
+  mNoDataValue = GDALGetRasterNoDataValue( mBand, &hasNoData );
+  mHasNoData = hasNoData != 0;
+  mVertUnit = strcmp( GDALGetRasterUnitType( mBand ), "ft" ) == 0 ? QgsUnitTypes::DistanceFeet : QgsUnitTypes::DistanceMeters;
+
+  // Read along the native blocks unless they are degenerate (i.e. scanlines)
+  int blockSizeX = 0, blockSizeY = 0;
+  GDALGetBlockSize( mBand, &blockSizeX, &blockSizeY );
+  mTileSizeX = blockSizeX >= 64 && blockSizeX <= 1024 ? blockSizeX : 256;
+  mTileSizeY = blockSizeY >= 64 && blockSizeY <= 1024 ? blockSizeY : 256;
+  return true;
+}
+
+void KadasDemSampler::closeDataset()
+{
+  if ( mDataset )
+  {
+    GDALClose( mDataset );
+  }
+  mDataset = nullptr;
+  mBand = nullptr;
+  mTransform = QgsCoordinateTransform();
+  mTileCache.clear();
+}
+
+bool KadasDemSampler::prepareTransform( const QgsCoordinateReferenceSystem &crs, QString *errMsg )
+{
+  if ( mTransform.isValid() && mTransform.sourceCrs() == crs )
+  {
+    return true;
+  }
+  mTransform = QgsCoordinateTransform( crs, mRasterCrs, mTransformContext );
+  if ( !mTransform.isValid() )
+  {
+    if ( errMsg )
+    {
+      *errMsg = tr( "Failed to transform position to raster CRS" );
+    }
+    return false;
+  }
+  return true;
+}
+
+bool KadasDemSampler::pixelValue( int col, int row, double &value )
+{
+  int windowRow = row - mWindowRowStart;
+  if ( windowRow >= 0 && windowRow < mWindowRows.size() && col >= mWindowRows[windowRow].colStart && col <= mWindowRows[windowRow].colEnd )
+  {
+    value = mWindowData[mWindowRows[windowRow].offset + col - mWindowRows[windowRow].colStart];
+    return !mHasNoData || value != float( mNoDataValue );
+  }
+  int tileX = col / mTileSizeX;
+  int tileY = row / mTileSizeY;
+  quint64 key = ( quint64( tileY ) << 32 ) | quint64( tileX );
+  Tile *tile = mTileCache.object( key );
+  if ( !tile )
+  {
+    tile = new Tile;
+    tile->width = qMin( mTileSizeX, mWidth - tileX * mTileSizeX );
+    tile->height = qMin( mTileSizeY, mHeight - tileY * mTileSizeY );
+    tile->data.resize( tile->width * tile->height );
+    if ( CE_None != GDALRasterIO( mBand, GF_Read, tileX * mTileSizeX, tileY * mTileSizeY, tile->width, tile->height,
+                                  tile->data.data(), tile->width, tile->height, GDT_Float32, 0, 0 ) )
+    {
+      QgsDebugMsg( "Failed to read pixel values" );
+      delete tile;
+      return false;
+    }
+    mTileCache.insert( key, tile );
+  }
+  value = tile->data[( row - tileY * mTileSizeY ) * tile->width + ( col - tileX * mTileSizeX )];
+  return !mHasNoData || value != float( mNoDataValue );
+}
+
+bool KadasDemSampler::samplePixelPos( double col, double row, double &value )
+{
+  if ( col < 0 || row < 0 || col >= mWidth || row >= mHeight )
+  {
+    return false;
+  }
+  int col0 = qFloor( col );
+  int row0 = qFloor( row );
+  int col1 = qMin( col0 + 1, mWidth - 1 );
+  int row1 = qMin( row0 + 1, mHeight - 1 );
+
+  // Interpolate values, skipping nodata pixels
+  double lambdaR = row - row0;
+  double lambdaC = col - col0;
+  int cols[4] = {col0, col1, col0, col1};
+  int rows[4] = {row0, row0, row1, row1};
+  double weights[4] = {( 1. - lambdaC ) * ( 1. - lambdaR ), lambdaC * ( 1. - lambdaR ), ( 1. - lambdaC ) * lambdaR, lambdaC * lambdaR};
+  double sum = 0;
+  double weightSum = 0;
+  for ( int i = 0; i < 4; ++i )
+  {
+    double pixValue = 0;
+    if ( pixelValue( cols[i], rows[i], pixValue ) )
+    {
+      sum += weights[i] * pixValue;
+      weightSum += weights[i];
+    }
+  }
+  if ( weightSum <= 0 )
+  {
+    return false;
+  }
+  value = sum / weightSum;
+  return true;
+}
@@ -0,0 +1,124 @@
+/***************************************************************************
+    kadasdemsampler.h
+    -----------------
+    copyright            : (C) 2019 by Sandro Mani
+    email                : smani at sourcepole dot ch
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef KADASDEMSAMPLER_H
+#define KADASDEMSAMPLER_H
+
+#include <QCache>
+#include <QMutex>
+#include <QObject>
+#include <QVector>
+
+#include <gdal.h>
+
+#include <qgis/qgscoordinatetransform.h>
+#include <qgis/qgscoordinatetransformcontext.h>
+#include <qgis/qgspointxy.h>
+#include <qgis/qgsunittypes.h>
+
+#include <kadas/core/kadas_core.h>
+
+/**Samples the heightmap configured in the project ("Heightmap" entry).
+  The dataset is kept open and read in tiles which are kept in a LRU cache, so that repeated
+  queries (i.e. the height display in the statusbar) do not hit the disk. Batch queries
+  transform all positions at once and read the pixels around them row by row, each row
+  limited to the columns covered by the samples.
+  The sampler is reset whenever the heightmap entry, the heightmap layer or its source changes.
+  Queries are serialized internally and can be performed from worker threads; the project
+  (heightmap entry, layer and transform context) is however only accessed from the main thread.*/
+class KADAS_CORE_EXPORT KadasDemSampler : public QObject
+{
+    Q_OBJECT
+  public:
+    static KadasDemSampler *instance();
+    ~KadasDemSampler();
+
+    /**Returns whether a usable heightmap is available*/
+    bool isValid( QString *errMsg = 0 );
+
+    /**Bilinearly interpolated height at the specified position, in the specified unit.
+      Returns 0 and sets ok to false if no height could be determined.*/
+    double sampleHeight( const QgsPointXY &p, const QgsCoordinateReferenceSystem &crs, QgsUnitTypes::DistanceUnit unit, bool *ok = 0, QString *errMsg = 0 );
+
+    /**Bilinearly interpolated heights at the specified positions, in the specified unit.
+      Positions for which no height can be determined are set to 0 and flagged in valid (if specified).*/
+    QVector<double> sampleHeights( const QVector<QgsPointXY> &points, const QgsCoordinateReferenceSystem &crs, QgsUnitTypes::DistanceUnit unit, QVector<bool> *valid = 0, QString *errMsg = 0 );
+
+    /**Samples nSamples equidistant heights along the specified polyline, in the specified unit.
+      The sample positions are stored in samplePoints (if specified).*/
+    QVector<double> samplePolyline( const QList<QgsPointXY> &points, const QgsCoordinateReferenceSystem &crs, int nSamples, QgsUnitTypes::DistanceUnit unit, QVector<QgsPointXY> *samplePoints = 0, QVector<bool> *valid = 0, QString *errMsg = 0 );
+
+    /**Returns nSamples equidistant positions along the specified polyline*/
+    static QVector<QgsPointXY> polylineSamplePoints( const QList<QgsPointXY> &points, int nSamples );
+
+  public slots:
+    /**Closes the dataset and clears the cache, the heightmap is reopened on the next query*/
+    void invalidate();
+
+  signals:
+    void heightmapChanged();
+
+  private:
+    KadasDemSampler() SIP_FORCE;
+
+    struct Tile
+    {
+      int width = 0;
+      int height = 0;
+      QVector<float> data;
+    };
+    struct WindowRow
+    {
+      int colStart = 0;
+      int colEnd = -1;
+      int offset = 0;
+    };
+
+    static const int sMaxCachedTiles;
+    static const int sMinWindowSamples;
+    static const int sMaxWindowPixels;
+
+    QMutex mMutex;
+    QString mLayerId;
+    QString mSource;
+    GDALDatasetH mDataset = nullptr;
+    GDALRasterBandH mBand = nullptr;
+    int mWidth = 0;
+    int mHeight = 0;
+    int mTileSizeX = 256;
+    int mTileSizeY = 256;
+    double mGtrans[6] = {};
+    double mNoDataValue = 0;
+    bool mHasNoData = false;
+    QgsUnitTypes::DistanceUnit mVertUnit = QgsUnitTypes::DistanceMeters;
+    QgsCoordinateReferenceSystem mRasterCrs;
+    QgsCoordinateTransformContext mTransformContext;
+    QgsCoordinateTransform mTransform;
+    QCache<quint64, Tile> mTileCache;
+    // Pixels read for the current batch query, by raster row starting at mWindowRowStart
+    int mWindowRowStart = 0;
+    QVector<WindowRow> mWindowRows;
+    QVector<float> mWindowData;
+
+    bool checkHeightmap( QString *errMsg );
+    bool openDataset( const QString &source, QString *errMsg );
+    void closeDataset();
+    bool prepareTransform( const QgsCoordinateReferenceSystem &crs, QString *errMsg );
+    bool pixelValue( int col, int row, double &value );
+    bool samplePixelPos( double col, double row, double &value );
+};
+
+#endif // KADASDEMSAMPLER_H
@@ -14,9 +14,14 @@
  *                                                                         *
  ***************************************************************************/
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include <qmath.h>
 
 #include <qgis/qgsdistancearea.h>
+#include <qgis/qgsrectangle.h>
 #include <qgis/qgspoint.h>
 
 #include <kadas/core/kadaslatlontoutm.h>
@@ -26,6 +31,88 @@ const int KadasLatLonToUTM::NUM_100K_SETS = 6;
 const QString KadasLatLonToUTM::SET_ORIGIN_COLUMN_LETTERS = "AJSAJS";
 const QString KadasLatLonToUTM::SET_ORIGIN_ROW_LETTERS = "AFAFAF";
 
+// WGS84 ellipsoid and UTM projection constants
+static const double UTM_K0 = 0.9996;
+static const double UTM_A = 6378137.0; //ellip.radius;
+static const double UTM_ECC_SQR = 0.00669438; //ellip.eccsq;
+static const double UTM_ECC_PRIME_SQR = UTM_ECC_SQR / ( 1 - UTM_ECC_SQR );
+static const double UTM_E1 = ( 1 - std::sqrt( 1 - UTM_ECC_SQR ) ) / ( 1 + std::sqrt( 1 - UTM_ECC_SQR ) );
+// Coefficients of the meridional arc series
+static const double UTM_M0 = 1 - UTM_ECC_SQR / 4 - 3 * UTM_ECC_SQR * UTM_ECC_SQR / 64 - 5 * UTM_ECC_SQR * UTM_ECC_SQR * UTM_ECC_SQR / 256;
+static const double UTM_M2 = 3 * UTM_ECC_SQR / 8 + 3 * UTM_ECC_SQR * UTM_ECC_SQR / 32 + 45 * UTM_ECC_SQR * UTM_ECC_SQR * UTM_ECC_SQR / 1024;
+static const double UTM_M4 = 15 * UTM_ECC_SQR * UTM_ECC_SQR / 256 + 45 * UTM_ECC_SQR * UTM_ECC_SQR * UTM_ECC_SQR / 1024;
+static const double UTM_M6 = 35 * UTM_ECC_SQR * UTM_ECC_SQR * UTM_ECC_SQR / 3072;
+// Coefficients of the footpoint latitude series
+static const double UTM_PHI2 = 3 * UTM_E1 / 2 - 27 * UTM_E1 * UTM_E1 * UTM_E1 / 32;
+static const double UTM_PHI4 = 21 * UTM_E1 * UTM_E1 / 16 - 55 * UTM_E1 * UTM_E1 * UTM_E1 * UTM_E1 / 32;
+static const double UTM_PHI6 = 151 * UTM_E1 * UTM_E1 * UTM_E1 / 96;
+
+static inline double utmLongOrigin( int zoneNumber )
+{
+  // There are 60 zones with zone 1 being at West -180 to -174, +3 puts origin in middle of zone
+  return ( zoneNumber - 1 ) * 6 - 180 + 3;
+}
+
+// Easting without the 500,000 meter offset, northing without the 10,000,000 meter southern hemisphere offset, longitude relative to the zone origin
+static inline void utmToLatLon( double x, double y, double &lonRel, double &lat )
+{
+  double mu = y / UTM_K0 / ( UTM_A * UTM_M0 );
+  // sin(4mu) and sin(6mu) from sin(2mu) and cos(2mu)
+  double sin2mu = std::sin( 2 * mu );
+  double cos2mu = std::cos( 2 * mu );
+  double sin4mu = 2 * sin2mu * cos2mu;
+  double sin6mu = sin2mu * ( 3 - 4 * sin2mu * sin2mu );
+  double phi1Rad = mu + UTM_PHI2 * sin2mu + UTM_PHI4 * sin4mu + UTM_PHI6 * sin6mu;
+
+  double sinPhi1 = std::sin( phi1Rad );
+  double cosPhi1 = std::cos( phi1Rad );
+  double tanPhi1 = sinPhi1 / cosPhi1;
+  double w = 1 - UTM_ECC_SQR * sinPhi1 * sinPhi1;
+  double N1 = UTM_A / std::sqrt( w );
+  double T1 = tanPhi1 * tanPhi1;
+  double C1 = UTM_ECC_PRIME_SQR * cosPhi1 * cosPhi1;
+  double R1 = UTM_A * ( 1 - UTM_ECC_SQR ) / ( w * std::sqrt( w ) );
+  double D = x / ( N1 * UTM_K0 );
+  double D2 = D * D;
+  double D3 = D2 * D;
+  double D4 = D2 * D2;
+  double D5 = D4 * D;
+  double D6 = D4 * D2;
+
+  lat = phi1Rad - ( N1 * tanPhi1 / R1 ) * ( D2 / 2 - ( 5 + 3 * T1 + 10 * C1 - 4 * C1 * C1 - 9 * UTM_ECC_PRIME_SQR ) * D4 / 24 + ( 61 + 90 * T1 + 298 * C1 + 45 * T1 * T1 - 252 * UTM_ECC_PRIME_SQR - 3 * C1 * C1 ) * D6 / 720 );
+  lat = lat / M_PI * 180.;
+
+  lonRel = ( D - ( 1 + 2 * T1 + C1 ) * D3 / 6 + ( 5 - 2 * C1 + 28 * T1 - 3 * C1 * C1 + 8 * UTM_ECC_PRIME_SQR + 24 * T1 * T1 ) * D5 / 120 ) / cosPhi1;
+  lonRel = lonRel / M_PI * 180.;
+}
+
+// Easting and northing without offsets
+static inline void latLonToUtm( double lonRelRad, double latRad, double &x, double &y )
+{
+  double sinLat = std::sin( latRad );
+  double cosLat = std::cos( latRad );
+  double tanLat = sinLat / cosLat;
+  // sin(2lat), sin(4lat) and sin(6lat) from sin(lat) and cos(lat)
+  double sin2Lat = 2 * sinLat * cosLat;
+  double cos2Lat = cosLat * cosLat - sinLat * sinLat;
+  double sin4Lat = 2 * sin2Lat * cos2Lat;
+  double sin6Lat = sin2Lat * ( 3 - 4 * sin2Lat * sin2Lat );
+
+  double N = UTM_A / std::sqrt( 1 - UTM_ECC_SQR * sinLat * sinLat );
+  double T = tanLat * tanLat;
+  double C = UTM_ECC_PRIME_SQR * cosLat * cosLat;
+  double A = cosLat * lonRelRad;
+  double A2 = A * A;
+  double A3 = A2 * A;
+  double A4 = A2 * A2;
+  double A5 = A4 * A;
+  double A6 = A4 * A2;
+  double M = UTM_A * ( UTM_M0 * latRad - UTM_M2 * sin2Lat + UTM_M4 * sin4Lat - UTM_M6 * sin6Lat );
+
+  x = UTM_K0 * N * ( A + ( 1 - T + C ) * A3 / 6.0 + ( 5 - 18 * T + T * T + 72 * C - 58 * UTM_ECC_PRIME_SQR ) * A5 / 120.0 );
+  y = UTM_K0 * ( M + N * tanLat * ( A2 / 2 + ( 5 - T + 9 * C + 4 * C * C ) * A4 / 24.0 + ( 61 - 58 * T + T * T + 600 * C - 330 * UTM_ECC_PRIME_SQR ) * A6 / 720.0 ) );
+}
+
 QgsPointXY KadasLatLonToUTM::UTM2LL( const UTMCoo &utm, bool &ok )
 {
   ok = false;
@@ -35,93 +122,74 @@ QgsPointXY KadasLatLonToUTM::UTM2LL( const UTMCoo &utm, bool &ok )
   {
     return QgsPointXY();
   }
+  double easting = utm.easting;
+  double northing = utm.northing;
+  double lon, lat;
+  ok = UTM2LL( &easting, &northing, 1, utm.zoneNumber, utm.zoneLetter.at( 0 ).toLatin1(), &lon, &lat );
+  return ok ? QgsPointXY( lon, lat ) : QgsPointXY();
+}
 
-  const double k0 = 0.9996;
-  const double a = 6378137.0; //ellip.radius;
-  const double eccSquared = 0.00669438; //ellip.eccsq;
-  double e1 = ( 1 - qSqrt( 1 - eccSquared ) ) / ( 1 + qSqrt( 1 - eccSquared ) );
-
-  // remove 500,000 meter offset for longitude
-  double x = utm.easting - 500000.0;
-  double y = utm.northing;
+bool KadasLatLonToUTM::UTM2LL( const double *easting, const double *northing, int n, int zoneNumber, char zoneLetter, double *lon, double *lat )
+{
+  if ( zoneNumber < 0 || zoneNumber > 60 || zoneLetter == '\0' )
+  {
+    return false;
+  }
 
   // We must know somehow if we are in the Northern or Southern
   // hemisphere, this is the only time we use the letter So even
   // if the Zone letter isn't exactly correct it should indicate
   // the hemisphere correctly
-  if ( utm.zoneLetter.at( 0 ) < 'N' )
+  double falseNorthing = zoneLetter < 'N' ? 10000000.0 : 0.;
+  double longOrigin = utmLongOrigin( zoneNumber );
+
+  for ( int i = 0; i < n; ++i )
   {
-    y -= 10000000.0; // remove 10,000,000 meter offset used
-    // for southern hemisphere
+    double lonRel;
+    utmToLatLon( easting[i] - 500000.0, northing[i] - falseNorthing, lonRel, lat[i] );
+    lon[i] = longOrigin + lonRel;
   }
-
-  // There are 60 zones with zone 1 being at West -180 to -174
-  double LongOrigin = ( utm.zoneNumber - 1 ) * 6 - 180 + 3; // +3 puts origin in middle of zone
-
-  double eccPrimeSquared = ( eccSquared ) / ( 1 - eccSquared );
-
-  double M = y / k0;
-  double mu = M / ( a * ( 1 - eccSquared / 4 - 3 * eccSquared * eccSquared / 64 - 5 * eccSquared * eccSquared * eccSquared / 256 ) );
-
-  double phi1Rad = mu + ( 3 * e1 / 2 - 27 * e1 * e1 * e1 / 32 ) * qSin( 2 * mu ) + ( 21 * e1 * e1 / 16 - 55 * e1 * e1 * e1 * e1 / 32 ) * qSin( 4 * mu ) + ( 151 * e1 * e1 * e1 / 96 ) * qSin( 6 * mu );
-  // double phi1 = ProjMath.radToDeg(phi1Rad);
-
-  double N1 = a / qSqrt( 1 - eccSquared * qSin( phi1Rad ) * qSin( phi1Rad ) );
-  double T1 = qTan( phi1Rad ) * qTan( phi1Rad );
-  double C1 = eccPrimeSquared * qCos( phi1Rad ) * qCos( phi1Rad );
-  double R1 = a * ( 1 - eccSquared ) / qPow( 1 - eccSquared * qSin( phi1Rad ) * qSin( phi1Rad ), 1.5 );
-  double D = x / ( N1 * k0 );
-
-  double lat = phi1Rad - ( N1 * qTan( phi1Rad ) / R1 ) * ( D * D / 2 - ( 5 + 3 * T1 + 10 * C1 - 4 * C1 * C1 - 9 * eccPrimeSquared ) * D * D * D * D / 24 + ( 61 + 90 * T1 + 298 * C1 + 45 * T1 * T1 - 252 * eccPrimeSquared - 3 * C1 * C1 ) * D * D * D * D * D * D / 720 );
-  lat = lat / M_PI * 180.;
-
-  double lon = ( D - ( 1 + 2 * T1 + C1 ) * D * D * D / 6 + ( 5 - 2 * C1 + 28 * T1 - 3 * C1 * C1 + 8 * eccPrimeSquared + 24 * T1 * T1 ) * D * D * D * D * D / 120 ) / qCos( phi1Rad );
-  lon = LongOrigin + lon / M_PI * 180.;
-
-  ok = true;
-  return QgsPointXY( lon, lat );
+  return true;
 }
 
 KadasLatLonToUTM::UTMCoo KadasLatLonToUTM::LL2UTM( const QgsPointXY &pLatLong )
 {
-  const double a = 6378137.0; //ellip.radius;
-  const double eccSqr = 0.00669438; //ellip.eccsq;
-  const double k0 = 0.9996;
-
-  double Long = pLatLong.x();
-  double Lat = pLatLong.y();
-  double LatRad = Lat / 180. * M_PI;
-  double LongRad = Long / 180. * M_PI;
-  int ZoneNumber = getZoneNumber( Long, Lat );
-
-  //+3 puts origin in middle of zone
-  double LongOriginRad = ( ( ZoneNumber - 1 ) * 6 - 180 + 3 ) / 180. * M_PI;
-
-  double eccPrimeSquared = ( eccSqr ) / ( 1 - eccSqr );
-
-  double N = a / qSqrt( 1 - eccSqr * qSin( LatRad ) * qSin( LatRad ) );
-  double T = qTan( LatRad ) * qTan( LatRad );
-  double C = eccPrimeSquared * qCos( LatRad ) * qCos( LatRad );
-  double A = qCos( LatRad ) * ( LongRad - LongOriginRad );
-  double M = a * (
-               ( 1 - eccSqr / 4 - 3 * eccSqr * eccSqr / 64 - 5 * eccSqr * eccSqr * eccSqr / 256 ) * LatRad -
-               ( 3 * eccSqr / 8 + 3 * eccSqr * eccSqr / 32 + 45 * eccSqr * eccSqr * eccSqr / 1024 ) * qSin( 2 * LatRad ) +
-               ( 15 * eccSqr * eccSqr / 256 + 45 * eccSqr * eccSqr * eccSqr / 1024 ) * qSin( 4 * LatRad ) -
-               ( 35 * eccSqr * eccSqr * eccSqr / 3072 ) * qSin( 6 * LatRad ) );
+  double lon = pLatLong.x();
+  double lat = pLatLong.y();
+  double easting, northing;
+  int zoneNumber;
+  char zoneLetter;
+  LL2UTM( &lon, &lat, 1, &easting, &northing, &zoneNumber, &zoneLetter );
 
   UTMCoo coo;
+  coo.easting = easting;
+  // Truncate before applying the southern hemisphere offset
+  coo.northing = lat < 0.0 ? static_cast<int>( northing - 10000000.0 ) + 10000000 : static_cast<int>( northing );
+  coo.zoneNumber = zoneNumber;
+  coo.zoneLetter = QString( QChar( zoneLetter ) );
+  return coo;
+}
 
-  coo.easting = ( k0 * N * ( A + ( 1 - T + C ) * A * A * A / 6.0 + ( 5 - 18 * T + T * T + 72 * C - 58 * eccPrimeSquared ) * A * A * A * A * A / 120.0 ) + 500000.0 );
-
-  coo.northing = ( k0 * ( M + N * qTan( LatRad ) * ( A * A / 2 + ( 5 - T + 9 * C + 4 * C * C ) * A * A * A * A / 24.0 + ( 61 - 58 * T + T * T + 600 * C - 330 * eccPrimeSquared ) * A * A * A * A * A * A / 720.0 ) ) );
-  if ( Lat < 0.0 )
-  {
-    coo.northing += 10000000.0; //10000000 meter offset for southern hemisphere
+void KadasLatLonToUTM::LL2UTM( const double *lon, const double *lat, int n, double *easting, double *northing, int *zoneNumber, char *zoneLetter )
+{
+  for ( int i = 0; i < n; ++i )
+  {
+    int zone = getZoneNumber( lon[i], lat[i] );
+    double longOriginRad = utmLongOrigin( zone ) / 180. * M_PI;
+    double x, y;
+    latLonToUtm( lon[i] / 180. * M_PI - longOriginRad, lat[i] / 180. * M_PI, x, y );
+    easting[i] = x + 500000.0;
+    //10000000 meter offset for southern hemisphere
+    northing[i] = lat[i] < 0.0 ? y + 10000000.0 : y;
+    if ( zoneNumber )
+    {
+      zoneNumber[i] = zone;
+    }
+    if ( zoneLetter )
+    {
+      zoneLetter[i] = hemisphereLetter( lat[i] );
+    }
   }
-
-  coo.zoneNumber = ZoneNumber;
-  coo.zoneLetter = getHemisphereLetter( Lat );
-  return coo;
 }
 
 int KadasLatLonToUTM::getZoneNumber( double lon, double lat )
@@ -165,89 +233,23 @@ int KadasLatLonToUTM::getZoneNumber( double lon, double lat )
 
 QString KadasLatLonToUTM::getHemisphereLetter( double lat )
 {
-  if ( ( 84 >= lat ) && ( lat >= 72 ) )
-  {
-    return "X";
-  }
-  else if ( ( 72 > lat ) && ( lat >= 64 ) )
-  {
-    return "W";
-  }
-  else if ( ( 64 > lat ) && ( lat >= 56 ) )
-  {
-    return "V";
-  }
-  else if ( ( 56 > lat ) && ( lat >= 48 ) )
-  {
-    return "U";
-  }
-  else if ( ( 48 > lat ) && ( lat >= 40 ) )
-  {
-    return "T";
-  }
-  else if ( ( 40 > lat ) && ( lat >= 32 ) )
-  {
-    return "S";
-  }
-  else if ( ( 32 > lat ) && ( lat >= 24 ) )
-  {
-    return "R";
-  }
-  else if ( ( 24 > lat ) && ( lat >= 16 ) )
-  {
-    return "Q";
-  }
-  else if ( ( 16 > lat ) && ( lat >= 8 ) )
-  {
-    return "P";
-  }
-  else if ( ( 8 > lat ) && ( lat >= 0 ) )
-  {
-    return "N";
-  }
-  else if ( ( 0 > lat ) && ( lat >= -8 ) )
-  {
-    return "M";
-  }
-  else if ( ( -8 > lat ) && ( lat >= -16 ) )
-  {
-    return "L";
-  }
-  else if ( ( -16 > lat ) && ( lat >= -24 ) )
-  {
-    return "K";
-  }
-  else if ( ( -24 > lat ) && ( lat >= -32 ) )
-  {
-    return "J";
-  }
-  else if ( ( -32 > lat ) && ( lat >= -40 ) )
-  {
-    return "H";
-  }
-  else if ( ( -40 > lat ) && ( lat >= -48 ) )
-  {
-    return "G";
-  }
-  else if ( ( -48 > lat ) && ( lat >= -56 ) )
-  {
-    return "F";
-  }
-  else if ( ( -56 > lat ) && ( lat >= -64 ) )
-  {
-    return "E";
-  }
-  else if ( ( -64 > lat ) && ( lat >= -72 ) )
+  return QString( QChar( hemisphereLetter( lat ) ) );
+}
+
+char KadasLatLonToUTM::hemisphereLetter( double lat )
+{
+  //'Z' is an error flag to show that the Latitude is outside MGRS limits
+  if ( !( lat >= -80 && lat <= 84 ) )
   {
-    return "D";
+    return 'Z';
   }
-  else if ( ( -72 > lat ) && ( lat >= -80 ) )
+  if ( lat >= 72 )
   {
-    return "C";
+    return 'X';
   }
-
-  //This is an error flag to show that the Latitude is outside MGRS limits
-  return "Z";
+  // 8 degree bands starting at -80
+  static const char letters[] = "CDEFGHJKLMNPQRSTUVW";
+  return letters[static_cast<int>( ( lat + 80 ) / 8 )];
 }
 
 KadasLatLonToUTM::MGRSCoo KadasLatLonToUTM::UTM2MGRS( const UTMCoo &utmcoo )
@@ -594,110 +596,56 @@ static inline void truncateGridLine( double &x1, double &x2, double &y1, double
   }
 }
 
-static inline QPointF truncateGridLineYMax( const QPointF &p, const QPointF &q, double xMin, double xMax, double yMax, bool &truncated )
+// Returns the first piece of the line which lies within the rectangle, or an empty polygon if the line misses it
+static inline QPolygonF clipGridLine( const QPolygonF &line, double xMin, double xMax, double yMin, double yMax )
 {
-  QPointF ret = q;
-  // Truncate at yMax
-  if ( ret.y() > yMax )
-  {
-    double dy = p.y() - ret.y();
-    if ( qAbs( dy ) > 1E-12 )
-    {
-      double lambda = ( yMax - p.y() ) / ( ret.y() - p.y() );
-      ret.ry() = yMax;
-      ret.rx() = p.x() + lambda * ( ret.x() - p.x() );
-    }
-    else
+  QPolygonF clipped;
+  for ( int i = 1, n = line.size(); i < n; ++i )
+  {
+    // Liang-Barsky clipping of the segment
+    const QPointF &p = line[i - 1];
+    const QPointF &q = line[i];
+    double dx = q.x() - p.x();
+    double dy = q.y() - p.y();
+    double den[4] = { -dx, dx, -dy, dy };
+    double num[4] = { p.x() - xMin, xMax - p.x(), p.y() - yMin, yMax - p.y() };
+    double t0 = 0.;
+    double t1 = 1.;
+    for ( int j = 0; j < 4 && t0 <= t1; ++j )
     {
-      ret = p;
-    }
-    truncated = true;
-  }
-  // Truncate at xMin/xMax
-  if ( ret.x() < xMin )
-  {
-    double dx = ret.x() - p.x();
-    if ( qAbs( dx ) > 1E-12 )
-    {
-      double lambda = ( xMin - p.x() ) / ( ret.x() - p.x() );
-      ret.rx() = xMin;
-      ret.ry() = p.y() + lambda * ( ret.y() - p.y() );
-    }
-    else
-    {
-      ret = p;
-    }
-    truncated = true;
-  }
-  else if ( ret.x() > xMax )
-  {
-    double dx = ret.x() - p.x();
-    if ( qAbs( dx ) > 1E-12 )
-    {
-      double lambda = ( xMax - p.x() ) / ( ret.x() - p.x() );
-      ret.rx() = xMax;
-      ret.ry() = p.y() + lambda * ( ret.y() - p.y() );
-    }
-    else
-    {
-      ret = p;
-    }
-    truncated = true;
-  }
-  return ret;
-}
-
-static inline QPointF truncateGridLineYMin( const QPointF &p, const QPointF &q, double xMin, double xMax, double yMin, bool &truncated )
-{
-  QPointF ret = q;
-  // Truncate at yMin
-  if ( ret.y() < yMin )
-  {
-    double dy = p.y() - ret.y();
-    if ( qAbs( dy ) > 1E-12 )
-    {
-      double lambda = ( yMin - ret.y() ) / ( p.y() - ret.y() );
-      ret.ry() = yMin;
-      ret.rx() += lambda * ( p.x() - ret.x() );
-    }
-    else
-    {
-      ret = p;
-    }
-    truncated = true;
-  }
-  // Truncate at xMin/xMax
-  if ( ret.x() < xMin )
-  {
-    double dx = ret.x() - p.x();
-    if ( qAbs( dx ) > 1E-12 )
-    {
-      double lambda = ( xMin - p.x() ) / ( ret.x() - p.x() );
-      ret.rx() = xMin;
-      ret.ry() = p.y() + lambda * ( ret.y() - p.y() );
+      if ( qAbs( den[j] ) < 1E-12 )
+      {
+        t1 = num[j] < 0 ? -1. : t1;
+      }
+      else if ( den[j] < 0 )
+      {
+        t0 = qMax( t0, num[j] / den[j] );
+      }
+      else
+      {
+        t1 = qMin( t1, num[j] / den[j] );
+      }
     }
-    else
+    if ( t0 > t1 )
     {
-      ret = p;
+      if ( !clipped.isEmpty() )
+      {
+        break;
+      }
+      continue;
     }
-    truncated = true;
-  }
-  else if ( ret.x() > xMax )
-  {
-    double dx = ret.x() - p.x();
-    if ( qAbs( dx ) > 1E-12 )
+    if ( clipped.isEmpty() )
     {
-      double lambda = ( xMax - p.x() ) / ( ret.x() - p.x() );
-      ret.rx() = xMax;
-      ret.ry() = p.y() + lambda * ( ret.y() - p.y() );
+      clipped.append( p + t0 * ( q - p ) );
     }
-    else
+    clipped.append( p + t1 * ( q - p ) );
+    if ( t1 < 1. )
     {
-      ret = p;
+      // The line leaves the rectangle
+      break;
     }
-    truncated = true;
   }
-  return ret;
+  return clipped;
 }
 
 static inline QPointF truncateGridLineXMin( const QPointF &p, const QPointF &q, double xMin )
@@ -740,125 +688,225 @@ static inline QPointF truncateGridLineXMax( const QPointF &p, const QPointF &q,
   return ret;
 }
 
-void KadasLatLonToUTM::computeGrid( const QgsRectangle &bbox, double mapScale,
-                                    QList<QPolygonF> &zoneLines, QList<QPolygonF> &subZoneLines, QList<QPolygonF> &gridLines,
-                                    QList<ZoneLabel> &zoneLabels, QList<ZoneLabel> &subZoneLabels, QList<GridLabel> &gridLabels, GridMode gridMode )
+QList<QgsRectangle> KadasLatLonToUTM::gridZones()
 {
-
-  QgsDistanceArea da;
-  da.setEllipsoid( "WGS84" );
-
-  double lats[] = { -90, -80, -72, -64, -56, -48, -40, -32, -24, -16, -8, 0, 8, 16, 24, 32, 40, 48, 56, 64, 72, 84, 90 };
-  for ( int iy = 0, ny = sizeof( lats ) / sizeof( lats[0] ); iy < ny - 1; ++iy )
+  static const QList<QgsRectangle> zones = []
   {
-    for ( int ix = -30; ix < 30; ++ix )
+    QList<QgsRectangle> zones;
+    double lats[] = { -90, -80, -72, -64, -56, -48, -40, -32, -24, -16, -8, 0, 8, 16, 24, 32, 40, 48, 56, 64, 72, 84, 90 };
+    for ( int iy = 0, ny = sizeof( lats ) / sizeof( lats[0] ); iy < ny - 1; ++iy )
     {
-      double x1 = ix * 6;
-      double x2 = ( ix + 1 ) * 6;
-      double y1 = lats[iy];
-      double y2 = lats[iy + 1];
-
-      // Special zone for Norway
-      if ( y1 == 56. && y2 ==  64. )
+      for ( int ix = -30; ix < 30; ++ix )
       {
-        if ( x1 == 0 )
-        {
-          x2 = 3;
-        }
-        else if ( x1 == 6 )
-        {
-          x1 = 3;
-        }
-      }
+        double x1 = ix * 6;
+        double x2 = ( ix + 1 ) * 6;
+        double y1 = lats[iy];
+        double y2 = lats[iy + 1];
 
-      // Special zones from Svalbard
-      if ( y1 == 72 && y2 == 84 )
-      {
-        if ( x1 == 0 )
+        // Special zone for Norway
+        if ( y1 == 56. && y2 ==  64. )
         {
-          x2 = 9;
+          if ( x1 == 0 )
+          {
+            x2 = 3;
+          }
+          else if ( x1 == 6 )
+          {
+            x1 = 3;
+          }
         }
-        else if ( x1 == 12 )
-        {
-          x1 = 9;
-          x2 = 21;
-        }
-        else if ( x1 == 24 )
-        {
-          x1 = 21;
-          x2 = 33;
-        }
-        else if ( x1 == 36 )
-        {
-          x1 = 33;
-        }
-        else if ( x1 == 6 || x1 == 18 || x1 == 30 )
+
+        // Special zones from Svalbard
+        if ( y1 == 72 && y2 == 84 )
         {
-          continue;
+          if ( x1 == 0 )
+          {
+            x2 = 9;
+          }
+          else if ( x1 == 12 )
+          {
+            x1 = 9;
+            x2 = 21;
+          }
+          else if ( x1 == 24 )
+          {
+            x1 = 21;
+            x2 = 33;
+          }
+          else if ( x1 == 36 )
+          {
+            x1 = 33;
+          }
+          else if ( x1 == 6 || x1 == 18 || x1 == 30 )
+          {
+            continue;
+          }
         }
+        zones.append( QgsRectangle( x1, y1, x2, y2 ) );
       }
+    }
+    return zones;
+  }();
+  return zones;
+}
 
-      // Check if within area of interest
-      if ( x1 > bbox.xMaximum() || x2 < bbox.xMinimum() ||
-           y1 > bbox.yMaximum() || y2 < bbox.yMinimum() )
-      {
-        continue;
-      }
+int KadasLatLonToUTM::gridCellSize( double mapScale )
+{
+  if ( mapScale > 5000000 )
+  {
+    return 0;
+  }
+  else if ( mapScale > 500000 )
+  {
+    return 100000;
+  }
+  else if ( mapScale > 50000 )
+  {
+    return 10000;
+  }
+  else if ( mapScale > 5000 )
+  {
+    return 1000;
+  }
+  return 100;
+}
 
-      double xMin = qMax( x1, bbox.xMinimum() );
-      double xMax = qMin( x2, bbox.xMaximum() );
-      double yMin = qMax( y1, bbox.yMinimum() );
-      double yMax = qMin( y2, bbox.yMaximum() );
-
-      // Split box perimeter into pieces and compute lines
-      zoneLines << polyGridLineX( xMin, yMin, yMax, 1 ) << polyGridLineX( xMax, yMin, yMax, 1. );
-      zoneLines << polyGridLineY( xMin, xMax, 1., yMin ) << polyGridLineY( xMin, xMax, 1., yMax );
-      int zoneNumber = KadasLatLonToUTM::getZoneNumber( x1, y1 );
-      ZoneLabel label;
-      label.pos = QPointF( xMax, yMax );
-      label.maxPos = QPointF( xMin, yMin );
-      label.label = QString( "%1%2" ).arg( zoneNumber ).arg( KadasLatLonToUTM::getHemisphereLetter( y1 ) );
-      zoneLabels.append( label );
-
-      // Sub-grid
-      if ( mapScale > 5000000 )
+void KadasLatLonToUTM::computeGrid( const QgsRectangle &bbox, double mapScale,
+                                    QList<QPolygonF> &zoneLines, QList<QPolygonF> &subZoneLines, QList<QPolygonF> &gridLines,
+                                    QList<ZoneLabel> &zoneLabels, QList<ZoneLabel> &subZoneLabels, QList<GridLabel> &gridLabels, GridMode gridMode )
+{
+  int cellSize = gridCellSize( mapScale );
+  for ( const QgsRectangle &zone : gridZones() )
+  {
+    // Check if within area of interest
+    if ( !computeZone( zone, bbox, zoneLines, zoneLabels ) )
+    {
+      continue;
+    }
+
+    // Sub-grid
+    if ( cellSize == 0 )
+    {
+      continue;
+    }
+    QgsRectangle rect( qMax( zone.xMinimum(), bbox.xMinimum() ), qMax( zone.yMinimum(), bbox.yMinimum() ),
+                       qMin( zone.xMaximum(), bbox.xMaximum() ), qMin( zone.yMaximum(), bbox.yMaximum() ), false );
+    QList<ZoneLabel> unusedZoneLabels;
+    QList<GridLabel> unusedGridLabels;
+    if ( gridMode == GridMGRS )
+    {
+      computeZoneGrid( rect, 100000, gridMode, subZoneLines, subZoneLabels, unusedGridLabels );
+      if ( cellSize == 100000 )
       {
         continue;
       }
-      int cellSize = 0;
-      if ( mapScale > 500000 )
-      {
-        if ( gridMode == GridMGRS )
-        {
-          computeSubGrid( 100000, xMin, xMax, yMin, yMax, subZoneLines, &subZoneLabels, 0, mgrs100kIDLabelCallback );
-          continue;
-        }
-        cellSize = 100000;
-      }
-      else if ( mapScale > 50000 )
-      {
-        cellSize = 10000;
-      }
-      else if ( mapScale > 5000 )
-      {
-        cellSize = 1000;
-      }
-      else
+    }
+    computeZoneGrid( rect, cellSize, gridMode, gridLines, unusedZoneLabels, gridLabels );
+  }
+}
+
+bool KadasLatLonToUTM::computeZone( const QgsRectangle &zone, const QgsRectangle &bbox, QList<QPolygonF> &zoneLines, QList<ZoneLabel> &zoneLabels )
+{
+  if ( zone.xMinimum() > bbox.xMaximum() || zone.xMaximum() < bbox.xMinimum() ||
+       zone.yMinimum() > bbox.yMaximum() || zone.yMaximum() < bbox.yMinimum() )
+  {
+    return false;
+  }
+
+  double xMin = qMax( zone.xMinimum(), bbox.xMinimum() );
+  double xMax = qMin( zone.xMaximum(), bbox.xMaximum() );
+  double yMin = qMax( zone.yMinimum(), bbox.yMinimum() );
+  double yMax = qMin( zone.yMaximum(), bbox.yMaximum() );
+
+  // Split box perimeter into pieces and compute lines
+  zoneLines << polyGridLineX( xMin, yMin, yMax, 1 ) << polyGridLineX( xMax, yMin, yMax, 1. );
+  zoneLines << polyGridLineY( xMin, xMax, 1., yMin ) << polyGridLineY( xMin, xMax, 1., yMax );
+  int zoneNumber = KadasLatLonToUTM::getZoneNumber( zone.xMinimum(), zone.yMinimum() );
+  ZoneLabel label;
+  label.pos = QPointF( xMax, yMax );
+  label.maxPos = QPointF( xMin, yMin );
+  label.label = QString( "%1%2" ).arg( zoneNumber ).arg( KadasLatLonToUTM::getHemisphereLetter( zone.yMinimum() ) );
+  zoneLabels.append( label );
+  return true;
+}
+
+void KadasLatLonToUTM::computeZoneGrid( const QgsRectangle &rect, int cellSize, GridMode gridMode, QList<QPolygonF> &gridLines, QList<ZoneLabel> &zoneLabels, QList<GridLabel> &gridLabels )
+{
+  if ( gridMode == GridMGRS && cellSize == 100000 )
+  {
+    computeSubGrid( 100000, rect.xMinimum(), rect.xMaximum(), rect.yMinimum(), rect.yMaximum(), gridLines, &zoneLabels, 0, mgrs100kIDLabelCallback );
+  }
+  else
+  {
+    computeSubGrid( cellSize, rect.xMinimum(), rect.xMaximum(), rect.yMinimum(), rect.yMaximum(), gridLines, 0, &gridLabels, 0, gridMode == GridMGRS ? mgrsGridLabelCallback : utmGridLabelCallback );
+  }
+}
+
+// Walks the points of a grid line with constant UTM step, converting them to lat/lon ahead in growing batches
+class KadasUTMGridLineWalker
+{
+  public:
+    KadasUTMGridLineWalker( const KadasLatLonToUTM::UTMCoo &start, int dEasting, int dNorthing )
+      : mEasting( start.easting )
+      , mNorthing( start.northing )
+      , mDEasting( dEasting )
+      , mDNorthing( dNorthing )
+      , mZoneNumber( start.zoneNumber )
+      , mZoneLetter( start.zoneLetter.isEmpty() ? '\0' : start.zoneLetter.at( 0 ).toLatin1() )
+    {}
+
+    // Returns the point at the current position and advances by one step
+    QgsPointXY next( bool &ok )
+    {
+      if ( mPos == mCount )
       {
-        cellSize = 100;
+        convertBatch();
       }
-      if ( gridMode == GridMGRS )
+      ok = mOk;
+      if ( !mOk )
       {
-        computeSubGrid( 100000, xMin, xMax, yMin, yMax, subZoneLines, &subZoneLabels, 0, mgrs100kIDLabelCallback );
-        computeSubGrid( cellSize, xMin, xMax, yMin, yMax, gridLines, 0, &gridLabels, 0, mgrsGridLabelCallback );
+        return QgsPointXY();
       }
-      else
+      QgsPointXY p( mLon[mPos], mLat[mPos] );
+      ++mPos;
+      return p;
+    }
+
+  private:
+    static const int sMaxBatchSize = 64;
+    double mEasting;
+    double mNorthing;
+    int mDEasting;
+    int mDNorthing;
+    int mZoneNumber;
+    char mZoneLetter;
+    int mBatchSize = 4;
+    int mPos = 0;
+    int mCount = 0;
+    bool mOk = true;
+    double mLon[sMaxBatchSize];
+    double mLat[sMaxBatchSize];
+
+    void convertBatch()
+    {
+      double eastings[sMaxBatchSize];
+      double northings[sMaxBatchSize];
+      for ( int i = 0; i < mBatchSize; ++i )
       {
-        computeSubGrid( cellSize, xMin, xMax, yMin, yMax, gridLines, 0, &gridLabels, 0, utmGridLabelCallback );
+        eastings[i] = mEasting;
+        northings[i] = mNorthing;
+        mEasting += mDEasting;
+        mNorthing += mDNorthing;
       }
+      mOk = KadasLatLonToUTM::UTM2LL( eastings, northings, mBatchSize, mZoneNumber, mZoneLetter, mLon, mLat );
+      mPos = 0;
+      mCount = mBatchSize;
+      // Short lines only need a few points, long lines are converted in larger batches
+      mBatchSize = qMin( 2 * mBatchSize, sMaxBatchSize );
     }
-  }
-}
+};
+
+const int KadasUTMGridLineWalker::sMaxBatchSize;
 
 void KadasLatLonToUTM::computeSubGrid( int cellSize, double xMin, double xMax, double yMin, double yMax,
                                        QList<QPolygonF> &gridLines, QList<ZoneLabel> *zoneLabels, QList<GridLabel> *gridLabels,
@@ -866,15 +914,43 @@ void KadasLatLonToUTM::computeSubGrid( int cellSize, double xMin, double xMax, d
 {
   QgsPointXY p, q, r;
   bool ok;
-  bool truncated;
 
   // X lines (vertical)
+  // Due to the meridian convergence, the lines do not only cross the border closer to the equator, but also the
+  // east or west border. Hence walk all eastings and northings spanned by the rectangle in the zone of its
+  // start corner, and clip the lines to the rectangle.
   UTMCoo coo = LL2UTM( QgsPointXY( xMin, yMin >= 0 ? yMin : yMax ) );
+  double longOrigin = utmLongOrigin( coo.zoneNumber );
+  double northingOffset = yMin >= 0 ? 0. : 10000000.;
+  double minEasting = std::numeric_limits<double>::max();
+  double maxEasting = std::numeric_limits<double>::lowest();
+  double minNorthing = std::numeric_limits<double>::max();
+  double maxNorthing = std::numeric_limits<double>::lowest();
+  // Lines of constant latitude are curved, with the extreme northing on the central meridian
+  double extentLons[3] = { xMin, xMax, qBound( xMin, longOrigin, xMax ) };
+  double extentLats[2] = { yMin, yMax };
+  for ( double lon : extentLons )
+  {
+    for ( double lat : extentLats )
+    {
+      double x, y;
+      latLonToUtm( ( lon - longOrigin ) / 180. * M_PI, lat / 180. * M_PI, x, y );
+      if ( lon == xMin )
+      {
+        minEasting = qMin( minEasting, x + 500000. );
+      }
+      if ( lon == xMax )
+      {
+        maxEasting = qMax( maxEasting, x + 500000. );
+      }
+      minNorthing = qMin( minNorthing, y + northingOffset );
+      maxNorthing = qMax( maxNorthing, y + northingOffset );
+    }
+  }
   // Round up to next grid line
   int reste = coo.easting % cellSize;
   coo.easting += reste != 0 ? cellSize - reste : 0;
   int restn = coo.northing % cellSize;
-  int northing1 = coo.northing - restn;
   int northing2 = coo.northing + ( restn != 0 ? cellSize - restn : 0 );
   if ( zoneLabelCallback && reste != 0 && restn != 0 )
   {
@@ -883,61 +959,50 @@ void KadasLatLonToUTM::computeSubGrid( int cellSize, double xMin, double xMax, d
     QgsPointXY maxPos = UTM2LL( maxCoo, ok );
     zoneLabels->append( zoneLabelCallback( xMin, yMin, maxPos.x(), maxPos.y() ) );
   }
-  while ( ( p = UTM2LL( coo, ok ) ).x() <= xMax && ok )
+  int easting1 = qCeil( minEasting / cellSize ) * cellSize;
+  int easting2 = qFloor( maxEasting / cellSize ) * cellSize;
+  int northing1 = qFloor( minNorthing / cellSize ) * cellSize;
+  int nNorthings = qCeil( maxNorthing / cellSize ) - northing1 / cellSize + 1;
+  double startY = yMin >= 0 ? yMin : yMax;
+  for ( int easting = easting1; easting <= easting2; easting += cellSize )
   {
-    QPolygonF xLine;
-    // Draw segment from border of zone to next 100k position
     UTMCoo xcoo = coo;
+    xcoo.easting = easting;
     xcoo.northing = northing1;
-    q = UTM2LL( xcoo, ok );
-    xcoo.northing = northing2;
-    r = UTM2LL( xcoo, ok );
-    if ( yMin >= 0 )
+    QPolygonF line;
+    KadasUTMGridLineWalker walker( xcoo, 0, cellSize );
+    for ( int i = 0; i < nNorthings; ++i )
     {
-      xLine.append( truncateGridLineYMin( QPointF( r.x(), r.y() ), QPointF( q.x(), q.y() ), xMin, xMax, yMin, truncated ) );
+      q = walker.next( ok );
+      if ( !ok )
+      {
+        break;
+      }
+      line.append( QPointF( q.x(), q.y() ) );
     }
-    else
+    QPolygonF xLine = clipGridLine( line, xMin, xMax, yMin, yMax );
+    if ( xLine.size() < 2 )
     {
-      xLine.append( truncateGridLineYMax( QPointF( r.x(), r.y() ), QPointF( q.x(), q.y() ), xMin, xMax, yMax, truncated ) );
+      continue;
+    }
+    if ( yMin < 0 )
+    {
+      // Lines start at the border closer to the equator
+      std::reverse( xLine.begin(), xLine.end() );
     }
     if ( lineLabelCallback )
     {
-      lineLabelCallback( xLine.last().x(), xLine.last().y(), cellSize, false, gridLines.size(), *gridLabels );
+      lineLabelCallback( xLine.first().x(), xLine.first().y(), cellSize, false, gridLines.size(), *gridLabels );
     }
-    if ( zoneLabelCallback && restn != 0 )
+    // Lines which enter through the east or west border do not start a 100k square
+    if ( zoneLabelCallback && restn != 0 && qAbs( xLine.first().y() - startY ) < 1E-9 )
     {
       UTMCoo maxCoo = xcoo;
       maxCoo.easting += cellSize;
+      maxCoo.northing = northing2;
       QgsPointXY maxPos = UTM2LL( maxCoo, ok );
-      zoneLabels->append( zoneLabelCallback( xLine.last().x(), qMax( yMin, xLine.last().y() ), maxPos.x(), maxPos.y() ) );
-    }
-    truncated = false;
-    // Draw remaining segments of grid line
-    if ( yMin >= 0 )
-    {
-      while ( !truncated && ( q = UTM2LL( xcoo, ok ) ).y() < yMax && ok )
-      {
-        xLine.append( truncateGridLineYMax( xLine.back(), QPointF( q.x(), q.y() ), xMin, xMax, yMax, truncated ) );
-        xcoo.northing += cellSize;
-      }
-      if ( !truncated )
-      {
-        xLine.append( truncateGridLineYMax( xLine.back(), QPointF( q.x(), q.y() ), xMin, xMax, yMax, truncated ) );
-      }
+      zoneLabels->append( zoneLabelCallback( xLine.first().x(), qMax( yMin, xLine.first().y() ), maxPos.x(), maxPos.y() ) );
     }
-    else
-    {
-      while ( !truncated && ( q = UTM2LL( xcoo, ok ) ).y() > yMin && ok )
-      {
-        xLine.append( truncateGridLineYMin( xLine.back(), QPointF( q.x(), q.y() ), xMin, xMax, yMin, truncated ) );
-        xcoo.northing -= cellSize;
-      }
-      if ( !truncated )
-      {
-        xLine.append( truncateGridLineYMin( xLine.back(), QPointF( q.x(), q.y() ), xMin, xMax, yMin, truncated ) );
-      }
-    }
-    coo.easting += cellSize;
     gridLines.append( xLine );
   }
 
@@ -947,18 +1012,21 @@ void KadasLatLonToUTM::computeSubGrid( int cellSize, double xMin, double xMax, d
   restn = coo.northing % cellSize;
   coo.northing += restn != 0 ? cellSize - restn : 0;
 
-  while ( ( p = UTM2LL( coo, ok ) ).y() <= yMax && ok )
+  KadasUTMGridLineWalker yLinesWalker( coo, 0, cellSize );
+  while ( ( p = yLinesWalker.next( ok ) ).y() <= yMax && ok )
   {
     QPolygonF yLine;
     // Draw segment from border of zone to next 100k position
     reste = coo.easting % cellSize;
     UTMCoo ycoo = coo;
     ycoo.easting = coo.easting + ( reste != 0 ? cellSize - reste : 0 );
-    while ( UTM2LL( ycoo, ok ).x() < xMin && ok )
+    KadasUTMGridLineWalker forwardWalker( ycoo, cellSize, 0 );
+    while ( forwardWalker.next( ok ).x() < xMin && ok )
     {
       ycoo.easting += cellSize;
     }
-    while ( ( q = UTM2LL( ycoo, ok ) ).x() > xMin && ok )
+    KadasUTMGridLineWalker backwardWalker( ycoo, -cellSize, 0 );
+    while ( ( q = backwardWalker.next( ok ) ).x() > xMin && ok )
     {
       ycoo.easting -= cellSize;
     }
@@ -977,20 +1045,21 @@ void KadasLatLonToUTM::computeSubGrid( int cellSize, double xMin, double xMax, d
       zoneLabels->append( zoneLabelCallback( yLine.last().x(), qMax( xMin, yLine.last().y() ), maxPos.x(), maxPos.y() ) );
     }
     // Draw remaining segments of grid line
-    while ( ( q = UTM2LL( ycoo, ok ) ).x() < xMax && ok )
+    KadasUTMGridLineWalker walker( ycoo, cellSize, 0 );
+    UTMCoo maxCoo = ycoo;
+    maxCoo.easting += cellSize;
+    maxCoo.northing += cellSize;
+    KadasUTMGridLineWalker maxWalker( maxCoo, cellSize, 0 );
+    while ( ( q = walker.next( ok ) ).x() < xMax && ok )
     {
       yLine.append( QPointF( q.x(), q.y() ) );
       if ( zoneLabelCallback )
       {
-        UTMCoo maxCoo = ycoo;
-        maxCoo.easting += cellSize;
-        maxCoo.northing += cellSize;
-        QgsPointXY maxPos = UTM2LL( maxCoo, ok );
+        QgsPointXY maxPos = maxWalker.next( ok );
         maxPos.setX( qMin( maxPos.x(), xMax ) );
         maxPos.setY( qMin( maxPos.y(), yMax ) );
         zoneLabels->append( zoneLabelCallback( q.x(), q.y(), maxPos.x(), maxPos.y() ) );
       }
-      ycoo.easting += cellSize;
     }
     yLine.append( truncateGridLineXMax( yLine.back(), QPointF( q.x(), q.y() ), xMax ) );
     coo.northing += cellSize;
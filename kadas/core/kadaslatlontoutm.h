@@ -62,16 +62,35 @@ class KADAS_CORE_EXPORT KadasLatLonToUTM
 
     static QgsPointXY UTM2LL( const UTMCoo &utm, bool &ok );
     static UTMCoo LL2UTM( const QgsPointXY &pLatLong );
+#ifndef SIP_RUN
+    /**Converts n UTM coordinates of the same zone to lat/lon. Only the hemisphere is derived from the zone letter.
+      Returns false if the zone is invalid.*/
+    static bool UTM2LL( const double *easting, const double *northing, int n, int zoneNumber, char zoneLetter, double *lon, double *lat );
+    /**Converts n lat/lon coordinates to UTM. The zone numbers and zone letters are only returned if the respective arrays are non-null.*/
+    static void LL2UTM( const double *lon, const double *lat, int n, double *easting, double *northing, int *zoneNumber = nullptr, char *zoneLetter = nullptr );
+#endif
     static MGRSCoo UTM2MGRS( const UTMCoo &utmcoo );
     static UTMCoo MGRS2UTM( const MGRSCoo &mgrs, bool &ok );
 
     static int getZoneNumber( double lon, double lat );
     static QString getHemisphereLetter( double lat );
+    static char hemisphereLetter( double lat );
 
     enum GridMode { GridUTM, GridMGRS };
     static void computeGrid( const QgsRectangle &bbox, double mapScale,
                              QList<QPolygonF> &zoneLines, QList<QPolygonF> &subZoneLines, QList<QPolygonF> &gridLines,
                              QList<KadasLatLonToUTM::ZoneLabel> &zoneLabels, QList<KadasLatLonToUTM::ZoneLabel> &subZoneLabels, QList<KadasLatLonToUTM::GridLabel> &gridLabels, KadasLatLonToUTM::GridMode gridMode );
+    /**Returns the extents of all UTM grid zones, including the Norway and Svalbard exceptions*/
+    static QList<QgsRectangle> gridZones();
+    /**Returns the grid cell size in meters for the specified map scale, or 0 if only the zones are drawn.
+      In MGRS mode, a cell size of 100000 means that only the 100km squares are drawn.*/
+    static int gridCellSize( double mapScale );
+    /**Computes the border lines and the label of the zone clipped to bbox. Returns false if the zone is outside bbox.*/
+    static bool computeZone( const QgsRectangle &zone, const QgsRectangle &bbox, QList<QPolygonF> &zoneLines, QList<KadasLatLonToUTM::ZoneLabel> &zoneLabels );
+    /**Computes the grid lines of the given cell size within rect, which must lie within a single zone. In MGRS mode, a cell size of 100000
+      yields the 100km squares and their zone labels, otherwise the grid labels are returned.*/
+    static void computeZoneGrid( const QgsRectangle &rect, int cellSize, KadasLatLonToUTM::GridMode gridMode, QList<QPolygonF> &gridLines,
+                                 QList<KadasLatLonToUTM::ZoneLabel> &zoneLabels, QList<KadasLatLonToUTM::GridLabel> &gridLabels );
 
   private:
     static const int NUM_100K_SETS;
@@ -15,23 +15,26 @@
  ***************************************************************************/
 
 #include <qgis/qgsproject.h>
+#include <qgis/qgssettings.h>
 
 #include <kadas/core/kadasstatehistory.h>
 
+const int KadasStateHistory::sKeyframeInterval = 16;
+
 KadasStateHistory::KadasStateHistory( QObject *parent )
   : QObject( parent )
-{}
-
-KadasStateHistory::~KadasStateHistory()
 {
-  qDeleteAll( mStates );
+  QgsSettings settings;
+  mMemoryBudget = settings.value( "/kadas/state_history_budget_mb", 64 ).toLongLong() * 1024 * 1024;
+  mDeltaEncoding = settings.value( "/kadas/state_history_delta_encoding", true ).toBool();
 }
 
 void KadasStateHistory::clear()
 {
-  qDeleteAll( mStates );
-  mStates.clear();
+  mEntries.clear();
+  mCurrentState.clear();
   mCurrent = -1;
+  mMemorySize = 0;
   emit canUndoChanged( false );
   emit canRedoChanged( false );
 }
@@ -40,7 +43,9 @@ void KadasStateHistory::undo()
 {
   if ( canUndo() )
   {
-    emit stateChanged( mStates[--mCurrent] );
+    mCurrentState = stateAt( mCurrent - 1 );
+    --mCurrent;
+    emit stateChanged( mCurrentState.data() );
   }
   emit canUndoChanged( canUndo() );
   emit canRedoChanged( canRedo() );
@@ -50,7 +55,9 @@ void KadasStateHistory::redo()
 {
   if ( canRedo() )
   {
-    emit stateChanged( mStates[++mCurrent] );
+    mCurrentState = stateAt( mCurrent + 1 );
+    ++mCurrent;
+    emit stateChanged( mCurrentState.data() );
   }
   emit canUndoChanged( canUndo() );
   emit canRedoChanged( canRedo() );
@@ -58,10 +65,95 @@ void KadasStateHistory::redo()
 
 void KadasStateHistory::push( State *state )
 {
-  mStates.resize( ++mCurrent );
-  mStates.append( state );
+  // Discard the redo states
+  for ( int i = mCurrent + 1, n = mEntries.size(); i < n; ++i )
+  {
+    mMemorySize -= mEntries[i].size;
+  }
+  mEntries.resize( mCurrent + 1 );
+
+  Entry entry;
+  if ( mDeltaEncoding && mCurrentState )
+  {
+    // Store a full state every sKeyframeInterval entries, to bound the cost of rebuilding states
+    int keyframe = mCurrent;
+    while ( !mEntries[keyframe].state )
+    {
+      --keyframe;
+    }
+    if ( mCurrent + 1 - keyframe < sKeyframeInterval )
+    {
+      entry.delta = QSharedPointer<Delta>( state->diff( mCurrentState.data() ) );
+    }
+  }
+  mCurrentState = QSharedPointer<State>( state );
+  if ( entry.delta )
+  {
+    entry.size = entry.delta->memorySize();
+  }
+  else
+  {
+    entry.state = mCurrentState;
+    entry.size = state->memorySize();
+  }
+  mEntries.append( entry );
+  mMemorySize += entry.size;
+  ++mCurrent;
+  evict();
+
   emit canUndoChanged( canUndo() );
   emit canRedoChanged( canRedo() );
 
   QgsProject::instance()->setDirty( true );
 }
+
+void KadasStateHistory::setMemoryBudget( qint64 budget )
+{
+  mMemoryBudget = budget;
+  evict();
+  emit canUndoChanged( canUndo() );
+}
+
+QSharedPointer<KadasStateHistory::State> KadasStateHistory::stateAt( int index ) const
+{
+  if ( index == mCurrent )
+  {
+    return mCurrentState;
+  }
+  if ( mEntries[index].state )
+  {
+    return mEntries[index].state;
+  }
+  // Rebuild the state from the closest preceding full state, or from the current state
+  int start = index - 1;
+  while ( !mEntries[start].state && start != mCurrent )
+  {
+    --start;
+  }
+  QSharedPointer<State> state = start == mCurrent ? mCurrentState : mEntries[start].state;
+  for ( int i = start + 1; i <= index; ++i )
+  {
+    state = QSharedPointer<State>( mEntries[i].delta->apply( state.data() ) );
+  }
+  return state;
+}
+
+void KadasStateHistory::evict()
+{
+  while ( mMemoryBudget > 0 && mMemorySize > mMemoryBudget && mCurrent > 0 )
+  {
+    // The successor of the oldest state becomes the first entry, hence it must be a full state
+    if ( mEntries[1].delta )
+    {
+      Entry &entry = mEntries[1];
+      entry.state = stateAt( 1 );
+      entry.delta.clear();
+      mMemorySize -= entry.size;
+      entry.size = entry.state->memorySize();
+      mMemorySize += entry.size;
+    }
+    mMemorySize -= mEntries.front().size;
+    mEntries.removeFirst();
+    --mCurrent;
+  }
+}
@@ -19,7 +19,7 @@
 
 #include <QObject>
 #include <QSharedPointer>
-#include <QStack>
+#include <QVector>
 
 #include <kadas/core/kadas_core.h>
 
@@ -28,19 +28,46 @@ class KADAS_CORE_EXPORT KadasStateHistory : public QObject
 {
     Q_OBJECT
   public:
+#ifndef SIP_RUN
+    struct Delta;
+#endif
+
     struct State
     {
       virtual ~State() {}
+      /**Approximate memory footprint in bytes, used to enforce the memory budget of the history*/
+      virtual qint64 memorySize() const { return sizeof( State ); }
+#ifndef SIP_RUN
+      /**Returns a delta which rebuilds this state from the predecessor state, or nullptr if the state does not support deltas*/
+      virtual Delta *diff( const State *predecessor ) const { Q_UNUSED( predecessor ); return nullptr; }
+#endif
     };
 
+#ifndef SIP_RUN
+    struct Delta
+    {
+      virtual ~Delta() {}
+      /**Rebuilds the full state from the predecessor state*/
+      virtual State *apply( const State *predecessor ) const = 0;
+      /**Approximate memory footprint in bytes*/
+      virtual qint64 memorySize() const = 0;
+    };
+#endif
+
     KadasStateHistory( QObject *parent = 0 );
-    ~KadasStateHistory();
     void clear();
-    void push( State *state );
+    void push( State *state SIP_TRANSFER );
     void undo();
     void redo();
     bool canUndo() const { return mCurrent > 0; }
-    bool canRedo() const { return mCurrent < mStates.length() - 1; }
+    bool canRedo() const { return mCurrent < mEntries.length() - 1; }
+
+    /**Sets the memory budget in bytes, the oldest states are discarded once it is exceeded. Zero means unlimited.*/
+    void setMemoryBudget( qint64 budget );
+    qint64 memoryBudget() const { return mMemoryBudget; }
+    /**Sets whether states are stored as deltas against their predecessor where supported*/
+    void setDeltaEncoding( bool deltaEncoding ) { mDeltaEncoding = deltaEncoding; }
+    bool deltaEncoding() const { return mDeltaEncoding; }
 
   signals:
     void canUndoChanged( bool );
@@ -48,8 +75,27 @@ class KADAS_CORE_EXPORT KadasStateHistory : public QObject
     void stateChanged( State *state );
 
   private:
-    QVector<State *> mStates;
+#ifndef SIP_RUN
+    // Either a full state or a delta against the preceding entry. The first entry is always a full state.
+    struct Entry
+    {
+      QSharedPointer<State> state;
+      QSharedPointer<Delta> delta;
+      qint64 size = 0;
+    };
+    QVector<Entry> mEntries;
+    // Full state of the current entry
+    QSharedPointer<State> mCurrentState;
+#endif
     int mCurrent = -1;
+    qint64 mMemorySize = 0;
+    qint64 mMemoryBudget = 0;
+    bool mDeltaEncoding = true;
+
+    static const int sKeyframeInterval;
+
+    QSharedPointer<State> stateAt( int index ) const;
+    void evict();
 };
 
 #endif // KADASSTATEHISTORY_H
@@ -23,7 +23,6 @@
 #include <QGroupBox>
 #include <QIcon>
 #include <QLabel>
-#include <QMessageBox>
 #include <QProgressBar>
 #include <QPushButton>
 #include <QVBoxLayout>
@@ -35,8 +34,6 @@
 #include <qwt_scale_draw.h>
 #include <qwt_symbol.h>
 
-#include <gdal.h>
-
 #include <qgis/qgsapplication.h>
 #include <qgis/qgsdistancearea.h>
 #include <qgis/qgslinestring.h>
@@ -45,8 +42,8 @@
 #include <qgis/qgssettings.h>
 #include <qgis/qgsvector.h>
 
-#include <kadas/core/kadas.h>
 #include <kadas/core/kadascoordinateformat.h>
+#include <kadas/core/kadasdemsampler.h>
 #include <kadas/gui/kadasheightprofiledialog.h>
 #include <kadas/gui/kadasitemlayer.h>
 #include <kadas/gui/kadasmapcanvasitemmanager.h>
@@ -180,7 +177,6 @@ KadasHeightProfileDialog::KadasHeightProfileDialog( KadasMapToolHeightProfile *t
   hboxLayout->addWidget( mProgressBar );
 
   mCancelButton = new QPushButton();
-  mCancelButton->setCheckable( true );
   mCancelButton->setIcon( QgsApplication::getThemeIcon( "/mTaskCancel.svg" ) );
   mCancelButton->hide();
   hboxLayout->addWidget( mCancelButton );
@@ -195,6 +191,13 @@ KadasHeightProfileDialog::KadasHeightProfileDialog( KadasMapToolHeightProfile *t
   connect( bbox, &QDialogButtonBox::rejected, this, &QDialog::reject );
   connect( copyButton, &QPushButton::clicked, this, &KadasHeightProfileDialog::copyToClipboard );
   connect( addButton, &QPushButton::clicked, this, &KadasHeightProfileDialog::addToCanvas );
+  connect( mCancelButton, &QPushButton::clicked, this, [this]
+  {
+    if ( mSampler )
+    {
+      mSampler->abort();
+    }
+  } );
   connect( this, &QDialog::finished, this, &KadasHeightProfileDialog::finish );
 
   connect( KadasCoordinateFormat::instance(), &KadasCoordinateFormat::heightDisplayUnitChanged, this, &KadasHeightProfileDialog::replot );
@@ -202,6 +205,11 @@ KadasHeightProfileDialog::KadasHeightProfileDialog( KadasMapToolHeightProfile *t
   restoreGeometry( QgsSettings().value( "/Windows/MeasureHeightProfile/geometry" ).toByteArray() );
 }
 
+KadasHeightProfileDialog::~KadasHeightProfileDialog()
+{
+  abortSampling();
+}
+
 void KadasHeightProfileDialog::setPoints( const QList<QgsPointXY> &points, const QgsCoordinateReferenceSystem &crs )
 {
   mPoints = points;
@@ -240,6 +248,9 @@ void KadasHeightProfileDialog::setMarkerPos( int segment, const QgsPointXY &p, c
 
 void KadasHeightProfileDialog::clear()
 {
+  abortSampling();
+  mCancelButton->hide();
+  mProgressBar->hide();
   static_cast<QwtPointSeriesData *>( mPlotCurve->data() )->setSamples( QVector<QPointF>() );
   mPlotMarker->setValue( 0, 0 );
   qDeleteAll( mLinesOfSight );
@@ -273,116 +284,42 @@ void KadasHeightProfileDialog::replot()
     return;
   }
 
-  QString layerid = QgsProject::instance()->readEntry( "Heightmap", "layer" );
-  QgsMapLayer *layer = QgsProject::instance()->mapLayer( layerid );
-  if ( !layer || layer->type() != QgsMapLayerType::RasterLayer )
-  {
-    emit mTool->messageEmitted( tr( "No heightmap is defined in the project." ), Qgis::Warning );
-    return;
-  }
-  QString rasterFile = Kadas::gdalSource( layer );
-  if ( rasterFile.isNull() )
+  KadasDemSampler *sampler = KadasDemSampler::instance();
+  QString errMsg;
+  if ( !sampler->isValid( &errMsg ) )
   {
+    emit mTool->messageEmitted( errMsg, Qgis::Warning );
     return;
   }
 
-  GDALDatasetH raster = GDALOpen( rasterFile.toLocal8Bit().data(), GA_ReadOnly );
-  if ( !raster )
-  {
-    QMessageBox::warning( 0, tr( "Error" ), tr( "Failed to open raster file: %1" ).arg( rasterFile ) );
-    return;
-  }
-
-  double gtrans[6] = {};
-  if ( GDALGetGeoTransform( raster, &gtrans[0] ) != CE_None )
-  {
-    QgsDebugMsg( "Failed to get raster geotransform" );
-    GDALClose( raster );
-    return;
-  }
-
-  QString proj( GDALGetProjectionRef( raster ) );
-  QgsCoordinateReferenceSystem rasterCrs( proj );
-  if ( !rasterCrs.isValid() )
-  {
-    QgsDebugMsg( "Failed to get raster CRS" );
-    GDALClose( raster );
-    return;
-  }
-
-  GDALRasterBandH band = GDALGetRasterBand( raster, 1 );
-  if ( !band )
-  {
-    QgsDebugMsg( "Failed to open raster band 0" );
-    GDALClose( raster );
-    return;
-  }
-
-  // Get vertical unit
-  QgsUnitTypes::DistanceUnit vertUnit = strcmp( GDALGetRasterUnitType( band ), "ft" ) == 0 ? QgsUnitTypes::DistanceFeet : QgsUnitTypes::DistanceMeters;
-  double heightConversion = QgsUnitTypes::fromUnitToUnitFactor( vertUnit, vertDisplayUnit );
-  mPlot->setAxisTitle( QwtPlot::yLeft, vertDisplayUnit == QgsUnitTypes::DistanceFeet ? tr( "Height [ft AMSL]" ) : tr( "Height [m AMSL]" ) );
-  mObserverHeightSpinBox->setSuffix( vertDisplayUnit == QgsUnitTypes::DistanceFeet ? " ft" : " m" );
-  mTargetHeightSpinBox->setSuffix( vertDisplayUnit == QgsUnitTypes::DistanceFeet ? " ft" : " m" );
-
+  abortSampling();
   mProgressBar->setValue( 0 );
   mProgressBar->setRange( 0, mNSamples );
   mProgressBar->show();
   mCancelButton->show();
 
+  mSampler = new KadasHeightProfileSampler( mPoints, mPointsCrs, mNSamples, vertDisplayUnit, this );
+  connect( mSampler, &KadasHeightProfileSampler::progressChanged, mProgressBar, &QProgressBar::setValue );
+  connect( mSampler, &KadasHeightProfileSampler::finished, this, &KadasHeightProfileDialog::samplingFinished );
+  mSampler->start();
+}
+
+void KadasHeightProfileDialog::samplingFinished()
+{
+  // Ignore a finished signal which was queued by a sampler that has been aborted and replaced since
+  if ( !mSampler || sender() != mSampler )
+  {
+    return;
+  }
+  const QVector<double> &heights = mSampler->heights();
   QVector<QPointF> samples;
-  double x = 0;
-  for ( int i = 0, n = mPoints.size() - 1; i < n; ++i )
+  samples.reserve( heights.size() );
+  for ( double height : heights )
   {
-    if ( x >= mSegmentLengths[i] )
-    {
-      continue;
-    }
-
-    QgsVector dir = QgsVector( mPoints[i + 1] - mPoints[i] ).normalized();
-    while ( x < mSegmentLengths[i] )
-    {
-      mProgressBar->setValue( mProgressBar->value() + 1 );
-      QApplication::processEvents();
-      if ( mCancelButton->isChecked() )
-      {
-        break;
-      }
-      QgsPointXY p = mPoints[i] + dir * x;
-      // Transform geo position to raster CRS
-      QgsPointXY pRaster = QgsCoordinateTransform( mPointsCrs, rasterCrs, QgsProject::instance() ).transform( p );
-
-
-      // Transform raster geo position to pixel coordinates
-      double col = ( -gtrans[0] * gtrans[5] + gtrans[2] * gtrans[3] - gtrans[2] * pRaster.y() + gtrans[5] * pRaster.x() ) / ( gtrans[1] * gtrans[5] - gtrans[2] * gtrans[4] );
-      double row = ( -gtrans[0] * gtrans[4] + gtrans[1] * gtrans[3] - gtrans[1] * pRaster.y() + gtrans[4] * pRaster.x() ) / ( gtrans[2] * gtrans[4] - gtrans[1] * gtrans[5] );
-
-      double pixValues[4] = {};
-      if ( CE_None != GDALRasterIO( band, GF_Read,
-                                    qFloor( col ), qFloor( row ), 2, 2, &pixValues[0], 2, 2, GDT_Float64, 0, 0 ) )
-      {
-        QgsDebugMsg( "Failed to read pixel values" );
-        samples.append( QPointF( samples.size(), 0 ) );
-      }
-      else
-      {
-        // Interpolate values
-        double lambdaR = row - qFloor( row );
-        double lambdaC = col - qFloor( col );
-
-        double value = ( pixValues[0] * ( 1. - lambdaC ) + pixValues[1] * lambdaC ) * ( 1. - lambdaR )
-                       + ( pixValues[2] * ( 1. - lambdaC ) + pixValues[3] * lambdaC ) * ( lambdaR );
-        samples.append( QPointF( samples.size(), value * heightConversion ) );
-      }
-      x += mTotLength / mNSamples;
-    }
-    x -= mSegmentLengths[i];
-    if ( mCancelButton->isChecked() )
-    {
-      break;
-    }
+    samples.append( QPointF( samples.size(), height ) );
   }
-  mCancelButton->setChecked( false );
+  mSampler->deleteLater();
+  mSampler = nullptr;
   mCancelButton->hide();
   mProgressBar->hide();
 
@@ -395,12 +332,10 @@ void KadasHeightProfileDialog::replot()
   while ( nSamples / step > 10 ) { step *= 2.; }
   mPlot->setAxisScale( QwtPlot::xBottom, 0, nSamples, step );
 
-  GDALClose( raster );
-
   // Node markers
   if ( mNodeMarkersCheckbox->isChecked() )
   {
-    x = 0;
+    double x = 0;
     for ( int i = 0, n = mPoints.size() - 2; i < n; ++i )
     {
       x += mSegmentLengths[i];
@@ -418,6 +353,20 @@ void KadasHeightProfileDialog::replot()
   updateLineOfSight( );
 }
 
+void KadasHeightProfileDialog::abortSampling()
+{
+  if ( mSampler )
+  {
+    // Also disconnects the progress bar
+    mSampler->disconnect();
+    mSampler->abort();
+    mSampler->wait();
+    // Deleted after any of its queued signals were delivered, so that the sender check in samplingFinished stays valid
+    mSampler->deleteLater();
+    mSampler = nullptr;
+  }
+}
+
 void KadasHeightProfileDialog::updateLineOfSight( )
 {
   QgsSettings().setValue( "/kadas/heightprofile_observerheight", mObserverHeightSpinBox->value() );
@@ -596,3 +545,16 @@ void KadasHeightProfileDialog::toggleNodeMarkers()
   mNodeMarkers.clear();
   replot();
 }
+
+void KadasHeightProfileSampler::run()
+{
+  // Sample in chunks to report progress and allow aborting
+  static const int sChunkSize = 256;
+  QVector<QgsPointXY> positions = KadasDemSampler::polylineSamplePoints( mPoints, mNSamples );
+  mHeights.reserve( positions.size() );
+  for ( int i = 0, n = positions.size(); i < n && !isInterruptionRequested(); i += sChunkSize )
+  {
+    mHeights += KadasDemSampler::instance()->sampleHeights( positions.mid( i, sChunkSize ), mCrs, mUnit );
+    emit progressChanged( mHeights.size() );
+  }
+}
@@ -18,8 +18,11 @@
 #define KADASHEIGHTPROFILEDIALOG_H
 
 #include <QDialog>
+#include <QThread>
 
 #include <qgis/qgscoordinatereferencesystem.h>
+#include <qgis/qgspointxy.h>
+#include <qgis/qgsunittypes.h>
 
 #include <kadas/gui/kadas_gui.h>
 
@@ -31,6 +34,7 @@ class QProgressBar;
 class QwtPlot;
 class QwtPlotCurve;
 class QwtPlotMarker;
+class KadasHeightProfileSampler;
 class KadasLineItem;
 class KadasMapToolHeightProfile;
 
@@ -40,6 +44,7 @@ class KADAS_GUI_EXPORT KadasHeightProfileDialog : public QDialog
     Q_OBJECT
   public:
     KadasHeightProfileDialog( KadasMapToolHeightProfile *tool, QWidget *parent = 0, Qt::WindowFlags f = 0 );
+    ~KadasHeightProfileDialog();
     void setPoints( const QList<QgsPointXY> &points, const QgsCoordinateReferenceSystem &crs );
     void setMarkerPos( int segment, const QgsPointXY &p, const QgsCoordinateReferenceSystem &crs );
     void clear();
@@ -50,6 +55,7 @@ class KADAS_GUI_EXPORT KadasHeightProfileDialog : public QDialog
   private slots:
     void finish();
     void replot();
+    void samplingFinished();
     void updateLineOfSight();
     void copyToClipboard();
     void addToCanvas();
@@ -80,6 +86,36 @@ class KADAS_GUI_EXPORT KadasHeightProfileDialog : public QDialog
     QComboBox *mHeightModeCombo = nullptr;
     QProgressBar *mProgressBar = nullptr;
     QPushButton *mCancelButton = nullptr;
+    KadasHeightProfileSampler *mSampler = nullptr;
+
+    void abortSampling();
+};
+
+
+#ifndef SIP_RUN
+
+class KADAS_GUI_EXPORT KadasHeightProfileSampler : public QThread
+{
+    Q_OBJECT
+  public:
+    KadasHeightProfileSampler( const QList<QgsPointXY> &points, const QgsCoordinateReferenceSystem &crs, int nSamples, QgsUnitTypes::DistanceUnit unit, QObject *parent = 0 )
+      : QThread( parent ), mPoints( points ), mCrs( crs ), mNSamples( nSamples ), mUnit( unit ) {}
+    void abort() { requestInterruption(); }
+    const QVector<double> &heights() const { return mHeights; }
+
+  signals:
+    void progressChanged( int samples );
+
+  private:
+    QList<QgsPointXY> mPoints;
+    QgsCoordinateReferenceSystem mCrs;
+    int mNSamples;
+    QgsUnitTypes::DistanceUnit mUnit;
+    QVector<double> mHeights;
+
+    void run() override;
 };
 
+#endif // SIP_RUN
+
 #endif // KADASHEIGHTPROFILEDIALOG_H
@@ -17,9 +17,13 @@
 #include <QHBoxLayout>
 #include <QLabel>
 #include <QMenu>
+#include <QSet>
 #include <QSlider>
+#include <QThread>
 #include <QWidgetAction>
 
+#include <qgis/qgsfeature.h>
+#include <qgis/qgsgeometry.h>
 #include <qgis/qgsmaplayerrenderer.h>
 #include <qgis/qgsmapsettings.h>
 #include <qgis/qgsproject.h>
@@ -29,30 +33,46 @@
 #include <kadas/gui/mapitems/kadasmapitem.h>
 
 
+static QString itemCrsKey( const QgsCoordinateReferenceSystem &crs )
+{
+  return crs.authid().isEmpty() ? crs.toWkt() : crs.authid();
+}
+
+
 class KadasItemLayer::Renderer : public QgsMapLayerRenderer
 {
   public:
     Renderer( KadasItemLayer *layer, QgsRenderContext &rendererContext )
       : QgsMapLayerRenderer( layer->id() )
-      , mLayer( layer )
       , mRendererContext( rendererContext )
-    {}
+      , mOpacity( layer->opacity() / 100. )
+    {
+      // Take a snapshot of the items to render, the layer is not touched while rendering
+      mItems = layer->renderSnapshot( rendererContext );
+    }
     bool render() override
     {
-      QList<KadasMapItem *> items;
-      for ( ItemId id : mLayer->mItemOrder )
-      {
-        items.append( mLayer->mItems[id] );
-      }
-      std::stable_sort( items.begin(), items.end(), []( KadasMapItem * a, KadasMapItem * b ) { return a->zIndex() < b->zIndex(); } );
       bool omitSinglePoint = mRendererContext.customRenderFlags().contains( "globe" );
-      for ( const KadasMapItem *item : items )
+      QgsCoordinateReferenceSystem destCrs = mRendererContext.coordinateTransform().destinationCrs();
+      QHash<QString, QgsCoordinateTransform> transforms;
+      for ( const RenderCopy &copy : mItems )
       {
-        if ( item && ( !omitSinglePoint || !item->isPointSymbol() ) )
+        const KadasMapItem *item = copy.item.data();
+        if ( mRendererContext.renderingStopped() )
+        {
+          break;
+        }
+        if ( !omitSinglePoint || !item->isPointSymbol() )
         {
+          QString crsKey = itemCrsKey( item->crs() );
+          auto it = transforms.find( crsKey );
+          if ( it == transforms.end() )
+          {
+            it = transforms.insert( crsKey, QgsCoordinateTransform( item->crs(), destCrs, mRendererContext.transformContext() ) );
+          }
           mRendererContext.painter()->save();
-          mRendererContext.painter()->setOpacity( mLayer->opacity() / 100. );
-          mRendererContext.setCoordinateTransform( QgsCoordinateTransform( item->crs(), mRendererContext.coordinateTransform().destinationCrs(), mRendererContext.transformContext() ) );
+          mRendererContext.painter()->setOpacity( mOpacity );
+          mRendererContext.setCoordinateTransform( it.value() );
           item->render( mRendererContext );
           mRendererContext.painter()->restore();
         }
@@ -61,10 +81,18 @@ class KadasItemLayer::Renderer : public QgsMapLayerRenderer
     }
 
   private:
-    KadasItemLayer *mLayer;
     QgsRenderContext &mRendererContext;
+    double mOpacity;
+    RenderSnapshot mItems;
 };
 
+static QgsFeature indexFeature( KadasItemLayer::ItemId id, const QgsRectangle &bounds )
+{
+  QgsFeature feature( id );
+  feature.setGeometry( QgsGeometry::fromRect( bounds ) );
+  return feature;
+}
+
 
 KadasItemLayer::KadasItemLayer( const QString &name, const QgsCoordinateReferenceSystem &crs )
   : KadasPluginLayer( layerType(), name )
@@ -87,45 +115,280 @@ KadasItemLayer::~KadasItemLayer()
 
 void KadasItemLayer::addItem( KadasMapItem *item )
 {
-  ItemId id = ITEM_ID_NULL;
-  if ( !mFreeIds.isEmpty() )
+  ItemId id = nextItemId();
+  item->setSymbolScale( mSymbolScale );
+  insertItem( id, item );
+  emit itemAdded( id );
+}
+
+void KadasItemLayer::addItems( const QList<KadasMapItem *> &items )
+{
+  if ( items.isEmpty() )
   {
-    id = mFreeIds.takeLast();
+    return;
   }
-  else
+  QList<ItemId> ids;
+  ids.reserve( items.size() );
+  for ( int i = 0, n = items.size(); i < n; ++i )
   {
-    id = ++mIdCounter;
+    ids.append( nextItemId() );
   }
-  mItems.insert( id, item );
-  mItemOrder.append( id );
-  QgsCoordinateTransform trans( item->crs(), crs(), mTransformContext );
-  mItemBounds.insert( id, trans.transformBoundingBox( item->boundingBox() ) );
-  item->setSymbolScale( mSymbolScale );
-  emit itemAdded( id );
+  // Items usually share few crs, hence reuse the bounds transforms
+  QHash<QString, QgsCoordinateTransform> transforms;
+  for ( int i = 0, n = items.size(); i < n; ++i )
+  {
+    KadasMapItem *item = items[i];
+    QString crsKey = itemCrsKey( item->crs() );
+    auto it = transforms.find( crsKey );
+    if ( it == transforms.end() )
+    {
+      it = transforms.insert( crsKey, QgsCoordinateTransform( item->crs(), crs(), mTransformContext ) );
+    }
+    item->setSymbolScale( mSymbolScale );
+    insertItem( ids[i], item, &it.value() );
+  }
+  emit itemsAdded( ids );
 }
 
 KadasMapItem *KadasItemLayer::takeItem( const ItemId &itemId )
 {
-  KadasMapItem *item = mItems.take( itemId );
+  KadasMapItem *item = mItems.value( itemId );
   if ( item )
   {
+    removeItem( itemId, item );
     mFreeIds.append( itemId );
-    mItemBounds.remove( itemId );
-    mItemOrder.removeOne( itemId );
     emit itemRemoved( itemId );
   }
   return item;
 }
 
+QList<KadasMapItem *> KadasItemLayer::takeItems( const QList<ItemId> &itemIds )
+{
+  QList<KadasMapItem *> items;
+  QList<ItemId> removedIds;
+  QSet<ItemId> removedIdSet;
+  for ( ItemId itemId : itemIds )
+  {
+    KadasMapItem *item = mItems.value( itemId );
+    if ( item )
+    {
+      removeItem( itemId, item, false );
+      mFreeIds.append( itemId );
+      items.append( item );
+      removedIds.append( itemId );
+      removedIdSet.insert( itemId );
+    }
+  }
+  if ( removedIds.isEmpty() )
+  {
+    return items;
+  }
+  // Prune the insertion order in one pass
+  QList<ItemId> itemOrder;
+  itemOrder.reserve( mItemOrder.size() - removedIds.size() );
+  for ( ItemId id : mItemOrder )
+  {
+    if ( !removedIdSet.contains( id ) )
+    {
+      itemOrder.append( id );
+    }
+  }
+  mItemOrder = itemOrder;
+  emit itemsRemoved( removedIds );
+  return items;
+}
+
+KadasItemLayer::ItemId KadasItemLayer::nextItemId()
+{
+  if ( !mFreeIds.isEmpty() )
+  {
+    return mFreeIds.takeLast();
+  }
+  return ++mIdCounter;
+}
+
+void KadasItemLayer::insertItem( ItemId id, KadasMapItem *item, const QgsCoordinateTransform *itemTransform )
+{
+  mItems.insert( id, item );
+  mItemOrder.append( id );
+  ZOrderKey key( item->zIndex(), ++mZOrderCounter );
+  mItemZOrder.insert( key, id );
+  mItemZKeys.insert( id, key );
+  updateItemIndex( id, itemTransform );
+  connect( item, &KadasMapItem::changed, this, [this, id] { updateItemIndex( id ); } );
+}
+
+void KadasItemLayer::removeItem( ItemId id, KadasMapItem *item, bool removeFromOrder )
+{
+  disconnect( item, &KadasMapItem::changed, this, nullptr );
+  mItems.remove( id );
+  if ( removeFromOrder )
+  {
+    mItemOrder.removeOne( id );
+  }
+  mItemIndex.deleteFeature( indexFeature( id, mItemBounds.take( id ) ) );
+  mItemZOrder.remove( mItemZKeys.take( id ) );
+  mRenderCopies.remove( id );
+}
+
+void KadasItemLayer::updateItemIndex( ItemId id, const QgsCoordinateTransform *itemTransform )
+{
+  KadasMapItem *item = mItems.value( id );
+  if ( !item )
+  {
+    return;
+  }
+  auto boundsIt = mItemBounds.find( id );
+  if ( boundsIt != mItemBounds.end() )
+  {
+    mItemIndex.deleteFeature( indexFeature( id, boundsIt.value() ) );
+  }
+  QgsRectangle bounds;
+  if ( itemTransform )
+  {
+    bounds = itemTransform->transformBoundingBox( item->boundingBox() );
+  }
+  else
+  {
+    QgsCoordinateTransform trans( item->crs(), crs(), mTransformContext );
+    bounds = trans.transformBoundingBox( item->boundingBox() );
+  }
+  mItemBounds[id] = bounds;
+  mItemIndex.addFeature( id, bounds );
+
+  ZOrderKey key = mItemZKeys.value( id );
+  if ( key.first != item->zIndex() )
+  {
+    mItemZOrder.remove( key );
+    key.first = item->zIndex();
+    mItemZOrder.insert( key, id );
+    mItemZKeys[id] = key;
+  }
+
+  KadasMapItem::Margin margin = item->margin();
+  mMaxItemMargin = qMax( mMaxItemMargin, qMax( qMax( margin.left, margin.right ), qMax( margin.top, margin.bottom ) ) );
+}
+
+KadasItemLayer::RenderSnapshot KadasItemLayer::renderSnapshot( const QgsRenderContext &context )
+{
+  RenderSnapshot snapshot;
+  if ( QThread::currentThread() != thread() )
+  {
+    // The items may be edited in the main thread meanwhile, only use the prepared copies
+    QSharedPointer<const ThreadedRenderItems> renderItems;
+    {
+      QMutexLocker locker( &mThreadedRenderItemsMutex );
+      renderItems = mThreadedRenderItems;
+    }
+    if ( !renderItems )
+    {
+      QgsDebugMsg( QString( "No render copies prepared for layer %1" ).arg( id() ) );
+      return snapshot;
+    }
+    QgsRectangle extent = renderCullExtent( context, renderItems->maxItemMargin );
+    for ( const QPair<QgsRectangle, RenderCopy> &entry : renderItems->items )
+    {
+      if ( entry.first.intersects( extent ) )
+      {
+        snapshot.append( entry.second );
+      }
+    }
+    return snapshot;
+  }
+  QList<ItemId> ids = itemsInZOrder( renderCullExtent( context, mMaxItemMargin ) );
+  snapshot.reserve( ids.size() );
+  for ( ItemId id : ids )
+  {
+    const KadasMapItem *item = mItems.value( id );
+    if ( item )
+    {
+      snapshot.append( renderCopy( id, item ) );
+    }
+  }
+  return snapshot;
+}
+
+const KadasItemLayer::RenderCopy &KadasItemLayer::renderCopy( ItemId id, const KadasMapItem *item )
+{
+  RenderCopy &copy = mRenderCopies[id];
+  if ( !copy.item || copy.revision != item->revision() )
+  {
+    // The render copy shares the state and geometry with the item, which detaches them when it is next modified.
+    // Copies may be released by a renderer in a worker thread, but need to be deleted in the main thread
+    copy.item = QSharedPointer<const KadasMapItem>( item->renderCopy(), []( const KadasMapItem * itemCopy ) { const_cast<KadasMapItem *>( itemCopy )->deleteLater(); } );
+    copy.id = id;
+    copy.revision = item->revision();
+  }
+  return copy;
+}
+
+void KadasItemLayer::prepareThreadedRendering()
+{
+  QSharedPointer<ThreadedRenderItems> renderItems( new ThreadedRenderItems );
+  renderItems->items.reserve( mItemZOrder.size() );
+  for ( ItemId id : mItemZOrder )
+  {
+    const KadasMapItem *item = mItems.value( id );
+    if ( item )
+    {
+      renderItems->items.append( qMakePair( mItemBounds.value( id ), renderCopy( id, item ) ) );
+    }
+  }
+  renderItems->maxItemMargin = mMaxItemMargin;
+  QMutexLocker locker( &mThreadedRenderItemsMutex );
+  mThreadedRenderItems = renderItems;
+}
+
+void KadasItemLayer::clearThreadedRendering()
+{
+  QMutexLocker locker( &mThreadedRenderItemsMutex );
+  mThreadedRenderItems.clear();
+}
+
+QList<KadasItemLayer::ItemId> KadasItemLayer::itemsInZOrder( const QgsRectangle &rect ) const
+{
+  QList<ItemId> ids;
+  QList<QgsFeatureId> candidates = mItemIndex.intersects( rect );
+  if ( candidates.size() * 4 > mItemZOrder.size() )
+  {
+    // Most items are within the rect, filtering the z-ordered list is cheaper than sorting the candidates
+    for ( ItemId id : mItemZOrder )
+    {
+      if ( mItemBounds[id].intersects( rect ) )
+      {
+        ids.append( id );
+      }
+    }
+  }
+  else
+  {
+    QVector<QPair<ZOrderKey, ItemId>> sorted;
+    sorted.reserve( candidates.size() );
+    for ( QgsFeatureId fid : candidates )
+    {
+      ItemId id = static_cast<ItemId>( fid );
+      sorted.append( qMakePair( mItemZKeys.value( id ), id ) );
+    }
+    std::sort( sorted.begin(), sorted.end() );
+    for ( const QPair<ZOrderKey, ItemId> &entry : sorted )
+    {
+      ids.append( entry.second );
+    }
+  }
+  return ids;
+}
+
 KadasItemLayer *KadasItemLayer::clone() const
 {
   KadasItemLayer *layer = new KadasItemLayer( name(), crs() );
   layer->mTransformContext = mTransformContext;
   layer->mOpacity = mOpacity;
-  for ( auto it = mItems.begin(), itEnd = mItems.end(); it != itEnd; ++it )
+  for ( ItemId id : mItemOrder )
   {
-    layer->mItems.insert( it.key(), it.value()->clone() );
+    layer->insertItem( id, mItems[id]->clone() );
   }
+  layer->mIdCounter = mIdCounter;
+  layer->mFreeIds = mFreeIds;
   return layer;
 }
 
@@ -156,6 +419,12 @@ bool KadasItemLayer::readXml( const QDomNode &layer_node, QgsReadWriteContext &c
 {
   qDeleteAll( mItems );
   mItems.clear();
+  mItemOrder.clear();
+  mItemBounds.clear();
+  mItemIndex = QgsSpatialIndex();
+  mItemZOrder.clear();
+  mItemZKeys.clear();
+  mRenderCopies.clear();
   mIdCounter = 0;
   mFreeIds.clear();
 
@@ -176,8 +445,7 @@ bool KadasItemLayer::readXml( const QDomNode &layer_node, QgsReadWriteContext &c
       item->setEditor( editor );
       if ( item->deserialize( data.object() ) )
       {
-        mItems.insert( ++mIdCounter, item );
-        mItemOrder.append( mIdCounter );
+        insertItem( ++mIdCounter, item );
       }
       else
       {
@@ -216,10 +484,11 @@ bool KadasItemLayer::writeXml( QDomNode &layer_node, QDomDocument &document, con
 KadasItemLayer::ItemId KadasItemLayer::pickItem( const QgsRectangle &pickRect, const QgsMapSettings &mapSettings ) const
 {
   KadasMapRect rect( pickRect.xMinimum(), pickRect.yMinimum(), pickRect.xMaximum(), pickRect.yMaximum() );
-  for ( auto it = mItemOrder.rbegin(), itEnd = mItemOrder.rend(); it != itEnd; ++it )
+  QList<ItemId> candidates = itemsInZOrder( layerSearchRect( pickRect, mapSettings, 0 ) );
+  for ( auto it = candidates.crbegin(), itEnd = candidates.crend(); it != itEnd; ++it )
   {
-    KadasMapItem *item = mItems[*it];
-    if ( item->intersects( rect, mapSettings ) )
+    const KadasMapItem *item = mItems.value( *it );
+    if ( item && item->intersects( rect, mapSettings ) )
     {
       return *it;
     }
@@ -241,29 +510,76 @@ KadasItemLayer::ItemId KadasItemLayer::pickItem( const QgsPointXY &mapPos, const
   return pickItem( filterRect, mapSettings );
 }
 
+QList<KadasItemLayer::ItemId> KadasItemLayer::itemsInRect( const QgsRectangle &rect, const QgsMapSettings &mapSettings ) const
+{
+  KadasMapRect mapRect( rect.xMinimum(), rect.yMinimum(), rect.xMaximum(), rect.yMaximum() );
+  QList<ItemId> ids;
+  for ( ItemId id : itemsInZOrder( layerSearchRect( rect, mapSettings, 0 ) ) )
+  {
+    const KadasMapItem *item = mItems.value( id );
+    if ( item && item->intersects( mapRect, mapSettings ) )
+    {
+      ids.append( id );
+    }
+  }
+  return ids;
+}
+
 QPair<QgsPointXY, double> KadasItemLayer::snapToVertex( const QgsPointXY &mapPos, const QgsMapSettings &settings, double tolPixels ) const
 {
-  QgsCoordinateTransform crst( crs(), settings.destinationCrs(), mTransformContext );
-  QgsPointXY layerPos = crst.transform( mapPos, QgsCoordinateTransform::ReverseTransform );
   double minDist = std::numeric_limits<double>::max();
   QgsPointXY minPos;
-  for ( auto it = mItemBounds.begin(), itEnd = mItemBounds.end(); it != itEnd; ++it )
+  for ( QgsFeatureId fid : mItemIndex.intersects( layerSearchRect( QgsRectangle( mapPos, mapPos ), settings, tolPixels ) ) )
   {
-    QgsRectangle bbox = crst.transformBoundingBox( it.value() );
-    bbox.grow( settings.mapUnitsPerPixel() * tolPixels );
-    if ( bbox.contains( mapPos ) )
+    const KadasMapItem *item = mItems.value( static_cast<ItemId>( fid ) );
+    if ( !item )
     {
-      QPair<KadasMapPos, double> result = mItems[it.key()]->closestPoint( KadasMapPos::fromPoint( mapPos ), settings );
-      if ( result.second < minDist && result.second < tolPixels )
-      {
-        minDist = result.second;
-        minPos = result.first;
-      }
+      continue;
+    }
+    QPair<KadasMapPos, double> result = item->closestPoint( KadasMapPos::fromPoint( mapPos ), settings );
+    if ( result.second < minDist && result.second < tolPixels )
+    {
+      minDist = result.second;
+      minPos = result.first;
     }
   }
   return qMakePair( minPos, minDist );
 }
 
+QgsRectangle KadasItemLayer::renderCullExtent( const QgsRenderContext &context, int maxItemMargin )
+{
+  // Render extent in layer crs, grown by the largest item margin since margins are in screen units
+  QgsRectangle extent = context.extent();
+  if ( maxItemMargin > 0 )
+  {
+    double unitsPerPixel = context.mapToPixel().mapUnitsPerPixel();
+    QgsRectangle mapExtent = context.mapExtent();
+    if ( mapExtent.width() > 0 )
+    {
+      unitsPerPixel *= extent.width() / mapExtent.width();
+    }
+    double dpiScale = qMax( 1., context.scaleFactor() * 25.4 / 96. );
+    extent.grow( maxItemMargin * dpiScale * unitsPerPixel );
+  }
+  return extent;
+}
+
+QgsRectangle KadasItemLayer::layerSearchRect( const QgsRectangle &mapRect, const QgsMapSettings &mapSettings, double tolPixels ) const
+{
+  // Item margins are in screen units, hence grow the rect in map units before transforming it to the layer crs
+  QgsRectangle rect = mapRect;
+  rect.grow( ( mMaxItemMargin + tolPixels ) * mapSettings.mapUnitsPerPixel() );
+  QgsCoordinateTransform crst( crs(), mapSettings.destinationCrs(), mTransformContext );
+  try
+  {
+    return crst.transformBoundingBox( rect, QgsCoordinateTransform::ReverseTransform );
+  }
+  catch ( const QgsCsException & )
+  {
+    return extent();
+  }
+}
+
 QString KadasItemLayer::asKml( const QgsRenderContext &context, QuaZip *kmzZip, const QgsRectangle &exportRect ) const
 {
   QString outString;
@@ -17,14 +17,19 @@
 #ifndef KADASITEMLAYER_H
 #define KADASITEMLAYER_H
 
+#include <QMutex>
+#include <QSharedPointer>
+
 #include <qgis/qgspluginlayer.h>
 #include <qgis/qgspluginlayerregistry.h>
+#include <qgis/qgsspatialindex.h>
 
 #include <kadas/core/kadaspluginlayer.h>
 #include <kadas/gui/kadas_gui.h>
 
 class QMenu;
 class QuaZip;
+class QgsCoordinateTransform;
 class KadasMapItem;
 
 #ifdef SIP_RUN
@@ -140,7 +145,11 @@ class KADAS_GUI_EXPORT KadasItemLayer : public KadasPluginLayer
     virtual bool acceptsItem( const KadasMapItem *item ) const { return true; }
 
     void addItem( KadasMapItem *item SIP_TRANSFER );
+    /**Adds multiple items at once, emitting a single itemsAdded signal*/
+    void addItems( const QList<KadasMapItem *> &items SIP_TRANSFER );
     KadasMapItem *takeItem( const ItemId &itemId ) SIP_TRANSFER;
+    /**Removes multiple items at once, emitting a single itemsRemoved signal*/
+    QList<KadasMapItem *> takeItems( const QList<KadasItemLayer::ItemId> &itemIds ) SIP_TRANSFER;
     const QMap<KadasItemLayer::ItemId, KadasMapItem *> &items() const { return mItems; }
 
     KadasItemLayer *clone() const override SIP_FACTORY;
@@ -150,6 +159,8 @@ class KADAS_GUI_EXPORT KadasItemLayer : public KadasPluginLayer
     bool writeXml( QDomNode &layer_node, QDomDocument &document, const QgsReadWriteContext &context ) const override;
     virtual KadasItemLayer::ItemId pickItem( const QgsRectangle &pickRect, const QgsMapSettings &mapSettings ) const;
     KadasItemLayer::ItemId pickItem( const QgsPointXY &mapPos, const QgsMapSettings &mapSettings ) const;
+    /**Returns the ids of the items intersecting the specified rect (in map coordinates), in z-order*/
+    QList<KadasItemLayer::ItemId> itemsInRect( const QgsRectangle &rect, const QgsMapSettings &mapSettings ) const;
 
 #ifndef SIP_RUN
     // TODO: SIP
@@ -163,9 +174,21 @@ class KADAS_GUI_EXPORT KadasItemLayer : public KadasPluginLayer
     void setSymbolScale( double scale );
     double symbolScale() const { return mSymbolScale; }
 
+#ifndef SIP_RUN
+
+    /**Prepares render copies of all items for renderers which are created outside the main thread, i.e. by the globe
+      tile source. Such renderers render the prepared copies, which are only updated by calling this method again.
+      Must be called from the main thread.*/
+    void prepareThreadedRendering();
+    /**Releases the render copies prepared for renderers created outside the main thread*/
+    void clearThreadedRendering();
+#endif
+
   signals:
     void itemAdded( KadasItemLayer::ItemId itemId );
     void itemRemoved( KadasItemLayer::ItemId itemId );
+    void itemsAdded( const QList<KadasItemLayer::ItemId> &itemIds );
+    void itemsRemoved( const QList<KadasItemLayer::ItemId> &itemIds );
 
   protected:
     KadasItemLayer( const QString &name, const QgsCoordinateReferenceSystem &crs, const QString &layerType );
@@ -177,6 +200,50 @@ class KADAS_GUI_EXPORT KadasItemLayer : public KadasPluginLayer
     ItemId mIdCounter = 0;
     QVector<ItemId> mFreeIds;
     double mSymbolScale = 1.0;
+
+#ifndef SIP_RUN
+    // Spatial index over mItemBounds
+    QgsSpatialIndex mItemIndex;
+    // Items sorted by z-index, items with equal z-index are sorted by insertion order
+    typedef QPair<int, quint64> ZOrderKey;
+    QMap<ZOrderKey, ItemId> mItemZOrder;
+    QHash<ItemId, ZOrderKey> mItemZKeys;
+    quint64 mZOrderCounter = 0;
+    // Largest item margin in screen units, used to grow the culling extent
+    int mMaxItemMargin = 0;
+
+    void insertItem( ItemId id, KadasMapItem *item, const QgsCoordinateTransform *itemTransform = nullptr );
+    void removeItem( ItemId id, KadasMapItem *item, bool removeFromOrder = true );
+    void updateItemIndex( ItemId id, const QgsCoordinateTransform *itemTransform = nullptr );
+    ItemId nextItemId();
+    // Read-only render copies of the items for the renderers, which run in worker threads. A copy is shared
+    // by all snapshots until the item revision changes, so the items can be edited while rendering.
+    // The copies are only created and updated in the main thread.
+    struct RenderCopy
+    {
+      ItemId id = ITEM_ID_NULL;
+      quint64 revision = 0;
+      QSharedPointer<const KadasMapItem> item;
+    };
+    typedef QVector<RenderCopy> RenderSnapshot;
+    QHash<ItemId, RenderCopy> mRenderCopies;
+    // Copies of all items in z-order with their bounds, for renderers created outside the main thread
+    struct ThreadedRenderItems
+    {
+      QVector<QPair<QgsRectangle, RenderCopy>> items;
+      int maxItemMargin = 0;
+    };
+    QSharedPointer<const ThreadedRenderItems> mThreadedRenderItems;
+    mutable QMutex mThreadedRenderItemsMutex;
+
+    QList<ItemId> itemsInZOrder( const QgsRectangle &rect ) const;
+    /**Returns the items to render in z-order. In the main thread, the render copies of the visible items are updated.
+      In other threads, the copies prepared by prepareThreadedRendering are returned, the items are not accessed.*/
+    RenderSnapshot renderSnapshot( const QgsRenderContext &context );
+    const RenderCopy &renderCopy( ItemId id, const KadasMapItem *item );
+    static QgsRectangle renderCullExtent( const QgsRenderContext &context, int maxItemMargin );
+    QgsRectangle layerSearchRect( const QgsRectangle &mapRect, const QgsMapSettings &mapSettings, double tolPixels ) const;
+#endif
 };
 
 class KADAS_GUI_EXPORT KadasItemLayerType : public KadasPluginLayerType
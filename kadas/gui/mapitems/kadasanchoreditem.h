@@ -73,14 +73,14 @@ class KADAS_GUI_EXPORT KadasAnchoredItem : public KadasMapItem SIP_ABSTRACT
       QJsonObject serialize() const override;
       bool deserialize( const QJsonObject &json ) override;
     };
-    const State *constState() const { return static_cast<State *>( mState ); }
+    const State *constState() const { return static_cast<State *>( mState.data() ); }
 
   protected:
     enum AttribIds {AttrX, AttrY, AttrA};
     double mAnchorX = 0.5;
     double mAnchorY = 0.5;
 
-    State *state() { return static_cast<State *>( mState ); }
+    State *state() { return static_cast<State *>( mutableState() ); }
     State *createEmptyState() const override { return new State(); } SIP_FACTORY
     QList<KadasMapPos> rotatedCornerPoints( double angle, const QgsMapSettings &settings ) const;
 
@@ -112,7 +112,7 @@ void KadasCircleItem::setPosition( const KadasItemPos &pos )
   }
   if ( mGeometry )
   {
-    mGeometry->transformVertices( [dx, dy]( const QgsPoint & p ) { return QgsPoint( p.x() + dx, p.y() + dy ); } );
+    mutableGeometry()->transformVertices( [dx, dy]( const QgsPoint & p ) { return QgsPoint( p.x() + dx, p.y() + dy ); } );
   }
   update();
 }
@@ -344,12 +344,12 @@ void KadasCircleItem::addPartFromGeometry( const QgsAbstractGeometry &geom )
 
 const QgsMultiSurface *KadasCircleItem::geometry() const
 {
-  return static_cast<QgsMultiSurface *>( mGeometry );
+  return static_cast<QgsMultiSurface *>( mGeometry.data() );
 }
 
 QgsMultiSurface *KadasCircleItem::geometry()
 {
-  return static_cast<QgsMultiSurface *>( mGeometry );
+  return static_cast<QgsMultiSurface *>( mutableGeometry() );
 }
 
 void KadasCircleItem::measureGeometry()
@@ -72,10 +72,13 @@ class KADAS_GUI_EXPORT KadasCircleItem : public KadasGeometryItem
       QJsonObject serialize() const override;
       bool deserialize( const QJsonObject &json ) override;
     };
-    const State *constState() const { return static_cast<State *>( mState ); }
+    const State *constState() const { return static_cast<State *>( mState.data() ); }
 
   protected:
     KadasMapItem *_clone() const override { return new KadasCircleItem( crs() ); } SIP_FACTORY
+#ifndef SIP_RUN
+    KadasMapItem *_renderCopy() const override { return new KadasCircleItem( *this ); }
+#endif
     State *createEmptyState() const override { return new State(); } SIP_FACTORY
     void recomputeDerived() override;
     void measureGeometry() override;
@@ -86,7 +89,7 @@ class KADAS_GUI_EXPORT KadasCircleItem : public KadasGeometryItem
     bool mGeodesic = false;
 
     QgsMultiSurface *geometry();
-    State *state() { return static_cast<State *>( mState ); }
+    State *state() { return static_cast<State *>( mutableState() ); }
     void computeCircle( const KadasItemPos &center, const KadasItemPos &ringpos, QgsMultiSurface *multiGeom );
     void computeGeoCircle( const KadasItemPos &center, const KadasItemPos &ringpos, QgsMultiSurface *multiGeom );
 };
@@ -152,7 +152,7 @@ void KadasCircularSectorItem::setPosition( const KadasItemPos &pos )
   }
   if ( mGeometry )
   {
-    mGeometry->transformVertices( [dx, dy]( const QgsPoint & p ) { return QgsPoint( p.x() + dx, p.y() + dy ); } );
+    mutableGeometry()->transformVertices( [dx, dy]( const QgsPoint & p ) { return QgsPoint( p.x() + dx, p.y() + dy ); } );
   }
   update();
 }
@@ -353,12 +353,12 @@ void KadasCircularSectorItem::addPartFromGeometry( const QgsAbstractGeometry &ge
 
 const QgsMultiSurface *KadasCircularSectorItem::geometry() const
 {
-  return static_cast<QgsMultiSurface *>( mGeometry );
+  return static_cast<QgsMultiSurface *>( mGeometry.data() );
 }
 
 QgsMultiSurface *KadasCircularSectorItem::geometry()
 {
-  return static_cast<QgsMultiSurface *>( mGeometry );
+  return static_cast<QgsMultiSurface *>( mutableGeometry() );
 }
 
 void KadasCircularSectorItem::measureGeometry()
@@ -71,10 +71,13 @@ class KADAS_GUI_EXPORT KadasCircularSectorItem : public KadasGeometryItem
       QJsonObject serialize() const override;
       bool deserialize( const QJsonObject &json ) override;
     };
-    const State *constState() const { return static_cast<State *>( mState ); }
+    const State *constState() const { return static_cast<State *>( mState.data() ); }
 
   protected:
     KadasMapItem *_clone() const override { return new KadasCircularSectorItem( crs() ); } SIP_FACTORY
+#ifndef SIP_RUN
+    KadasMapItem *_renderCopy() const override { return new KadasCircularSectorItem( *this ); }
+#endif
     State *createEmptyState() const override { return new State(); } SIP_FACTORY
     void recomputeDerived() override;
     void measureGeometry() override;
@@ -83,7 +86,7 @@ class KADAS_GUI_EXPORT KadasCircularSectorItem : public KadasGeometryItem
     enum AttribIds {AttrX, AttrY, AttrR, AttrA1, AttrA2};
 
     QgsMultiSurface *geometry();
-    State *state() { return static_cast<State *>( mState ); }
+    State *state() { return static_cast<State *>( mutableState() ); }
 };
 
 #endif // KADASCIRCULARSECTORITEM_H
@@ -71,9 +71,27 @@ KadasGeometryItem::KadasGeometryItem( const QgsCoordinateReferenceSystem &crs )
   connect( this, &KadasGeometryItem::geometryChanged, this, &KadasGeometryItem::updateMeasurements );
 }
 
+KadasGeometryItem::KadasGeometryItem( const KadasGeometryItem &other )
+  : KadasMapItem( other )
+  , mGeometry( other.mGeometry )
+  , mPen( other.mPen )
+  , mBrush( other.mBrush )
+  , mIconSize( other.mIconSize )
+  , mIconType( other.mIconType )
+  , mIconPen( other.mIconPen )
+  , mIconBrush( other.mIconBrush )
+  , mDa( other.mDa )
+  , mMeasureGeometry( other.mMeasureGeometry )
+  , mBaseUnit( other.mBaseUnit )
+  , mTotalMeasurement( other.mTotalMeasurement )
+  , mMeasurementLabels( other.mMeasurementLabels )
+{
+  mGeometryShared = true;
+  other.mGeometryShared = true;
+}
+
 KadasGeometryItem::~KadasGeometryItem()
 {
-  delete mGeometry;
 }
 
 void KadasGeometryItem::render( QgsRenderContext &context ) const
@@ -239,10 +257,20 @@ void KadasGeometryItem::updateMeasurements()
   update();
 }
 
+QgsAbstractGeometry *KadasGeometryItem::mutableGeometry()
+{
+  if ( mGeometryShared && mGeometry )
+  {
+    mGeometry.reset( mGeometry->clone() );
+  }
+  mGeometryShared = false;
+  return mGeometry.data();
+}
+
 void KadasGeometryItem::setInternalGeometry( QgsAbstractGeometry *geom )
 {
-  delete mGeometry;
-  mGeometry = geom;
+  mGeometry.reset( geom );
+  mGeometryShared = false;
   emit geometryChanged();
 }
 
@@ -265,9 +293,9 @@ bool KadasGeometryItem::intersects( const KadasMapRect &rect, const QgsMapSettin
   filterRect.setExteriorRing( exterior );
 
   QgsGeometryEngine *geomEngine = nullptr;
-  if ( ( mBrush.color().alpha() == 0 || mBrush.style() == Qt::NoBrush ) && dynamic_cast<QgsMultiSurface *>( mGeometry ) )
+  if ( ( mBrush.color().alpha() == 0 || mBrush.style() == Qt::NoBrush ) && dynamic_cast<QgsMultiSurface *>( mGeometry.data() ) )
   {
-    QgsMultiSurface *multiSurface = static_cast<QgsMultiSurface *>( mGeometry );
+    QgsMultiSurface *multiSurface = static_cast<QgsMultiSurface *>( mGeometry.data() );
     QgsMultiCurve multiCurve;
     for ( int i = 0, n = multiSurface->numGeometries(); i < n; ++i )
     {
@@ -278,7 +306,7 @@ bool KadasGeometryItem::intersects( const KadasMapRect &rect, const QgsMapSettin
   }
   else
   {
-    geomEngine = QgsGeometry::createGeometryEngine( mGeometry );
+    geomEngine = QgsGeometry::createGeometryEngine( mGeometry.data() );
   }
   bool intersects = geomEngine->intersects( &filterRect );
   delete geomEngine;
@@ -308,14 +336,13 @@ QPair<KadasMapPos, double> KadasGeometryItem::closestPoint( const KadasMapPos &p
 
 void KadasGeometryItem::clear()
 {
-  delete mState;
-  mState = createEmptyState();
+  resetState();
   recomputeDerived();
 }
 
 void KadasGeometryItem::setState( const State *state )
 {
-  mState->assign( state );
+  mutableState()->assign( state );
   recomputeDerived();
 }
 
@@ -114,13 +114,13 @@ class KADAS_GUI_EXPORT KadasGeometryItem : public KadasMapItem SIP_ABSTRACT
     QString getTotalMeasurement() const { return mTotalMeasurement; }
 
     // Geometry in item CRS
-    const QgsAbstractGeometry *geometry() const { return mGeometry; }
+    const QgsAbstractGeometry *geometry() const { return mGeometry.data(); }
 
   signals:
     void geometryChanged();
 
   protected:
-    QgsAbstractGeometry *mGeometry = nullptr;
+    QSharedPointer<QgsAbstractGeometry> mGeometry;
 
     QPen mPen;
     QBrush mBrush;
@@ -136,6 +136,11 @@ class KADAS_GUI_EXPORT KadasGeometryItem : public KadasMapItem SIP_ABSTRACT
     QString mTotalMeasurement;
 
 
+#ifndef SIP_RUN
+    KadasGeometryItem( const KadasGeometryItem &other );
+    /* Geometry for modification, detached from any render copy sharing it */
+    QgsAbstractGeometry *mutableGeometry();
+#endif
     void setInternalGeometry( QgsAbstractGeometry *geom );
 
     void drawVertex( QPainter *p, double x, double y ) const;
@@ -165,6 +170,7 @@ class KADAS_GUI_EXPORT KadasGeometryItem : public KadasMapItem SIP_ABSTRACT
       bool center;
     };
     QList<MeasurementLabel> mMeasurementLabels;
+    mutable bool mGeometryShared = false;
 
     static void registerMetaTypes();
 };
@@ -41,6 +41,9 @@ class KADAS_GUI_EXPORT KadasGpxRouteItem : public KadasLineItem
 
   protected:
     KadasMapItem *_clone() const override { return new KadasGpxRouteItem( ); } SIP_FACTORY
+#ifndef SIP_RUN
+    KadasMapItem *_renderCopy() const override { return new KadasGpxRouteItem( *this ); }
+#endif
 
     QString mName;
     QString mNumber;
@@ -37,6 +37,9 @@ class KADAS_GUI_EXPORT KadasGpxWaypointItem : public KadasPointItem
 
   protected:
     KadasMapItem *_clone() const override { return new KadasGpxWaypointItem( ); } SIP_FACTORY
+#ifndef SIP_RUN
+    KadasMapItem *_renderCopy() const override { return new KadasGpxWaypointItem( *this ); }
+#endif
 
     QString mName;
     QFont mLabelFont;
@@ -33,6 +33,16 @@
 
 KADAS_REGISTER_MAP_ITEM( KadasLineItem, []( const QgsCoordinateReferenceSystem &crs )  { return new KadasLineItem( crs ); } );
 
+qint64 KadasLineItem::State::memorySize() const
+{
+  qint64 size = sizeof( State );
+  for ( const QList<KadasItemPos> &part : points )
+  {
+    size += part.size() * sizeof( KadasItemPos );
+  }
+  return size;
+}
+
 QJsonObject KadasLineItem::State::serialize() const
 {
   QJsonArray pts;
@@ -118,7 +128,7 @@ void KadasLineItem::setPosition( const KadasItemPos &pos )
   }
   if ( mGeometry )
   {
-    mGeometry->transformVertices( [dx, dy]( const QgsPoint & p ) { return QgsPoint( p.x() + dx, p.y() + dy ); } );
+    mutableGeometry()->transformVertices( [dx, dy]( const QgsPoint & p ) { return QgsPoint( p.x() + dx, p.y() + dy ); } );
   }
   update();
 }
@@ -336,12 +346,12 @@ void KadasLineItem::addPartFromGeometry( const QgsAbstractGeometry &geom )
 
 const QgsMultiLineString *KadasLineItem::geometry() const
 {
-  return static_cast<QgsMultiLineString *>( mGeometry );
+  return static_cast<QgsMultiLineString *>( mGeometry.data() );
 }
 
 QgsMultiLineString *KadasLineItem::geometry()
 {
-  return static_cast<QgsMultiLineString *>( mGeometry );
+  return static_cast<QgsMultiLineString *>( mutableGeometry() );
 }
 
 void KadasLineItem::setMeasurementMode( MeasurementMode measurementMode, QgsUnitTypes::AngleUnit angleUnit )
@@ -27,6 +27,21 @@ KadasMapItem::KadasMapItem( const QgsCoordinateReferenceSystem &crs )
 {
 }
 
+KadasMapItem::KadasMapItem( const KadasMapItem &other )
+  : QObject()
+  , mState( other.mState )
+  , mCrs( other.mCrs )
+  , mSelected( other.mSelected )
+  , mZIndex( other.mZIndex )
+  , mSymbolScale( other.mSymbolScale )
+  , mIsPointSymbol( other.mIsPointSymbol )
+  , mEditor( other.mEditor )
+  , mRevision( other.mRevision )
+{
+  mStateShared = true;
+  other.mStateShared = true;
+}
+
 KadasMapItem::~KadasMapItem()
 {
   emit aboutToBeDestroyed();
@@ -49,6 +64,27 @@ KadasMapItem *KadasMapItem::clone() const
   return item;
 }
 
+KadasMapItem *KadasMapItem::renderCopy() const
+{
+  return _renderCopy();
+}
+
+KadasMapItem::State *KadasMapItem::mutableState()
+{
+  if ( mStateShared )
+  {
+    mState.reset( mState->clone() );
+    mStateShared = false;
+  }
+  return mState.data();
+}
+
+void KadasMapItem::resetState()
+{
+  mState.reset( createEmptyState() );
+  mStateShared = false;
+}
+
 QJsonObject KadasMapItem::serialize() const
 {
   QJsonObject props;
@@ -178,14 +214,13 @@ void KadasMapItem::setSymbolScale( double scale )
 
 void KadasMapItem::setState( const State *state )
 {
-  mState->assign( state );
+  mutableState()->assign( state );
   update();
 }
 
 void KadasMapItem::clear()
 {
-  delete mState;
-  mState = createEmptyState();
+  resetState();
   update();
 }
 
@@ -200,6 +235,7 @@ QPair<KadasMapPos, double> KadasMapItem::closestPoint( const KadasMapPos &pos, c
 
 void KadasMapItem::update()
 {
+  ++mRevision;
   emit changed();
 }
 
@@ -285,3 +321,65 @@ QString KadasMapItem::NumericAttribute::suffix( const QgsMapSettings &mapSetting
   }
   return QString();
 }
+
+KadasItemPosListDelta KadasItemPosListDelta::compute( const QList<KadasItemPos> &from, const QList<KadasItemPos> &to )
+{
+  KadasItemPosListDelta delta;
+  int n = qMin( from.size(), to.size() );
+  while ( delta.prefix < n && from[delta.prefix] == to[delta.prefix] )
+  {
+    ++delta.prefix;
+  }
+  while ( delta.suffix < n - delta.prefix && from[from.size() - 1 - delta.suffix] == to[to.size() - 1 - delta.suffix] )
+  {
+    ++delta.suffix;
+  }
+  delta.points = to.mid( delta.prefix, to.size() - delta.prefix - delta.suffix );
+  return delta;
+}
+
+QList<KadasItemPos> KadasItemPosListDelta::apply( const QList<KadasItemPos> &from ) const
+{
+  QList<KadasItemPos> result;
+  result.reserve( prefix + points.size() + suffix );
+  result.append( from.mid( 0, prefix ) );
+  result.append( points );
+  result.append( from.mid( from.size() - suffix ) );
+  return result;
+}
+
+KadasItemPartsDelta KadasItemPartsDelta::compute( const QList<QList<KadasItemPos>> &from, const QList<QList<KadasItemPos>> &to )
+{
+  KadasItemPartsDelta delta;
+  delta.nParts = to.size();
+  for ( int i = 0; i < delta.nParts; ++i )
+  {
+    if ( i >= from.size() || from[i] != to[i] )
+    {
+      delta.parts.insert( i, KadasItemPosListDelta::compute( from.value( i ), to[i] ) );
+    }
+  }
+  return delta;
+}
+
+QList<QList<KadasItemPos>> KadasItemPartsDelta::apply( const QList<QList<KadasItemPos>> &from ) const
+{
+  QList<QList<KadasItemPos>> result;
+  result.reserve( nParts );
+  for ( int i = 0; i < nParts; ++i )
+  {
+    auto it = parts.find( i );
+    result.append( it != parts.end() ? it->apply( from.value( i ) ) : from.value( i ) );
+  }
+  return result;
+}
+
+qint64 KadasItemPartsDelta::memorySize() const
+{
+  qint64 size = sizeof( KadasItemPartsDelta );
+  for ( const KadasItemPosListDelta &part : parts )
+  {
+    size += part.memorySize();
+  }
+  return size;
+}
@@ -18,6 +18,7 @@
 #define KADASMAPITEM_H
 
 #include <QObject>
+#include <QSharedPointer>
 #include <QWidget>
 
 #include <qgis/qgsabstractgeometry.h>
@@ -88,11 +89,74 @@ class KADAS_GUI_EXPORT KadasItemPos
     void setY( double y ) { mY = y; }
     operator QgsPointXY() const { return QgsPointXY( mX, mY ); }
     double sqrDist( const KadasItemPos &p ) const { return ( mX - p.mX ) * ( mX - p.mX ) + ( mY - p.mY ) * ( mY - p.mY ); }
+    bool operator==( const KadasItemPos &other ) const { return mX == other.mX && mY == other.mY; }
   private:
     double mX = 0.;
     double mY = 0.;
 };
 
+#ifndef SIP_RUN
+
+/**Changed range of a point list: the points replacing all but the first prefix and the last suffix points of the original list*/
+struct KADAS_GUI_EXPORT KadasItemPosListDelta
+{
+  int prefix = 0;
+  int suffix = 0;
+  QList<KadasItemPos> points;
+
+  static KadasItemPosListDelta compute( const QList<KadasItemPos> &from, const QList<KadasItemPos> &to );
+  QList<KadasItemPos> apply( const QList<KadasItemPos> &from ) const;
+  qint64 memorySize() const { return sizeof( KadasItemPosListDelta ) + points.size() * sizeof( KadasItemPos ); }
+};
+
+/**Changed parts of a multi-part point list*/
+struct KADAS_GUI_EXPORT KadasItemPartsDelta
+{
+  int nParts = 0;
+  QMap<int, KadasItemPosListDelta> parts;
+
+  static KadasItemPartsDelta compute( const QList<QList<KadasItemPos>> &from, const QList<QList<KadasItemPos>> &to );
+  QList<QList<KadasItemPos>> apply( const QList<QList<KadasItemPos>> &from ) const;
+  qint64 memorySize() const;
+};
+
+/**Delta of a map item state S with a points member, storing the other members in full and the points as PointsDelta*/
+template<class S, class PointsDelta>
+struct KadasMapItemStateDelta : KadasStateHistory::Delta
+{
+  S state;
+  PointsDelta points;
+
+  /**Returns the delta of state against predecessor, or nullptr if it is not smaller than the full state*/
+  static KadasStateHistory::Delta *create( const S *state, const KadasStateHistory::State *predecessor )
+  {
+    const S *prev = dynamic_cast<const S *>( predecessor );
+    if ( !prev )
+    {
+      return nullptr;
+    }
+    KadasMapItemStateDelta *delta = new KadasMapItemStateDelta();
+    delta->state = *state;
+    delta->state.points.clear();
+    delta->points = PointsDelta::compute( prev->points, state->points );
+    if ( delta->memorySize() >= state->memorySize() )
+    {
+      delete delta;
+      return nullptr;
+    }
+    return delta;
+  }
+  KadasStateHistory::State *apply( const KadasStateHistory::State *predecessor ) const override
+  {
+    S *result = state.clone();
+    result->points = points.apply( static_cast<const S *>( predecessor )->points );
+    return result;
+  }
+  qint64 memorySize() const override { return state.memorySize() + points.memorySize(); }
+};
+
+#endif // SIP_RUN
+
 class KADAS_GUI_EXPORT KadasItemRect
 {
   public:
@@ -129,6 +193,10 @@ class KADAS_GUI_EXPORT KadasMapItem : public QObject SIP_ABSTRACT
     KadasMapItem( const QgsCoordinateReferenceSystem &crs );
     ~KadasMapItem();
     KadasMapItem *clone() const;
+#ifndef SIP_RUN
+    /* Lightweight copy for rendering in a worker thread, sharing the state and style with this item until either is modified */
+    KadasMapItem *renderCopy() const;
+#endif
     QJsonObject serialize() const;
     bool deserialize( const QJsonObject &json );
 
@@ -208,6 +276,9 @@ class KADAS_GUI_EXPORT KadasMapItem : public QObject SIP_ABSTRACT
     /* Trigger a redraw */
     void update();
 
+    /* Revision, incremented on every update */
+    quint64 revision() const { return mRevision; }
+
     // State interface
     struct State : KadasStateHistory::State
     {
@@ -218,7 +289,7 @@ class KADAS_GUI_EXPORT KadasMapItem : public QObject SIP_ABSTRACT
       virtual QJsonObject serialize() const = 0;
       virtual bool deserialize( const QJsonObject &json ) = 0;
     };
-    const State *constState() const { return mState; }
+    const State *constState() const { return mState.data(); }
     virtual void setState( const State *state );
 
     struct KADAS_GUI_EXPORT NumericAttribute
@@ -304,7 +375,7 @@ class KADAS_GUI_EXPORT KadasMapItem : public QObject SIP_ABSTRACT
     void changed();
 
   protected:
-    State *mState = nullptr;
+    QSharedPointer<State> mState;
     QgsCoordinateReferenceSystem mCrs;
     bool mSelected = false;
     int mZIndex = 0;
@@ -314,6 +385,15 @@ class KADAS_GUI_EXPORT KadasMapItem : public QObject SIP_ABSTRACT
 
     virtual KadasMapItem::State *createEmptyState() const = 0 SIP_FACTORY;
 
+#ifndef SIP_RUN
+    /* Copy constructor for render copies, the copy is not associated to a layer */
+    KadasMapItem( const KadasMapItem &other );
+    /* State for modification, detached from any render copy sharing it */
+    State *mutableState();
+    /* Replace the state with an empty state */
+    void resetState();
+#endif
+
     static void defaultNodeRenderer( QPainter *painter, const QPointF &screenPoint, int nodeSize );
     static void anchorNodeRenderer( QPainter *painter, const QPointF &screenPoint, int nodeSize );
 
@@ -326,8 +406,13 @@ class KADAS_GUI_EXPORT KadasMapItem : public QObject SIP_ABSTRACT
 
   private:
     QString mEditor;
+    quint64 mRevision = 0;
+    mutable bool mStateShared = false;
 
     virtual KadasMapItem *_clone() const = 0 SIP_FACTORY;
+#ifndef SIP_RUN
+    virtual KadasMapItem *_renderCopy() const { return clone(); }
+#endif
 };
 
 #ifndef SIP_RUN
@@ -87,11 +87,14 @@ class KADAS_GUI_EXPORT KadasPictureItem : public KadasMapItem
       QJsonObject serialize() const override;
       bool deserialize( const QJsonObject &json ) override;
     };
-    const State *constState() const { return static_cast<State *>( mState ); }
+    const State *constState() const { return static_cast<State *>( mState.data() ); }
     void setState( const KadasMapItem::State *state ) override;
 
   protected:
     KadasMapItem *_clone() const override { return new KadasPictureItem( crs() ); } SIP_FACTORY
+#ifndef SIP_RUN
+    KadasMapItem *_renderCopy() const override { return new KadasPictureItem( *this ); }
+#endif
     State *createEmptyState() const override { return new State(); } SIP_FACTORY
 
   private:
@@ -104,7 +107,7 @@ class KADAS_GUI_EXPORT KadasPictureItem : public KadasMapItem
     static constexpr int sFramePadding = 4;
     static constexpr int sArrowWidth = 6;
 
-    State *state() { return static_cast<State *>( mState ); }
+    State *state() { return static_cast<State *>( mutableState() ); }
 
     QList<KadasMapPos> cornerPoints( const QgsMapSettings &settings ) const;
     static bool readGeoPos( const QString &filePath, QgsPointXY &wgsPos );
@@ -91,7 +91,7 @@ void KadasPointItem::setPosition( const KadasItemPos &pos )
     }
     if ( mGeometry )
     {
-      mGeometry->transformVertices( [dx, dy]( const QgsPoint & p ) { return QgsPoint( p.x() + dx, p.y() + dy ); } );
+      mutableGeometry()->transformVertices( [dx, dy]( const QgsPoint & p ) { return QgsPoint( p.x() + dx, p.y() + dy ); } );
     }
     update();
   }
@@ -217,12 +217,12 @@ void KadasPointItem::addPartFromGeometry( const QgsAbstractGeometry &geom )
 
 const QgsMultiPoint *KadasPointItem::geometry() const
 {
-  return static_cast<QgsMultiPoint *>( mGeometry );
+  return static_cast<QgsMultiPoint *>( mGeometry.data() );
 }
 
 QgsMultiPoint *KadasPointItem::geometry()
 {
-  return static_cast<QgsMultiPoint *>( mGeometry );
+  return static_cast<QgsMultiPoint *>( mutableGeometry() );
 }
 
 void KadasPointItem::recomputeDerived()
@@ -62,10 +62,13 @@ class KADAS_GUI_EXPORT KadasPointItem : public KadasGeometryItem
       QJsonObject serialize() const override;
       bool deserialize( const QJsonObject &json ) override;
     };
-    const State *constState() const { return static_cast<State *>( mState ); }
+    const State *constState() const { return static_cast<State *>( mState.data() ); }
 
   protected:
     KadasMapItem *_clone() const override { return new KadasPointItem( crs() ); } SIP_FACTORY
+#ifndef SIP_RUN
+    KadasMapItem *_renderCopy() const override { return new KadasPointItem( *this ); }
+#endif
     State *createEmptyState() const override { return new State(); } SIP_FACTORY
     void recomputeDerived() override;
 
@@ -73,7 +76,7 @@ class KADAS_GUI_EXPORT KadasPointItem : public KadasGeometryItem
     enum AttribIds {AttrX, AttrY};
 
     QgsMultiPoint *geometry();
-    State *state() { return static_cast<State *>( mState ); }
+    State *state() { return static_cast<State *>( mutableState() ); }
 };
 
 #endif // KADASPOINTITEM_H
@@ -33,6 +33,16 @@
 
 KADAS_REGISTER_MAP_ITEM( KadasPolygonItem, []( const QgsCoordinateReferenceSystem &crs )  { return new KadasPolygonItem( crs ); } );
 
+qint64 KadasPolygonItem::State::memorySize() const
+{
+  qint64 size = sizeof( State );
+  for ( const QList<KadasItemPos> &part : points )
+  {
+    size += part.size() * sizeof( KadasItemPos );
+  }
+  return size;
+}
+
 QJsonObject KadasPolygonItem::State::serialize() const
 {
   QJsonArray pts;
@@ -132,7 +142,7 @@ void KadasPolygonItem::setPosition( const KadasItemPos &pos )
   }
   if ( mGeometry )
   {
-    mGeometry->transformVertices( [dx, dy]( const QgsPoint & p ) { return QgsPoint( p.x() + dx, p.y() + dy ); } );
+    mutableGeometry()->transformVertices( [dx, dy]( const QgsPoint & p ) { return QgsPoint( p.x() + dx, p.y() + dy ); } );
   }
   update();
 }
@@ -325,12 +335,12 @@ void KadasPolygonItem::addPartFromGeometry( const QgsAbstractGeometry &geom )
 
 const QgsMultiPolygon *KadasPolygonItem::geometry() const
 {
-  return static_cast<QgsMultiPolygon *>( mGeometry );
+  return static_cast<QgsMultiPolygon *>( mGeometry.data() );
 }
 
 QgsMultiPolygon *KadasPolygonItem::geometry()
 {
-  return static_cast<QgsMultiPolygon *>( mGeometry );
+  return static_cast<QgsMultiPolygon *>( mutableGeometry() );
 }
 
 void KadasPolygonItem::measureGeometry()
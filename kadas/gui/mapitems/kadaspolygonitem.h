@@ -68,13 +68,20 @@ class KADAS_GUI_EXPORT KadasPolygonItem : public KadasGeometryItem
       QList<QList<KadasItemPos>> points;
       void assign( const KadasMapItem::State *other ) override { *this = *static_cast<const State *>( other ); }
       State *clone() const override SIP_FACTORY { return new State( *this ); }
+      qint64 memorySize() const override;
+#ifndef SIP_RUN
+      KadasStateHistory::Delta *diff( const KadasStateHistory::State *predecessor ) const override { return KadasMapItemStateDelta<State, KadasItemPartsDelta>::create( this, predecessor ); }
+#endif
       QJsonObject serialize() const override;
       bool deserialize( const QJsonObject &json ) override;
     };
-    const State *constState() const { return static_cast<State *>( mState ); }
+    const State *constState() const { return static_cast<State *>( mState.data() ); }
 
   protected:
     KadasMapItem *_clone() const override { return new KadasPolygonItem( crs() ); } SIP_FACTORY
+#ifndef SIP_RUN
+    KadasMapItem *_renderCopy() const override { return new KadasPolygonItem( *this ); }
+#endif
     State *createEmptyState() const override { return new State(); } SIP_FACTORY
     void recomputeDerived() override;
     void measureGeometry() override;
@@ -85,7 +92,7 @@ class KADAS_GUI_EXPORT KadasPolygonItem : public KadasGeometryItem
     bool mGeodesic = false;
 
     QgsMultiPolygon *geometry();
-    State *state() { return static_cast<State *>( mState ); }
+    State *state() { return static_cast<State *>( mutableState() ); }
 };
 
 #endif // KADASLINEITEM_H
@@ -112,7 +112,7 @@ void KadasRectangleItem::setPosition( const KadasItemPos &pos )
   }
   if ( mGeometry )
   {
-    mGeometry->transformVertices( [dx, dy]( const QgsPoint & p ) { return QgsPoint( p.x() + dx, p.y() + dy ); } );
+    mutableGeometry()->transformVertices( [dx, dy]( const QgsPoint & p ) { return QgsPoint( p.x() + dx, p.y() + dy ); } );
   }
   update();
 }
@@ -290,12 +290,12 @@ void KadasRectangleItem::addPartFromGeometry( const QgsAbstractGeometry &geom )
 
 const QgsMultiPolygon *KadasRectangleItem::geometry() const
 {
-  return static_cast<QgsMultiPolygon *>( mGeometry );
+  return static_cast<QgsMultiPolygon *>( mGeometry.data() );
 }
 
 QgsMultiPolygon *KadasRectangleItem::geometry()
 {
-  return static_cast<QgsMultiPolygon *>( mGeometry );
+  return static_cast<QgsMultiPolygon *>( mutableGeometry() );
 }
 
 void KadasRectangleItem::measureGeometry()
@@ -65,7 +65,7 @@ class KADAS_GUI_EXPORT KadasRectangleItem : public KadasGeometryItem
       QJsonObject serialize() const override;
       bool deserialize( const QJsonObject &json ) override;
     };
-    const State *constState() const { return static_cast<State *>( mState ); }
+    const State *constState() const { return static_cast<State *>( mState.data() ); }
 
   protected:
     State *createEmptyState() const override { return new State(); } SIP_FACTORY
@@ -76,8 +76,11 @@ class KADAS_GUI_EXPORT KadasRectangleItem : public KadasGeometryItem
     enum AttribIds {AttrX, AttrY};
 
     KadasMapItem *_clone() const override { return new KadasRectangleItem( crs() ); } SIP_FACTORY
+#ifndef SIP_RUN
+    KadasMapItem *_renderCopy() const override { return new KadasRectangleItem( *this ); }
+#endif
     QgsMultiPolygon *geometry();
-    State *state() { return static_cast<State *>( mState ); }
+    State *state() { return static_cast<State *>( mutableState() ); }
 };
 
 #endif // KADASRECTANGLEITEM_H
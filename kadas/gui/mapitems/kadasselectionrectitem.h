@@ -72,6 +72,9 @@ class KADAS_GUI_EXPORT KadasSelectionRectItem : public KadasMapItem
 
   protected:
     KadasMapItem *_clone() const override { return new KadasSelectionRectItem( crs() ); } SIP_FACTORY
+#ifndef SIP_RUN
+    KadasMapItem *_renderCopy() const override { return new KadasSelectionRectItem( *this ); }
+#endif
     State *createEmptyState() const override { return new State(); } SIP_FACTORY
 
   private:
@@ -59,6 +59,9 @@ class KADAS_GUI_EXPORT KadasSymbolItem : public KadasAnchoredItem
     bool mScalable = false;
 
     KadasMapItem *_clone() const override { return new KadasSymbolItem( crs() ); } SIP_FACTORY
+#ifndef SIP_RUN
+    KadasMapItem *_renderCopy() const override { return new KadasSymbolItem( *this ); }
+#endif
 };
 
 
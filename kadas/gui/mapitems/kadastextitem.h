@@ -56,6 +56,9 @@ class KADAS_GUI_EXPORT KadasTextItem : public KadasAnchoredItem
     QFont mFont;
 
     KadasMapItem *_clone() const override { return new KadasTextItem( crs() ); } SIP_FACTORY
+#ifndef SIP_RUN
+    KadasMapItem *_renderCopy() const override { return new KadasTextItem( *this ); }
+#endif
 };
 
 #endif // KADASTEXTITEM_H
@@ -80,14 +80,10 @@ void KadasMapToolDeleteItems::deleteItems( const QgsRectangle &filterRect, const
     {
       continue;
     }
-    KadasMapRect rect( filterRect.xMinimum(), filterRect.yMinimum(), filterRect.xMaximum(), filterRect.yMaximum() );
-    for ( auto it = itemLayer->items().begin(), itEnd = itemLayer->items().end(); it != itEnd; ++it )
+    QList<KadasItemLayer::ItemId> itemIds = itemLayer->itemsInRect( filterRect, canvas()->mapSettings() );
+    if ( !itemIds.isEmpty() )
     {
-      KadasMapItem *item = it.value();
-      if ( item->intersects( rect, canvas()->mapSettings() ) )
-      {
-        delItems[itemLayer].append( it.key() );
-      }
+      delItems[itemLayer] = itemIds;
     }
   }
 
@@ -117,10 +113,7 @@ void KadasMapToolDeleteItems::deleteItems( const QgsRectangle &filterRect, const
         if ( it.value()->isChecked() )
         {
           KadasItemLayer *layer = it.key();
-          for ( const KadasItemLayer::ItemId &itemId : delItems[layer] )
-          {
-            delete layer->takeItem( itemId );
-          }
+          qDeleteAll( layer->takeItems( delItems[layer] ) );
           layer->triggerRepaint( true );
         }
       }
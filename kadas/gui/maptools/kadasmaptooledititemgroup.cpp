@@ -74,11 +74,17 @@ void KadasMapToolEditItemGroup::activate()
 void KadasMapToolEditItemGroup::deactivate()
 {
   QgsMapTool::deactivate();
-  while ( !mItems.isEmpty() )
+  for ( KadasMapItem *item : mItems )
   {
-    deselectItem( mItems.front(), false );
+    item->setSelected( false );
   }
+  mLayer->addItems( mItems );
   mLayer->triggerRepaint();
+  for ( KadasMapItem *item : mItems )
+  {
+    KadasMapCanvasItemManager::removeItemAfterRefresh( item, mCanvas );
+  }
+  mItems.clear();
 
   KadasMapCanvasItemManager::removeItem( mSelectionRect );
   delete mSelectionRect;
@@ -224,7 +224,9 @@ void KadasMapToolViewshed::drawFinished()
     return;
   }
 
-  bool success = KadasViewshedFilter::computeViewshed( gdalSource, outputFile, "GTiff", center, canvasCrs, viewshedDialog.getObserverHeight() * heightConv, viewshedDialog.getTargetHeight() * heightConv, viewshedDialog.getHeightRelativeToGround(), curRadius, QgsUnitTypes::DistanceMeters, filterRegion, displayVisible, accuracyFactor, &p );
+  KadasViewshedFilter::setMemoryBudget( QgsSettings().value( "/kadas/viewshed_memory_budget_mb", 1024 ).toLongLong() * 1024 * 1024 );
+  KadasViewshedFilter::Algorithm algorithm = QgsSettings().value( "/kadas/viewshed_raycasting", false ).toBool() ? KadasViewshedFilter::RayCasting : KadasViewshedFilter::SweepXDraw;
+  bool success = KadasViewshedFilter::computeViewshed( gdalSource, outputFile, "GTiff", center, canvasCrs, viewshedDialog.getObserverHeight() * heightConv, viewshedDialog.getTargetHeight() * heightConv, viewshedDialog.getHeightRelativeToGround(), curRadius, QgsUnitTypes::DistanceMeters, filterRegion, displayVisible, accuracyFactor, &p, algorithm );
   QApplication::restoreOverrideCursor();
   if ( success )
   {
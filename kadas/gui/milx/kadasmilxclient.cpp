@@ -21,16 +21,20 @@
 #include <QApplication>
 #include <QDataStream>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QEventLoop>
+#include <QFutureInterface>
 #include <QHostAddress>
 #include <QNetworkConfigurationManager>
 #include <QNetworkSession>
 #include <QImage>
+#include <QMutexLocker>
 #include <QProcess>
 #include <QTcpSocket>
 #include <QThread>
 #include <QTimer>
 
+#include <qgis/qgslogger.h>
 #include <qgis/qgssettings.h>
 
 #include <kadas/gui/milx/kadasmilxclient.h>
@@ -56,6 +60,8 @@ void KadasMilxClientWorker::cleanup()
   }
   delete mNetworkSession;
   mNetworkSession = 0;
+  mReadBuffer.clear();
+  failPendingRequests();
 }
 
 bool KadasMilxClientWorker::initialize()
@@ -155,6 +161,7 @@ bool KadasMilxClientWorker::initialize()
   timeoutTimer.setSingleShot( true );
   connect( mTcpSocket, &QTcpSocket::disconnected, this, &KadasMilxClientWorker::cleanup );
   connect( mTcpSocket, qOverload<QAbstractSocket::SocketError>( &QTcpSocket::error ), this, &KadasMilxClientWorker::handleSocketError );
+  connect( mTcpSocket, &QTcpSocket::readyRead, this, &KadasMilxClientWorker::readReplies );
   {
     QEventLoop evLoop;
     connect( mTcpSocket, qOverload<QAbstractSocket::SocketError>( &QTcpSocket::error ), &evLoop, &QEventLoop::quit );
@@ -212,57 +219,147 @@ bool KadasMilxClientWorker::processRequest( const QByteArray &request, QByteArra
     return false;
   }
 
-  int requiredSize = 0;
+  bool finished = false;
+  bool success = false;
   response.clear();
+  sendRequest( request, expectedReply, [&]( bool ok, const QByteArray & reply )
+  {
+    finished = true;
+    success = ok;
+    response = reply;
+  } );
+
+  // Replies to previously posted requests are dispatched to their handlers while waiting
+  static const int sReplyTimeout = 5000;
+  while ( !finished )
+  {
+    bool timedOut = false;
+    if ( mSync || forceSync )
+    {
+      // The socket is only scheduled for deletion if it disconnects while waiting
+      QTcpSocket *socket = mTcpSocket;
+      timedOut = !socket->waitForReadyRead( sReplyTimeout ) && socket->error() == QAbstractSocket::SocketTimeoutError;
+    }
+    else
+    {
+      QEventLoop evLoop;
+      QTimer timeoutTimer;
+      timeoutTimer.setSingleShot( true );
+      connect( mTcpSocket, &QTcpSocket::readyRead, &evLoop, &QEventLoop::quit );
+      connect( mTcpSocket, &QTcpSocket::disconnected, &evLoop, &QEventLoop::quit );
+      connect( &timeoutTimer, &QTimer::timeout, &evLoop, [&]() { timedOut = true; evLoop.quit(); } );
+      timeoutTimer.start( sReplyTimeout );
+      evLoop.exec( QEventLoop::ExcludeUserInputEvents );
+    }
+    if ( finished )
+    {
+      break;
+    }
+    if ( timedOut )
+    {
+      // A late reply would be matched to the wrong request, so drop the connection. Also invokes the handler of this request.
+      mLastError = tr( "Timeout waiting for reply" );
+      if ( mTcpSocket )
+      {
+        mTcpSocket->abort();
+      }
+      cleanup();
+      break;
+    }
+    if ( !mTcpSocket || !mTcpSocket->isValid() )
+    {
+      // Also invokes the handler of this request
+      failPendingRequests();
+      break;
+    }
+    readReplies();
+  }
+  return success;
+}
+
+quint32 KadasMilxClientWorker::postRequest( const QByteArray &request, quint8 expectedReply, const ReplyHandler &handler )
+{
+  mLastError = QString();
+
+  if ( !mTcpSocket && !initialize() )
+  {
+    mLastError = tr( "Connection failed" );
+    handler( false, QByteArray() );
+    return 0;
+  }
+  return sendRequest( request, expectedReply, handler );
+}
+
+quint32 KadasMilxClientWorker::sendRequest( const QByteArray &request, quint8 expectedReply, const ReplyHandler &handler )
+{
+  PendingRequest pending;
+  pending.id = ++mNextRequestId;
+  pending.expectedReply = expectedReply;
+  pending.handler = handler;
+  mPendingRequests.enqueue( pending );
 
   qint32 len = request.size();
   mTcpSocket->write( reinterpret_cast<char *>( &len ), sizeof( quint32 ) );
   mTcpSocket->write( request );
   mTcpSocket->flush();
+  return pending.id;
+}
 
-  do
+void KadasMilxClientWorker::readReplies()
+{
+  if ( !mTcpSocket )
   {
-    if ( mSync || forceSync )
+    return;
+  }
+  mReadBuffer += mTcpSocket->readAll();
+  while ( mReadBuffer.size() >= int( sizeof( qint32 ) ) )
+  {
+    qint32 len = *reinterpret_cast<const qint32 *>( mReadBuffer.constData() );
+    if ( mReadBuffer.size() < int( sizeof( qint32 ) ) + len )
     {
-      mTcpSocket->waitForReadyRead( 5000 );
+      break;
     }
-    else
+    QByteArray response = mReadBuffer.mid( sizeof( qint32 ), len );
+    mReadBuffer.remove( 0, sizeof( qint32 ) + len );
+    if ( mPendingRequests.isEmpty() )
     {
-      if ( !mTcpSocket->bytesAvailable() )
-      {
-        QEventLoop evLoop;
-        connect( mTcpSocket, &QTcpSocket::readyRead, &evLoop, &QEventLoop::quit );
-        evLoop.exec( QEventLoop::ExcludeUserInputEvents );
-      }
+      QgsDebugMsg( "Discarding reply without pending request" );
+      continue;
     }
+    PendingRequest pending = mPendingRequests.dequeue();
 
-    if ( !mLastError.isEmpty() || !mTcpSocket->isValid() )
+    QDataStream ostream( &response, QIODevice::ReadOnly );
+    MilXServerReply replycmd = 0; ostream >> replycmd;
+    bool ok = false;
+    if ( replycmd == MILX_REPLY_ERROR )
     {
-      return false;
+      ostream >> mLastError;
     }
-    response += mTcpSocket->readAll();
-    if ( requiredSize == 0 && !response.isEmpty() )
+    else if ( replycmd != pending.expectedReply )
     {
-      requiredSize = *reinterpret_cast<qint32 *>( response.left( sizeof( qint32 ) ).data() );
-      response = response.mid( sizeof( qint32 ) );
+      mLastError = tr( "Unexpected reply" );
     }
+    else
+    {
+      ok = true;
+    }
+    if ( !ok )
+    {
+      QgsDebugMsg( QString( "Request %1 failed: %2" ).arg( pending.id ).arg( mLastError ) );
+    }
+    pending.handler( ok, response );
   }
-  while ( response.size() < requiredSize );
-  Q_ASSERT( mTcpSocket->bytesAvailable() == 0 );
+}
 
-  QDataStream ostream( &response, QIODevice::ReadOnly );
-  MilXServerReply replycmd = 0; ostream >> replycmd;
-  if ( replycmd == MILX_REPLY_ERROR )
-  {
-    ostream >> mLastError;
-    return false;
-  }
-  else if ( replycmd != expectedReply )
+void KadasMilxClientWorker::failPendingRequests()
+{
+  // Handlers may post new requests, hence detach the queue first
+  QQueue<PendingRequest> pendingRequests;
+  pendingRequests.swap( mPendingRequests );
+  for ( const PendingRequest &pending : pendingRequests )
   {
-    mLastError = tr( "Unexpected reply" );
-    return false;
+    pending.handler( false, QByteArray() );
   }
-  return true;
 }
 
 void KadasMilxClientWorker::handleSocketError()
@@ -284,14 +381,23 @@ void KadasMilxClientWorker::handleSocketError()
     case QAbstractSocket::ConnectionRefusedError:
       mLastError = tr( "Connection refused" );
       break;
+    case QAbstractSocket::SocketTimeoutError:
+      mLastError = tr( "Timeout waiting for reply" );
+      break;
     default:
       mLastError = tr( "An error occured: %1" ).arg( mTcpSocket->errorString() );
   }
+  // Late replies to the failed requests would be matched to later requests, so drop the connection. Also fails the pending requests.
+  QString lastError = mLastError;
+  mTcpSocket->abort();
+  cleanup();
+  mLastError = lastError;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
 KadasMilxClient *KadasMilxClient::sInstance = 0;
+const int KadasMilxClient::sGraphicCacheSize = 64 * 1024;
 
 KadasMilxClient *KadasMilxClient::instance()
 {
@@ -305,7 +411,7 @@ KadasMilxClient *KadasMilxClient::instance()
 KadasMilxClient::KadasMilxClient()
   : mAsyncWorker( false ), mSyncWorker( true )
 {
-  ;
+  mGraphicCache.setMaxCost( sGraphicCacheSize );
   mSyncWorker.moveToThread( this );
   start();
 }
@@ -333,6 +439,13 @@ bool KadasMilxClient::processRequest( const QByteArray &request, QByteArray &res
   }
 }
 
+void KadasMilxClient::postRequest( const QByteArray &request, quint8 expectedReply, const KadasMilxClientWorker::ReplyHandler &handler )
+{
+  // Pipelined requests go through the worker living in the client thread, so that replies are dispatched independently of the caller
+  KadasMilxClientWorker *worker = &mSyncWorker;
+  QMetaObject::invokeMethod( worker, [worker, request, expectedReply, handler] { worker->postRequest( request, expectedReply, handler ); } );
+}
+
 QString KadasMilxClient::attributeName( KadasMilxAttrType idx )
 {
   if ( idx == MilxAttributeWidth )
@@ -582,6 +695,18 @@ bool KadasMilxClient::createSymbol( QString &symbolId, KadasMilxSymbolDesc &resu
 }
 
 bool KadasMilxClient::updateSymbol( const QRect &visibleExtent, int dpi, const NPointSymbol &symbol, NPointSymbolGraphic &result, bool returnPoints )
+{
+  QFuture<NPointSymbolGraphic> future = updateSymbolAsync( visibleExtent, dpi, symbol, returnPoints );
+  future.waitForFinished();
+  if ( future.isCanceled() )
+  {
+    return false;
+  }
+  result = future.result();
+  return true;
+}
+
+QFuture<KadasMilxClient::NPointSymbolGraphic> KadasMilxClient::updateSymbolAsync( const QRect &visibleExtent, int dpi, const NPointSymbol &symbol, bool returnPoints )
 {
   QByteArray request;
   QDataStream istream( &request, QIODevice::WriteOnly );
@@ -589,57 +714,153 @@ bool KadasMilxClient::updateSymbol( const QRect &visibleExtent, int dpi, const N
   istream << visibleExtent << dpi;
   istream << symbol.xml << symbol.points << symbol.controlPoints << symbol.attributes << symbol.finalized << symbol.colored << returnPoints;
 
-  QByteArray response;
-  if ( !instance()->processRequest( request, response, MILX_REPLY_UPDATE_SYMBOL ) )
+  QFutureInterface<NPointSymbolGraphic> futureInterface;
+  futureInterface.reportStarted();
+  instance()->postRequest( request, MILX_REPLY_UPDATE_SYMBOL, [futureInterface, returnPoints]( bool ok, const QByteArray & response ) mutable
   {
-    return false;
-  }
-
-  QDataStream ostream( &response, QIODevice::ReadOnly );
-  MilXServerReply replycmd = 0; ostream >> replycmd;
-  KadasMilxClient::deserializeSymbol( ostream, result, returnPoints );
-  return true;
+    if ( ok )
+    {
+      QDataStream ostream( response );
+      MilXServerReply replycmd = 0; ostream >> replycmd;
+      NPointSymbolGraphic result;
+      KadasMilxClient::deserializeSymbol( ostream, result, returnPoints );
+      futureInterface.reportResult( result );
+    }
+    else
+    {
+      futureInterface.reportCanceled();
+    }
+    futureInterface.reportFinished();
+  } );
+  return futureInterface.future();
 }
 
 bool KadasMilxClient::updateSymbols( const QRect &visibleExtent, int dpi, double scaleFactor, const QList<NPointSymbol> &symbols, QList<NPointSymbolGraphic> &result )
 {
+  // Look up the symbols in the graphic cache, only request the missing ones from the server
   int nSymbols = symbols.length();
-  QByteArray request;
-  QDataStream istream( &request, QIODevice::WriteOnly );
-  istream << MILX_REQUEST_UPDATE_SYMBOLS;
-  istream << visibleExtent;
-  istream << dpi;
-  istream << scaleFactor;
-  istream << nSymbols;
-  for ( const NPointSymbol &symbol : symbols )
+  QVector<NPointSymbolGraphic> graphics( nSymbols );
+  QVector<QByteArray> cacheKeys( nSymbols );
+  QVector<int> missing;
   {
-    istream << symbol.xml << symbol.points << symbol.controlPoints << symbol.attributes << symbol.finalized << symbol.colored;
+    QMutexLocker locker( &instance()->mGraphicCacheMutex );
+    for ( int i = 0; i < nSymbols; ++i )
+    {
+      cacheKeys[i] = graphicCacheKey( symbols[i], dpi, scaleFactor );
+      const NPointSymbolGraphic *cached = instance()->mGraphicCache.object( cacheKeys[i] );
+      if ( cached )
+      {
+        graphics[i] = *cached;
+      }
+      else
+      {
+        missing.append( i );
+      }
+    }
   }
-  QByteArray response;
-  if ( !instance()->processRequest( request, response, MILX_REPLY_UPDATE_SYMBOLS ) )
+
+  UpdateTimings timings;
+  timings.nSymbols = nSymbols;
+  timings.nCached = nSymbols - missing.length();
+  if ( !missing.isEmpty() )
   {
-    return false;
-  }
+    QElapsedTimer timer;
+    timer.start();
+    int nRequested = missing.length();
+    QByteArray request;
+    QDataStream istream( &request, QIODevice::WriteOnly );
+    istream << MILX_REQUEST_UPDATE_SYMBOLS;
+    istream << visibleExtent;
+    istream << dpi;
+    istream << scaleFactor;
+    istream << nRequested;
+    for ( int i : missing )
+    {
+      const NPointSymbol &symbol = symbols[i];
+      istream << symbol.xml << symbol.points << symbol.controlPoints << symbol.attributes << symbol.finalized << symbol.colored;
+    }
+    QByteArray response;
+    if ( !instance()->processRequest( request, response, MILX_REPLY_UPDATE_SYMBOLS ) )
+    {
+      return false;
+    }
+    timings.serverTime = timer.nsecsElapsed() / 1.0e6;
+    timer.restart();
+
+    QDataStream ostream( &response, QIODevice::ReadOnly );
+    MilXServerReply replycmd = 0; ostream >> replycmd;
+    int nOutSymbols;
+    ostream >> nOutSymbols;
+    if ( nOutSymbols != nRequested )
+    {
+      return false;
+    }
+    QVector<QByteArray> svgxmls( nRequested );
+    for ( int j = 0; j < nRequested; ++j )
+    {
+      ostream >> svgxmls[j];
+      ostream >> graphics[missing[j]].offset;
+    }
+    timings.parseTime = timer.nsecsElapsed() / 1.0e6;
+    timer.restart();
+
+    // Rasterize the symbols in parallel, each iteration writes to a distinct graphic
+    NPointSymbolGraphic *graphicsData = graphics.data();
+    const int *missingData = missing.constData();
+    #pragma omp parallel for schedule(dynamic)
+    for ( int j = 0; j < nRequested; ++j )
+    {
+      graphicsData[missingData[j]].graphic = renderSvg( svgxmls[j] );
+    }
+    timings.rasterTime = timer.nsecsElapsed() / 1.0e6;
 
-  QDataStream ostream( &response, QIODevice::ReadOnly );
-  MilXServerReply replycmd = 0; ostream >> replycmd;
-  int nOutSymbols;
-  ostream >> nOutSymbols;
-  if ( nOutSymbols != nSymbols )
+    QMutexLocker locker( &instance()->mGraphicCacheMutex );
+    for ( int i : missing )
+    {
+      const NPointSymbolGraphic &symbolGraphic = graphics[i];
+      // Graphics touching the border of the visible extent may be clipped and are hence not reusable after panning
+      QRect graphicRect( symbols[i].points.front() + symbolGraphic.offset, symbolGraphic.graphic.size() );
+      if ( visibleExtent.adjusted( 1, 1, -1, -1 ).contains( graphicRect ) )
+      {
+        int cost = qMax( 1, symbolGraphic.graphic.bytesPerLine() * symbolGraphic.graphic.height() / 1024 );
+        instance()->mGraphicCache.insert( cacheKeys[i], new NPointSymbolGraphic( symbolGraphic ), cost );
+      }
+    }
+  }
+  QgsDebugMsgLevel( QString( "Updated %1 symbols (%2 cached): server %3 ms, parse %4 ms, raster %5 ms" )
+                    .arg( timings.nSymbols ).arg( timings.nCached ).arg( timings.serverTime ).arg( timings.parseTime ).arg( timings.rasterTime ), 2 );
   {
-    return false;
+    QMutexLocker locker( &instance()->mGraphicCacheMutex );
+    instance()->mLastUpdateTimings = timings;
   }
-  for ( int i = 0; i < nOutSymbols; ++i )
+  for ( const NPointSymbolGraphic &symbolGraphic : graphics )
   {
-    NPointSymbolGraphic symbolGraphic;
-    QByteArray svgxml; ostream >> svgxml;
-    symbolGraphic.graphic = renderSvg( svgxml );
-    ostream >> symbolGraphic.offset;
     result.append( symbolGraphic );
   }
   return true;
 }
 
+KadasMilxClient::UpdateTimings KadasMilxClient::lastUpdateTimings()
+{
+  QMutexLocker locker( &instance()->mGraphicCacheMutex );
+  return instance()->mLastUpdateTimings;
+}
+
+QByteArray KadasMilxClient::graphicCacheKey( const NPointSymbol &symbol, int dpi, double scaleFactor )
+{
+  // Points are relative to the first point, since the graphic offset also is, so that the key is invariant under panning
+  QList<QPoint> points;
+  QPoint origin = symbol.points.isEmpty() ? QPoint() : symbol.points.front();
+  for ( const QPoint &point : symbol.points )
+  {
+    points.append( point - origin );
+  }
+  QByteArray key;
+  QDataStream stream( &key, QIODevice::WriteOnly );
+  stream << symbol.xml << points << symbol.controlPoints << symbol.attributes << symbol.finalized << symbol.colored << dpi << scaleFactor;
+  return key;
+}
+
 bool KadasMilxClient::upgradeMilXFile( const QString &inputXml, QString &outputXml, bool &valid, QString &messages )
 {
   QByteArray request;
@@ -699,22 +920,43 @@ bool KadasMilxClient::validateSymbolXml( const QString &symbolXml, const QString
 
 
 bool KadasMilxClient::hitTest( const NPointSymbol &symbol, const QPoint &clickPos, bool &hitTestResult )
+{
+  QFuture<bool> future = hitTestAsync( symbol, clickPos );
+  future.waitForFinished();
+  if ( future.isCanceled() )
+  {
+    return false;
+  }
+  hitTestResult = future.result();
+  return true;
+}
+
+QFuture<bool> KadasMilxClient::hitTestAsync( const NPointSymbol &symbol, const QPoint &clickPos )
 {
   QByteArray request;
   QDataStream istream( &request, QIODevice::WriteOnly );
   istream << MILX_REQUEST_HIT_TEST;
   istream << symbol.xml << symbol.points << symbol.controlPoints << symbol.attributes << symbol.finalized << symbol.colored << clickPos;
 
-  QByteArray response;
-  if ( !instance()->processRequest( request, response, MILX_REPLY_HIT_TEST ) )
+  QFutureInterface<bool> futureInterface;
+  futureInterface.reportStarted();
+  instance()->postRequest( request, MILX_REPLY_HIT_TEST, [futureInterface]( bool ok, const QByteArray & response ) mutable
   {
-    return false;
-  }
-
-  QDataStream ostream( &response, QIODevice::ReadOnly );
-  MilXServerReply replycmd = 0; ostream >> replycmd;
-  ostream >> hitTestResult;
-  return true;
+    if ( ok )
+    {
+      QDataStream ostream( response );
+      MilXServerReply replycmd = 0; ostream >> replycmd;
+      bool hitTestResult = false;
+      ostream >> hitTestResult;
+      futureInterface.reportResult( hitTestResult );
+    }
+    else
+    {
+      futureInterface.reportCanceled();
+    }
+    futureInterface.reportFinished();
+  } );
+  return futureInterface.future();
 }
 
 bool KadasMilxClient::pickSymbol( const QList<NPointSymbol> &symbols, const QPoint &clickPos, int &selectedSymbol, QRect &boundingBox )
@@ -767,6 +1009,12 @@ bool KadasMilxClient::getCurrentLibraryVersionTag( QString &versionTag )
 
 bool KadasMilxClient::setSymbolOptions( int symbolSize, int lineWidth, int workMode )
 {
+  {
+    // Cached graphics were rendered with the previous options
+    QMutexLocker locker( &mGraphicCacheMutex );
+    mGraphicCache.clear();
+  }
+  mSymbolOptionsRevision.ref();
   QByteArray request;
   QDataStream istream( &request, QIODevice::WriteOnly );
   istream << MILX_REQUEST_SET_SYMBOL_OPTIONS << symbolSize << lineWidth << workMode;
@@ -842,22 +1090,29 @@ QImage KadasMilxClient::renderSvg( const QByteArray &xml )
   }
   GInputStream *stream = g_memory_input_stream_new_from_data( reinterpret_cast<const unsigned char *>( xml.constData() ), xml.length(), nullptr );
   RsvgHandle *handle = rsvg_handle_new_from_stream_sync( stream, nullptr, RSVG_HANDLE_FLAGS_NONE, nullptr, nullptr );
+  g_object_unref( stream );
   if ( handle == 0 )
   {
     return QImage();
   }
   RsvgDimensionData dimension_data;
   rsvg_handle_get_dimensions( handle, &dimension_data );
+  if ( dimension_data.width <= 0 || dimension_data.height <= 0 )
+  {
+    g_object_unref( handle );
+    return QImage();
+  }
 
-  QImage image( dimension_data.width, dimension_data.height, QImage::Format_ARGB32 );
-  image.fill( Qt::transparent );
+  // Cairo renders premultiplied ARGB32 with native endianness, which is the memory layout of QImage::Format_ARGB32_Premultiplied,
+  // hence render straight into the image buffer, which also can be drawn without conversion
+  QImage image( dimension_data.width, dimension_data.height, QImage::Format_ARGB32_Premultiplied );
+  image.fill( 0 );
   cairo_surface_t *surface = cairo_image_surface_create_for_data( image.bits(), CAIRO_FORMAT_ARGB32, image.width(), image.height(), image.bytesPerLine() );
   cairo_t *cr = cairo_create( surface );
   rsvg_handle_render_cairo( handle, cr );
   cairo_destroy( cr );
   cairo_surface_destroy( surface );
   g_object_unref( handle );
-  g_object_unref( stream );
   return image;
 }
 
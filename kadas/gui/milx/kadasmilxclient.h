@@ -18,12 +18,19 @@
 #ifndef KADASMILXCLIENT_H
 #define KADASMILXCLIENT_H
 
+#include <functional>
+
 #include <qglobal.h>
+#include <QAtomicInt>
+#include <QCache>
+#include <QFuture>
 #include <QMap>
+#include <QMutex>
 #include <QObject>
 #include <QPair>
 #include <QPoint>
 #include <QPixmap>
+#include <QQueue>
 #include <QThread>
 
 #include <kadas/gui/kadas_gui.h>
@@ -57,8 +64,15 @@ class KADAS_GUI_EXPORT KadasMilxClientWorker : public QObject
 {
     Q_OBJECT
   public:
+    /**Invoked with the reply (including the reply command) once it arrives, ok is false if the request failed*/
+    typedef std::function<void( bool ok, const QByteArray &response )> ReplyHandler;
+
     KadasMilxClientWorker( bool sync );
 
+    /**Sends the request without waiting for the reply and returns the request id.
+      Requests are pipelined, the handler is invoked from the worker thread when the reply arrives.*/
+    quint32 postRequest( const QByteArray &request, quint8 expectedReply, const ReplyHandler &handler );
+
   public slots:
     bool initialize();
     bool getCurrentLibraryVersionTag( QString &versionTag );
@@ -66,15 +80,30 @@ class KADAS_GUI_EXPORT KadasMilxClientWorker : public QObject
     void cleanup();
 
   private:
+    struct PendingRequest
+    {
+      quint32 id;
+      quint8 expectedReply;
+      ReplyHandler handler;
+    };
+
     bool mSync;
     QProcess *mProcess;
     QNetworkSession *mNetworkSession;
     QTcpSocket *mTcpSocket;
     QString mLastError;
     QString mLibraryVersionTag;
+    // The server replies in request order, hence pending requests are matched in FIFO order
+    QQueue<PendingRequest> mPendingRequests;
+    QByteArray mReadBuffer;
+    quint32 mNextRequestId = 0;
+
+    quint32 sendRequest( const QByteArray &request, quint8 expectedReply, const ReplyHandler &handler );
+    void failPendingRequests();
 
   private slots:
     void handleSocketError();
+    void readReplies();
 };
 
 
@@ -105,6 +134,16 @@ class KADAS_GUI_EXPORT KadasMilxClient : public QThread
       QMap<KadasMilxAttrType, QPoint> attributePoints;
     };
 
+    /**Timings of an updateSymbols call (i.e. of a rendered frame of a MilX layer), in milliseconds*/
+    struct UpdateTimings
+    {
+      int nSymbols = 0;
+      int nCached = 0;
+      double serverTime = 0;
+      double parseTime = 0;
+      double rasterTime = 0;
+    };
+
     static QString attributeName( KadasMilxAttrType idx );
     static KadasMilxAttrType attributeIdx( const QString &name );
 
@@ -113,6 +152,8 @@ class KADAS_GUI_EXPORT KadasMilxClient : public QThread
     static int getSymbolSize() { return instance()->mSymbolSize; }
     static int getLineWidth() { return instance()->mLineWidth; }
     static void setWorkMode( int workMode ) { instance()->mWorkMode = workMode; instance()->setSymbolOptions( instance()->mSymbolSize, instance()->mLineWidth, instance()->mWorkMode ); }
+    /**Incremented whenever the symbol options change, i.e. when previously rendered graphics become stale*/
+    static int symbolOptionsRevision() { return instance()->mSymbolOptionsRevision.load(); }
 
     static bool init();
     static bool getSymbolMetadata( const QString &symbolId, KadasMilxSymbolDesc &result );
@@ -132,8 +173,15 @@ class KADAS_GUI_EXPORT KadasMilxClient : public QThread
 
     static bool updateSymbol( const QRect &visibleExtent, int dpi, const NPointSymbol &symbol, NPointSymbolGraphic &result, bool returnPoints );
     static bool updateSymbols( const QRect &visibleExtent, int dpi, double scaleFactor, const QList<NPointSymbol> &symbols, QList<NPointSymbolGraphic> &result );
+    static UpdateTimings lastUpdateTimings();
 
     static bool hitTest( const NPointSymbol &symbol, const QPoint &clickPos, bool &hitTestResult );
+
+    /**Asynchronous variants of updateSymbol and hitTest. The requests are pipelined, so that many of them can be in flight at once.
+      The returned future is canceled if the request fails. Results are reported from the client thread, hence it is safe to
+      wait on the future from any thread, or to watch it with a QFutureWatcher.*/
+    static QFuture<NPointSymbolGraphic> updateSymbolAsync( const QRect &visibleExtent, int dpi, const NPointSymbol &symbol, bool returnPoints );
+    static QFuture<bool> hitTestAsync( const NPointSymbol &symbol, const QPoint &clickPos );
     static bool pickSymbol( const QList<NPointSymbol> &symbols, const QPoint &clickPos, int &selectedSymbol, QRect &boundingBox );
 
     static bool getCurrentLibraryVersionTag( QString &versionTag );
@@ -151,14 +199,22 @@ class KADAS_GUI_EXPORT KadasMilxClient : public QThread
     int mSymbolSize;
     int mLineWidth;
     int mWorkMode;
+    QAtomicInt mSymbolOptionsRevision;
+    // Graphics returned by updateSymbols, keyed by graphicCacheKey, cost in kB
+    QMutex mGraphicCacheMutex;
+    QCache<QByteArray, NPointSymbolGraphic> mGraphicCache;
+    static const int sGraphicCacheSize;
+    UpdateTimings mLastUpdateTimings;
 
     KadasMilxClient();
     ~KadasMilxClient();
     static KadasMilxClient *instance();
     static QImage renderSvg( const QByteArray &xml );
     static void deserializeSymbol( QDataStream &ostream, NPointSymbolGraphic &result, bool deserializePoints = true );
+    static QByteArray graphicCacheKey( const NPointSymbol &symbol, int dpi, double scaleFactor );
 
     bool processRequest( const QByteArray &request, QByteArray &response, quint8 expectedReply, bool async = false );
+    void postRequest( const QByteArray &request, quint8 expectedReply, const KadasMilxClientWorker::ReplyHandler &handler );
     bool setSymbolOptions( int symbolSize, int lineWidth, int workMode );
 };
 
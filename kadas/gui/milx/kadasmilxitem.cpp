@@ -31,6 +31,11 @@
 
 KADAS_REGISTER_MAP_ITEM( KadasMilxItem, []( const QgsCoordinateReferenceSystem &crs )  { return new KadasMilxItem(); } );
 
+qint64 KadasMilxItem::State::memorySize() const
+{
+  return sizeof( State ) + points.size() * sizeof( KadasItemPos ) + attributes.size() * sizeof( double ) + attributePoints.size() * sizeof( KadasItemPos ) + controlPoints.size() * sizeof( int );
+}
+
 QJsonObject KadasMilxItem::State::serialize() const
 {
   QJsonArray pts;
@@ -746,6 +751,14 @@ KadasMilxClient::NPointSymbol KadasMilxItem::toSymbol( const QgsMapToPixel &mapT
   return KadasMilxClient::NPointSymbol( mMssString, points, constState()->controlPoints, screenAttribs, finalized, colored );
 }
 
+QPoint KadasMilxItem::symbolOrigin( const QgsMapToPixel &mapToPixel, const QgsCoordinateReferenceSystem &mapCrs ) const
+{
+  // First point of the symbol returned by toSymbol, to which the graphic offset is relative
+  QgsCoordinateTransform mapCrst( mCrs, mapCrs, QgsProject::instance()->transformContext() );
+  QPoint origin = mapToPixel.transform( mapCrst.transform( constState()->points.front() ) ).toQPointF().toPoint();
+  return origin + constState()->userOffset;
+}
+
 void KadasMilxItem::writeMilx( QDomDocument &doc, QDomElement &itemElement ) const
 {
   QDomElement stringXmlEl = doc.createElement( "MssStringXML" );
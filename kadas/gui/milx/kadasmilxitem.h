@@ -74,11 +74,15 @@ class KADAS_GUI_EXPORT KadasMilxItem : public KadasMapItem
 
       void assign( const KadasMapItem::State *other ) override { *this = *static_cast<const State *>( other ); }
       State *clone() const override SIP_FACTORY { return new State( *this ); }
+      qint64 memorySize() const override;
+#ifndef SIP_RUN
+      KadasStateHistory::Delta *diff( const KadasStateHistory::State *predecessor ) const override { return KadasMapItemStateDelta<State, KadasItemPosListDelta>::create( this, predecessor ); }
+#endif
       QJsonObject serialize() const override;
       bool deserialize( const QJsonObject &json ) override;
     };
     void setState( const KadasMapItem::State *state ) override;
-    const State *constState() const { return static_cast<State *>( mState ); }
+    const State *constState() const { return static_cast<State *>( mState.data() ); }
 
     // Draw interface (all points in item crs)
     bool startPart( const KadasMapPos &firstPoint, const QgsMapSettings &mapSettings ) override;
@@ -117,6 +121,9 @@ class KADAS_GUI_EXPORT KadasMilxItem : public KadasMapItem
 
   protected:
     KadasMapItem *_clone() const override { return new KadasMilxItem(); } SIP_FACTORY
+#ifndef SIP_RUN
+    KadasMapItem *_renderCopy() const override { return new KadasMilxItem( *this ); }
+#endif
     KadasMilxItem::State *createEmptyState() const override { return new State(); } SIP_FACTORY
 
   private:
@@ -144,11 +151,12 @@ class KADAS_GUI_EXPORT KadasMilxItem : public KadasMapItem
 
     Margin mMargin;
 
-    KadasMilxItem::State *state() { return static_cast<State *>( mState ); }
+    KadasMilxItem::State *state() { return static_cast<State *>( mutableState() ); }
 
     QList<QPoint> computeScreenPoints( const QgsMapToPixel &mapToPixel, const QgsCoordinateTransform &mapCrst ) const;
     QList< QPair<int, double> > computeScreenAttributes( const QgsMapToPixel &mapToPixel, const QgsCoordinateTransform &mapCrst ) const;
     KadasMilxClient::NPointSymbol toSymbol( const QgsMapToPixel &mapToPixel, const QgsCoordinateReferenceSystem &mapCrs, bool colored = true ) const;
+    QPoint symbolOrigin( const QgsMapToPixel &mapToPixel, const QgsCoordinateReferenceSystem &mapCrs ) const;
     double metersToPixels( const QgsPointXY &refPoint, const QgsMapToPixel &mapToPixel, const QgsCoordinateTransform &mapCrst ) const;
     void updateSymbol( const QgsMapSettings &mapSettings, const KadasMilxClient::NPointSymbolGraphic &result );
 
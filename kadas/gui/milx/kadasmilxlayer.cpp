@@ -17,6 +17,7 @@
 #include <QApplication>
 #include <QDesktopWidget>
 #include <QMenu>
+#include <QMutexLocker>
 
 #include <qgis/qgslayertreeview.h>
 #include <qgis/qgsmaplayerrenderer.h>
@@ -32,63 +33,138 @@ class KadasMilxLayer::Renderer : public QgsMapLayerRenderer
   public:
     Renderer( KadasMilxLayer *layer, QgsRenderContext &rendererContext )
       : QgsMapLayerRenderer( layer->id() )
-      , mLayer( layer )
       , mRendererContext( rendererContext )
-    {}
+      , mOpacity( layer->opacity() / 100. )
+      , mIsApproved( layer->mIsApproved )
+      , mSymbolGraphicCache( layer->mSymbolGraphicCache )
+    {
+      // Take a snapshot of the visible items to render, the layer is not touched while rendering
+      mItems = layer->renderSnapshot( rendererContext );
+    }
     bool render() override
     {
-      QList<KadasMapItem *> items = mLayer->items().values();
+      // Globe tiles are rendered at varying scales, don't let them evict the graphics of the map view
+      bool isGlobe = mRendererContext.customRenderFlags().contains( "globe" );
+      QgsCoordinateReferenceSystem destCrs = mRendererContext.coordinateTransform().destinationCrs();
+      int dpi = mRendererContext.painter()->device()->logicalDpiX();
+      double scaleFactor = double( mRendererContext.painter()->device()->logicalDpiX() ) / double( QApplication::desktop()->logicalDpiX() );
+      QRect screenExtent = KadasMilxItem::computeScreenExtent( mRendererContext.mapExtent(), mRendererContext.mapToPixel() );
+      QString viewKey = QString( "%1:%2:%3:%4:%5:%6:%7" )
+                        .arg( mRendererContext.mapToPixel().mapUnitsPerPixel(), 0, 'g', 17 ).arg( mRendererContext.mapToPixel().mapRotation() )
+                        .arg( destCrs.authid().isEmpty() ? destCrs.toWkt() : destCrs.authid() ).arg( dpi ).arg( scaleFactor )
+                        .arg( mIsApproved ).arg( KadasMilxClient::symbolOptionsRevision() );
+
+      QVector<QPoint> origins( mItems.size() );
+      QVector<KadasMilxClient::NPointSymbolGraphic> graphics( mItems.size() );
+      QVector<bool> drawItem( mItems.size(), false );
       QList<KadasMilxClient::NPointSymbol> symbols;
-      QList<KadasMilxItem *> renderItems;
-      bool omitSinglePoint = mRendererContext.customRenderFlags().contains( "globe" );
-      for ( int i = 0, n = items.size(); i < n; ++i )
+      QList<int> symbolItems;
       {
-        KadasMilxItem *item = dynamic_cast<KadasMilxItem *>( items[i] );
-        if ( !item || item->constState()->points.isEmpty() || ( omitSinglePoint && !item->isMultiPoint() ) )
+        QMutexLocker locker( &mSymbolGraphicCache->mutex );
+        if ( !isGlobe && mSymbolGraphicCache->viewKey != viewKey )
         {
-          // Skip symbols
-          continue;
+          mSymbolGraphicCache->viewKey = viewKey;
+          mSymbolGraphicCache->graphics.clear();
+        }
+        for ( int i = 0, n = mItems.size(); i < n; ++i )
+        {
+          const KadasMilxItem *item = dynamic_cast<const KadasMilxItem *>( mItems[i].item.data() );
+          if ( !item || item->constState()->points.isEmpty() || ( isGlobe && !item->isMultiPoint() ) )
+          {
+            // Skip symbols
+            continue;
+          }
+          drawItem[i] = true;
+          auto it = isGlobe ? mSymbolGraphicCache->graphics.end() : mSymbolGraphicCache->graphics.find( mItems[i].id );
+          if ( it != mSymbolGraphicCache->graphics.end() && it->revision == mItems[i].revision )
+          {
+            // Unchanged item in a panned view: reuse the graphic
+            origins[i] = item->symbolOrigin( mRendererContext.mapToPixel(), destCrs );
+            graphics[i].graphic = it->graphic;
+            graphics[i].offset = it->offset;
+          }
+          else
+          {
+            symbols.append( item->toSymbol( mRendererContext.mapToPixel(), destCrs, !mIsApproved ) );
+            symbolItems.append( i );
+            origins[i] = symbols.last().points.front();
+          }
         }
-        symbols.append( item->toSymbol( mRendererContext.mapToPixel(), mRendererContext.coordinateTransform().destinationCrs(), !mLayer->mIsApproved ) );
-        renderItems.append( item );
-      }
-      if ( symbols.isEmpty() )
-      {
-        return true;
       }
-      QList<KadasMilxClient::NPointSymbolGraphic> result;
-      int dpi = mRendererContext.painter()->device()->logicalDpiX();
-      double scaleFactor = double( mRendererContext.painter()->device()->logicalDpiX() ) / double( QApplication::desktop()->logicalDpiX() );
-      QRect screenExtent = KadasMilxItem::computeScreenExtent( mRendererContext.mapExtent(), mRendererContext.mapToPixel() );
-      if ( !KadasMilxClient::updateSymbols( screenExtent, dpi, scaleFactor, symbols, result ) )
+
+      // Only query new, edited or rescaled symbols
+      if ( !symbols.isEmpty() )
       {
-        return false;
+        QList<KadasMilxClient::NPointSymbolGraphic> result;
+        if ( !KadasMilxClient::updateSymbols( screenExtent, dpi, scaleFactor, symbols, result ) )
+        {
+          return false;
+        }
+        QMutexLocker locker( &mSymbolGraphicCache->mutex );
+        bool storeGraphics = !isGlobe && mSymbolGraphicCache->viewKey == viewKey;
+        for ( int j = 0, n = result.size(); j < n; ++j )
+        {
+          int i = symbolItems[j];
+          graphics[i] = result[j];
+          // Graphics touching the border of the visible extent may be clipped and are hence not reusable after panning
+          QRect graphicRect( origins[i] + result[j].offset, result[j].graphic.size() );
+          if ( storeGraphics && screenExtent.adjusted( 1, 1, -1, -1 ).contains( graphicRect ) )
+          {
+            SymbolGraphic &symbolGraphic = mSymbolGraphicCache->graphics[mItems[i].id];
+            symbolGraphic.revision = mItems[i].revision;
+            symbolGraphic.graphic = result[j].graphic;
+            symbolGraphic.offset = result[j].offset;
+          }
+        }
       }
+
       mRendererContext.painter()->save();
-      mRendererContext.painter()->setOpacity( mLayer->opacity() / 100. );
-      for ( int i = 0, n = result.size(); i < n; ++i )
+      mRendererContext.painter()->setOpacity( mOpacity );
+      for ( int i = 0, n = mItems.size(); i < n; ++i )
       {
-        QPoint itemOrigin = symbols[i].points.front();
-        QPoint renderPos = itemOrigin + result[i].offset;
-        if ( !renderItems[i]->isMultiPoint() )
+        if ( !drawItem[i] )
+        {
+          continue;
+        }
+        const KadasMilxItem *item = static_cast<const KadasMilxItem *>( mItems[i].item.data() );
+        QPoint itemOrigin = origins[i];
+        QPoint renderPos = itemOrigin + graphics[i].offset;
+        if ( !item->isMultiPoint() )
         {
           // Draw line from visual reference point to actual refrence point
-          mRendererContext.painter()->drawLine( itemOrigin, itemOrigin - renderItems[i]->constState()->userOffset );
+          mRendererContext.painter()->drawLine( itemOrigin, itemOrigin - item->constState()->userOffset );
         }
-        mRendererContext.painter()->drawImage( renderPos, result[i].graphic );
+        mRendererContext.painter()->drawImage( renderPos, graphics[i].graphic );
       }
       mRendererContext.painter()->restore();
       return true;
     }
 
   private:
-    KadasMilxLayer *mLayer;
     QgsRenderContext &mRendererContext;
+    double mOpacity;
+    bool mIsApproved;
+    RenderSnapshot mItems;
+    QSharedPointer<SymbolGraphicCache> mSymbolGraphicCache;
 };
 
 KadasMilxLayer::KadasMilxLayer( const QString &name )
   : KadasItemLayer( name, QgsCoordinateReferenceSystem( "EPSG:4326" ), layerType() )
+  , mSymbolGraphicCache( new SymbolGraphicCache )
 {
+  connect( this, &KadasItemLayer::itemRemoved, this, [this]( ItemId itemId )
+  {
+    QMutexLocker locker( &mSymbolGraphicCache->mutex );
+    mSymbolGraphicCache->graphics.remove( itemId );
+  } );
+  connect( this, &KadasItemLayer::itemsRemoved, this, [this]( const QList<ItemId> &itemIds )
+  {
+    QMutexLocker locker( &mSymbolGraphicCache->mutex );
+    for ( ItemId itemId : itemIds )
+    {
+      mSymbolGraphicCache->graphics.remove( itemId );
+    }
+  } );
 }
 
 bool KadasMilxLayer::acceptsItem( const KadasMapItem *item ) const
@@ -139,6 +215,11 @@ void KadasMilxLayer::setApproved( bool approved )
 bool KadasMilxLayer::readXml( const QDomNode &layer_node, QgsReadWriteContext &context )
 {
   bool success = KadasItemLayer::readXml( layer_node, context );
+  {
+    // Item ids are reassigned
+    QMutexLocker locker( &mSymbolGraphicCache->mutex );
+    mSymbolGraphicCache->graphics.clear();
+  }
   QDomElement layerEl = layer_node.toElement();
   mIsApproved = layerEl.attribute( "approved" ).toInt() == 1;
   return success;
@@ -223,11 +304,14 @@ bool KadasMilxLayer::importFromMilxly( const QDomElement &milxLayerEl, int dpi,
   mIsApproved = milxLayerEl.firstChildElement( "DisplayBW" ).text().toInt();
 
   QDomNodeList graphicEls = milxLayerEl.firstChildElement( "GraphicList" ).elementsByTagName( "MilXGraphic" );
+  QList<KadasMapItem *> items;
+  items.reserve( graphicEls.count() );
   for ( int iGraphic = 0, nGraphics = graphicEls.count(); iGraphic < nGraphics; ++iGraphic )
   {
     QDomElement graphicEl = graphicEls.at( iGraphic ).toElement();
-    addItem( KadasMilxItem::fromMilx( graphicEl, crst, symbolSize ) );
+    items.append( KadasMilxItem::fromMilx( graphicEl, crst, symbolSize ) );
   }
+  addItems( items );
   return true;
 }
 
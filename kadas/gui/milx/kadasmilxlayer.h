@@ -17,6 +17,10 @@
 #ifndef KADASMILXLAYER_H
 #define KADASMILXLAYER_H
 
+#include <QImage>
+#include <QMutex>
+#include <QSharedPointer>
+
 #include <kadas/core/kadaspluginlayer.h>
 #include <kadas/gui/kadasitemlayer.h>
 
@@ -50,6 +54,25 @@ class KADAS_GUI_EXPORT KadasMilxLayer : public KadasItemLayer
     class Renderer;
 
     bool mIsApproved = false;
+
+#ifndef SIP_RUN
+    // Symbol graphics of the last rendered view. Graphics remain valid as long as the item is not edited
+    // and the view only is panned, in which case the graphic is just drawn at the new origin.
+    struct SymbolGraphic
+    {
+      quint64 revision = 0;
+      QImage graphic;
+      QPoint offset;
+    };
+    struct SymbolGraphicCache
+    {
+      QMutex mutex;
+      // Scale, rotation, crs, dpi and symbol options of the view
+      QString viewKey;
+      QHash<ItemId, SymbolGraphic> graphics;
+    };
+    QSharedPointer<SymbolGraphicCache> mSymbolGraphicCache;
+#endif
 };
 
 
@@ -0,0 +1,217 @@
+/***************************************************************************
+    testkadasninecellkernels.cpp
+    ----------------------------
+    copyright            : (C) 2019 by Sandro Mani
+    email                : smani at sourcepole dot ch
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <QtTest/QtTest>
+
+#include <kadas/analysis/kadashillshadefilter.h>
+#include <kadas/analysis/kadasninecellkernels.h>
+#include <kadas/analysis/kadasslopefilter.h>
+
+
+class TestKadasNineCellKernels : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void initTestCase();
+    void testRowKernels_data();
+    void testRowKernels();
+    void benchmarkRows_data();
+    void benchmarkRows();
+
+  private:
+    static const float sNodata;
+
+    // Synthetic DEM of width x height cells, padded with one nodata cell on each side like the tiles of KadasNineCellFilter
+    struct Dem
+    {
+      int width;
+      int height;
+      std::vector<float> values;
+      std::vector<unsigned char> noDataMask;
+
+      float *scanLine( int row ) { return values.data() + row * ( width + 2 ); }
+      const unsigned char *rowMask( int row ) const { return noDataMask.data() + row * width; }
+    };
+
+    static Dem createDem( int width, int height, double relief, double noDataFraction );
+    static std::unique_ptr<KadasNineCellFilter> createFilter( const QString &type, double cellSize );
+    // Processes all rows, either with the row kernels of the filter or with the per cell code of KadasNineCellFilter
+    static void processDem( KadasNineCellFilter *filter, Dem &dem, bool perCell, float *result );
+};
+
+const float TestKadasNineCellKernels::sNodata = -9999.f;
+
+TestKadasNineCellKernels::Dem TestKadasNineCellKernels::createDem( int width, int height, double relief, double noDataFraction )
+{
+  Dem dem;
+  dem.width = width;
+  dem.height = height;
+  int stride = width + 2;
+  dem.values.assign( stride * ( height + 2 ), sNodata );
+  std::mt19937 gen( 1981 );
+  std::uniform_real_distribution<double> noise( -0.5, 0.5 );
+  std::uniform_real_distribution<double> uniform( 0., 1. );
+  for ( int i = 0; i < height; ++i )
+  {
+    for ( int j = 0; j < width; ++j )
+    {
+      float value = 1000. + relief * std::sin( j * 0.031 ) * std::cos( i * 0.017 ) + relief * 0.1 * std::sin( ( i + j ) * 0.29 ) + noise( gen );
+      dem.values[( i + 1 ) * stride + j + 1] = uniform( gen ) < noDataFraction ? sNodata : value;
+    }
+  }
+  // The nodata mask as computed by KadasNineCellFilter::processTile
+  dem.noDataMask.resize( width * height );
+  for ( int i = 0; i < height; ++i )
+  {
+    const float *scanLine1 = dem.scanLine( i );
+    const float *scanLine2 = scanLine1 + stride;
+    const float *scanLine3 = scanLine2 + stride;
+    for ( int j = 0; j < width; ++j )
+    {
+      bool noData = false;
+      for ( int k = j; k < j + 3; ++k )
+      {
+        noData |= scanLine1[k] == sNodata || scanLine2[k] == sNodata || scanLine3[k] == sNodata;
+      }
+      dem.noDataMask[i * width + j] = noData;
+    }
+  }
+  return dem;
+}
+
+std::unique_ptr<KadasNineCellFilter> TestKadasNineCellKernels::createFilter( const QString &type, double cellSize )
+{
+  std::unique_ptr<KadasNineCellFilter> filter;
+  if ( type == "slope" )
+  {
+    filter.reset( new KadasSlopeFilter( QString(), QString(), "GTiff" ) );
+  }
+  else
+  {
+    filter.reset( new KadasHillshadeFilter( QString(), QString(), "GTiff", 300, 40 ) );
+  }
+  filter->setCellSizeX( cellSize );
+  filter->setCellSizeY( cellSize );
+  filter->setZFactor( 1 );
+  filter->setInputNodataValue( sNodata );
+  filter->setOutputNodataValue( sNodata );
+  return filter;
+}
+
+void TestKadasNineCellKernels::processDem( KadasNineCellFilter *filter, Dem &dem, bool perCell, float *result )
+{
+  for ( int i = 0; i < dem.height; ++i )
+  {
+    float *scanLine1 = dem.scanLine( i );
+    float *scanLine2 = dem.scanLine( i + 1 );
+    float *scanLine3 = dem.scanLine( i + 2 );
+    float *resultLine = result + i * dem.width;
+    if ( perCell )
+    {
+      filter->KadasNineCellFilter::processRow( scanLine1, scanLine2, scanLine3, dem.rowMask( i ), resultLine, dem.width );
+    }
+    else
+    {
+      filter->processRow( scanLine1, scanLine2, scanLine3, dem.rowMask( i ), resultLine, dem.width );
+    }
+  }
+}
+
+void TestKadasNineCellKernels::initTestCase()
+{
+  qDebug( "Row kernel instruction set: %s", KadasNineCellKernels::instructionSet() );
+}
+
+void TestKadasNineCellKernels::testRowKernels_data()
+{
+  QTest::addColumn<QString>( "type" );
+  QTest::addColumn<double>( "cellSize" );
+  QTest::addColumn<double>( "relief" );
+  QTest::addColumn<double>( "noDataFraction" );
+  QTest::addColumn<double>( "maxError" );
+
+  // Slope in degrees, hillshade in 0-255. Steep terrain covers the range of the polynomial arctangent.
+  QTest::newRow( "slope flat" ) << QString( "slope" ) << 25. << 0. << 0. << 1E-4;
+  QTest::newRow( "slope gentle" ) << QString( "slope" ) << 25. << 50. << 0. << 1E-4;
+  QTest::newRow( "slope steep" ) << QString( "slope" ) << 1. << 500. << 0. << 1E-4;
+  QTest::newRow( "slope nodata" ) << QString( "slope" ) << 25. << 300. << 0.02 << 1E-4;
+  QTest::newRow( "hillshade flat" ) << QString( "hillshade" ) << 25. << 0. << 0. << 1E-3;
+  QTest::newRow( "hillshade gentle" ) << QString( "hillshade" ) << 25. << 50. << 0. << 1E-3;
+  QTest::newRow( "hillshade steep" ) << QString( "hillshade" ) << 1. << 500. << 0. << 1E-3;
+  QTest::newRow( "hillshade nodata" ) << QString( "hillshade" ) << 25. << 300. << 0.02 << 1E-3;
+}
+
+void TestKadasNineCellKernels::testRowKernels()
+{
+  // The row kernels match the per cell code, cells with nodata in their window are computed by the per cell code
+  QFETCH( QString, type );
+  QFETCH( double, cellSize );
+  QFETCH( double, relief );
+  QFETCH( double, noDataFraction );
+  QFETCH( double, maxError );
+
+  // Odd width, so that the scalar tails of the vector loops are covered
+  Dem dem = createDem( 1001, 64, relief, noDataFraction );
+  std::unique_ptr<KadasNineCellFilter> filter = createFilter( type, cellSize );
+  std::vector<float> expected( dem.width * dem.height );
+  std::vector<float> result( dem.width * dem.height );
+  processDem( filter.get(), dem, true, expected.data() );
+  processDem( filter.get(), dem, false, result.data() );
+  for ( int k = 0, n = expected.size(); k < n; ++k )
+  {
+    bool ok = dem.noDataMask[k] ? result[k] == expected[k] : std::fabs( result[k] - expected[k] ) <= maxError;
+    if ( !ok )
+    {
+      QByteArray cell = QString( "row %1 col %2: %3 vs %4" ).arg( k / dem.width ).arg( k % dem.width ).arg( result[k] ).arg( expected[k] ).toLocal8Bit();
+      QVERIFY2( ok, cell.constData() );
+    }
+  }
+}
+
+void TestKadasNineCellKernels::benchmarkRows_data()
+{
+  QTest::addColumn<QString>( "type" );
+  QTest::addColumn<bool>( "perCell" );
+
+  QTest::newRow( "slope row kernel" ) << QString( "slope" ) << false;
+  QTest::newRow( "slope per cell" ) << QString( "slope" ) << true;
+  QTest::newRow( "hillshade row kernel" ) << QString( "hillshade" ) << false;
+  QTest::newRow( "hillshade per cell" ) << QString( "hillshade" ) << true;
+}
+
+void TestKadasNineCellKernels::benchmarkRows()
+{
+  // 1024 x 1024 cells without nodata
+  QFETCH( QString, type );
+  QFETCH( bool, perCell );
+
+  Dem dem = createDem( 1024, 1024, 300., 0. );
+  std::unique_ptr<KadasNineCellFilter> filter = createFilter( type, 25. );
+  std::vector<float> result( dem.width * dem.height );
+  QBENCHMARK
+  {
+    processDem( filter.get(), dem, perCell, result.data() );
+  }
+}
+
+QTEST_GUILESS_MAIN( TestKadasNineCellKernels )
+#include "testkadasninecellkernels.moc"
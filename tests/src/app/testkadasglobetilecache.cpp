@@ -0,0 +1,211 @@
+/***************************************************************************
+    testkadasglobetilecache.cpp
+    ---------------------------
+    copyright            : (C) 2019 by Sandro Mani
+    email                : smani at sourcepole dot ch
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+
+#include <kadas/app/globe/kadasglobetilecache.h>
+
+
+class TestKadasGlobeTileCache : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void testLookup();
+    void testLayerOrder();
+    void testInvalidateDirtyExtent();
+    void testInvalidateLayers();
+    void testStaleInsert();
+    void testDiskCache();
+    void benchmarkLookup();
+
+  private:
+    static QImage tileImage( QRgb color );
+    static QgsRectangle tileExtent( int x, int y );
+    static QString tileKey( int x, int y );
+};
+
+QImage TestKadasGlobeTileCache::tileImage( QRgb color )
+{
+  QImage image( 64, 64, QImage::Format_ARGB32_Premultiplied );
+  image.fill( color );
+  image.setPixel( 5, 7, qRgba( 1, 2, 3, 255 ) );
+  return image;
+}
+
+QgsRectangle TestKadasGlobeTileCache::tileExtent( int x, int y )
+{
+  return QgsRectangle( x * 10., y * 10., x * 10. + 10., y * 10. + 10. );
+}
+
+QString TestKadasGlobeTileCache::tileKey( int x, int y )
+{
+  return QString( "5/%1/%2" ).arg( x ).arg( y );
+}
+
+void TestKadasGlobeTileCache::testLookup()
+{
+  KadasGlobeTileCache cache( 16 );
+  KadasGlobeTileCache::LayerSet layerSet = cache.layerSet( QStringList() << "a" << "b" );
+  QImage image;
+  QVERIFY( !cache.lookup( layerSet, tileKey( 0, 0 ), image ) );
+  cache.insert( layerSet, tileKey( 0, 0 ), tileExtent( 0, 0 ), tileImage( 0xFF00FF00 ) );
+  QVERIFY( cache.lookup( layerSet, tileKey( 0, 0 ), image ) );
+  QCOMPARE( image, tileImage( 0xFF00FF00 ) );
+  QVERIFY( !cache.lookup( layerSet, tileKey( 0, 1 ), image ) );
+  QVERIFY( !cache.lookup( cache.layerSet( QStringList() << "a" ), tileKey( 0, 0 ), image ) );
+}
+
+void TestKadasGlobeTileCache::testLayerOrder()
+{
+  // A tile composited in another layer order is not reused
+  KadasGlobeTileCache cache( 16 );
+  cache.insert( cache.layerSet( QStringList() << "a" << "b" ), tileKey( 0, 0 ), tileExtent( 0, 0 ), tileImage( 0xFF00FF00 ) );
+  QImage image;
+  QVERIFY( !cache.lookup( cache.layerSet( QStringList() << "b" << "a" ), tileKey( 0, 0 ), image ) );
+}
+
+void TestKadasGlobeTileCache::testInvalidateDirtyExtent()
+{
+  KadasGlobeTileCache cache( 16 );
+  QStringList ab = QStringList() << "a" << "b";
+  QStringList bc = QStringList() << "b" << "c";
+  for ( int x = 0; x < 3; ++x )
+  {
+    cache.insert( cache.layerSet( ab ), tileKey( x, 0 ), tileExtent( x, 0 ), tileImage( 0xFF000000 + x ) );
+    cache.insert( cache.layerSet( bc ), tileKey( x, 0 ), tileExtent( x, 0 ), tileImage( 0xFF000100 + x ) );
+  }
+
+  // Layer a changed within tile 1. Only the tile of a within the dirty extent is dropped.
+  cache.invalidate( QSet<QString>() << "a", QgsRectangle( 12., 2., 18., 8. ) );
+  QImage image;
+  QVERIFY( cache.lookup( cache.layerSet( ab ), tileKey( 0, 0 ), image ) );
+  QCOMPARE( image, tileImage( 0xFF000000 ) );
+  QVERIFY( !cache.lookup( cache.layerSet( ab ), tileKey( 1, 0 ), image ) );
+  QVERIFY( cache.lookup( cache.layerSet( ab ), tileKey( 2, 0 ), image ) );
+  QCOMPARE( image, tileImage( 0xFF000002 ) );
+  for ( int x = 0; x < 3; ++x )
+  {
+    QVERIFY( cache.lookup( cache.layerSet( bc ), tileKey( x, 0 ), image ) );
+    QCOMPARE( image, tileImage( 0xFF000100 + x ) );
+  }
+
+  // Layer b changed within tile 2, which drops tile 2 of both layer sets
+  cache.invalidate( QSet<QString>() << "b", tileExtent( 2, 0 ).buffered( -1. ) );
+  QVERIFY( cache.lookup( cache.layerSet( ab ), tileKey( 0, 0 ), image ) );
+  QVERIFY( !cache.lookup( cache.layerSet( ab ), tileKey( 2, 0 ), image ) );
+  QVERIFY( cache.lookup( cache.layerSet( bc ), tileKey( 1, 0 ), image ) );
+  QVERIFY( !cache.lookup( cache.layerSet( bc ), tileKey( 2, 0 ), image ) );
+}
+
+void TestKadasGlobeTileCache::testInvalidateLayers()
+{
+  KadasGlobeTileCache cache( 16 );
+  cache.insert( cache.layerSet( QStringList() << "a" << "b" ), tileKey( 0, 0 ), tileExtent( 0, 0 ), tileImage( 0xFF00FF00 ) );
+  cache.insert( cache.layerSet( QStringList() << "c" ), tileKey( 0, 0 ), tileExtent( 0, 0 ), tileImage( 0xFF0000FF ) );
+  cache.invalidate( QSet<QString>() << "b" );
+  QImage image;
+  QVERIFY( !cache.lookup( cache.layerSet( QStringList() << "a" << "b" ), tileKey( 0, 0 ), image ) );
+  QVERIFY( cache.lookup( cache.layerSet( QStringList() << "c" ), tileKey( 0, 0 ), image ) );
+  QCOMPARE( image, tileImage( 0xFF0000FF ) );
+}
+
+void TestKadasGlobeTileCache::testStaleInsert()
+{
+  // A tile whose layer was invalidated while it was rendered is not inserted, even outside the dirty extent
+  KadasGlobeTileCache cache( 16 );
+  KadasGlobeTileCache::LayerSet layerSet = cache.layerSet( QStringList() << "a" << "b" );
+  cache.invalidate( QSet<QString>() << "b", tileExtent( 5, 5 ) );
+  cache.insert( layerSet, tileKey( 0, 0 ), tileExtent( 0, 0 ), tileImage( 0xFF00FF00 ) );
+  QImage image;
+  QVERIFY( !cache.lookup( layerSet, tileKey( 0, 0 ), image ) );
+  QVERIFY( !cache.lookup( cache.layerSet( QStringList() << "a" << "b" ), tileKey( 0, 0 ), image ) );
+
+  // Invalidating another layer does not affect the tile
+  layerSet = cache.layerSet( QStringList() << "a" << "b" );
+  cache.invalidate( QSet<QString>() << "c" );
+  cache.insert( layerSet, tileKey( 0, 0 ), tileExtent( 0, 0 ), tileImage( 0xFF00FF00 ) );
+  QVERIFY( cache.lookup( cache.layerSet( QStringList() << "a" << "b" ), tileKey( 0, 0 ), image ) );
+}
+
+void TestKadasGlobeTileCache::testDiskCache()
+{
+  // With a single tile in memory, the other tiles are read from disk
+  QTemporaryDir dir;
+  QVERIFY( dir.isValid() );
+  QString cacheDir = dir.filePath( "globetiles" );
+  {
+    KadasGlobeTileCache cache( 1, cacheDir );
+    QStringList ab = QStringList() << "a" << "b";
+    for ( int x = 0; x < 3; ++x )
+    {
+      cache.insert( cache.layerSet( ab ), tileKey( x, 0 ), tileExtent( x, 0 ), tileImage( 0xFF000000 + x ) );
+    }
+    QCOMPARE( QDir( cacheDir ).entryList( QDir::Files ).size(), 3 );
+    QImage image;
+    for ( int x = 0; x < 3; ++x )
+    {
+      QVERIFY( cache.lookup( cache.layerSet( ab ), tileKey( x, 0 ), image ) );
+      QCOMPARE( image, tileImage( 0xFF000000 + x ) );
+    }
+
+    // Stored tiles outside the dirty extent remain valid for the new revision
+    cache.invalidate( QSet<QString>() << "b", tileExtent( 1, 0 ).buffered( -1. ) );
+    QCOMPARE( QDir( cacheDir ).entryList( QDir::Files ).size(), 2 );
+    for ( int x = 0; x < 3; x += 2 )
+    {
+      QVERIFY( cache.lookup( cache.layerSet( ab ), tileKey( x, 0 ), image ) );
+      QCOMPARE( image, tileImage( 0xFF000000 + x ) );
+    }
+    QVERIFY( !cache.lookup( cache.layerSet( ab ), tileKey( 1, 0 ), image ) );
+
+    cache.invalidate( QSet<QString>() << "a" );
+    QCOMPARE( QDir( cacheDir ).entryList( QDir::Files ).size(), 0 );
+  }
+  QVERIFY( !QDir( cacheDir ).exists() );
+}
+
+void TestKadasGlobeTileCache::benchmarkLookup()
+{
+  KadasGlobeTileCache cache( 1024 );
+  QStringList layerIds;
+  for ( int i = 0; i < 10; ++i )
+  {
+    layerIds.append( QString( "layer_%1_20190101000000000" ).arg( i ) );
+  }
+  for ( int x = 0; x < 32; ++x )
+  {
+    for ( int y = 0; y < 32; ++y )
+    {
+      cache.insert( cache.layerSet( layerIds ), tileKey( x, y ), tileExtent( x, y ), tileImage( 0xFF00FF00 ) );
+    }
+  }
+  QImage image;
+  QBENCHMARK
+  {
+    for ( int x = 0; x < 32; ++x )
+    {
+      for ( int y = 0; y < 32; ++y )
+      {
+        QVERIFY( cache.lookup( cache.layerSet( layerIds ), tileKey( x, y ), image ) );
+      }
+    }
+  }
+}
+
+QTEST_GUILESS_MAIN( TestKadasGlobeTileCache )
+#include "testkadasglobetilecache.moc"
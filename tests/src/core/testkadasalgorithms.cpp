@@ -0,0 +1,321 @@
+/***************************************************************************
+    testkadasalgorithms.cpp
+    -----------------------
+    copyright            : (C) 2019 by Sandro Mani
+    email                : smani at sourcepole dot ch
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <list>
+#include <random>
+#include <vector>
+
+#include <QtTest/QtTest>
+
+#include <kadas/core/kadasalgorithms.h>
+
+
+// Reference implementation: the recursive x/y line scans on std::list clusters, which
+// KadasAlgorithms::overlappingRects replaced. Its output must be reproduced exactly.
+
+struct ReferenceCluster1D
+{
+  int min, max;
+  std::vector<const KadasAlgorithms::Rect *> rects;
+};
+
+struct ReferenceCluster2D
+{
+  int x1, y1, x2, y2;
+  std::vector<const KadasAlgorithms::Rect *> rects;
+};
+
+static int referenceLinescan( const std::vector<const KadasAlgorithms::Rect *> &rects, int axis, std::list<ReferenceCluster1D> &clusters )
+{
+  for ( const KadasAlgorithms::Rect *rect : rects )
+  {
+    clusters.push_back( {axis == 0 ? rect->x1 : rect->y1, axis == 0 ? rect->x2 : rect->y2, {rect}} );
+  }
+
+  clusters.sort( []( const ReferenceCluster1D & c1, const ReferenceCluster1D & c2 ) { return c1.min < c2.min; } );
+
+  // Merge neighboring clusters
+  auto it = clusters.begin();
+  int count = 1;
+  ++it;
+  while ( it != clusters.end() )
+  {
+    auto prev = it; --prev;
+    ReferenceCluster1D &c1 = *prev;
+    ReferenceCluster1D &c2 = *it;
+    if ( c2.min < c1.max )
+    {
+      c1.max = std::max( c1.max, c2.max );
+      c1.rects.insert( c1.rects.end(), c2.rects.begin(), c2.rects.end() );
+      it = clusters.erase( it );
+    }
+    else
+    {
+      ++it;
+      ++count;
+    }
+  }
+  return count;
+}
+
+static void referenceClusters( const std::vector<const KadasAlgorithms::Rect *> &rects, std::vector<ReferenceCluster2D> &output )
+{
+  std::list<ReferenceCluster1D> clustersX;
+  referenceLinescan( rects, 0, clustersX );
+  for ( const ReferenceCluster1D &cx : clustersX )
+  {
+    std::list<ReferenceCluster1D> clustersY;
+    int count = referenceLinescan( cx.rects, 1, clustersY );
+    if ( count == 1 )
+    {
+      const ReferenceCluster1D &cy = clustersY.front();
+      output.push_back( {cx.min, cy.min, cx.max, cy.max, cy.rects} );
+    }
+    else
+    {
+      for ( const ReferenceCluster1D &cy : clustersY )
+      {
+        referenceClusters( cy.rects, output );
+      }
+    }
+  }
+}
+
+static QList<KadasAlgorithms::Cluster> referenceOverlappingRects( const QList<KadasAlgorithms::Rect> &rects )
+{
+  std::vector<const KadasAlgorithms::Rect *> rectp;
+  for ( const KadasAlgorithms::Rect &rect : rects )
+  {
+    rectp.push_back( &rect );
+  }
+  std::vector<ReferenceCluster2D> output;
+  referenceClusters( rectp, output );
+
+  QList<KadasAlgorithms::Cluster> result;
+  for ( const ReferenceCluster2D &c : output )
+  {
+    KadasAlgorithms::Cluster cluster;
+    cluster.x1 = c.x1;
+    cluster.y1 = c.y1;
+    cluster.x2 = c.x2;
+    cluster.y2 = c.y2;
+    for ( const KadasAlgorithms::Rect *rect : c.rects )
+    {
+      cluster.rects.append( *rect );
+    }
+    result.append( cluster );
+  }
+  return result;
+}
+
+
+class TestKadasAlgorithms : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void testEmpty();
+    void testSimpleClusters();
+    void testRandomEquivalence();
+    void testClusterInvariants();
+    void benchmarkOverlappingRects();
+    void benchmarkReferenceOverlappingRects();
+
+  private:
+    static KadasAlgorithms::Rect rect( int x1, int y1, int x2, int y2, int id );
+    static int id( const KadasAlgorithms::Rect &rect );
+    static QList<KadasAlgorithms::Rect> randomRects( std::mt19937 &gen, int n, int extent, int maxSize );
+    static QList<KadasAlgorithms::Rect> tileGrid();
+    static bool sameClusters( const QList<KadasAlgorithms::Cluster> &clusters, const QList<KadasAlgorithms::Cluster> &expected );
+};
+
+KadasAlgorithms::Rect TestKadasAlgorithms::rect( int x1, int y1, int x2, int y2, int id )
+{
+  KadasAlgorithms::Rect r;
+  r.x1 = x1;
+  r.y1 = y1;
+  r.x2 = x2;
+  r.y2 = y2;
+  r.data = reinterpret_cast<void *>( quintptr( id ) );
+  return r;
+}
+
+int TestKadasAlgorithms::id( const KadasAlgorithms::Rect &rect )
+{
+  return int( reinterpret_cast<quintptr>( rect.data ) );
+}
+
+QList<KadasAlgorithms::Rect> TestKadasAlgorithms::randomRects( std::mt19937 &gen, int n, int extent, int maxSize )
+{
+  std::uniform_int_distribution<int> posDist( 0, extent );
+  std::uniform_int_distribution<int> sizeDist( 1, maxSize );
+  QList<KadasAlgorithms::Rect> rects;
+  for ( int i = 0; i < n; ++i )
+  {
+    int x = posDist( gen );
+    int y = posDist( gen );
+    rects.append( rect( x, y, x + sizeDist( gen ), y + sizeDist( gen ), i ) );
+  }
+  return rects;
+}
+
+QList<KadasAlgorithms::Rect> TestKadasAlgorithms::tileGrid()
+{
+  // 316 x 316 tiles of 256 pixels, which overlap their neighbors by two pixels within blocks of 8 x 8 tiles
+  QList<KadasAlgorithms::Rect> rects;
+  int n = 316;
+  for ( int i = 0; i < n; ++i )
+  {
+    for ( int j = 0; j < n; ++j )
+    {
+      int x = i * 256;
+      int y = j * 256;
+      rects.append( rect( x, y, x + ( i % 8 == 7 ? 256 : 258 ), y + ( j % 8 == 7 ? 256 : 258 ), i * n + j ) );
+    }
+  }
+  // Shuffle, as the tiles of a ground overlay are not necessarily sorted
+  std::mt19937 gen( 100000 );
+  std::shuffle( rects.begin(), rects.end(), gen );
+  return rects;
+}
+
+bool TestKadasAlgorithms::sameClusters( const QList<KadasAlgorithms::Cluster> &clusters, const QList<KadasAlgorithms::Cluster> &expected )
+{
+  if ( clusters.size() != expected.size() )
+  {
+    return false;
+  }
+  for ( int i = 0, n = clusters.size(); i < n; ++i )
+  {
+    const KadasAlgorithms::Cluster &c = clusters[i];
+    const KadasAlgorithms::Cluster &e = expected[i];
+    if ( c.x1 != e.x1 || c.y1 != e.y1 || c.x2 != e.x2 || c.y2 != e.y2 || c.rects.size() != e.rects.size() )
+    {
+      return false;
+    }
+    for ( int j = 0, m = c.rects.size(); j < m; ++j )
+    {
+      const KadasAlgorithms::Rect &r = c.rects[j];
+      const KadasAlgorithms::Rect &s = e.rects[j];
+      if ( r.x1 != s.x1 || r.y1 != s.y1 || r.x2 != s.x2 || r.y2 != s.y2 || r.data != s.data )
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void TestKadasAlgorithms::testEmpty()
+{
+  QVERIFY( KadasAlgorithms::overlappingRects( QList<KadasAlgorithms::Rect>() ).isEmpty() );
+}
+
+void TestKadasAlgorithms::testSimpleClusters()
+{
+  // Rects 0 and 1 overlap, 2 only touches 1, 3 and 4 overlap in x but not in y
+  QList<KadasAlgorithms::Rect> rects;
+  rects << rect( 0, 0, 10, 10, 0 ) << rect( 5, 5, 15, 15, 1 ) << rect( 15, 0, 20, 10, 2 )
+        << rect( 30, 0, 40, 10, 3 ) << rect( 35, 20, 45, 30, 4 );
+  QList<KadasAlgorithms::Cluster> clusters = KadasAlgorithms::overlappingRects( rects );
+  QCOMPARE( clusters.size(), 4 );
+  QCOMPARE( clusters[0].rects.size(), 2 );
+  QCOMPARE( id( clusters[0].rects[0] ), 0 );
+  QCOMPARE( id( clusters[0].rects[1] ), 1 );
+  QCOMPARE( clusters[0].x2, 15 );
+  QCOMPARE( clusters[0].y2, 15 );
+  QCOMPARE( id( clusters[1].rects[0] ), 2 );
+  QCOMPARE( id( clusters[2].rects[0] ), 3 );
+  QCOMPARE( id( clusters[3].rects[0] ), 4 );
+}
+
+void TestKadasAlgorithms::testRandomEquivalence()
+{
+  // Dense and sparse inputs, with many duplicate coordinates to exercise the stable ordering
+  std::mt19937 gen( 25 );
+  std::uniform_int_distribution<int> countDist( 1, 200 );
+  for ( int run = 0; run < 3000; ++run )
+  {
+    int extent = run % 3 == 0 ? 50 : 1000;
+    QList<KadasAlgorithms::Rect> rects = randomRects( gen, countDist( gen ), extent, 100 );
+    QVERIFY2( sameClusters( KadasAlgorithms::overlappingRects( rects ), referenceOverlappingRects( rects ) ), QByteArray::number( run ).constData() );
+  }
+}
+
+void TestKadasAlgorithms::testClusterInvariants()
+{
+  // Each rect is in exactly one cluster, the cluster extents are the unions of their rects and do not overlap
+  std::mt19937 gen( 2019 );
+  for ( int run = 0; run < 100; ++run )
+  {
+    QList<KadasAlgorithms::Rect> rects = randomRects( gen, 500, 2000, 100 );
+    QList<KadasAlgorithms::Cluster> clusters = KadasAlgorithms::overlappingRects( rects );
+    QVector<int> seen( rects.size(), 0 );
+    for ( const KadasAlgorithms::Cluster &cluster : clusters )
+    {
+      QVERIFY( !cluster.rects.isEmpty() );
+      int x1 = cluster.rects[0].x1, y1 = cluster.rects[0].y1, x2 = cluster.rects[0].x2, y2 = cluster.rects[0].y2;
+      for ( const KadasAlgorithms::Rect &r : cluster.rects )
+      {
+        ++seen[id( r )];
+        x1 = std::min( x1, r.x1 );
+        y1 = std::min( y1, r.y1 );
+        x2 = std::max( x2, r.x2 );
+        y2 = std::max( y2, r.y2 );
+      }
+      QCOMPARE( cluster.x1, x1 );
+      QCOMPARE( cluster.y1, y1 );
+      QCOMPARE( cluster.x2, x2 );
+      QCOMPARE( cluster.y2, y2 );
+    }
+    QCOMPARE( seen, QVector<int>( rects.size(), 1 ) );
+    for ( int i = 0, n = clusters.size(); i < n; ++i )
+    {
+      for ( int j = i + 1; j < n; ++j )
+      {
+        const KadasAlgorithms::Cluster &a = clusters[i];
+        const KadasAlgorithms::Cluster &b = clusters[j];
+        QVERIFY( !( a.x1 < b.x2 && b.x1 < a.x2 && a.y1 < b.y2 && b.y1 < a.y2 ) );
+      }
+    }
+  }
+}
+
+void TestKadasAlgorithms::benchmarkOverlappingRects()
+{
+  QList<KadasAlgorithms::Rect> rects = tileGrid();
+  QList<KadasAlgorithms::Cluster> clusters;
+  QBENCHMARK
+  {
+    clusters = KadasAlgorithms::overlappingRects( rects );
+  }
+  QCOMPARE( clusters.size(), 40 * 40 );
+}
+
+void TestKadasAlgorithms::benchmarkReferenceOverlappingRects()
+{
+  QList<KadasAlgorithms::Rect> rects = tileGrid();
+  QList<KadasAlgorithms::Cluster> clusters;
+  QBENCHMARK
+  {
+    clusters = referenceOverlappingRects( rects );
+  }
+  QCOMPARE( clusters.size(), 40 * 40 );
+}
+
+QTEST_MAIN( TestKadasAlgorithms )
+#include "testkadasalgorithms.moc"
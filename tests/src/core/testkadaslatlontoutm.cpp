@@ -0,0 +1,316 @@
+/***************************************************************************
+    testkadaslatlontoutm.cpp
+    ------------------------
+    copyright            : (C) 2019 by Sandro Mani
+    email                : smani at sourcepole dot ch
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <cmath>
+#include <random>
+
+#include <QtTest/QtTest>
+#include <QVector>
+
+#include <GeographicLib/UTMUPS.hpp>
+
+#include <qgis/qgspointxy.h>
+
+#include <kadas/core/kadaslatlontoutm.h>
+
+
+class TestKadasLatLonToUTM : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void testLL2UTM_data();
+    void testLL2UTM();
+    void testUTM2LL_data();
+    void testUTM2LL();
+    void testSinglePointConversions();
+    void benchmarkLL2UTMBatch();
+    void benchmarkLL2UTMPerPoint();
+    void benchmarkUTM2LLBatch();
+    void benchmarkUTM2LLPerPoint();
+
+  private:
+    // Tolerances against the exact transverse Mercator projection of GeographicLib
+    static constexpr double sMaxEastNorthError = 0.05;
+    static constexpr double sMaxLonLatError = 1E-6;
+    static const int sBenchmarkPoints = 100000;
+
+    static void addSamples();
+    static void randomPoints( double lonMin, double lonMax, double latMin, double latMax, int n, QVector<double> &lon, QVector<double> &lat );
+    static char expectedZoneLetter( double lat );
+};
+
+void TestKadasLatLonToUTM::randomPoints( double lonMin, double lonMax, double latMin, double latMax, int n, QVector<double> &lon, QVector<double> &lat )
+{
+  // Fixed seed, so that failures are reproducible
+  std::mt19937 gen( 4326 );
+  std::uniform_real_distribution<double> lonDist( lonMin, lonMax );
+  std::uniform_real_distribution<double> latDist( latMin, latMax );
+  for ( int i = 0; i < n; ++i )
+  {
+    lon.append( lonDist( gen ) );
+    lat.append( latDist( gen ) );
+  }
+}
+
+char TestKadasLatLonToUTM::expectedZoneLetter( double lat )
+{
+  // MGRS latitude bands, band X extends to 84N
+  static const char bands[] = "CDEFGHJKLMNPQRSTUVWX";
+  return bands[qMin( 19, int( std::floor( ( lat + 80. ) / 8. ) ) )];
+}
+
+void TestKadasLatLonToUTM::addSamples()
+{
+  QTest::addColumn<QVector<double>>( "lon" );
+  QTest::addColumn<QVector<double>>( "lat" );
+
+  QVector<double> lon, lat;
+  randomPoints( -180., 180., -80., 84., 10000, lon, lat );
+  QTest::newRow( "global" ) << lon << lat;
+
+  // Both sides of all zone edges, where the distance to the central meridian is largest
+  lon.clear();
+  lat.clear();
+  for ( int zone = 0; zone < 60; ++zone )
+  {
+    for ( double y = -79.5; y < 84.; y += 4. )
+    {
+      lon << -180. + zone * 6. << -180. + zone * 6. + 5.9999999 << -180. + zone * 6. + 6. - 1E-9;
+      lat << y << y << y;
+    }
+  }
+  QTest::newRow( "zone edges" ) << lon << lat;
+
+  // Latitude band edges
+  lon.clear();
+  lat.clear();
+  for ( double y = -80.; y < 84.; y += 8. )
+  {
+    lon << 7.5 << 7.5 << -123.5 << -123.5;
+    lat << y << y + 8. - 1E-9 << y << y + 8. - 1E-9;
+  }
+  QTest::newRow( "band edges" ) << lon << lat;
+
+  // Widened zone 32V of southern Norway
+  lon.clear();
+  lat.clear();
+  randomPoints( 3., 12., 56., 64., 1000, lon, lat );
+  lon << 3. << 3. << 6. - 1E-9 << 12. - 1E-9;
+  lat << 56. << 64. - 1E-9 << 60. << 60.;
+  QTest::newRow( "norway" ) << lon << lat;
+
+  // Zones 31X to 37X of Svalbard
+  lon.clear();
+  lat.clear();
+  randomPoints( 0., 42., 72., 84., 1000, lon, lat );
+  for ( double x : {0., 9., 21., 33., 42.} )
+  {
+    lon << x << x - 1E-9 << x;
+    lat << 72. << 78. << 84. - 1E-9;
+  }
+  QTest::newRow( "svalbard" ) << lon << lat;
+
+  // Polar bands C and X
+  lon.clear();
+  lat.clear();
+  randomPoints( -180., 180., 72., 84., 2000, lon, lat );
+  randomPoints( -180., 180., -80., -72., 2000, lon, lat );
+  QTest::newRow( "polar bands" ) << lon << lat;
+
+  // Southern hemisphere, including the equator and the points just south of it
+  lon.clear();
+  lat.clear();
+  randomPoints( -180., 180., -80., 0., 5000, lon, lat );
+  for ( double x = -177.; x < 180.; x += 1.5 )
+  {
+    lon << x << x << x;
+    lat << 0. << -1E-9 << -0.0001;
+  }
+  QTest::newRow( "southern hemisphere" ) << lon << lat;
+}
+
+void TestKadasLatLonToUTM::testLL2UTM_data()
+{
+  addSamples();
+}
+
+void TestKadasLatLonToUTM::testLL2UTM()
+{
+  QFETCH( QVector<double>, lon );
+  QFETCH( QVector<double>, lat );
+
+  int n = lon.size();
+  QVector<double> easting( n ), northing( n );
+  QVector<int> zoneNumber( n );
+  QVector<char> zoneLetter( n );
+  KadasLatLonToUTM::LL2UTM( lon.constData(), lat.constData(), n, easting.data(), northing.data(), zoneNumber.data(), zoneLetter.data() );
+
+  for ( int i = 0; i < n; ++i )
+  {
+    int zone = 0;
+    bool northp = false;
+    double x = 0., y = 0.;
+    GeographicLib::UTMUPS::Forward( lat[i], lon[i], zone, northp, x, y );
+    QByteArray point = QString( "lon %1 lat %2" ).arg( lon[i], 0, 'f', 10 ).arg( lat[i], 0, 'f', 10 ).toLocal8Bit();
+    QVERIFY2( zoneNumber[i] == zone, point.constData() );
+    QVERIFY2( zoneLetter[i] == expectedZoneLetter( lat[i] ), point.constData() );
+    QVERIFY2( ( zoneLetter[i] >= 'N' ) == northp, point.constData() );
+    QVERIFY2( qAbs( easting[i] - x ) < sMaxEastNorthError, point.constData() );
+    QVERIFY2( qAbs( northing[i] - y ) < sMaxEastNorthError, point.constData() );
+  }
+
+  // Without zone arrays, the same coordinates are returned
+  QVector<double> easting2( n ), northing2( n );
+  KadasLatLonToUTM::LL2UTM( lon.constData(), lat.constData(), n, easting2.data(), northing2.data() );
+  QCOMPARE( easting2, easting );
+  QCOMPARE( northing2, northing );
+}
+
+void TestKadasLatLonToUTM::testUTM2LL_data()
+{
+  addSamples();
+}
+
+void TestKadasLatLonToUTM::testUTM2LL()
+{
+  QFETCH( QVector<double>, lon );
+  QFETCH( QVector<double>, lat );
+
+  // The exact UTM coordinates, converted back in batches of points of the same zone and hemisphere
+  QMap<QPair<int, char>, QVector<int>> batches;
+  int n = lon.size();
+  QVector<double> easting( n ), northing( n );
+  for ( int i = 0; i < n; ++i )
+  {
+    int zone = 0;
+    bool northp = false;
+    GeographicLib::UTMUPS::Forward( lat[i], lon[i], zone, northp, easting[i], northing[i] );
+    batches[qMakePair( zone, expectedZoneLetter( lat[i] ) )].append( i );
+  }
+  for ( auto it = batches.constBegin(), itEnd = batches.constEnd(); it != itEnd; ++it )
+  {
+    const QVector<int> &indices = it.value();
+    int m = indices.size();
+    QVector<double> e( m ), nn( m ), resLon( m ), resLat( m );
+    for ( int j = 0; j < m; ++j )
+    {
+      e[j] = easting[indices[j]];
+      nn[j] = northing[indices[j]];
+    }
+    QVERIFY( KadasLatLonToUTM::UTM2LL( e.constData(), nn.constData(), m, it.key().first, it.key().second, resLon.data(), resLat.data() ) );
+    for ( int j = 0; j < m; ++j )
+    {
+      int i = indices[j];
+      QByteArray point = QString( "lon %1 lat %2" ).arg( lon[i], 0, 'f', 10 ).arg( lat[i], 0, 'f', 10 ).toLocal8Bit();
+      QVERIFY2( qAbs( resLon[j] - lon[i] ) < sMaxLonLatError, point.constData() );
+      QVERIFY2( qAbs( resLat[j] - lat[i] ) < sMaxLonLatError, point.constData() );
+    }
+  }
+
+  // Invalid zones are rejected
+  double e = 500000., nn = 0., resLon = 0., resLat = 0.;
+  QVERIFY( !KadasLatLonToUTM::UTM2LL( &e, &nn, 1, -1, 'N', &resLon, &resLat ) );
+  QVERIFY( !KadasLatLonToUTM::UTM2LL( &e, &nn, 1, 61, 'N', &resLon, &resLat ) );
+}
+
+void TestKadasLatLonToUTM::testSinglePointConversions()
+{
+  // The single point conversions truncate the batch results to meters
+  QVector<double> lon, lat;
+  randomPoints( -180., 180., -80., 84., 1000, lon, lat );
+  int n = lon.size();
+  QVector<double> easting( n ), northing( n );
+  QVector<int> zoneNumber( n );
+  QVector<char> zoneLetter( n );
+  KadasLatLonToUTM::LL2UTM( lon.constData(), lat.constData(), n, easting.data(), northing.data(), zoneNumber.data(), zoneLetter.data() );
+  for ( int i = 0; i < n; ++i )
+  {
+    KadasLatLonToUTM::UTMCoo coo = KadasLatLonToUTM::LL2UTM( QgsPointXY( lon[i], lat[i] ) );
+    QCOMPARE( coo.zoneNumber, zoneNumber[i] );
+    QCOMPARE( coo.zoneLetter, QString( QChar( zoneLetter[i] ) ) );
+    QVERIFY( qAbs( coo.easting - easting[i] ) < 1. );
+    QVERIFY( qAbs( coo.northing - northing[i] ) < 1. );
+
+    bool ok = false;
+    QgsPointXY p = KadasLatLonToUTM::UTM2LL( coo, ok );
+    QVERIFY( ok );
+    // One meter is at most 1E-5 degrees of latitude, and about 1E-4 degrees of longitude at 84N
+    QVERIFY( qAbs( p.x() - lon[i] ) < 2E-4 );
+    QVERIFY( qAbs( p.y() - lat[i] ) < 2E-5 );
+  }
+}
+
+void TestKadasLatLonToUTM::benchmarkLL2UTMBatch()
+{
+  QVector<double> lon, lat;
+  randomPoints( 6., 12., 45., 48., sBenchmarkPoints, lon, lat );
+  QVector<double> easting( sBenchmarkPoints ), northing( sBenchmarkPoints );
+  QVector<int> zoneNumber( sBenchmarkPoints );
+  QVector<char> zoneLetter( sBenchmarkPoints );
+  QBENCHMARK
+  {
+    KadasLatLonToUTM::LL2UTM( lon.constData(), lat.constData(), sBenchmarkPoints, easting.data(), northing.data(), zoneNumber.data(), zoneLetter.data() );
+  }
+}
+
+void TestKadasLatLonToUTM::benchmarkLL2UTMPerPoint()
+{
+  QVector<double> lon, lat;
+  randomPoints( 6., 12., 45., 48., sBenchmarkPoints, lon, lat );
+  QVector<KadasLatLonToUTM::UTMCoo> coos( sBenchmarkPoints );
+  QBENCHMARK
+  {
+    for ( int i = 0; i < sBenchmarkPoints; ++i )
+    {
+      coos[i] = KadasLatLonToUTM::LL2UTM( QgsPointXY( lon[i], lat[i] ) );
+    }
+  }
+}
+
+void TestKadasLatLonToUTM::benchmarkUTM2LLBatch()
+{
+  QVector<double> easting, northing;
+  randomPoints( 300000., 700000., 5000000., 5300000., sBenchmarkPoints, easting, northing );
+  QVector<double> lon( sBenchmarkPoints ), lat( sBenchmarkPoints );
+  QBENCHMARK
+  {
+    QVERIFY( KadasLatLonToUTM::UTM2LL( easting.constData(), northing.constData(), sBenchmarkPoints, 32, 'T', lon.data(), lat.data() ) );
+  }
+}
+
+void TestKadasLatLonToUTM::benchmarkUTM2LLPerPoint()
+{
+  QVector<double> easting, northing;
+  randomPoints( 300000., 700000., 5000000., 5300000., sBenchmarkPoints, easting, northing );
+  QVector<QgsPointXY> points( sBenchmarkPoints );
+  QBENCHMARK
+  {
+    KadasLatLonToUTM::UTMCoo coo;
+    coo.zoneNumber = 32;
+    coo.zoneLetter = "T";
+    bool ok = false;
+    for ( int i = 0; i < sBenchmarkPoints; ++i )
+    {
+      coo.easting = int( easting[i] );
+      coo.northing = int( northing[i] );
+      points[i] = KadasLatLonToUTM::UTM2LL( coo, ok );
+    }
+  }
+}
+
+QTEST_MAIN( TestKadasLatLonToUTM )
+#include "testkadaslatlontoutm.moc"
@@ -0,0 +1,180 @@
+/***************************************************************************
+    kadasmilxstandinserver.cpp
+    --------------------------
+    copyright            : (C) 2019 by Sandro Mani
+    email                : smani at sourcepole dot ch
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QPair>
+#include <QPoint>
+#include <QPolygon>
+#include <QQueue>
+#include <QRect>
+#include <QSharedPointer>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include <kadas/gui/milx/kadasmilxinterface.h>
+
+#include "kadasmilxstandinserver.h"
+
+
+// Replies of a connection, which are written in request order once they are due
+struct KadasMilxStandInConnection
+{
+  QByteArray readBuffer;
+  QQueue<QPair<qint64, QByteArray>> replies;
+  QElapsedTimer clock;
+  QTimer timer;
+};
+
+KadasMilxStandInServer::KadasMilxStandInServer()
+{
+  mReplyDelay.store( 0 );
+  mRequestCount.store( 0 );
+}
+
+KadasMilxStandInServer::~KadasMilxStandInServer()
+{
+  quit();
+  wait();
+}
+
+bool KadasMilxStandInServer::startListening()
+{
+  start();
+  mListening.acquire();
+  return mPort != 0;
+}
+
+void KadasMilxStandInServer::run()
+{
+  QTcpServer server;
+  if ( server.listen( QHostAddress::LocalHost ) )
+  {
+    mPort = server.serverPort();
+  }
+  connect( &server, &QTcpServer::newConnection, &server, [this, &server]
+  {
+    while ( QTcpSocket *socket = server.nextPendingConnection() )
+    {
+      QSharedPointer<KadasMilxStandInConnection> connection( new KadasMilxStandInConnection );
+      connection->clock.start();
+      connection->timer.setSingleShot( true );
+      KadasMilxStandInConnection *conn = connection.data();
+      auto writeDueReplies = [socket, conn]
+      {
+        while ( !conn->replies.isEmpty() && conn->replies.head().first <= conn->clock.elapsed() )
+        {
+          QByteArray data = conn->replies.dequeue().second;
+          qint32 len = data.size();
+          socket->write( reinterpret_cast<const char *>( &len ), sizeof( qint32 ) );
+          socket->write( data );
+        }
+        socket->flush();
+        if ( !conn->replies.isEmpty() )
+        {
+          conn->timer.start( int( conn->replies.head().first - conn->clock.elapsed() ) );
+        }
+      };
+      connect( &connection->timer, &QTimer::timeout, socket, writeDueReplies );
+      connect( socket, &QTcpSocket::readyRead, socket, [this, socket, connection, writeDueReplies]
+      {
+        connection->readBuffer += socket->readAll();
+        while ( connection->readBuffer.size() >= int( sizeof( qint32 ) ) )
+        {
+          qint32 len = *reinterpret_cast<const qint32 *>( connection->readBuffer.constData() );
+          if ( connection->readBuffer.size() < int( sizeof( qint32 ) ) + len )
+          {
+            break;
+          }
+          QByteArray request = connection->readBuffer.mid( sizeof( qint32 ), len );
+          connection->readBuffer.remove( 0, sizeof( qint32 ) + len );
+          mRequestCount.ref();
+          connection->replies.enqueue( qMakePair( connection->clock.elapsed() + mReplyDelay.load(), reply( request ) ) );
+        }
+        writeDueReplies();
+      } );
+      connect( socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater );
+    }
+  } );
+  mListening.release();
+  exec();
+}
+
+QByteArray KadasMilxStandInServer::reply( const QByteArray &request )
+{
+  QDataStream istream( request );
+  MilXServerRequest req = 0;
+  istream >> req;
+
+  QByteArray response;
+  QDataStream ostream( &response, QIODevice::WriteOnly );
+  if ( req == MILX_REQUEST_INIT )
+  {
+    ostream << MILX_REPLY_INIT_OK << QString( "standin" );
+  }
+  else if ( req == MILX_REQUEST_SET_SYMBOL_OPTIONS )
+  {
+    ostream << MILX_REPLY_SET_SYMBOL_OPTIONS;
+  }
+  else if ( req == MILX_REQUEST_GET_MILITARY_NAME )
+  {
+    QString symbolXml;
+    istream >> symbolXml;
+    ostream << MILX_REPLY_GET_MILITARY_NAME << QString( "Name of %1" ).arg( symbolXml );
+  }
+  else if ( req == MILX_REQUEST_UPDATE_SYMBOL || req == MILX_REQUEST_HIT_TEST )
+  {
+    QRect visibleExtent;
+    int dpi = 0;
+    QString symbolXml;
+    QList<QPoint> points;
+    QList<int> controlPoints;
+    QList<QPair<int, double>> attributes;
+    bool finalized = false;
+    bool colored = false;
+    if ( req == MILX_REQUEST_UPDATE_SYMBOL )
+    {
+      istream >> visibleExtent >> dpi;
+    }
+    istream >> symbolXml >> points >> controlPoints >> attributes >> finalized >> colored;
+    // The symbol graphic is the bounding box of the points
+    QRect bbox = QPolygon( points.toVector() ).boundingRect().adjusted( -5, -5, 5, 5 );
+    if ( req == MILX_REQUEST_UPDATE_SYMBOL )
+    {
+      bool returnPoints = false;
+      istream >> returnPoints;
+      QByteArray svg = QString( "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%1\" height=\"%2\"><rect width=\"%1\" height=\"%2\" fill=\"red\"/></svg>" )
+                       .arg( bbox.width() ).arg( bbox.height() ).toUtf8();
+      ostream << MILX_REPLY_UPDATE_SYMBOL << svg << ( bbox.topLeft() - points.value( 0 ) );
+      if ( returnPoints )
+      {
+        ostream << points << controlPoints << attributes << QList<QPair<int, QPoint>>();
+      }
+    }
+    else
+    {
+      QPoint clickPos;
+      istream >> clickPos;
+      ostream << MILX_REPLY_HIT_TEST << bbox.contains( clickPos );
+    }
+  }
+  else
+  {
+    ostream << MILX_REPLY_ERROR << QString( "Unsupported request %1" ).arg( req );
+  }
+  return response;
+}
@@ -0,0 +1,54 @@
+/***************************************************************************
+    kadasmilxstandinserver.h
+    ------------------------
+    copyright            : (C) 2019 by Sandro Mani
+    email                : smani at sourcepole dot ch
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef KADASMILXSTANDINSERVER_H
+#define KADASMILXSTANDINSERVER_H
+
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <QThread>
+
+/**Local stand-in for the MilX server, for tests and benchmarks of KadasMilxClient.
+  Speaks the length-prefixed request protocol of kadasmilxinterface.h and answers the
+  requests used by the tests with synthetic replies, in request order. Runs in its own thread.*/
+class KadasMilxStandInServer : public QThread
+{
+    Q_OBJECT
+  public:
+    KadasMilxStandInServer();
+    ~KadasMilxStandInServer();
+
+    /**Starts the server thread and returns once the server listens*/
+    bool startListening();
+    quint16 port() const { return mPort; }
+
+    /**Delays the replies to subsequently received requests, i.e. to simulate server latency or a stalled server*/
+    void setReplyDelay( int msecs ) { mReplyDelay.store( msecs ); }
+    int requestCount() const { return mRequestCount.load(); }
+
+  protected:
+    void run() override;
+
+  private:
+    QSemaphore mListening;
+    quint16 mPort = 0;
+    QAtomicInt mReplyDelay;
+    QAtomicInt mRequestCount;
+
+    static QByteArray reply( const QByteArray &request );
+};
+
+#endif // KADASMILXSTANDINSERVER_H
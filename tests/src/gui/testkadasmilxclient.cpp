@@ -0,0 +1,136 @@
+/***************************************************************************
+    testkadasmilxclient.cpp
+    -----------------------
+    copyright            : (C) 2019 by Sandro Mani
+    email                : smani at sourcepole dot ch
+ ***************************************************************************/
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <QtTest/QtTest>
+
+#include <kadas/gui/milx/kadasmilxclient.h>
+
+#include "kadasmilxstandinserver.h"
+
+
+class TestKadasMilxClient : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void testPipelinedRequests();
+    void testReplyTimeout();
+    void benchmarkSequentialRequests();
+    void benchmarkPipelinedRequests();
+
+  private:
+    KadasMilxStandInServer mServer;
+
+    static KadasMilxClient::NPointSymbol testSymbol( int i );
+};
+
+KadasMilxClient::NPointSymbol TestKadasMilxClient::testSymbol( int i )
+{
+  QList<QPoint> points = QList<QPoint>() << QPoint( i, i ) << QPoint( i + 20 + i % 7, i + 10 );
+  return KadasMilxClient::NPointSymbol( QString( "symbol%1" ).arg( i ), points, QList<int>(), QList<QPair<int, double>>(), true, true );
+}
+
+void TestKadasMilxClient::initTestCase()
+{
+  QVERIFY( mServer.startListening() );
+  QByteArray port = QByteArray::number( mServer.port() );
+  qputenv( "MILIX_SERVER_ADDR", "127.0.0.1" );
+  qputenv( "MILIX_SERVER_PORT_SYNC", port );
+  qputenv( "MILIX_SERVER_PORT_ASYNC", port );
+  QVERIFY( KadasMilxClient::init() );
+}
+
+void TestKadasMilxClient::cleanupTestCase()
+{
+  KadasMilxClient::quit();
+}
+
+void TestKadasMilxClient::testPipelinedRequests()
+{
+  // All requests are in flight at once, each future must get the reply to its own request
+  const int n = 50;
+  QList<QFuture<KadasMilxClient::NPointSymbolGraphic>> updates;
+  QList<QFuture<bool>> hitTests;
+  for ( int i = 0; i < n; ++i )
+  {
+    updates.append( KadasMilxClient::updateSymbolAsync( QRect( 0, 0, 1000, 1000 ), 96, testSymbol( i ), true ) );
+    hitTests.append( KadasMilxClient::hitTestAsync( testSymbol( i ), QPoint( i % 2 == 0 ? i + 1 : 900, i + 1 ) ) );
+  }
+  for ( int i = 0; i < n; ++i )
+  {
+    KadasMilxClient::NPointSymbol symbol = testSymbol( i );
+    QRect bbox = QPolygon( symbol.points.toVector() ).boundingRect().adjusted( -5, -5, 5, 5 );
+    updates[i].waitForFinished();
+    QVERIFY( !updates[i].isCanceled() );
+    KadasMilxClient::NPointSymbolGraphic graphic = updates[i].result();
+    QCOMPARE( graphic.graphic.size(), bbox.size() );
+    QCOMPARE( graphic.offset, bbox.topLeft() - symbol.points.first() );
+    QCOMPARE( graphic.adjustedPoints, symbol.points );
+
+    hitTests[i].waitForFinished();
+    QVERIFY( !hitTests[i].isCanceled() );
+    QCOMPARE( hitTests[i].result(), i % 2 == 0 );
+  }
+}
+
+void TestKadasMilxClient::testReplyTimeout()
+{
+  // A request without reply fails, and its late reply must not be taken as the reply to the next request
+  QString militaryName;
+  mServer.setReplyDelay( 7000 );
+  QVERIFY( !KadasMilxClient::getMilitaryName( "stalled", militaryName ) );
+  mServer.setReplyDelay( 0 );
+  QVERIFY( KadasMilxClient::getMilitaryName( "next", militaryName ) );
+  QCOMPARE( militaryName, QString( "Name of next" ) );
+  QTest::qWait( 2500 );
+  QVERIFY( KadasMilxClient::getMilitaryName( "last", militaryName ) );
+  QCOMPARE( militaryName, QString( "Name of last" ) );
+}
+
+void TestKadasMilxClient::benchmarkSequentialRequests()
+{
+  // One round-trip per request, as before the requests were pipelined
+  QBENCHMARK
+  {
+    for ( int i = 0; i < 500; ++i )
+    {
+      bool hit = false;
+      QVERIFY( KadasMilxClient::hitTest( testSymbol( i ), QPoint( i, i ), hit ) );
+    }
+  }
+}
+
+void TestKadasMilxClient::benchmarkPipelinedRequests()
+{
+  QBENCHMARK
+  {
+    QList<QFuture<bool>> hitTests;
+    for ( int i = 0; i < 500; ++i )
+    {
+      hitTests.append( KadasMilxClient::hitTestAsync( testSymbol( i ), QPoint( i, i ) ) );
+    }
+    for ( QFuture<bool> &future : hitTests )
+    {
+      future.waitForFinished();
+      QVERIFY( !future.isCanceled() );
+    }
+  }
+}
+
+QTEST_MAIN( TestKadasMilxClient )
+#include "testkadasmilxclient.moc"